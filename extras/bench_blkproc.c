@@ -0,0 +1,229 @@
+#include "sqfs/block_processor.h"
+#include "sqfs/block_writer.h"
+#include "sqfs/frag_table.h"
+#include "sqfs/compressor.h"
+#include "sqfs/inode.h"
+#include "sqfs/super.h"
+#include "sqfs/io.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+  A file object that only keeps track of its size. This way, the benchmark
+  measures the block processor and not the disk it writes to.
+ */
+typedef struct {
+	sqfs_file_t base;
+	sqfs_u64 size;
+} null_file_t;
+
+static int null_read_at(sqfs_file_t *file, sqfs_u64 offset,
+			void *buffer, size_t size)
+{
+	(void)file; (void)offset; (void)buffer; (void)size;
+	return -1;
+}
+
+static int null_write_at(sqfs_file_t *base, sqfs_u64 offset,
+			 const void *buffer, size_t size)
+{
+	null_file_t *file = (null_file_t *)base;
+	(void)buffer;
+
+	if (offset + size > file->size)
+		file->size = offset + size;
+	return 0;
+}
+
+static sqfs_u64 null_get_size(const sqfs_file_t *file)
+{
+	return ((const null_file_t *)file)->size;
+}
+
+static int null_truncate(sqfs_file_t *file, sqfs_u64 size)
+{
+	((null_file_t *)file)->size = size;
+	return 0;
+}
+
+static void null_destroy(sqfs_object_t *obj)
+{
+	free(obj);
+}
+
+static sqfs_file_t *null_file_create(void)
+{
+	null_file_t *file = calloc(1, sizeof(*file));
+
+	if (file == NULL)
+		return NULL;
+
+	((sqfs_object_t *)file)->destroy = null_destroy;
+	file->base.read_at = null_read_at;
+	file->base.write_at = null_write_at;
+	file->base.get_size = null_get_size;
+	file->base.truncate = null_truncate;
+	return (sqfs_file_t *)file;
+}
+
+/* fill a buffer with somewhat compressible, non-repeating data */
+static void fill_buffer(sqfs_u8 *data, size_t size, sqfs_u32 *seed)
+{
+	size_t i;
+
+	for (i = 0; i < size; ++i) {
+		*seed = *seed * 1103515245 + 12345;
+		data[i] = 'a' + ((*seed >> 16) % 16);
+	}
+}
+
+static double get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int run_bench(unsigned int num_workers, size_t block_size,
+		     size_t file_size, size_t total_size, sqfs_u32 flags,
+		     double *elapsed)
+{
+	sqfs_block_processor_t *proc = NULL;
+	sqfs_inode_generic_t **inodes = NULL;
+	sqfs_compressor_config_t cfg;
+	sqfs_block_writer_t *wr = NULL;
+	sqfs_frag_table_t *tbl = NULL;
+	sqfs_compressor_t *cmp = NULL;
+	sqfs_file_t *file = NULL;
+	size_t i, done, count, diff, num_files;
+	sqfs_u8 *data = NULL, *ptr;
+	sqfs_u32 seed = 42;
+	int ret = -1;
+	double start;
+
+	/* the block processor updates the inodes until it is finished */
+	num_files = (total_size + file_size - 1) / file_size;
+
+	inodes = calloc(num_files, sizeof(inodes[0]));
+	data = malloc(2 * file_size);
+	file = null_file_create();
+	if (inodes == NULL || data == NULL || file == NULL)
+		goto out;
+
+	/* generate the input up front, so the producer is not the bottleneck */
+	fill_buffer(data, 2 * file_size, &seed);
+
+	sqfs_compressor_config_init(&cfg, SQFS_COMP_GZIP, block_size, 0);
+
+	if (sqfs_compressor_create(&cfg, &cmp))
+		goto out;
+
+	wr = sqfs_block_writer_create(file, 4096, 0);
+	tbl = sqfs_frag_table_create(0);
+	if (wr == NULL || tbl == NULL)
+		goto out;
+
+	proc = sqfs_block_processor_create_ex(block_size, cmp, num_workers,
+					      10 * num_workers, flags, wr, tbl);
+	if (proc == NULL)
+		goto out;
+
+	start = get_time();
+
+	for (i = 0, done = 0; done < total_size; ++i, done += file_size) {
+		count = total_size - done;
+		if (count > file_size)
+			count = file_size;
+
+		if (sqfs_block_processor_begin_file(proc, inodes + i, 0))
+			goto out;
+
+		/* make every file different to avoid deduplication */
+		ptr = data + (i * 4099) % file_size;
+
+		for (; count > 0; count -= diff, ptr += diff) {
+			diff = count < block_size ? count : block_size;
+
+			if (sqfs_block_processor_append(proc, ptr, diff))
+				goto out;
+		}
+
+		if (sqfs_block_processor_end_file(proc))
+			goto out;
+	}
+
+	if (sqfs_block_processor_finish(proc))
+		goto out;
+
+	*elapsed = get_time() - start;
+	ret = 0;
+out:
+	if (proc != NULL)
+		sqfs_destroy(proc);
+	if (tbl != NULL)
+		sqfs_destroy(tbl);
+	if (wr != NULL)
+		sqfs_destroy(wr);
+	if (cmp != NULL)
+		sqfs_destroy(cmp);
+	if (file != NULL)
+		sqfs_destroy(file);
+	if (inodes != NULL) {
+		for (i = 0; i < num_files; ++i)
+			free(inodes[i]);
+		free(inodes);
+	}
+	free(data);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	size_t block_size = 4096, total_size = 64 * 1024 * 1024;
+	unsigned int i, max_workers = 4;
+	double elapsed, base = 0.0;
+	sqfs_u32 flags = 0;
+
+	if (argc > 1)
+		max_workers = strtoul(argv[1], NULL, 0);
+	if (argc > 2)
+		block_size = strtoul(argv[2], NULL, 0);
+	if (argc > 3)
+		total_size = strtoul(argv[3], NULL, 0) * 1024 * 1024;
+	for (i = 4; i < (unsigned int)argc; ++i) {
+		if (strcmp(argv[i], "async") == 0)
+			flags |= SQFS_BLOCK_PROCESSOR_ASYNC_IO;
+		if (strcmp(argv[i], "hugepages") == 0)
+			flags |= SQFS_BLOCK_PROCESSOR_HUGE_PAGES;
+	}
+
+	if (max_workers < 1 || block_size < 4096 ||
+	    block_size > (1 << 20)) {
+		fputs("Usage: bench_blkproc [max_jobs] [block_size] "
+		      "[MiB] [async] [hugepages]\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	printf("jobs\tMiB/s\tspeedup\n");
+
+	for (i = 1; i <= max_workers; ++i) {
+		if (run_bench(i, block_size, 16 * block_size,
+			      total_size, flags, &elapsed)) {
+			fprintf(stderr, "benchmark with %u jobs failed\n", i);
+			return EXIT_FAILURE;
+		}
+
+		if (i == 1)
+			base = elapsed;
+
+		printf("%u\t%.1f\t%.2f\n", i,
+		       (double)total_size / (1024.0 * 1024.0) / elapsed,
+		       base / elapsed);
+	}
+
+	return EXIT_SUCCESS;
+}
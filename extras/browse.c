@@ -533,6 +533,12 @@ int main(int argc, char **argv)
 		goto out_id;
 	}
 
+	/* remember resolved path components, paths are looked up a lot */
+	if (sqfs_dir_reader_set_dentry_cache(dr, 1024)) {
+		fprintf(stderr, "%s: error creating dentry cache.\n", argv[1]);
+		goto out_dir;
+	}
+
 	if (sqfs_dir_reader_get_root_inode(dr, &working_dir)) {
 		fprintf(stderr, "%s: error reading root inode.\n", argv[1]);
 		goto out_dir;
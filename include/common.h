@@ -17,6 +17,7 @@
 #include "sqfs/table.h"
 #include "sqfs/error.h"
 #include "sqfs/meta_writer.h"
+#include "sqfs/meta_reader.h"
 #include "sqfs/data_reader.h"
 #include "sqfs/block_processor.h"
 #include "sqfs/block_writer.h"
@@ -35,6 +36,7 @@
 #include <stddef.h>
 
 typedef struct {
+	/* NULL if the output file was supplied by the caller */
 	const char *filename;
 	sqfs_block_writer_t *blkwr;
 	sqfs_frag_table_t *fragtbl;
@@ -65,8 +67,21 @@ typedef struct {
 	bool exportable;
 	bool no_xattr;
 	bool quiet;
+
+	/*
+	  If set, the image is written to this file instead of creating
+	  filename, which is then only used for error messages. The writer
+	  takes ownership of the file, but does not remove anything on failure.
+	 */
+	sqfs_file_t *outfile;
 } sqfs_writer_cfg_t;
 
+/* memory budget of the meta data block cache used by the unpacking tools */
+#define META_CACHE_SIZE (4 * 1024 * 1024)
+
+/* upper limit for the number of threads of the unpacking tools */
+#define MAX_NUM_JOBS (1024)
+
 typedef struct sqfs_hard_link_t {
 	struct sqfs_hard_link_t *next;
 	sqfs_u32 inode_number;
@@ -109,9 +124,76 @@ int inode_stat(const sqfs_tree_node_t *node, struct stat *sb);
 
 char *sqfs_tree_node_get_path(const sqfs_tree_node_t *node);
 
+/*
+  Write the contents of a file to fp. If scratch is not NULL, it must point
+  to a buffer of at least block_size bytes that is used for unpacking the
+  data blocks, otherwise a buffer is allocated temporarily.
+ */
 int sqfs_data_reader_dump(const char *name, sqfs_data_reader_t *data,
 			  const sqfs_inode_generic_t *inode,
-			  FILE *fp, size_t block_size, bool allow_sparse);
+			  FILE *fp, size_t block_size, bool allow_sparse,
+			  sqfs_u8 *scratch);
+
+/*
+  Wrap an input stream that is read front to back, e.g. a pipe, in a stream
+  that is filled in large chunks by a background thread. If the input is
+  compressed, the background thread also decompresses it, using up to
+  num_jobs threads if the format allows it.
+
+  If read ahead is not supported, the original stream is returned. On
+  failure, an error message is printed to stderr and NULL is returned.
+  The underlying stream must not be read directly afterwards.
+ */
+FILE *sqfs_get_read_ahead_stream(FILE *fp, unsigned int num_jobs);
+
+enum {
+	STREAM_COMPRESSOR_NONE = 0,
+	STREAM_COMPRESSOR_GZIP,
+	STREAM_COMPRESSOR_XZ,
+	STREAM_COMPRESSOR_ZSTD,
+	STREAM_COMPRESSOR_BZIP2,
+
+	STREAM_COMPRESSOR_MAX = STREAM_COMPRESSOR_BZIP2,
+};
+
+/* the number of leading bytes that stream_decompressor_detect looks at */
+#define STREAM_MAGIC_SIZE (6)
+
+/*
+  Decompresses a compressed tar ball in-process. The compressed data is
+  fetched through a callback that works like read(2), so the caller decides
+  how and from where it is read.
+ */
+typedef struct stream_decompressor_t stream_decompressor_t;
+
+typedef ssize_t (*stream_read_fun_t)(void *user, void *buffer, size_t size);
+
+/* Returns a STREAM_COMPRESSOR_* value from the first bytes of a stream. */
+int stream_decompressor_detect(const sqfs_u8 *data, size_t size);
+
+/*
+  Returns true if the first byte of a stream matches the first byte of any
+  of the formats that stream_decompressor_detect recognizes.
+ */
+bool stream_decompressor_may_start_with(int c);
+
+/*
+  Prints an error message to stderr and returns NULL on failure, e.g. if
+  support for the format was not compiled in.
+ */
+stream_decompressor_t *stream_decompressor_create(int id,
+						  unsigned int num_jobs,
+						  stream_read_fun_t read_input,
+						  void *user);
+
+/*
+  Works like read(2) and returns 0 at the end of the compressed stream.
+  If the data is corrupted, an error message is printed to stderr.
+ */
+ssize_t stream_decompressor_read(stream_decompressor_t *dec,
+				 void *buffer, size_t size);
+
+void stream_decompressor_destroy(stream_decompressor_t *dec);
 
 sqfs_file_t *sqfs_get_stdin_file(FILE *fp, const sparse_map_t *map,
 				 sqfs_u64 size);
@@ -120,6 +202,10 @@ int write_data_from_file(const char *filename, sqfs_block_processor_t *data,
 			 sqfs_inode_generic_t **inode,
 			 sqfs_file_t *file, int flags);
 
+/* Write the contents of a file to a block stream and close the stream. */
+int write_data_to_stream(const char *filename, sqfs_block_stream_t *strm,
+			 sqfs_file_t *file);
+
 void sqfs_writer_cfg_init(sqfs_writer_cfg_t *cfg);
 
 int sqfs_writer_init(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *wrcfg);
@@ -40,6 +40,9 @@
  * @ref sqfs_block_processor_append and @ref sqfs_block_processor_end
  * respectively).
  *
+ * Alternatively, several files can be written at the same time, possibly from
+ * different threads, by opening a @ref sqfs_block_stream_t for each of them.
+ *
  * Internally it takes care of partitioning data in the correct block sizes,
  * adding tail-ens to fragment blocks, compressing the data, deduplicating data
  * and finally writing it to disk.
@@ -47,6 +50,67 @@
  * This object is not copyable, i.e. @ref sqfs_copy will always return NULL.
  */
 
+/**
+ * @enum SQFS_BLOCK_PROCESSOR_FLAGS
+ *
+ * @brief Possible flags for @ref sqfs_block_processor_create_ex.
+ */
+typedef enum {
+	/**
+	 * @brief Write completed blocks from a dedicated I/O thread.
+	 *
+	 * If set, the blocks are written to disk, and the fragment table and
+	 * the file inodes updated, by a background thread instead of the
+	 * thread that submits data. The block writer hooks are also called
+	 * from that thread.
+	 *
+	 * This flag is ignored if libsquashfs was built without
+	 * multi-threading support.
+	 */
+	SQFS_BLOCK_PROCESSOR_ASYNC_IO = 0x01,
+
+	/**
+	 * @brief Try to back the internal block buffer pool with huge pages.
+	 *
+	 * The block processor preallocates enough buffers for all blocks that
+	 * can be in flight and recycles them. If this flag is set, it tries
+	 * to allocate that memory using huge pages, falling back to regular
+	 * pages if that is not possible.
+	 */
+	SQFS_BLOCK_PROCESSOR_HUGE_PAGES = 0x02,
+
+	SQFS_BLOCK_PROCESSOR_ALL_FLAGS = 0x03,
+} SQFS_BLOCK_PROCESSOR_FLAGS;
+
+/**
+ * @struct sqfs_block_stream_t
+ *
+ * @brief A handle for writing the data of one file through a
+ *        @ref sqfs_block_processor_t.
+ *
+ * A block processor can have any number of streams open at the same time.
+ * Each stream has its own block buffer, so different streams can be fed
+ * concurrently from different threads. A single stream must not be used by
+ * more than one thread at a time.
+ *
+ * The data of each file is always stored contiguously and the files are
+ * written to the image in the order in which their streams were opened,
+ * regardless of the order in which they are filled or closed. Blocks of a
+ * stream are held back in memory until all streams opened before it have
+ * been closed. Once a stream holds back as many blocks as the backlog of
+ * the processor, the thread feeding it waits until that is the case, so
+ * every stream has to be closed eventually, even after an error. A thread
+ * that feeds several streams has to fill and close them one after another,
+ * in the order in which they were opened.
+ *
+ * If libsquashfs was built without multi-threading support, access to the
+ * streams is not serialized and all of them have to be used from the same
+ * thread. Blocks are then held back without a limit.
+ *
+ * The begin_file/append/end_file interface of the block processor
+ * internally uses a stream as well and is ordered the same way.
+ */
+
 /**
  * @struct sqfs_block_processor_stats_t
  *
@@ -134,13 +198,41 @@ sqfs_block_processor_t *sqfs_block_processor_create(size_t max_block_size,
 						    sqfs_block_writer_t *wr,
 						    sqfs_frag_table_t *tbl);
 
+/**
+ * @brief Create a data block writer with additional flags.
+ *
+ * @memberof sqfs_block_processor_t
+ *
+ * This works exactly like @ref sqfs_block_processor_create, but accepts an
+ * additional set of flags to tune the behaviour of the processor.
+ *
+ * @param max_block_size The maximum size of a data block.
+ * @param cmp A pointer to a compressor.
+ * @param num_workers The number of worker threads to create.
+ * @param max_backlog The maximum number of blocks currently in flight.
+ * @param flags A combination of @ref SQFS_BLOCK_PROCESSOR_FLAGS.
+ * @param wr A block writer to send to finished blocks to.
+ * @param tbl A fragment table to use for storing fragment and fragment block
+ *            locations.
+ *
+ * @return A pointer to a data writer object on success, NULL on allocation
+ *         failure, if unknown flags are set or on failure to create and
+ *         initialize the worker threads.
+ */
+SQFS_API sqfs_block_processor_t
+*sqfs_block_processor_create_ex(size_t max_block_size, sqfs_compressor_t *cmp,
+				unsigned int num_workers, size_t max_backlog,
+				sqfs_u32 flags, sqfs_block_writer_t *wr,
+				sqfs_frag_table_t *tbl);
+
 /**
  * @brief Start writing a file.
  *
  * @memberof sqfs_block_processor_t
  *
  * After calling this function, call @ref sqfs_block_processor_append
- * repeatedly to add data to the file. Finally
+ * (or @ref sqfs_block_processor_get_buffer and
+ * @ref sqfs_block_processor_commit) repeatedly to add data to the file. Finally
  * call @ref sqfs_block_processor_end_file when you
  * are done. After writing all files, use @ref sqfs_block_processor_finish to
  * wait until all blocks that are still in flight are done and written to disk.
@@ -185,6 +277,48 @@ SQFS_API int sqfs_block_processor_begin_file(sqfs_block_processor_t *proc,
 SQFS_API int sqfs_block_processor_append(sqfs_block_processor_t *proc,
 					 const void *data, size_t size);
 
+/**
+ * @brief Get direct access to the block buffer that the next bytes of the
+ *        current file are stored in.
+ *
+ * @memberof sqfs_block_processor_t
+ *
+ * This can be used instead of @ref sqfs_block_processor_append to avoid an
+ * extra copy, e.g. by reading file data directly into the block that is
+ * going to be compressed. Write up to the returned number of bytes to the
+ * buffer and then call @ref sqfs_block_processor_commit to add them to
+ * the file.
+ *
+ * The buffer remains valid until the next call to any other block processor
+ * function. Calling this function again without committing anything returns
+ * the same buffer.
+ *
+ * @param proc A pointer to a data writer object.
+ * @param buffer Returns a pointer to the free space in the current block.
+ * @param size Returns the number of bytes that can be written to the buffer.
+ *             This is always at least one byte.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_block_processor_get_buffer(sqfs_block_processor_t *proc,
+					     void **buffer, size_t *size);
+
+/**
+ * @brief Add data written to a buffer obtained through
+ *        @ref sqfs_block_processor_get_buffer to the current file.
+ *
+ * @memberof sqfs_block_processor_t
+ *
+ * @param proc A pointer to a data writer object.
+ * @param size The number of bytes that have been written to the start of
+ *             the buffer. Must not exceed the size returned
+ *             by @ref sqfs_block_processor_get_buffer.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_block_processor_commit(sqfs_block_processor_t *proc,
+					 size_t size);
+
 /**
  * @brief Stop writing the current file and flush everything that is
  *        buffered internally.
@@ -203,6 +337,95 @@ SQFS_API int sqfs_block_processor_append(sqfs_block_processor_t *proc,
  */
 SQFS_API int sqfs_block_processor_end_file(sqfs_block_processor_t *proc);
 
+/**
+ * @brief Start writing a file through a new stream.
+ *
+ * @memberof sqfs_block_processor_t
+ *
+ * This works like @ref sqfs_block_processor_begin_file, but instead of
+ * remembering the file internally, a stream handle is returned and more
+ * files can be opened while this one is still being written.
+ *
+ * @param proc A pointer to a data writer object.
+ * @param inode A pointer to a pointer to an inode. See
+ *              @ref sqfs_block_processor_begin_file.
+ * @param flags A combination of @ref SQFS_BLK_FLAGS that can be used to
+ *              micro manage how the data is processed.
+ * @param out Returns a pointer to the new stream on success.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_block_processor_open_stream(sqfs_block_processor_t *proc,
+					      sqfs_inode_generic_t **inode,
+					      sqfs_u32 flags,
+					      sqfs_block_stream_t **out);
+
+/**
+ * @brief Append data to the file written through a stream.
+ *
+ * @memberof sqfs_block_stream_t
+ *
+ * @param strm A pointer to a stream.
+ * @param data A pointer to a buffer to read data from.
+ * @param size How many bytes should be copied out of the given
+ *             buffer and written to disk.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_block_stream_append(sqfs_block_stream_t *strm,
+				      const void *data, size_t size);
+
+/**
+ * @brief Get direct access to the block buffer of a stream.
+ *
+ * @memberof sqfs_block_stream_t
+ *
+ * The stream equivalent of @ref sqfs_block_processor_get_buffer. The buffer
+ * remains valid until the next call to a function of the same stream.
+ *
+ * @param strm A pointer to a stream.
+ * @param buffer Returns a pointer to the free space in the current block.
+ * @param size Returns the number of bytes that can be written to the buffer.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_block_stream_get_buffer(sqfs_block_stream_t *strm,
+					  void **buffer, size_t *size);
+
+/**
+ * @brief Add data written to a buffer obtained through
+ *        @ref sqfs_block_stream_get_buffer to the file.
+ *
+ * @memberof sqfs_block_stream_t
+ *
+ * @param strm A pointer to a stream.
+ * @param size The number of bytes that have been written to the start of
+ *             the buffer.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_block_stream_commit(sqfs_block_stream_t *strm, size_t size);
+
+/**
+ * @brief Stop writing a file through a stream.
+ *
+ * @memberof sqfs_block_stream_t
+ *
+ * The counter part to @ref sqfs_block_processor_open_stream. The stream
+ * handle is no longer valid after this function returns, even if it
+ * returns an error.
+ *
+ * If streams opened before this one are still open, the remaining blocks of
+ * this stream are kept until they are closed. Otherwise, the blocks of this
+ * and all following streams that are already closed are submitted for
+ * processing, and threads waiting to feed the next stream continue.
+ *
+ * @param strm A pointer to a stream.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_block_stream_close(sqfs_block_stream_t *strm);
+
 /**
  * @brief Wait for the in-flight data blocks to finish.
  *
@@ -226,6 +449,9 @@ SQFS_API int sqfs_block_processor_sync(sqfs_block_processor_t *proc);
  * syncing, it also flushes the current fragment block, even if it isn't full
  * yet and waits for it to be completed as well.
  *
+ * All streams must be closed before calling this, as blocks held back for
+ * an open stream are not flushed.
+ *
  * @param proc A pointer to a block processor object.
  *
  * @return Zero on success, an @ref SQFS_ERROR value on failure. The failure
@@ -156,6 +156,18 @@ struct sqfs_block_writer_stats_t {
 	 *        deduplicated blocks.
 	 */
 	sqfs_u64 blocks_written;
+
+	/**
+	 * @brief Number of files for which the deduplication index
+	 *        found an identical, previously written block sequence.
+	 */
+	sqfs_u64 index_hits;
+
+	/**
+	 * @brief Number of files for which the deduplication index
+	 *        lookup found no match and the blocks were kept.
+	 */
+	sqfs_u64 index_misses;
 };
 
 #ifdef __cplusplus
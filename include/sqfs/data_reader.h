@@ -47,8 +47,57 @@
  *
  * The data reader abstracts all of this away in a simple interface that allows
  * reading file data through an inode description and a location in the file.
+ *
+ * Decompressed data and fragment blocks are kept in a least recently used
+ * cache, keyed by their on-disk location, so that interleaved reads from
+ * several files or repeated accesses to the same fragment block do not
+ * read and decompress the same block over and over again. By default, the
+ * cache holds up to 8 blocks, which can be changed through
+ * @ref sqfs_data_reader_set_cache_size.
+ *
+ * If read-ahead is enabled through @ref sqfs_data_reader_set_read_ahead and
+ * the data reader detects that the blocks of a file are accessed sequentially,
+ * the following blocks are read on the calling thread and handed to a pool of
+ * worker threads for decompression, so that they are ready by the time they
+ * are accessed.
+ *
+ * A copy of a data reader made with @ref sqfs_copy starts out with an empty
+ * cache of the same size and its own set of read-ahead workers.
  */
 
+/**
+ * @struct sqfs_data_reader_stats_t
+ *
+ * @brief Collects run time statistics of the @ref sqfs_data_reader_t
+ */
+struct sqfs_data_reader_stats_t {
+	/**
+	 * @brief Holds the size of the structure.
+	 *
+	 * If a later version of libsquashfs expands this structure, the value
+	 * of this field can be used to check at runtime whether the newer
+	 * fields are avaialable or not.
+	 */
+	size_t size;
+
+	/**
+	 * @brief Number of block accesses that were served from the cache.
+	 */
+	sqfs_u64 cache_hits;
+
+	/**
+	 * @brief Number of block accesses that required reading and
+	 *        decompressing a block from disk.
+	 */
+	sqfs_u64 cache_misses;
+
+	/**
+	 * @brief Number of cache misses for which the block had already
+	 *        been decompressed by the read-ahead workers.
+	 */
+	sqfs_u64 read_ahead_hits;
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -70,6 +119,65 @@ SQFS_API sqfs_data_reader_t *sqfs_data_reader_create(sqfs_file_t *file,
 						     size_t block_size,
 						     sqfs_compressor_t *cmp);
 
+/**
+ * @brief Set the memory budget of the decompressed block cache.
+ *
+ * @memberof sqfs_data_reader_t
+ *
+ * The budget is rounded down to a multiple of the block size, but the cache
+ * always holds at least one block. If the cache currently holds more blocks
+ * than the new budget allows, the least recently used ones are discarded.
+ *
+ * @param data A pointer to a data reader object.
+ * @param size The maximum number of bytes to use for cached blocks.
+ *
+ * @return Zero on succcess, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_data_reader_set_cache_size(sqfs_data_reader_t *data,
+					     size_t size);
+
+/**
+ * @brief Enable or disable parallel read-ahead decompression.
+ *
+ * @memberof sqfs_data_reader_t
+ *
+ * Sequential access is detected on a per-file basis, using the block index
+ * passed to @ref sqfs_data_reader_get_block or the offsets passed to
+ * @ref sqfs_data_reader_read. Once detected, up to max_blocks of the following
+ * compressed blocks of the file are read from disk and decompressed by the
+ * worker threads, each of which uses its own copy of the compressor.
+ *
+ * Decompressed blocks end up in the block cache, so the cache should be large
+ * enough to hold at least a few blocks. The underlying file is only ever
+ * accessed from the calling thread.
+ *
+ * If libsquashfs was compiled without thread support, this function does
+ * nothing and blocks are always decompressed on the calling thread.
+ *
+ * @param data A pointer to a data reader object.
+ * @param num_workers The number of worker threads to use, or 0 to disable
+ *                    read-ahead entirely.
+ * @param max_blocks The maximum number of blocks to read ahead. If set to 0,
+ *                   twice the number of workers is used.
+ *
+ * @return Zero on succcess, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_data_reader_set_read_ahead(sqfs_data_reader_t *data,
+					     unsigned int num_workers,
+					     size_t max_blocks);
+
+/**
+ * @brief Get access to a data readers run time statistics.
+ *
+ * @memberof sqfs_data_reader_t
+ *
+ * @param data A pointer to a data reader object.
+ *
+ * @return A pointer to the internal statistics counters.
+ */
+SQFS_API const sqfs_data_reader_stats_t
+*sqfs_data_reader_get_stats(const sqfs_data_reader_t *data);
+
 /**
  * @brief Read and decode the fragment table from disk.
  *
@@ -100,6 +208,25 @@ SQFS_API int sqfs_data_reader_get_fragment(sqfs_data_reader_t *data,
 					   const sqfs_inode_generic_t *inode,
 					   size_t *size, sqfs_u8 **out);
 
+/**
+ * @brief Get the tail end of a file into a caller supplied buffer.
+ *
+ * @memberof sqfs_data_reader_t
+ *
+ * This works exactly like @ref sqfs_data_reader_get_fragment, but copies the
+ * data into the given buffer instead of allocating a new one.
+ *
+ * @param data A pointer to a data reader object.
+ * @param inode A pointer to the inode describing the file.
+ * @param size Returns the size of the data read.
+ * @param buffer A buffer that is at least as large as the block size.
+ *
+ * @return Zero on succcess, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_data_reader_get_fragment_into(sqfs_data_reader_t *data,
+						const sqfs_inode_generic_t *inode,
+						size_t *size, sqfs_u8 *buffer);
+
 /**
  * @brief Get a full sized data block of a file by block index.
  *
@@ -119,14 +246,37 @@ SQFS_API int sqfs_data_reader_get_block(sqfs_data_reader_t *data,
 					size_t index, size_t *size,
 					sqfs_u8 **out);
 
+/**
+ * @brief Get a data block of a file by block index into a caller
+ *        supplied buffer.
+ *
+ * @memberof sqfs_data_reader_t
+ *
+ * This works exactly like @ref sqfs_data_reader_get_block, but decompresses
+ * the block directly into the given buffer instead of allocating a new one.
+ * Sparse blocks are filled with zero bytes.
+ *
+ * @param data A pointer to a data reader object.
+ * @param inode A pointer to the inode describing the file.
+ * @param index The block index in the inodes block list.
+ * @param size Returns the size of the data read.
+ * @param buffer A buffer that is at least as large as the block size.
+ *
+ * @return Zero on succcess, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_data_reader_get_block_into(sqfs_data_reader_t *data,
+					     const sqfs_inode_generic_t *inode,
+					     size_t index, size_t *size,
+					     sqfs_u8 *buffer);
+
 /**
  * @brief A simple UNIX-read-like function to read data from a file.
  *
  * @memberof sqfs_data_reader_t
  *
  * This function acts like the read system call in a Unix-like OS. It takes
- * care of reading accross data blocks and fragment internally, using a
- * data and fragment block cache.
+ * care of reading accross data blocks and fragment internally, using the
+ * decompressed block cache.
  *
  * @param data A pointer to a data reader object.
  * @param inode A pointer to the inode describing the file.
@@ -102,9 +102,51 @@ typedef enum {
 	 */
 	SQFS_TREE_STORE_PARENTS = 0x40,
 
-	SQFS_TREE_ALL_FLAGS = 0x7F,
+	/**
+	 * @brief Allocate the nodes, names and inodes of the tree in large
+	 *        chunks that are owned by the tree.
+	 *
+	 * This saves a lot of small allocations and allows
+	 * @ref sqfs_dir_tree_destroy to release the entire tree at once.
+	 * Only the root node can be destroyed and nodes must not be moved
+	 * over to a different tree.
+	 */
+	SQFS_TREE_ARENA = 0x80,
+
+	/**
+	 * @brief Only read the children of a directory when they are
+	 *        accessed through @ref sqfs_dir_tree_get_children.
+	 *
+	 * Implies @ref SQFS_TREE_ARENA. The directory reader and ID table
+	 * are kept internally for expanding directories later on and must
+	 * not be destroyed before the tree. Cannot be combined with
+	 * @ref SQFS_TREE_NO_EMPTY.
+	 */
+	SQFS_TREE_LAZY = 0x100,
+
+	SQFS_TREE_ALL_FLAGS = 0x1FF,
 } SQFS_TREE_FILTER_FLAGS;
 
+/**
+ * @enum SQFS_TREE_NODE_FLAGS
+ *
+ * @brief Flags that describe the state of a @ref sqfs_tree_node_t
+ */
+typedef enum {
+	/**
+	 * @brief The node is allocated from the memory chunks of its tree.
+	 */
+	SQFS_TREE_NODE_ARENA = 0x01,
+
+	/**
+	 * @brief The node is a directory that has not been expanded yet.
+	 *
+	 * The children list is empty until the node is accessed through
+	 * @ref sqfs_dir_tree_get_children.
+	 */
+	SQFS_TREE_NODE_UNEXPANDED = 0x02,
+} SQFS_TREE_NODE_FLAGS;
+
 /**
  * @struct sqfs_tree_node_t
  *
@@ -142,6 +184,12 @@ struct sqfs_tree_node_t {
 	 */
 	sqfs_u32 gid;
 
+	/**
+	 * @brief A combination of @ref SQFS_TREE_NODE_FLAGS, managed by the
+	 *        library.
+	 */
+	sqfs_u32 flags;
+
 	/**
 	 * @brief null-terminated entry name.
 	 */
@@ -168,6 +216,47 @@ SQFS_API sqfs_dir_reader_t *sqfs_dir_reader_create(const sqfs_super_t *super,
 						   sqfs_compressor_t *cmp,
 						   sqfs_file_t *file);
 
+/**
+ * @brief Make a directory reader use a cache of decompressed meta data blocks.
+ *
+ * @memberof sqfs_dir_reader_t
+ *
+ * The cache is used for both, reading directory listings and inodes. It can
+ * be shared with other readers of the same image, e.g. an xattr reader.
+ *
+ * @param rd A pointer to a directory reader.
+ * @param cache A pointer to a cache object or NULL to stop using a cache.
+ *              The reader does not take ownership of the cache, it has to
+ *              be destroyed after the reader and all copies made from it.
+ */
+SQFS_API void sqfs_dir_reader_set_cache(sqfs_dir_reader_t *rd,
+					sqfs_meta_cache_t *cache);
+
+/**
+ * @brief Enable or disable caching of path lookups.
+ *
+ * @memberof sqfs_dir_reader_t
+ *
+ * The dentry cache remembers, for every path component resolved by
+ * @ref sqfs_dir_reader_find_by_path, which inode the name refers to in its
+ * parent directory. Later lookups of paths with the same prefix skip reading
+ * and searching the directory listings of the cached components. Only the
+ * inode at the end of the path is read from the image.
+ *
+ * The cache is disabled by default. If it holds the maximum number of
+ * entries, the least recently used one is discarded. Calling this function
+ * drops all cached entries. A copy of a directory reader made with
+ * @ref sqfs_copy starts out with an empty cache of the same size.
+ *
+ * @param rd A pointer to a directory reader.
+ * @param max_entries The maximum number of path components to remember, or
+ *                    zero to disable the cache.
+ *
+ * @return Zero on succcess, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_dir_reader_set_dentry_cache(sqfs_dir_reader_t *rd,
+					      size_t max_entries);
+
 /**
  * @brief Navigate a directory reader to the location of a directory
  *        represented by an inode.
@@ -204,6 +293,13 @@ SQFS_API int sqfs_dir_reader_rewind(sqfs_dir_reader_t *rd);
  *
  * @memberof sqfs_dir_reader_t
  *
+ * If the directory was opened through an extended directory inode with a
+ * directory index, a binary search on the index is used to skip straight to
+ * the directory header that the entry has to follow. Only the entries after
+ * that header are read and compared.
+ *
+ * On success, the entry can be read with @ref sqfs_dir_reader_get_inode.
+ *
  * @param rd A pointer to a directory reader.
  * @param name The name of the entry to find.
  *
@@ -269,6 +365,9 @@ SQFS_API int sqfs_dir_reader_get_root_inode(sqfs_dir_reader_t *rd,
  *
  * @memberof sqfs_dir_reader_t
  *
+ * Every path component is looked up the same way as with
+ * @ref sqfs_dir_reader_find, i.e. using the directory index if available.
+ *
  * @param rd A pointer to a directory reader.
  * @param start If not NULL, path traversal starts at this node downwards. If
  *              set to NULL, start at the root node.
@@ -314,12 +413,32 @@ SQFS_API int sqfs_dir_reader_get_full_hierarchy(sqfs_dir_reader_t *rd,
  * @brief Recursively destroy a tree of @ref sqfs_tree_node_t nodes
  *
  * This function can be used to clean up after
- * @ref sqfs_dir_reader_get_full_hierarchy.
+ * @ref sqfs_dir_reader_get_full_hierarchy. For trees read with the
+ * @ref SQFS_TREE_ARENA flag, all memory is released at once and calling
+ * this on anything but the root node has no effect.
  *
  * @param root A pointer to the root node.
  */
 SQFS_API void sqfs_dir_tree_destroy(sqfs_tree_node_t *root);
 
+/**
+ * @brief Get the list of children of a tree node.
+ *
+ * If the tree was read with the @ref SQFS_TREE_LAZY flag and the node is a
+ * directory that has not been expanded yet, its children are read from the
+ * image first, applying the same filter flags.
+ *
+ * For trees read without that flag, this simply returns the children list.
+ *
+ * @param node A pointer to a tree node.
+ * @param out Returns a pointer to the first child or NULL if the node
+ *            has no children.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_dir_tree_get_children(sqfs_tree_node_t *node,
+					sqfs_tree_node_t **out);
+
 #ifdef __cplusplus
 }
 #endif
@@ -54,7 +54,37 @@ typedef enum {
 	 */
 	SQFS_FILE_OPEN_OVERWRITE = 0x02,
 
-	SQFS_FILE_OPEN_ALL_FLAGS = 0x03,
+	/**
+	 * @brief If the read only flag is set, map the file into memory.
+	 *
+	 * Reads are then served directly from the page cache, and the data
+	 * and meta data readers in libsquashfs decompress data straight out
+	 * of the mapping without copying it first.
+	 *
+	 * If the file cannot be mapped, or the operating system does not
+	 * support it, this flag is silently ignored. Note that truncating
+	 * the file while it is mapped can crash the process.
+	 */
+	SQFS_FILE_OPEN_MMAP = 0x04,
+
+	/**
+	 * @brief If the read only flag is not set, queue writes and
+	 *        submit them to the kernel in batches.
+	 *
+	 * On Linux, this uses io_uring. The data passed to write_at is
+	 * copied, so the caller can reuse the buffer immediately. Queued
+	 * writes are completed before any read_at or truncate call on the
+	 * file and before the file is destroyed.
+	 *
+	 * Errors of queued writes are reported by a later write_at, read_at
+	 * or truncate call, or by @ref sqfs_file_flush.
+	 *
+	 * If io_uring is not available, the flag is silently ignored and
+	 * data is written synchronously.
+	 */
+	SQFS_FILE_OPEN_ASYNC_WRITE = 0x08,
+
+	SQFS_FILE_OPEN_ALL_FLAGS = 0x0F,
 } SQFS_FILE_OPEN_FLAGS;
 
 /**
@@ -144,6 +174,21 @@ extern "C" {
  */
 SQFS_API sqfs_file_t *sqfs_open_file(const char *filename, sqfs_u32 flags);
 
+/**
+ * @brief Wait for all queued writes on a file to finish
+ *
+ * If the file was opened through @ref sqfs_open_file with the
+ * @ref SQFS_FILE_OPEN_ASYNC_WRITE flag, this submits all queued writes and
+ * waits for them to complete. For all other files, including user supplied
+ * implementations of @ref sqfs_file_t, this does nothing.
+ *
+ * @param file A pointer to a file object.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value if one of the queued
+ *         writes failed.
+ */
+SQFS_API int sqfs_file_flush(sqfs_file_t *file);
+
 #ifdef __cplusplus
 }
 #endif
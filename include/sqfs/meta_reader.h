@@ -47,6 +47,58 @@
  * from disk and reading transparently across block boarders if required.
  */
 
+/**
+ * @struct sqfs_meta_cache_t
+ *
+ * @implements sqfs_object_t
+ *
+ * @brief A cache of decompressed meta data blocks that can be shared by
+ *        several meta data readers.
+ *
+ * Blocks are keyed by their absolute on-disk location, so all readers that
+ * share a cache must read from the same filesystem image. If the cache is
+ * full, the least recently used block is discarded.
+ *
+ * The directory reader, the inode reads going through it and the xattr
+ * reader access the same regions of an image over and over again, e.g. when
+ * walking a directory tree. Attaching the same cache to all of them saves
+ * decompressing the same blocks again.
+ *
+ * The cache is not owned by the readers it is attached to and must outlive
+ * them. Copies of readers made with @ref sqfs_copy use the same cache. If
+ * libsquashfs was built with thread support, the cache is internally
+ * synchronized, so the copies can be used on different threads.
+ *
+ * The cache cannot be copied.
+ */
+
+/**
+ * @struct sqfs_meta_cache_stats_t
+ *
+ * @brief Collects run time statistics of a @ref sqfs_meta_cache_t
+ */
+struct sqfs_meta_cache_stats_t {
+	/**
+	 * @brief Holds the size of the structure.
+	 *
+	 * If a later version of libsquashfs expands this structure, the value
+	 * of this field can be used to check at runtime whether the newer
+	 * fields are avaialable or not.
+	 */
+	size_t size;
+
+	/**
+	 * @brief Number of block accesses that were served from the cache.
+	 */
+	sqfs_u64 hits;
+
+	/**
+	 * @brief Number of block accesses that required reading and
+	 *        decompressing a block from disk.
+	 */
+	sqfs_u64 misses;
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -71,13 +123,53 @@ SQFS_API sqfs_meta_reader_t *sqfs_meta_reader_create(sqfs_file_t *file,
 						     sqfs_u64 start,
 						     sqfs_u64 limit);
 
+/**
+ * @brief Create a meta data block cache.
+ *
+ * @memberof sqfs_meta_cache_t
+ *
+ * @param size The maximum number of bytes to use for cached blocks. This
+ *             is rounded down to a multiple of the meta data block size,
+ *             but the cache always holds at least one block.
+ *
+ * @return A pointer to a cache object on success, NULL on allocation failure.
+ */
+SQFS_API sqfs_meta_cache_t *sqfs_meta_cache_create(size_t size);
+
+/**
+ * @brief Get access to the run time statistics of a meta data block cache.
+ *
+ * @memberof sqfs_meta_cache_t
+ *
+ * The hit rate is hits / (hits + misses). Accesses to the block that a
+ * reader is already positioned on don't touch the cache and aren't counted.
+ *
+ * @param cache A pointer to a meta data block cache.
+ *
+ * @return A pointer to the internal statistics counters.
+ */
+SQFS_API const sqfs_meta_cache_stats_t
+*sqfs_meta_cache_get_stats(const sqfs_meta_cache_t *cache);
+
+/**
+ * @brief Make a meta data reader use a cache of decompressed blocks.
+ *
+ * @memberof sqfs_meta_reader_t
+ *
+ * @param m A pointer to a meta data reader.
+ * @param cache A pointer to a cache object or NULL to stop using a cache.
+ *              The reader does not take ownership of the cache.
+ */
+SQFS_API void sqfs_meta_reader_set_cache(sqfs_meta_reader_t *m,
+					 sqfs_meta_cache_t *cache);
+
 /**
  * @brief Seek to a specific meta data block and offset.
  *
  * @memberof sqfs_meta_reader_t
  *
  * The underlying block is fetched from disk and uncompressed, unless it
- * already is the current block.
+ * already is the current block or can be found in the block cache.
  *
  * @param m A pointer to a meta data reader.
  * @param block_start Absolute position where the block header can be found.
@@ -47,6 +47,11 @@
  * function that transparently takes care of chopping data up into blocks,
  * compressing the blocks and pre-pending a header.
  *
+ * Optionally, full blocks can be compressed by a pool of worker threads
+ * (see @ref sqfs_meta_writer_set_workers). The blocks are still written to
+ * disk or stored in memory in the order they were filled, so the result is
+ * exactly the same as with inline compression.
+ *
  * This object is not copyable, i.e. @ref sqfs_copy will always return NULL.
  */
 
@@ -91,6 +96,30 @@ SQFS_API sqfs_meta_writer_t *sqfs_meta_writer_create(sqfs_file_t *file,
 						     sqfs_compressor_t *cmp,
 						     sqfs_u32 flags);
 
+/**
+ * @brief Compress full blocks with a pool of worker threads.
+ *
+ * @memberof sqfs_meta_writer_t
+ *
+ * Each worker uses its own copy of the compressor, so the compressor must
+ * support @ref sqfs_copy. Blocks that are still in flight are finished
+ * before the pool is replaced.
+ *
+ * If a worker fails to compress a block, the error is reported by the next
+ * call that appends, flushes or writes blocks.
+ *
+ * If libsquashfs was compiled without thread support, this function does
+ * nothing and blocks are always compressed on the calling thread.
+ *
+ * @param m A pointer to a meta data writer.
+ * @param num_workers The number of worker threads, or 0 to compress
+ *                    blocks on the calling thread.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_meta_writer_set_workers(sqfs_meta_writer_t *m,
+					  unsigned int num_workers);
+
 /**
  * @brief Finish the current block, even if it isn't full yet.
  *
@@ -99,7 +128,8 @@ SQFS_API sqfs_meta_writer_t *sqfs_meta_writer_create(sqfs_file_t *file,
  * This function forces the meta writer to compress and store the block it
  * is currently writing to, even if it isn't full yet, and either write it
  * out to disk (or append it to the in memory chain if told to keep blocks
- * in memory).
+ * in memory). It also waits for all blocks that are still being compressed
+ * by worker threads.
  *
  * @param m A pointer to a meta data writer.
  *
@@ -136,6 +166,13 @@ SQFS_API int sqfs_meta_writer_append(sqfs_meta_writer_t *m, const void *data,
  * block that the next call to @ref sqfs_meta_writer_append will start writing
  * data at.
  *
+ * If worker threads are used, this blocks until all previous blocks are
+ * compressed. See @ref sqfs_meta_writer_get_block_index for a way to
+ * avoid that. If compressing one of them failed, the error is reported by
+ * the next call to @ref sqfs_meta_writer_append or
+ * @ref sqfs_meta_writer_flush. Use @ref sqfs_meta_writer_get_position_ex
+ * to get it right away.
+ *
  * @param m A pointer to a meta data writer.
  * @param block_start Returns the offset of the current block from the first.
  * @param offset Returns an offset into the current block where the next write
@@ -145,6 +182,64 @@ SQFS_API void sqfs_meta_writer_get_position(const sqfs_meta_writer_t *m,
 					    sqfs_u64 *block_start,
 					    sqfs_u32 *offset);
 
+/**
+ * @brief Query the current block start position and report worker errors
+ *
+ * @memberof sqfs_meta_writer_t
+ *
+ * This works like @ref sqfs_meta_writer_get_position, but returns an error
+ * code if compressing one of the previous blocks on a worker thread failed.
+ *
+ * @param m A pointer to a meta data writer.
+ * @param block_start Returns the offset of the current block from the first.
+ * @param offset Returns an offset into the current block where the next write
+ *               starts.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_meta_writer_get_position_ex(sqfs_meta_writer_t *m,
+					      sqfs_u64 *block_start,
+					      sqfs_u32 *offset);
+
+/**
+ * @brief Query the current position as a block index and an offset
+ *
+ * @memberof sqfs_meta_writer_t
+ *
+ * This works like @ref sqfs_meta_writer_get_position, but returns the
+ * index of the current block, counted since the writer was created or
+ * reset, instead of its location. The index is available right away, even
+ * if previous blocks are still being compressed, and can be turned into a
+ * location later on using @ref sqfs_meta_writer_resolve_block.
+ *
+ * @param m A pointer to a meta data writer.
+ * @param index Returns the index of the current block.
+ * @param offset Returns an offset into the current block where the next write
+ *               starts.
+ */
+SQFS_API void sqfs_meta_writer_get_block_index(const sqfs_meta_writer_t *m,
+					       sqfs_u64 *index,
+					       sqfs_u32 *offset);
+
+/**
+ * @brief Get the location of a block from its index
+ *
+ * @memberof sqfs_meta_writer_t
+ *
+ * If necessary, this waits until all blocks before the requested one are
+ * compressed.
+ *
+ * @param m A pointer to a meta data writer.
+ * @param index A block index returned by
+ *              @ref sqfs_meta_writer_get_block_index since the last reset.
+ * @param block_start Returns the offset of the block from the first.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_meta_writer_resolve_block(sqfs_meta_writer_t *m,
+					    sqfs_u64 index,
+					    sqfs_u64 *block_start);
+
 /**
  * @brief Reset all internal state, including the current block start position.
  *
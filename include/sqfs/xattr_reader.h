@@ -90,6 +90,23 @@ extern "C" {
  */
 SQFS_API sqfs_xattr_reader_t *sqfs_xattr_reader_create(sqfs_u32 flags);
 
+/**
+ * @brief Make an xattr reader use a cache of decompressed meta data blocks.
+ *
+ * @memberof sqfs_xattr_reader_t
+ *
+ * The cache can be set before or after calling @ref sqfs_xattr_reader_load
+ * and can be shared with other readers of the same image, e.g. a directory
+ * reader.
+ *
+ * @param xr A pointer to an xattr reader instance.
+ * @param cache A pointer to a cache object or NULL to stop using a cache.
+ *              The reader does not take ownership of the cache, it has to
+ *              be destroyed after the reader and all copies made from it.
+ */
+SQFS_API void sqfs_xattr_reader_set_cache(sqfs_xattr_reader_t *xr,
+					  sqfs_meta_cache_t *cache);
+
 /**
  * @brief Load the locations of the xattr meta data blocks into memory
  *
@@ -37,11 +37,12 @@ static int append_block(FILE *fp, const sqfs_u8 *data, size_t size)
 
 int sqfs_data_reader_dump(const char *name, sqfs_data_reader_t *data,
 			  const sqfs_inode_generic_t *inode,
-			  FILE *fp, size_t block_size, bool allow_sparse)
+			  FILE *fp, size_t block_size, bool allow_sparse,
+			  sqfs_u8 *scratch)
 {
 	size_t i, diff, chunk_size;
+	sqfs_u8 *buffer = scratch;
 	sqfs_u64 filesz;
-	sqfs_u8 *chunk;
 	int err;
 
 	sqfs_inode_get_file_size(inode, &filesz);
@@ -57,6 +58,14 @@ int sqfs_data_reader_dump(const char *name, sqfs_data_reader_t *data,
 	allow_sparse = false;
 #endif
 
+	if (buffer == NULL) {
+		buffer = malloc(block_size);
+		if (buffer == NULL) {
+			perror(name);
+			return -1;
+		}
+	}
+
 	for (i = 0; i < sqfs_inode_get_file_block_count(inode); ++i) {
 		diff = (filesz < block_size) ? filesz : block_size;
 
@@ -64,41 +73,40 @@ int sqfs_data_reader_dump(const char *name, sqfs_data_reader_t *data,
 			if (fseek(fp, diff, SEEK_CUR) < 0)
 				goto fail_sparse;
 		} else {
-			err = sqfs_data_reader_get_block(data, inode, i,
-							 &chunk_size, &chunk);
+			err = sqfs_data_reader_get_block_into(data, inode, i,
+							      &chunk_size,
+							      buffer);
 			if (err) {
 				sqfs_perror(name, "reading data block", err);
-				return -1;
+				goto fail;
 			}
 
-			err = append_block(fp, chunk, chunk_size);
-			free(chunk);
-
-			if (err)
-				return -1;
+			if (append_block(fp, buffer, chunk_size))
+				goto fail;
 		}
 
 		filesz -= diff;
 	}
 
 	if (filesz > 0) {
-		err = sqfs_data_reader_get_fragment(data, inode,
-						    &chunk_size, &chunk);
+		err = sqfs_data_reader_get_fragment_into(data, inode,
+							 &chunk_size, buffer);
 		if (err) {
 			sqfs_perror(name, "reading fragment block", err);
-			return -1;
-		}
-
-		if (append_block(fp, chunk, chunk_size)) {
-			free(chunk);
-			return -1;
+			goto fail;
 		}
 
-		free(chunk);
+		if (append_block(fp, buffer, chunk_size))
+			goto fail;
 	}
 
+	if (buffer != scratch)
+		free(buffer);
 	return 0;
 fail_sparse:
 	perror("creating sparse output file");
+fail:
+	if (buffer != scratch)
+		free(buffer);
 	return -1;
 }
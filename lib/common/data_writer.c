@@ -6,49 +6,64 @@
  */
 #include "common.h"
 
-static sqfs_u8 buffer[4096];
-
-int write_data_from_file(const char *filename, sqfs_block_processor_t *data,
-			 sqfs_inode_generic_t **inode, sqfs_file_t *file,
-			 int flags)
+int write_data_to_stream(const char *filename, sqfs_block_stream_t *strm,
+			 sqfs_file_t *file)
 {
 	sqfs_u64 filesz, offset;
 	size_t diff;
+	void *ptr;
 	int ret;
 
-	ret = sqfs_block_processor_begin_file(data, inode, flags);
-	if (ret) {
-		sqfs_perror(filename, "beginning file data blocks", ret);
-		return -1;
-	}
-
 	filesz = file->get_size(file);
 
 	for (offset = 0; offset < filesz; offset += diff) {
-		if (filesz - offset > sizeof(buffer)) {
-			diff = sizeof(buffer);
-		} else {
-			diff = filesz - offset;
+		ret = sqfs_block_stream_get_buffer(strm, &ptr, &diff);
+		if (ret) {
+			sqfs_perror(filename, "packing file data", ret);
+			goto fail;
 		}
 
-		ret = file->read_at(file, offset, buffer, diff);
+		if (diff > filesz - offset)
+			diff = filesz - offset;
+
+		ret = file->read_at(file, offset, ptr, diff);
 		if (ret) {
 			sqfs_perror(filename, "reading file range", ret);
-			return -1;
+			goto fail;
 		}
 
-		ret = sqfs_block_processor_append(data, buffer, diff);
+		ret = sqfs_block_stream_commit(strm, diff);
 		if (ret) {
 			sqfs_perror(filename, "packing file data", ret);
-			return -1;
+			goto fail;
 		}
 	}
 
-	ret = sqfs_block_processor_end_file(data);
+	ret = sqfs_block_stream_close(strm);
 	if (ret) {
 		sqfs_perror(filename, "finishing file data", ret);
 		return -1;
 	}
 
 	return 0;
+fail:
+	/* streams opened after this one may be waiting for it */
+	sqfs_block_stream_close(strm);
+	return -1;
+}
+
+int write_data_from_file(const char *filename, sqfs_block_processor_t *data,
+			 sqfs_inode_generic_t **inode, sqfs_file_t *file,
+			 int flags)
+{
+	sqfs_block_stream_t *strm;
+	int ret;
+
+	ret = sqfs_block_processor_open_stream(data, inode, flags, &strm);
+	if (ret) {
+		sqfs_perror(filename, "beginning file data blocks", ret);
+		return -1;
+	}
+
+	return write_data_to_stream(filename, strm, file);
 }
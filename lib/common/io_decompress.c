@@ -0,0 +1,498 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * io_decompress.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "common.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+
+#ifdef WITH_GZIP
+#include <zlib.h>
+#endif
+
+#ifdef WITH_XZ
+#include <lzma.h>
+#endif
+
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef WITH_BZIP2
+#include <bzlib.h>
+#endif
+
+#define DECOMP_INPUT_SIZE (128 * 1024)
+
+struct stream_decompressor_t {
+	stream_read_fun_t read_input;
+	void *user;
+	const char *name;
+
+	/* decompresses from the input buffer, returns 0 or an errno value */
+	int (*process)(stream_decompressor_t *dec, sqfs_u8 *out, size_t size,
+		       size_t *produced);
+	void (*cleanup)(stream_decompressor_t *dec);
+
+	/* set once the underlying stream and the decompressor are done */
+	bool in_eof;
+	bool done;
+
+	/* set by the gzip and bzip2 decoders between concatenated streams */
+	bool member_end;
+
+	union {
+#ifdef WITH_GZIP
+		z_stream gzip;
+#endif
+#ifdef WITH_XZ
+		lzma_stream xz;
+#endif
+#ifdef WITH_ZSTD
+		ZSTD_DStream *zstd;
+#endif
+#ifdef WITH_BZIP2
+		bz_stream bzip2;
+#endif
+		int dummy;
+	} strm;
+
+	const sqfs_u8 *in_ptr;
+	size_t in_avail;
+	sqfs_u8 in[DECOMP_INPUT_SIZE];
+};
+
+static const char *names[STREAM_COMPRESSOR_MAX + 1] = {
+	[STREAM_COMPRESSOR_NONE] = "uncompressed",
+	[STREAM_COMPRESSOR_GZIP] = "gzip",
+	[STREAM_COMPRESSOR_XZ] = "xz",
+	[STREAM_COMPRESSOR_ZSTD] = "zstd",
+	[STREAM_COMPRESSOR_BZIP2] = "bzip2",
+};
+
+static int corrupted(stream_decompressor_t *dec, const char *what)
+{
+	fprintf(stderr, "decompressing %s input: %s\n", dec->name, what);
+	return EIO;
+}
+
+static int truncated(stream_decompressor_t *dec)
+{
+	return corrupted(dec, "unexpected end of compressed stream");
+}
+
+#ifdef WITH_GZIP
+static int gzip_process(stream_decompressor_t *dec, sqfs_u8 *out,
+			size_t size, size_t *produced)
+{
+	z_stream *strm = &dec->strm.gzip;
+	int ret;
+
+	/* continue with the next member of a concatenated stream */
+	if (dec->member_end) {
+		if (dec->in_avail == 0) {
+			dec->done = dec->in_eof;
+			return 0;
+		}
+
+		/* anything other than another member is trailing garbage */
+		if (dec->in_ptr[0] != 0x1F) {
+			dec->done = true;
+			return 0;
+		}
+
+		if (inflateReset(strm) != Z_OK)
+			return corrupted(dec, "resetting inflate stream");
+
+		dec->member_end = false;
+	}
+
+	strm->next_in = (Bytef *)dec->in_ptr;
+	strm->avail_in = dec->in_avail;
+	strm->next_out = out;
+	strm->avail_out = size;
+
+	ret = inflate(strm, Z_NO_FLUSH);
+
+	*produced = size - strm->avail_out;
+	dec->in_ptr += dec->in_avail - strm->avail_in;
+	dec->in_avail = strm->avail_in;
+
+	switch (ret) {
+	case Z_STREAM_END:
+		dec->member_end = true;
+		break;
+	case Z_OK:
+		break;
+	case Z_BUF_ERROR:
+		if (dec->in_eof && dec->in_avail == 0)
+			return truncated(dec);
+		break;
+	case Z_MEM_ERROR:
+		return ENOMEM;
+	default:
+		return corrupted(dec, strm->msg != NULL ? strm->msg :
+				 "corrupted compressed data");
+	}
+
+	return 0;
+}
+
+static void gzip_cleanup(stream_decompressor_t *dec)
+{
+	inflateEnd(&dec->strm.gzip);
+}
+
+static int gzip_init(stream_decompressor_t *dec, unsigned int num_jobs)
+{
+	(void)num_jobs;
+
+	/* 32 enables automatic detection of the gzip header */
+	if (inflateInit2(&dec->strm.gzip, 15 + 32) != Z_OK)
+		return -1;
+
+	dec->process = gzip_process;
+	dec->cleanup = gzip_cleanup;
+	return 0;
+}
+#endif
+
+#ifdef WITH_XZ
+static int xz_process(stream_decompressor_t *dec, sqfs_u8 *out,
+		      size_t size, size_t *produced)
+{
+	lzma_stream *strm = &dec->strm.xz;
+	lzma_ret ret;
+
+	strm->next_in = dec->in_ptr;
+	strm->avail_in = dec->in_avail;
+	strm->next_out = out;
+	strm->avail_out = size;
+
+	/* with LZMA_CONCATENATED, the end is only reported on LZMA_FINISH */
+	ret = lzma_code(strm, dec->in_eof ? LZMA_FINISH : LZMA_RUN);
+
+	*produced = size - strm->avail_out;
+	dec->in_ptr = strm->next_in;
+	dec->in_avail = strm->avail_in;
+
+	switch (ret) {
+	case LZMA_STREAM_END:
+		dec->done = true;
+		break;
+	case LZMA_OK:
+		break;
+	case LZMA_BUF_ERROR:
+		return truncated(dec);
+	case LZMA_MEM_ERROR:
+		return ENOMEM;
+	case LZMA_MEMLIMIT_ERROR:
+		return corrupted(dec, "memory usage limit reached");
+	case LZMA_FORMAT_ERROR:
+		return corrupted(dec, "unknown file format");
+	case LZMA_OPTIONS_ERROR:
+		return corrupted(dec, "unsupported compression options");
+	default:
+		return corrupted(dec, "corrupted compressed data");
+	}
+
+	return 0;
+}
+
+static void xz_cleanup(stream_decompressor_t *dec)
+{
+	lzma_end(&dec->strm.xz);
+}
+
+static int xz_init(stream_decompressor_t *dec, unsigned int num_jobs)
+{
+	lzma_stream strm = LZMA_STREAM_INIT;
+	lzma_ret ret;
+#if LZMA_VERSION >= UINT32_C(50040002)
+	lzma_mt mt;
+
+	/*
+	  The multi threaded decoder processes the blocks of a stream in
+	  parallel, if the encoder wrote the block sizes to the headers (e.g.
+	  xz -T). Otherwise, it falls back to decoding on a single thread.
+	 */
+	if (num_jobs > 1) {
+		memset(&mt, 0, sizeof(mt));
+		mt.flags = LZMA_CONCATENATED;
+		mt.threads = num_jobs;
+		mt.memlimit_stop = UINT64_MAX;
+		mt.memlimit_threading = lzma_physmem() / 4;
+
+		if (mt.memlimit_threading == 0)
+			mt.memlimit_threading = UINT64_MAX;
+
+		ret = lzma_stream_decoder_mt(&strm, &mt);
+	} else {
+		ret = lzma_stream_decoder(&strm, UINT64_MAX, LZMA_CONCATENATED);
+	}
+#else
+	(void)num_jobs;
+	ret = lzma_stream_decoder(&strm, UINT64_MAX, LZMA_CONCATENATED);
+#endif
+
+	if (ret != LZMA_OK)
+		return -1;
+
+	dec->strm.xz = strm;
+	dec->process = xz_process;
+	dec->cleanup = xz_cleanup;
+	return 0;
+}
+#endif
+
+#ifdef WITH_ZSTD
+static int zstd_process(stream_decompressor_t *dec, sqfs_u8 *out,
+			size_t size, size_t *produced)
+{
+	ZSTD_outBuffer outbuf = { out, size, 0 };
+	ZSTD_inBuffer inbuf = { dec->in_ptr, dec->in_avail, 0 };
+	size_t ret;
+
+	/* the stream object moves on to the next frame by itself */
+	ret = ZSTD_decompressStream(dec->strm.zstd, &outbuf, &inbuf);
+
+	if (ZSTD_isError(ret))
+		return corrupted(dec, ZSTD_getErrorName(ret));
+
+	*produced = outbuf.pos;
+	dec->in_ptr += inbuf.pos;
+	dec->in_avail -= inbuf.pos;
+
+	if (dec->in_eof && dec->in_avail == 0) {
+		if (ret == 0) {
+			dec->done = true;
+		} else if (outbuf.pos == 0) {
+			return truncated(dec);
+		}
+	}
+
+	return 0;
+}
+
+static void zstd_cleanup(stream_decompressor_t *dec)
+{
+	ZSTD_freeDStream(dec->strm.zstd);
+}
+
+static int zstd_init(stream_decompressor_t *dec, unsigned int num_jobs)
+{
+	(void)num_jobs;
+
+	dec->strm.zstd = ZSTD_createDStream();
+	if (dec->strm.zstd == NULL)
+		return -1;
+
+	if (ZSTD_isError(ZSTD_initDStream(dec->strm.zstd))) {
+		ZSTD_freeDStream(dec->strm.zstd);
+		return -1;
+	}
+
+	dec->process = zstd_process;
+	dec->cleanup = zstd_cleanup;
+	return 0;
+}
+#endif
+
+#ifdef WITH_BZIP2
+static int bzip2_process(stream_decompressor_t *dec, sqfs_u8 *out,
+			 size_t size, size_t *produced)
+{
+	bz_stream *strm = &dec->strm.bzip2;
+	int ret;
+
+	/* continue with the next stream, e.g. the output of pbzip2 */
+	if (dec->member_end) {
+		if (dec->in_avail == 0) {
+			dec->done = dec->in_eof;
+			return 0;
+		}
+
+		if (dec->in_ptr[0] != 'B') {
+			dec->done = true;
+			return 0;
+		}
+
+		BZ2_bzDecompressEnd(strm);
+		memset(strm, 0, sizeof(*strm));
+
+		if (BZ2_bzDecompressInit(strm, 0, 0) != BZ_OK)
+			return ENOMEM;
+
+		dec->member_end = false;
+	}
+
+	strm->next_in = (char *)dec->in_ptr;
+	strm->avail_in = dec->in_avail;
+	strm->next_out = (char *)out;
+	strm->avail_out = size;
+
+	ret = BZ2_bzDecompress(strm);
+
+	*produced = size - strm->avail_out;
+	dec->in_ptr += dec->in_avail - strm->avail_in;
+	dec->in_avail = strm->avail_in;
+
+	switch (ret) {
+	case BZ_STREAM_END:
+		dec->member_end = true;
+		break;
+	case BZ_OK:
+		if (dec->in_eof && dec->in_avail == 0 && *produced == 0)
+			return truncated(dec);
+		break;
+	case BZ_MEM_ERROR:
+		return ENOMEM;
+	default:
+		return corrupted(dec, "corrupted compressed data");
+	}
+
+	return 0;
+}
+
+static void bzip2_cleanup(stream_decompressor_t *dec)
+{
+	BZ2_bzDecompressEnd(&dec->strm.bzip2);
+}
+
+static int bzip2_init(stream_decompressor_t *dec, unsigned int num_jobs)
+{
+	(void)num_jobs;
+
+	if (BZ2_bzDecompressInit(&dec->strm.bzip2, 0, 0) != BZ_OK)
+		return -1;
+
+	dec->process = bzip2_process;
+	dec->cleanup = bzip2_cleanup;
+	return 0;
+}
+#endif
+
+static int (*backends[STREAM_COMPRESSOR_MAX + 1])(stream_decompressor_t *,
+						     unsigned int) = {
+#ifdef WITH_GZIP
+	[STREAM_COMPRESSOR_GZIP] = gzip_init,
+#endif
+#ifdef WITH_XZ
+	[STREAM_COMPRESSOR_XZ] = xz_init,
+#endif
+#ifdef WITH_ZSTD
+	[STREAM_COMPRESSOR_ZSTD] = zstd_init,
+#endif
+#ifdef WITH_BZIP2
+	[STREAM_COMPRESSOR_BZIP2] = bzip2_init,
+#endif
+};
+
+int stream_decompressor_detect(const sqfs_u8 *data, size_t size)
+{
+	if (size >= 2 && data[0] == 0x1F && data[1] == 0x8B)
+		return STREAM_COMPRESSOR_GZIP;
+
+	if (size >= 6 && memcmp(data, "\xFD" "7zXZ\0", 6) == 0)
+		return STREAM_COMPRESSOR_XZ;
+
+	if (size >= 4 && memcmp(data, "\x28\xB5\x2F\xFD", 4) == 0)
+		return STREAM_COMPRESSOR_ZSTD;
+
+	if (size >= 4 && memcmp(data, "BZh", 3) == 0 &&
+	    data[3] >= '1' && data[3] <= '9') {
+		return STREAM_COMPRESSOR_BZIP2;
+	}
+
+	return STREAM_COMPRESSOR_NONE;
+}
+
+bool stream_decompressor_may_start_with(int c)
+{
+	return c == 0x1F || c == 0xFD || c == 0x28 || c == 'B';
+}
+
+stream_decompressor_t *stream_decompressor_create(int id,
+						  unsigned int num_jobs,
+						  stream_read_fun_t read_input,
+						  void *user)
+{
+	stream_decompressor_t *dec;
+
+	if (id <= STREAM_COMPRESSOR_NONE || id > STREAM_COMPRESSOR_MAX)
+		return NULL;
+
+	if (backends[id] == NULL) {
+		fprintf(stderr, "%s compressed input is not supported.\n",
+			names[id]);
+		return NULL;
+	}
+
+	dec = calloc(1, sizeof(*dec));
+	if (dec == NULL) {
+		perror("creating input stream decompressor");
+		return NULL;
+	}
+
+	dec->read_input = read_input;
+	dec->user = user;
+	dec->name = names[id];
+
+	if (backends[id](dec, num_jobs)) {
+		fprintf(stderr, "initializing %s decompressor failed.\n",
+			dec->name);
+		free(dec);
+		return NULL;
+	}
+
+	return dec;
+}
+
+ssize_t stream_decompressor_read(stream_decompressor_t *dec,
+				 void *buffer, size_t size)
+{
+	size_t produced;
+	ssize_t ret;
+	int err;
+
+	if (size > SSIZE_MAX)
+		size = SSIZE_MAX;
+
+	for (;;) {
+		if (dec->done || size == 0)
+			return 0;
+
+		if (dec->in_avail == 0 && !dec->in_eof) {
+			ret = dec->read_input(dec->user, dec->in,
+					      sizeof(dec->in));
+			if (ret < 0)
+				return -1;
+
+			dec->in_ptr = dec->in;
+			dec->in_avail = ret;
+			dec->in_eof = (ret == 0);
+		}
+
+		produced = 0;
+		err = dec->process(dec, buffer, size, &produced);
+		if (err != 0) {
+			errno = err;
+			return -1;
+		}
+
+		if (produced > 0)
+			return produced;
+	}
+}
+
+void stream_decompressor_destroy(stream_decompressor_t *dec)
+{
+	dec->cleanup(dec);
+	free(dec);
+}
@@ -10,6 +10,57 @@
 #include <string.h>
 #include <errno.h>
 
+#if defined(HAVE_FOPENCOOKIE)
+#include <unistd.h>
+#endif
+
+#if defined(WITH_PTHREAD) && defined(HAVE_FOPENCOOKIE)
+#include <pthread.h>
+
+#define READ_AHEAD_CHUNK_SIZE (1024 * 1024)
+#define READ_AHEAD_CHUNKS (8)
+#endif
+
+/* the raw input, with the bytes read up front to detect compression */
+typedef struct {
+	FILE *fp;
+
+	sqfs_u8 magic[STREAM_MAGIC_SIZE];
+	size_t magic_size;
+	size_t magic_pos;
+
+	/* decompresses the input, if it is compressed */
+	stream_decompressor_t *dec;
+} input_t;
+
+#if defined(WITH_PTHREAD) && defined(HAVE_FOPENCOOKIE)
+/*
+  A background thread reads the input in large chunks into a ring, so that
+  the pipe is kept drained while the main thread waits for the compressors.
+  The main thread reads from the ring through a FILE created with
+  fopencookie, so the tar reader can use it like any other stream.
+ */
+typedef struct {
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+	pthread_t thread;
+
+	input_t in;
+
+	/* set by the reader thread at end of file or on error */
+	int eof;
+	int error;
+	int terminate;
+
+	/* chunks are filled at tail and consumed at head */
+	size_t head;
+	size_t tail;
+	size_t used[READ_AHEAD_CHUNKS];
+	size_t read_pos;
+
+	sqfs_u8 *chunks[READ_AHEAD_CHUNKS];
+} read_ahead_t;
+#endif
 
 typedef struct {
 	sqfs_file_t base;
@@ -42,44 +93,37 @@ static int stdin_read_at(sqfs_file_t *base, sqfs_u64 offset,
 			 void *buffer, size_t size)
 {
 	sqfs_file_stdinout_t *file = (sqfs_file_stdinout_t *)base;
-	size_t temp_size = 0;
-	sqfs_u8 *temp = NULL;
-	sqfs_u64 diff;
-	size_t ret;
+	size_t ret, diff;
 
 	if (offset < file->offset)
 		return SQFS_ERROR_IO;
 
-	if (offset > file->offset) {
-		temp_size = 1024;
-		temp = alloca(temp_size);
-	}
-
 	if (offset >= file->real_size || (offset + size) > file->real_size)
 		return SQFS_ERROR_OUT_OF_BOUNDS;
 
-	while (size > 0) {
-		if (ferror(file->fp))
-			return SQFS_ERROR_IO;
+	/* skip over the gap, using the destination as scratch space */
+	while (size > 0 && offset > file->offset) {
+		diff = size;
+		if ((sqfs_u64)diff > offset - file->offset)
+			diff = offset - file->offset;
 
-		if (feof(file->fp))
-			return SQFS_ERROR_OUT_OF_BOUNDS;
+		ret = fread(buffer, 1, diff, file->fp);
+		if (ret == 0)
+			return ferror(file->fp) ? SQFS_ERROR_IO :
+				SQFS_ERROR_OUT_OF_BOUNDS;
 
-		if (offset > file->offset) {
-			diff = file->offset - offset;
-			diff = diff > (sqfs_u64)temp_size ? temp_size : diff;
-
-			ret = fread(temp, 1, diff, file->fp);
-		} else {
-			ret = fread(buffer, 1, size, file->fp);
-		}
+		file->offset += ret;
+	}
 
-		if (offset <= file->offset) {
-			buffer = (char *)buffer + ret;
-			size -= ret;
-			offset += ret;
-		}
+	/* large reads go straight into the buffer, bypassing stdio */
+	while (size > 0) {
+		ret = fread(buffer, 1, size, file->fp);
+		if (ret == 0)
+			return ferror(file->fp) ? SQFS_ERROR_IO :
+				SQFS_ERROR_OUT_OF_BOUNDS;
 
+		buffer = (char *)buffer + ret;
+		size -= ret;
 		file->offset += ret;
 	}
 
@@ -90,8 +134,8 @@ static int stdin_read_condensed(sqfs_file_t *base, sqfs_u64 offset,
 				void *buffer, size_t size)
 {
 	sqfs_file_stdinout_t *file = (sqfs_file_stdinout_t *)base;
-	sqfs_u64 poffset = 0, src_start;
-	size_t dst_start, diff, count;
+	sqfs_u64 poffset = 0, src_start, start, end;
+	size_t dst_start, count;
 	const sparse_map_t *it;
 	int err;
 
@@ -108,26 +152,15 @@ static int stdin_read_condensed(sqfs_file_t *base, sqfs_u64 offset,
 			continue;
 		}
 
-		count = size;
-
-		if (offset + count >= it->offset + it->count)
-			count = it->offset + it->count - offset;
+		/* the part of the block covered by this map entry */
+		start = it->offset > offset ? it->offset : offset;
+		end = it->offset + it->count;
+		if (end > offset + size)
+			end = offset + size;
 
-		if (it->offset < offset) {
-			diff = offset - it->offset;
-
-			src_start = poffset + diff;
-			dst_start = 0;
-			count -= diff;
-		} else if (it->offset > offset) {
-			diff = it->offset - offset;
-
-			src_start = poffset;
-			dst_start = diff;
-		} else {
-			src_start = poffset;
-			dst_start = 0;
-		}
+		src_start = poffset + (start - it->offset);
+		dst_start = start - offset;
+		count = end - start;
 
 		err = stdin_read_at(base, src_start,
 				    (char *)buffer + dst_start, count);
@@ -163,7 +196,7 @@ sqfs_file_t *sqfs_get_stdin_file(FILE *fp, const sparse_map_t *map,
 
 	if (map != NULL) {
 		for (it = map; it != NULL; it = it->next)
-			file->real_size += map->count;
+			file->real_size += it->count;
 	} else {
 		file->real_size = size;
 	}
@@ -180,3 +213,374 @@ sqfs_file_t *sqfs_get_stdin_file(FILE *fp, const sparse_map_t *map,
 	}
 	return base;
 }
+
+
+static ssize_t read_raw(void *user, void *buffer, size_t size)
+{
+	input_t *in = user;
+	ssize_t ret;
+
+	if (in->magic_pos < in->magic_size) {
+		if (size > in->magic_size - in->magic_pos)
+			size = in->magic_size - in->magic_pos;
+
+		memcpy(buffer, in->magic + in->magic_pos, size);
+		in->magic_pos += size;
+		return size;
+	}
+
+#if defined(HAVE_FOPENCOOKIE)
+#if defined(WITH_PTHREAD)
+	/* the only place where the read-ahead thread may block indefinitely */
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+#endif
+
+	do {
+		ret = read(fileno(in->fp), buffer, size);
+	} while (ret < 0 && errno == EINTR);
+
+#if defined(WITH_PTHREAD)
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+#endif
+#else
+	ret = fread(buffer, 1, size, in->fp);
+	if (ret == 0 && ferror(in->fp))
+		ret = -1;
+#endif
+	return ret;
+}
+
+static ssize_t input_read(input_t *in, void *buffer, size_t size)
+{
+	if (in->dec != NULL)
+		return stream_decompressor_read(in->dec, buffer, size);
+
+	return read_raw(in, buffer, size);
+}
+
+/* On failure, an error message is printed to stderr and -1 returned. */
+static int input_init(input_t *in, FILE *fp, unsigned int num_jobs)
+{
+	ssize_t ret;
+	int id;
+
+	in->fp = fp;
+
+	while (in->magic_size < STREAM_MAGIC_SIZE) {
+		ret = read_raw(in, in->magic + in->magic_size,
+			       STREAM_MAGIC_SIZE - in->magic_size);
+		if (ret < 0) {
+			perror("reading input");
+			return -1;
+		}
+
+		if (ret == 0)
+			break;
+
+		in->magic_size += ret;
+	}
+
+	id = stream_decompressor_detect(in->magic, in->magic_size);
+
+	if (id != STREAM_COMPRESSOR_NONE) {
+		in->dec = stream_decompressor_create(id, num_jobs,
+						     read_raw, in);
+		if (in->dec == NULL)
+			return -1;
+	}
+
+	return 0;
+}
+
+static void input_cleanup(input_t *in)
+{
+	if (in->dec != NULL)
+		stream_decompressor_destroy(in->dec);
+}
+
+#if defined(WITH_PTHREAD) && defined(HAVE_FOPENCOOKIE)
+static void *read_ahead_proc(void *arg)
+{
+	read_ahead_t *ra = arg;
+	sqfs_u8 *chunk;
+	size_t used;
+	ssize_t ret;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_mutex_lock(&ra->mtx);
+
+	for (;;) {
+		while (!ra->terminate &&
+		       ra->tail - ra->head >= READ_AHEAD_CHUNKS) {
+			pthread_cond_wait(&ra->cond, &ra->mtx);
+		}
+
+		if (ra->terminate)
+			break;
+
+		chunk = ra->chunks[ra->tail % READ_AHEAD_CHUNKS];
+		pthread_mutex_unlock(&ra->mtx);
+
+		for (used = 0; used < READ_AHEAD_CHUNK_SIZE; used += ret) {
+			ret = input_read(&ra->in, chunk + used,
+					 READ_AHEAD_CHUNK_SIZE - used);
+			if (ret <= 0)
+				break;
+		}
+
+		pthread_mutex_lock(&ra->mtx);
+
+		if (used > 0) {
+			ra->used[ra->tail % READ_AHEAD_CHUNKS] = used;
+			ra->tail += 1;
+		}
+
+		if (ret <= 0) {
+			if (ret < 0)
+				ra->error = errno;
+			ra->eof = 1;
+		}
+
+		pthread_cond_broadcast(&ra->cond);
+
+		if (ra->eof)
+			break;
+	}
+
+	pthread_mutex_unlock(&ra->mtx);
+	return NULL;
+}
+
+static ssize_t read_ahead_read(void *cookie, char *buffer, size_t size)
+{
+	read_ahead_t *ra = cookie;
+	size_t idx, diff, total = 0;
+
+	pthread_mutex_lock(&ra->mtx);
+
+	while (total < size) {
+		while (ra->head == ra->tail && !ra->eof)
+			pthread_cond_wait(&ra->cond, &ra->mtx);
+
+		if (ra->head == ra->tail)
+			break;
+
+		idx = ra->head % READ_AHEAD_CHUNKS;
+		pthread_mutex_unlock(&ra->mtx);
+
+		/* the chunk at head is not touched by the reader thread */
+		diff = ra->used[idx] - ra->read_pos;
+		if (diff > size - total)
+			diff = size - total;
+
+		memcpy(buffer + total, ra->chunks[idx] + ra->read_pos, diff);
+		ra->read_pos += diff;
+		total += diff;
+
+		pthread_mutex_lock(&ra->mtx);
+
+		if (ra->read_pos == ra->used[idx]) {
+			ra->read_pos = 0;
+			ra->head += 1;
+			pthread_cond_broadcast(&ra->cond);
+		}
+	}
+
+	if (total == 0 && ra->error != 0) {
+		errno = ra->error;
+		pthread_mutex_unlock(&ra->mtx);
+		return -1;
+	}
+
+	pthread_mutex_unlock(&ra->mtx);
+	return total;
+}
+
+static int read_ahead_close(void *cookie)
+{
+	read_ahead_t *ra = cookie;
+	size_t i;
+
+	pthread_mutex_lock(&ra->mtx);
+	ra->terminate = 1;
+	pthread_cond_broadcast(&ra->cond);
+	pthread_mutex_unlock(&ra->mtx);
+
+	/* the thread might be blocked reading from a pipe */
+	pthread_cancel(ra->thread);
+	pthread_join(ra->thread, NULL);
+
+	input_cleanup(&ra->in);
+
+	for (i = 0; i < READ_AHEAD_CHUNKS; ++i)
+		free(ra->chunks[i]);
+
+	pthread_cond_destroy(&ra->cond);
+	pthread_mutex_destroy(&ra->mtx);
+	free(ra);
+	return 0;
+}
+
+FILE *sqfs_get_read_ahead_stream(FILE *fp, unsigned int num_jobs)
+{
+	cookie_io_functions_t funcs;
+	read_ahead_t *ra;
+	FILE *out;
+	size_t i;
+
+	ra = calloc(1, sizeof(*ra));
+	if (ra == NULL)
+		goto fail_errno;
+
+	for (i = 0; i < READ_AHEAD_CHUNKS; ++i) {
+		ra->chunks[i] = malloc(READ_AHEAD_CHUNK_SIZE);
+		if (ra->chunks[i] == NULL)
+			goto fail_errno;
+	}
+
+	if (input_init(&ra->in, fp, num_jobs))
+		goto fail;
+
+	pthread_mutex_init(&ra->mtx, NULL);
+	pthread_cond_init(&ra->cond, NULL);
+
+	memset(&funcs, 0, sizeof(funcs));
+	funcs.read = read_ahead_read;
+	funcs.close = read_ahead_close;
+
+	if (pthread_create(&ra->thread, NULL, read_ahead_proc, ra)) {
+		pthread_cond_destroy(&ra->cond);
+		pthread_mutex_destroy(&ra->mtx);
+		goto fail_errno;
+	}
+
+	out = fopencookie(ra, "rb", funcs);
+	if (out == NULL) {
+		perror("creating read ahead stream");
+		read_ahead_close(ra);
+		return NULL;
+	}
+
+	return out;
+fail_errno:
+	perror("creating read ahead stream");
+fail:
+	if (ra != NULL) {
+		input_cleanup(&ra->in);
+
+		for (i = 0; i < READ_AHEAD_CHUNKS; ++i)
+			free(ra->chunks[i]);
+		free(ra);
+	}
+	return NULL;
+}
+#elif defined(HAVE_FOPENCOOKIE)
+static ssize_t input_cookie_read(void *cookie, char *buffer, size_t size)
+{
+	return input_read(cookie, buffer, size);
+}
+
+static int input_cookie_close(void *cookie)
+{
+	input_cleanup(cookie);
+	free(cookie);
+	return 0;
+}
+
+/* without threads, the input is decompressed when the stream is read */
+FILE *sqfs_get_read_ahead_stream(FILE *fp, unsigned int num_jobs)
+{
+	cookie_io_functions_t funcs;
+	input_t *in;
+	FILE *out;
+
+	in = calloc(1, sizeof(*in));
+	if (in == NULL) {
+		perror("creating input stream");
+		return NULL;
+	}
+
+	if (input_init(in, fp, num_jobs)) {
+		input_cookie_close(in);
+		return NULL;
+	}
+
+	memset(&funcs, 0, sizeof(funcs));
+	funcs.read = input_cookie_read;
+	funcs.close = input_cookie_close;
+
+	out = fopencookie(in, "rb", funcs);
+	if (out == NULL) {
+		perror("creating input stream");
+		input_cookie_close(in);
+	}
+
+	return out;
+}
+#else
+#define COPY_BUFFER_SIZE (64 * 1024)
+
+/*
+  There is no portable way to wrap a FILE, so if the input might be
+  compressed, it is decompressed into a temporary file up front. Only a
+  single byte can be pushed back into the original stream, so if the first
+  one matches, the input is copied to the temporary file even if the rest
+  turns out not to be compressed after all.
+ */
+FILE *sqfs_get_read_ahead_stream(FILE *fp, unsigned int num_jobs)
+{
+	sqfs_u8 buffer[COPY_BUFFER_SIZE];
+	input_t in;
+	FILE *out;
+	ssize_t ret;
+	int c;
+
+	c = getc(fp);
+	if (c == EOF)
+		return fp;
+
+	ungetc(c, fp);
+
+	if (!stream_decompressor_may_start_with(c))
+		return fp;
+
+	memset(&in, 0, sizeof(in));
+	if (input_init(&in, fp, num_jobs))
+		return NULL;
+
+	out = tmpfile();
+	if (out == NULL) {
+		perror("creating temporary file for the input");
+		goto fail;
+	}
+
+	for (;;) {
+		ret = input_read(&in, buffer, sizeof(buffer));
+		if (ret < 0) {
+			perror("reading input");
+			goto fail_out;
+		}
+
+		if (ret == 0)
+			break;
+
+		if (fwrite(buffer, 1, ret, out) != (size_t)ret) {
+			perror("writing input to temporary file");
+			goto fail_out;
+		}
+	}
+
+	if (fflush(out) != 0 || fseek(out, 0, SEEK_SET) != 0) {
+		perror("rewinding temporary input file");
+		goto fail_out;
+	}
+
+	input_cleanup(&in);
+	return out;
+fail_out:
+	fclose(out);
+fail:
+	input_cleanup(&in);
+	return NULL;
+}
+#endif
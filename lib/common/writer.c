@@ -70,18 +70,29 @@ int sqfs_writer_init(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *wrcfg)
 	sqfs_compressor_config_t cfg;
 	int ret, flags;
 
-	sqfs->filename = wrcfg->filename;
-
 	if (compressor_cfg_init_options(&cfg, wrcfg->comp_id,
 					wrcfg->block_size,
 					wrcfg->comp_extra)) {
+		if (wrcfg->outfile != NULL)
+			sqfs_destroy(wrcfg->outfile);
 		return -1;
 	}
 
-	sqfs->outfile = sqfs_open_file(wrcfg->filename, wrcfg->outmode);
-	if (sqfs->outfile == NULL) {
-		perror(wrcfg->filename);
-		return -1;
+	if (wrcfg->outfile != NULL) {
+		sqfs->filename = NULL;
+		sqfs->outfile = wrcfg->outfile;
+	} else {
+		sqfs->filename = wrcfg->filename;
+
+		flags = wrcfg->outmode;
+		if (wrcfg->num_jobs > 1)
+			flags |= SQFS_FILE_OPEN_ASYNC_WRITE;
+
+		sqfs->outfile = sqfs_open_file(wrcfg->filename, flags);
+		if (sqfs->outfile == NULL) {
+			perror(wrcfg->filename);
+			return -1;
+		}
 	}
 
 	if (fstree_init(&sqfs->fs, wrcfg->fs_defaults))
@@ -138,10 +149,14 @@ int sqfs_writer_init(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *wrcfg)
 		goto fail_blkwr;
 	}
 
-	sqfs->data = sqfs_block_processor_create(sqfs->super.block_size,
-						 sqfs->cmp, wrcfg->num_jobs,
-						 wrcfg->max_backlog,
-						 sqfs->blkwr, sqfs->fragtbl);
+	flags = 0;
+	if (wrcfg->num_jobs > 1)
+		flags |= SQFS_BLOCK_PROCESSOR_ASYNC_IO;
+
+	sqfs->data = sqfs_block_processor_create_ex(sqfs->super.block_size,
+						    sqfs->cmp, wrcfg->num_jobs,
+						    wrcfg->max_backlog, flags,
+						    sqfs->blkwr, sqfs->fragtbl);
 	if (sqfs->data == NULL) {
 		perror("creating data block processor");
 		goto fail_fragtbl;
@@ -292,6 +307,12 @@ int sqfs_writer_finish(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *cfg)
 		return -1;
 	}
 
+	ret = sqfs_file_flush(sqfs->outfile);
+	if (ret) {
+		sqfs_perror(cfg->filename, "writing output file", ret);
+		return -1;
+	}
+
 	if (!cfg->quiet)
 		sqfs_print_statistics(&sqfs->super, sqfs->data, sqfs->blkwr);
 
@@ -314,7 +335,7 @@ void sqfs_writer_cleanup(sqfs_writer_t *sqfs, int status)
 	fstree_cleanup(&sqfs->fs);
 	sqfs_destroy(sqfs->outfile);
 
-	if (status != EXIT_SUCCESS) {
+	if (status != EXIT_SUCCESS && sqfs->filename != NULL) {
 #if defined(_WIN32) || defined(__WINDOWS__)
 		WCHAR *path = path_to_windows(sqfs->filename);
 
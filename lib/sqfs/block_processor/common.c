@@ -7,6 +7,126 @@
 #define SQFS_BUILDING_DLL
 #include "internal.h"
 
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#define POOL_ALIGNMENT (64)
+
+static void *map_pool_memory(size_t size, bool huge_pages)
+{
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_ANONYMOUS)
+	void *ptr = MAP_FAILED;
+
+	if (!huge_pages)
+		return NULL;
+#ifdef MAP_HUGETLB
+	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+	if (ptr == MAP_FAILED) {
+		ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ptr == MAP_FAILED)
+			return NULL;
+#ifdef MADV_HUGEPAGE
+		madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+	}
+	return ptr;
+#else
+	(void)size; (void)huge_pages;
+	return NULL;
+#endif
+}
+
+int block_pool_init(sqfs_block_processor_t *proc, size_t count,
+		    sqfs_u32 flags)
+{
+	sqfs_block_t *blk;
+	size_t i, stride;
+
+	stride = sizeof(sqfs_block_t) + proc->max_block_size;
+	stride = (stride + POOL_ALIGNMENT - 1) & ~(POOL_ALIGNMENT - 1);
+
+	if (SZ_MUL_OV(stride, count, &proc->pool_size))
+		return SQFS_ERROR_OVERFLOW;
+
+	proc->pool_stride = stride;
+	proc->pool_mem = map_pool_memory(proc->pool_size,
+				(flags & SQFS_BLOCK_PROCESSOR_HUGE_PAGES) != 0);
+
+	if (proc->pool_mem != NULL) {
+		proc->pool_mapped = true;
+	} else {
+		proc->pool_mem = malloc(proc->pool_size);
+		if (proc->pool_mem == NULL)
+			return SQFS_ERROR_ALLOC;
+	}
+
+	for (i = 0; i < count; ++i) {
+		blk = (sqfs_block_t *)(proc->pool_mem + i * stride);
+		blk->next = proc->pool_free;
+		proc->pool_free = blk;
+	}
+
+	return 0;
+}
+
+void block_pool_cleanup(sqfs_block_processor_t *proc)
+{
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_ANONYMOUS)
+	if (proc->pool_mapped) {
+		munmap(proc->pool_mem, proc->pool_size);
+	} else {
+		free(proc->pool_mem);
+	}
+#else
+	free(proc->pool_mem);
+#endif
+	proc->pool_mem = NULL;
+	proc->pool_free = NULL;
+}
+
+sqfs_block_t *get_new_block(sqfs_block_processor_t *proc)
+{
+	sqfs_block_t *blk = proc->pool_free;
+
+	if (blk == NULL)
+		return alloc_flex(sizeof(*blk), 1, proc->max_block_size);
+
+	proc->pool_free = blk->next;
+	memset(blk, 0, sizeof(*blk));
+	return blk;
+}
+
+void release_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
+{
+	sqfs_u8 *ptr = (sqfs_u8 *)blk;
+
+	if (blk == NULL)
+		return;
+
+	if (proc->pool_mem != NULL && ptr >= proc->pool_mem &&
+	    ptr < (proc->pool_mem + proc->pool_size)) {
+		blk->next = proc->pool_free;
+		proc->pool_free = blk;
+	} else {
+		free(blk);
+	}
+}
+
+void release_block_list(sqfs_block_processor_t *proc, sqfs_block_t *list)
+{
+	sqfs_block_t *it;
+
+	while (list != NULL) {
+		it = list;
+		list = list->next;
+		release_block(proc, it);
+	}
+}
+
 static int set_block_size(sqfs_inode_generic_t **inode,
 			  sqfs_u32 index, sqfs_u32 size)
 {
@@ -44,17 +164,12 @@ static int set_block_size(sqfs_inode_generic_t **inode,
 	return 0;
 }
 
-int process_completed_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
+static int update_block_location(sqfs_block_processor_t *proc,
+				 sqfs_block_t *blk, sqfs_u64 location)
 {
-	sqfs_u64 location;
 	sqfs_u32 size;
 	int err;
 
-	err = sqfs_block_writer_write(proc->wr, blk->size, blk->checksum,
-				      blk->flags, blk->data, &location);
-	if (err)
-		return err;
-
 	if (blk->flags & SQFS_BLK_IS_SPARSE) {
 		sqfs_inode_make_extended(*(blk->inode));
 		(*(blk->inode))->data.file_ext.sparse += blk->size;
@@ -88,6 +203,22 @@ int process_completed_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
 	return 0;
 }
 
+int process_completed_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
+{
+	sqfs_u64 location;
+	int err;
+
+	err = sqfs_block_writer_write(proc->wr, blk->size, blk->checksum,
+				      blk->flags, blk->data, &location);
+	if (err)
+		return err;
+
+	lock_io_state(proc);
+	err = update_block_location(proc, blk, location);
+	unlock_io_state(proc);
+	return err;
+}
+
 static bool is_zero_block(unsigned char *ptr, size_t size)
 {
 	return ptr[0] == 0 && memcmp(ptr, ptr + 1, size - 1) == 0;
@@ -163,13 +294,11 @@ int process_completed_fragment(sqfs_block_processor_t *proc, sqfs_block_t *frag,
 	}
 
 	if (proc->frag_block == NULL) {
-		size = sizeof(sqfs_block_t) + proc->max_block_size;
-
-		err= sqfs_frag_table_append(proc->frag_tbl, 0, 0, &index);
+		err = sqfs_frag_table_append(proc->frag_tbl, 0, 0, &index);
 		if (err)
 			goto fail;
 
-		proc->frag_block = calloc(1, size);
+		proc->frag_block = get_new_block(proc);
 		if (proc->frag_block == NULL) {
 			err = SQFS_ERROR_ALLOC;
 			goto fail;
@@ -198,142 +327,332 @@ int process_completed_fragment(sqfs_block_processor_t *proc, sqfs_block_t *frag,
 	proc->stats.actual_frag_count += 1;
 	return 0;
 fail:
-	free(*blk_out);
+	release_block(proc, *blk_out);
 	*blk_out = NULL;
 	return err;
 }
 
-static int add_sentinel_block(sqfs_block_processor_t *proc)
+static int enqueue_block(sqfs_block_stream_t *strm, sqfs_block_t *blk)
+{
+	sqfs_block_processor_t *proc = strm->proc;
+	int err;
+
+	while (strm != proc->streams && proc->max_stream_queue > 0 &&
+	       strm->queue_count >= proc->max_stream_queue) {
+		err = wait_producer(proc);
+		if (err) {
+			release_block(proc, blk);
+			return err;
+		}
+	}
+
+	if (strm == proc->streams)
+		return append_to_work_queue(proc, blk);
+
+	blk->next = NULL;
+
+	if (strm->queue_last == NULL) {
+		strm->queue = blk;
+	} else {
+		strm->queue_last->next = blk;
+	}
+
+	strm->queue_last = blk;
+	strm->queue_count += 1;
+	return 0;
+}
+
+static int drain_streams(sqfs_block_processor_t *proc)
+{
+	sqfs_block_stream_t *strm;
+	sqfs_block_t *blk;
+	int err;
+
+	while (proc->streams != NULL) {
+		strm = proc->streams;
+
+		while (strm->queue != NULL) {
+			blk = strm->queue;
+			strm->queue = blk->next;
+			if (strm->queue == NULL)
+				strm->queue_last = NULL;
+			strm->queue_count -= 1;
+
+			err = append_to_work_queue(proc, blk);
+			if (err)
+				return err;
+		}
+
+		if (!strm->closed)
+			break;
+
+		proc->streams = strm->next;
+		if (proc->streams == NULL)
+			proc->streams_last = NULL;
+
+		free(strm);
+	}
+
+	return 0;
+}
+
+void block_streams_cleanup(sqfs_block_processor_t *proc)
+{
+	sqfs_block_stream_t *strm;
+
+	while (proc->streams != NULL) {
+		strm = proc->streams;
+		proc->streams = strm->next;
+
+		release_block(proc, strm->blk_current);
+		release_block_list(proc, strm->queue);
+		free(strm);
+	}
+
+	proc->streams_last = NULL;
+	proc->file_stream = NULL;
+}
+
+static int add_sentinel_block(sqfs_block_stream_t *strm)
 {
-	sqfs_block_t *blk = calloc(1, sizeof(*blk));
+	sqfs_block_t *blk = get_new_block(strm->proc);
 
 	if (blk == NULL)
 		return SQFS_ERROR_ALLOC;
 
-	blk->inode = proc->inode;
-	blk->flags = proc->blk_flags | SQFS_BLK_LAST_BLOCK;
+	blk->inode = strm->inode;
+	blk->flags = strm->blk_flags | SQFS_BLK_LAST_BLOCK;
 
-	return append_to_work_queue(proc, blk);
+	return enqueue_block(strm, blk);
 }
 
-static int flush_block(sqfs_block_processor_t *proc)
+static int flush_block(sqfs_block_stream_t *strm)
 {
-	sqfs_block_t *block = proc->blk_current;
+	sqfs_block_t *block = strm->blk_current;
 
-	proc->blk_current = NULL;
+	strm->blk_current = NULL;
 
-	if (block->size < proc->max_block_size &&
+	if (block->size < strm->proc->max_block_size &&
 	    !(block->flags & SQFS_BLK_DONT_FRAGMENT)) {
 		block->flags |= SQFS_BLK_IS_FRAGMENT;
 	} else {
-		proc->blk_flags &= ~SQFS_BLK_FIRST_BLOCK;
+		strm->blk_flags &= ~SQFS_BLK_FIRST_BLOCK;
 	}
 
-	block->index = proc->blk_index++;
-	return append_to_work_queue(proc, block);
+	block->index = strm->blk_index++;
+	return enqueue_block(strm, block);
 }
 
-int sqfs_block_processor_begin_file(sqfs_block_processor_t *proc,
-				    sqfs_inode_generic_t **inode, sqfs_u32 flags)
+int sqfs_block_processor_open_stream(sqfs_block_processor_t *proc,
+				     sqfs_inode_generic_t **inode,
+				     sqfs_u32 flags, sqfs_block_stream_t **out)
 {
-	if (proc->inode != NULL)
-		return SQFS_ERROR_SEQUENCE;
+	sqfs_block_stream_t *strm;
 
 	if (flags & ~SQFS_BLK_USER_SETTABLE_FLAGS)
 		return SQFS_ERROR_UNSUPPORTED;
 
+	strm = calloc(1, sizeof(*strm));
+	if (strm == NULL)
+		return SQFS_ERROR_ALLOC;
+
 	(*inode) = calloc(1, sizeof(sqfs_inode_generic_t));
-	if ((*inode) == NULL)
+	if ((*inode) == NULL) {
+		free(strm);
 		return SQFS_ERROR_ALLOC;
+	}
 
 	(*inode)->base.type = SQFS_INODE_FILE;
 	sqfs_inode_set_frag_location(*inode, 0xFFFFFFFF, 0xFFFFFFFF);
 
-	proc->inode = inode;
-	proc->blk_flags = flags | SQFS_BLK_FIRST_BLOCK;
-	proc->blk_index = 0;
+	strm->proc = proc;
+	strm->inode = inode;
+	strm->blk_flags = flags | SQFS_BLK_FIRST_BLOCK;
+
+	lock_producer(proc);
+	if (proc->streams_last == NULL) {
+		proc->streams = strm;
+	} else {
+		proc->streams_last->next = strm;
+	}
+	proc->streams_last = strm;
+	unlock_producer(proc);
+
+	*out = strm;
 	return 0;
 }
 
-int sqfs_block_processor_append(sqfs_block_processor_t *proc, const void *data,
-				size_t size)
+int sqfs_block_stream_get_buffer(sqfs_block_stream_t *strm,
+				 void **buffer, size_t *size)
 {
+	sqfs_block_processor_t *proc = strm->proc;
 	sqfs_block_t *new;
-	sqfs_u64 filesize;
-	size_t diff;
-	int err;
+	int err = 0;
 
-	sqfs_inode_get_file_size(*(proc->inode), &filesize);
-	sqfs_inode_set_file_size(*(proc->inode), filesize + size);
+	lock_producer(proc);
+	if (strm->blk_current != NULL &&
+	    strm->blk_current->size == proc->max_block_size) {
+		err = flush_block(strm);
+		if (err)
+			goto out;
+	}
 
-	while (size > 0) {
-		if (proc->blk_current == NULL) {
-			new = alloc_flex(sizeof(*new), 1, proc->max_block_size);
-			if (new == NULL)
-				return SQFS_ERROR_ALLOC;
-
-			proc->blk_current = new;
-			proc->blk_current->flags = proc->blk_flags;
-			proc->blk_current->inode = proc->inode;
+	if (strm->blk_current == NULL) {
+		new = get_new_block(proc);
+		if (new == NULL) {
+			err = SQFS_ERROR_ALLOC;
+			goto out;
 		}
 
-		diff = proc->max_block_size - proc->blk_current->size;
+		strm->blk_current = new;
+		strm->blk_current->flags = strm->blk_flags;
+		strm->blk_current->inode = strm->inode;
+	}
 
-		if (diff == 0) {
-			err = flush_block(proc);
-			if (err)
-				return err;
-			continue;
-		}
+	*buffer = strm->blk_current->data + strm->blk_current->size;
+	*size = proc->max_block_size - strm->blk_current->size;
+out:
+	unlock_producer(proc);
+	return err;
+}
+
+int sqfs_block_stream_commit(sqfs_block_stream_t *strm, size_t size)
+{
+	sqfs_block_processor_t *proc = strm->proc;
+	sqfs_u64 filesize;
+	int err = 0;
+
+	if (size == 0)
+		return 0;
+
+	if (strm->blk_current == NULL)
+		return SQFS_ERROR_SEQUENCE;
+
+	if (size > (proc->max_block_size - strm->blk_current->size))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	lock_producer(proc);
+	lock_io_state(proc);
+	sqfs_inode_get_file_size(*(strm->inode), &filesize);
+	sqfs_inode_set_file_size(*(strm->inode), filesize + size);
+	unlock_io_state(proc);
+
+	strm->blk_current->size += size;
+	proc->stats.input_bytes_read += size;
+
+	if (strm->blk_current->size == proc->max_block_size)
+		err = flush_block(strm);
+	unlock_producer(proc);
+	return err;
+}
+
+int sqfs_block_stream_append(sqfs_block_stream_t *strm, const void *data,
+			     size_t size)
+{
+	size_t diff;
+	void *ptr;
+	int err;
+
+	while (size > 0) {
+		err = sqfs_block_stream_get_buffer(strm, &ptr, &diff);
+		if (err)
+			return err;
 
 		if (diff > size)
 			diff = size;
 
-		memcpy(proc->blk_current->data + proc->blk_current->size,
-		       data, diff);
+		memcpy(ptr, data, diff);
+
+		err = sqfs_block_stream_commit(strm, diff);
+		if (err)
+			return err;
 
 		size -= diff;
-		proc->blk_current->size += diff;
 		data = (const char *)data + diff;
-
-		proc->stats.input_bytes_read += diff;
-	}
-
-	if (proc->blk_current != NULL &&
-	    proc->blk_current->size == proc->max_block_size) {
-		return flush_block(proc);
 	}
 
 	return 0;
 }
 
-int sqfs_block_processor_end_file(sqfs_block_processor_t *proc)
+int sqfs_block_stream_close(sqfs_block_stream_t *strm)
 {
-	int err;
-
-	if (proc->inode == NULL)
-		return SQFS_ERROR_SEQUENCE;
-
-	if (!(proc->blk_flags & SQFS_BLK_FIRST_BLOCK)) {
-		if (proc->blk_current != NULL &&
-		    (proc->blk_flags & SQFS_BLK_DONT_FRAGMENT)) {
-			proc->blk_flags |= SQFS_BLK_LAST_BLOCK;
+	sqfs_block_processor_t *proc = strm->proc;
+	int err = 0;
+
+	lock_producer(proc);
+	if (!(strm->blk_flags & SQFS_BLK_FIRST_BLOCK)) {
+		if (strm->blk_current != NULL &&
+		    (strm->blk_flags & SQFS_BLK_DONT_FRAGMENT)) {
+			strm->blk_flags |= SQFS_BLK_LAST_BLOCK;
 		} else {
-			err = add_sentinel_block(proc);
+			err = add_sentinel_block(strm);
 			if (err)
-				return err;
+				goto out;
 		}
 	}
 
-	if (proc->blk_current != NULL) {
-		err = flush_block(proc);
+	if (strm->blk_current != NULL) {
+		err = flush_block(strm);
 		if (err)
-			return err;
+			goto out;
 	}
+out:
+	strm->closed = true;
 
-	proc->inode = NULL;
-	proc->blk_flags = 0;
-	return 0;
+	if (err == 0 && strm == proc->streams)
+		err = drain_streams(proc);
+
+	/* the first stream may have moved on, or failed */
+	signal_producers(proc);
+	unlock_producer(proc);
+	return err;
+}
+
+int sqfs_block_processor_begin_file(sqfs_block_processor_t *proc,
+				    sqfs_inode_generic_t **inode, sqfs_u32 flags)
+{
+	if (proc->file_stream != NULL)
+		return SQFS_ERROR_SEQUENCE;
+
+	return sqfs_block_processor_open_stream(proc, inode, flags,
+						&proc->file_stream);
+}
+
+int sqfs_block_processor_append(sqfs_block_processor_t *proc, const void *data,
+				size_t size)
+{
+	if (proc->file_stream == NULL)
+		return SQFS_ERROR_SEQUENCE;
+
+	return sqfs_block_stream_append(proc->file_stream, data, size);
+}
+
+int sqfs_block_processor_get_buffer(sqfs_block_processor_t *proc,
+				    void **buffer, size_t *size)
+{
+	if (proc->file_stream == NULL)
+		return SQFS_ERROR_SEQUENCE;
+
+	return sqfs_block_stream_get_buffer(proc->file_stream, buffer, size);
+}
+
+int sqfs_block_processor_commit(sqfs_block_processor_t *proc, size_t size)
+{
+	if (proc->file_stream == NULL)
+		return SQFS_ERROR_SEQUENCE;
+
+	return sqfs_block_stream_commit(proc->file_stream, size);
+}
+
+int sqfs_block_processor_end_file(sqfs_block_processor_t *proc)
+{
+	sqfs_block_stream_t *strm = proc->file_stream;
+
+	if (strm == NULL)
+		return SQFS_ERROR_SEQUENCE;
+
+	proc->file_stream = NULL;
+	return sqfs_block_stream_close(strm);
 }
 
 const sqfs_block_processor_stats_t
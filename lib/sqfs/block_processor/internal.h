@@ -39,6 +39,22 @@ typedef struct sqfs_block_t {
 	sqfs_u8 data[];
 } sqfs_block_t;
 
+struct sqfs_block_stream_t {
+	struct sqfs_block_stream_t *next;
+	sqfs_block_processor_t *proc;
+
+	sqfs_inode_generic_t **inode;
+	sqfs_block_t *blk_current;
+	sqfs_u32 blk_flags;
+	sqfs_u32 blk_index;
+	bool closed;
+
+	/* Finished blocks held back until all earlier streams are done. */
+	sqfs_block_t *queue;
+	sqfs_block_t *queue_last;
+	size_t queue_count;
+};
+
 struct sqfs_block_processor_t {
 	sqfs_object_t obj;
 
@@ -49,14 +65,52 @@ struct sqfs_block_processor_t {
 
 	sqfs_block_processor_stats_t stats;
 
-	sqfs_inode_generic_t **inode;
-	sqfs_block_t *blk_current;
-	sqfs_u32 blk_flags;
-	sqfs_u32 blk_index;
+	/*
+	  Open streams, and closed ones that still have blocks queued, in
+	  the order they were opened. Only the first one submits its blocks
+	  directly, so the data of each file ends up contiguous and in a
+	  deterministic order. file_stream is the one used by the
+	  begin_file/append/end_file interface.
+	 */
+	sqfs_block_stream_t *streams;
+	sqfs_block_stream_t *streams_last;
+	sqfs_block_stream_t *file_stream;
+
+	/*
+	  Number of blocks a stream other than the first one can hold back
+	  before its producer has to wait. Zero if there is no limit.
+	 */
+	size_t max_stream_queue;
 
 	size_t max_block_size;
+
+	/*
+	  Preallocated block buffers. Blocks that are not currently in use
+	  are kept in a free list. If the pool runs dry, blocks are allocated
+	  from the heap instead. Only ever touched by the producer thread.
+	 */
+	sqfs_block_t *pool_free;
+	sqfs_u8 *pool_mem;
+	size_t pool_size;
+	size_t pool_stride;
+	bool pool_mapped;
 };
 
+SQFS_INTERNAL int block_pool_init(sqfs_block_processor_t *proc, size_t count,
+				  sqfs_u32 flags);
+
+SQFS_INTERNAL void block_pool_cleanup(sqfs_block_processor_t *proc);
+
+SQFS_INTERNAL sqfs_block_t *get_new_block(sqfs_block_processor_t *proc);
+
+SQFS_INTERNAL void release_block(sqfs_block_processor_t *proc,
+				 sqfs_block_t *blk);
+
+SQFS_INTERNAL void release_block_list(sqfs_block_processor_t *proc,
+				      sqfs_block_t *list);
+
+SQFS_INTERNAL void block_streams_cleanup(sqfs_block_processor_t *proc);
+
 SQFS_INTERNAL int process_completed_block(sqfs_block_processor_t *proc,
 					  sqfs_block_t *block);
 
@@ -71,4 +125,29 @@ int block_processor_do_block(sqfs_block_t *block, sqfs_compressor_t *cmp,
 SQFS_INTERNAL
 int append_to_work_queue(sqfs_block_processor_t *proc, sqfs_block_t *block);
 
+/*
+  Protects the inodes and the fragment table against concurrent
+  modification by an asynchronous I/O thread, if there is one.
+ */
+SQFS_INTERNAL void lock_io_state(sqfs_block_processor_t *proc);
+
+SQFS_INTERNAL void unlock_io_state(sqfs_block_processor_t *proc);
+
+/*
+  Serializes the producer side (streams, block pool, work queue) between
+  multiple threads feeding streams concurrently.
+ */
+SQFS_INTERNAL void lock_producer(sqfs_block_processor_t *proc);
+
+SQFS_INTERNAL void unlock_producer(sqfs_block_processor_t *proc);
+
+/*
+  Called with the producer lock held. Temporarily releases it and waits
+  until another producer closes a stream. Returns the sticky error status
+  of the processor.
+ */
+SQFS_INTERNAL int wait_producer(sqfs_block_processor_t *proc);
+
+SQFS_INTERNAL void signal_producers(sqfs_block_processor_t *proc);
+
 #endif /* INTERNAL_H */
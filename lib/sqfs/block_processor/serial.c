@@ -17,21 +17,24 @@ static void block_processor_destroy(sqfs_object_t *obj)
 {
 	sqfs_block_processor_t *proc = (sqfs_block_processor_t *)obj;
 
-	free(proc->blk_current);
-	free(proc->frag_block);
+	block_streams_cleanup(proc);
+	release_block(proc, proc->frag_block);
+	block_pool_cleanup(proc);
 	free(proc);
 }
 
-sqfs_block_processor_t *sqfs_block_processor_create(size_t max_block_size,
-						    sqfs_compressor_t *cmp,
-						    unsigned int num_workers,
-						    size_t max_backlog,
-						    sqfs_block_writer_t *wr,
-						    sqfs_frag_table_t *tbl)
+sqfs_block_processor_t
+*sqfs_block_processor_create_ex(size_t max_block_size, sqfs_compressor_t *cmp,
+				unsigned int num_workers, size_t max_backlog,
+				sqfs_u32 flags, sqfs_block_writer_t *wr,
+				sqfs_frag_table_t *tbl)
 {
 	serial_block_processor_t *proc;
 	(void)num_workers; (void)max_backlog;
 
+	if (flags & ~SQFS_BLOCK_PROCESSOR_ALL_FLAGS)
+		return NULL;
+
 	proc = alloc_flex(sizeof(*proc), 1, max_block_size);
 	if (proc == NULL)
 		return NULL;
@@ -42,9 +45,57 @@ sqfs_block_processor_t *sqfs_block_processor_create(size_t max_block_size,
 	proc->base.wr = wr;
 	proc->base.stats.size = sizeof(proc->base.stats);
 	((sqfs_object_t *)proc)->destroy = block_processor_destroy;
+
+	/* current block, sentinel and the old and new fragment block */
+	if (block_pool_init((sqfs_block_processor_t *)proc, 4, flags)) {
+		free(proc);
+		return NULL;
+	}
+
 	return (sqfs_block_processor_t *)proc;
 }
 
+sqfs_block_processor_t *sqfs_block_processor_create(size_t max_block_size,
+						    sqfs_compressor_t *cmp,
+						    unsigned int num_workers,
+						    size_t max_backlog,
+						    sqfs_block_writer_t *wr,
+						    sqfs_frag_table_t *tbl)
+{
+	return sqfs_block_processor_create_ex(max_block_size, cmp, num_workers,
+					      max_backlog, 0, wr, tbl);
+}
+
+void lock_io_state(sqfs_block_processor_t *proc)
+{
+	(void)proc;
+}
+
+void unlock_io_state(sqfs_block_processor_t *proc)
+{
+	(void)proc;
+}
+
+void lock_producer(sqfs_block_processor_t *proc)
+{
+	(void)proc;
+}
+
+void unlock_producer(sqfs_block_processor_t *proc)
+{
+	(void)proc;
+}
+
+int wait_producer(sqfs_block_processor_t *proc)
+{
+	return ((serial_block_processor_t *)proc)->status;
+}
+
+void signal_producers(sqfs_block_processor_t *proc)
+{
+	(void)proc;
+}
+
 int append_to_work_queue(sqfs_block_processor_t *proc, sqfs_block_t *block)
 {
 	serial_block_processor_t *sproc = (serial_block_processor_t *)proc;
@@ -65,7 +116,7 @@ int append_to_work_queue(sqfs_block_processor_t *proc, sqfs_block_t *block)
 		if (fragblk == NULL)
 			goto done;
 
-		free(block);
+		release_block(proc, block);
 		block = fragblk;
 
 		sproc->status = block_processor_do_block(block, proc->cmp,
@@ -77,7 +128,7 @@ int append_to_work_queue(sqfs_block_processor_t *proc, sqfs_block_t *block)
 
 	sproc->status = process_completed_block(proc, block);
 done:
-	free(block);
+	release_block(proc, block);
 	return sproc->status;
 }
 
@@ -101,7 +152,7 @@ int sqfs_block_processor_finish(sqfs_block_processor_t *proc)
 
 	sproc->status = process_completed_block(proc, proc->frag_block);
 out:
-	free(proc->frag_block);
+	release_block(proc, proc->frag_block);
 	proc->frag_block = NULL;
 	return sproc->status;
 }
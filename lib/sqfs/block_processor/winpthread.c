@@ -6,48 +6,21 @@
  */
 #define SQFS_BUILDING_DLL
 #include "internal.h"
-
-#if defined(_WIN32) || defined(__WINDOWS__)
-#	define WIN32_LEAN_AND_MEAN
-#	include <windows.h>
-#	define LOCK(mtx) EnterCriticalSection(mtx)
-#	define UNLOCK(mtx) LeaveCriticalSection(mtx)
-#	define AWAIT(cond, mtx) SleepConditionVariableCS(cond, mtx, INFINITE)
-#	define SIGNAL_ALL(cond) WakeAllConditionVariable(cond)
-#	define THREAD_JOIN(t) \
-		if (t != NULL) { \
-			WaitForSingleObject(t, INFINITE); \
-			CloseHandle(t); \
-		}
-#	define MUTEX_DESTROY(mtx) DeleteCriticalSection(mtx)
-#	define CONDITION_DESTROY(cond)
-#	define THREAD_EXIT_SUCCESS 0
-#	define THREAD_TYPE DWORD WINAPI
-#	define THREAD_ARG LPVOID
-#	define THREAD_HANDLE HANDLE
-#	define MUTEX_TYPE CRITICAL_SECTION
-#	define CONDITION_TYPE CONDITION_VARIABLE
-#else
-#	include <pthread.h>
-#	include <signal.h>
-#	define LOCK(mtx) pthread_mutex_lock(mtx)
-#	define UNLOCK(mtx) pthread_mutex_unlock(mtx)
-#	define AWAIT(cond, mtx) pthread_cond_wait(cond, mtx)
-#	define SIGNAL_ALL(cond) pthread_cond_broadcast(cond)
-#	define THREAD_JOIN(t) if (t != (pthread_t)0) { pthread_join(t, NULL); }
-#	define MUTEX_DESTROY(mtx) pthread_mutex_destroy(mtx)
-#	define CONDITION_DESTROY(cond) pthread_cond_destroy(cond)
-#	define THREAD_EXIT_SUCCESS NULL
-#	define THREAD_TYPE void *
-#	define THREAD_ARG void *
-#	define THREAD_HANDLE pthread_t
-#	define MUTEX_TYPE pthread_mutex_t
-#	define CONDITION_TYPE pthread_cond_t
-#endif
+#include "../winpthread.h"
 
 typedef struct compress_worker_t compress_worker_t;
 typedef struct thread_pool_processor_t thread_pool_processor_t;
 
+/*
+  A slot in the work ring. The block with sequence number N is stored in
+  slot N & ring_mask, so blocks are reordered simply by walking the ring.
+ */
+typedef struct {
+	sqfs_block_t *blk;
+	int done;
+	int status;
+} work_slot_t;
+
 struct compress_worker_t {
 	thread_pool_processor_t *shared;
 	sqfs_compressor_t *cmp;
@@ -58,119 +31,209 @@ struct compress_worker_t {
 struct thread_pool_processor_t {
 	sqfs_block_processor_t base;
 
+	/*
+	  Only used to put idle threads to sleep and wake them up again.
+	  All work is handed around through the rings using atomics.
+	 */
 	MUTEX_TYPE mtx;
 	CONDITION_TYPE queue_cond;
 	CONDITION_TYPE done_cond;
+	unsigned int idle_workers;
+	int main_waiting;
 
-	sqfs_block_t *proc_queue;
-	sqfs_block_t *proc_queue_last;
+	/* indexed by proc_seq_num, written by workers */
+	work_slot_t *proc_ring;
+
+	/* indexed by io_seq_num, only accessed by the main thread */
+	sqfs_block_t **io_ring;
 
-	sqfs_block_t *io_queue;
-	sqfs_block_t *done;
 	size_t backlog;
 	int status;
 
 	sqfs_u32 proc_enq_id;
+	sqfs_u32 proc_claim_id;
 	sqfs_u32 proc_deq_id;
 
 	sqfs_u32 io_enq_id;
 	sqfs_u32 io_deq_id;
 
+	/*
+	  With SQFS_BLOCK_PROCESSOR_ASYNC_IO, blocks in I/O order are handed
+	  to a dedicated thread through this queue and handed back through
+	  the io_written list, so the main thread can recycle them. io_mtx
+	  also serializes access to the inodes and the fragment table.
+	 */
+	MUTEX_TYPE io_mtx;
+	CONDITION_TYPE io_cond;
+	CONDITION_TYPE io_done_cond;
+	THREAD_HANDLE io_thread;
+	sqfs_block_t *io_queue;
+	sqfs_block_t *io_queue_last;
+	sqfs_block_t *io_written;
+	size_t io_pending;
+	bool io_exit;
+
+	/*
+	  Serializes producers feeding different streams. Producers of
+	  streams that hold back too many blocks wait for prod_cond.
+	 */
+	MUTEX_TYPE prod_mtx;
+	CONDITION_TYPE prod_cond;
+
 	unsigned int num_workers;
 	size_t max_backlog;
+	size_t ring_mask;
+	sqfs_u32 flags;
 
 	compress_worker_t *workers[];
 };
 
-static void free_blk_list(sqfs_block_t *list)
+static void set_status(thread_pool_processor_t *shared, int status)
 {
-	sqfs_block_t *it;
+	int expected = 0;
 
-	while (list != NULL) {
-		it = list;
-		list = list->next;
-		free(it);
-	}
+	ATOMIC_CAS(&shared->status, &expected, status);
+
+	LOCK(&shared->mtx);
+	SIGNAL_ALL(&shared->queue_cond);
+	SIGNAL_ALL(&shared->done_cond);
+	UNLOCK(&shared->mtx);
 }
 
-static sqfs_block_t *get_next_work_item(thread_pool_processor_t *shared)
+static sqfs_block_t *get_next_work_item(thread_pool_processor_t *shared,
+					work_slot_t **slot_out)
 {
-	sqfs_block_t *blk = NULL;
+	sqfs_u32 id;
 
-	while (shared->proc_queue == NULL && shared->status == 0)
-		AWAIT(&shared->queue_cond, &shared->mtx);
+	for (;;) {
+		if (ATOMIC_LOAD(&shared->status) != 0)
+			return NULL;
 
-	if (shared->status == 0) {
-		blk = shared->proc_queue;
-		shared->proc_queue = blk->next;
-		blk->next = NULL;
+		id = ATOMIC_LOAD(&shared->proc_claim_id);
 
-		if (shared->proc_queue == NULL)
-			shared->proc_queue_last = NULL;
-	}
+		if (id != ATOMIC_LOAD(&shared->proc_enq_id)) {
+			if (!ATOMIC_CAS(&shared->proc_claim_id, &id, id + 1))
+				continue;
+
+			*slot_out = shared->proc_ring +
+				(id & shared->ring_mask);
+			return (*slot_out)->blk;
+		}
 
-	return blk;
+		LOCK(&shared->mtx);
+		ATOMIC_ADD(&shared->idle_workers, 1);
+
+		while (ATOMIC_LOAD(&shared->status) == 0 &&
+		       ATOMIC_LOAD(&shared->proc_claim_id) ==
+		       ATOMIC_LOAD(&shared->proc_enq_id)) {
+			AWAIT(&shared->queue_cond, &shared->mtx);
+		}
+
+		ATOMIC_SUB(&shared->idle_workers, 1);
+		UNLOCK(&shared->mtx);
+	}
 }
 
 static void store_completed_block(thread_pool_processor_t *shared,
-				  sqfs_block_t *blk, int status)
+				  work_slot_t *slot, int status)
 {
-	sqfs_block_t *it = shared->done, *prev = NULL;
+	slot->status = status;
+	ATOMIC_STORE(&slot->done, 1);
 
-	while (it != NULL) {
-		if (it->proc_seq_num >= blk->proc_seq_num)
-			break;
-		prev = it;
-		it = it->next;
-	}
+	if (status != 0)
+		set_status(shared, status);
 
-	if (prev == NULL) {
-		blk->next = shared->done;
-		shared->done = blk;
-	} else {
-		blk->next = prev->next;
-		prev->next = blk;
+	if (ATOMIC_LOAD(&shared->main_waiting)) {
+		LOCK(&shared->mtx);
+		SIGNAL_ALL(&shared->done_cond);
+		UNLOCK(&shared->mtx);
 	}
-
-	if (status != 0 && shared->status == 0)
-		shared->status = status;
-
-	SIGNAL_ALL(&shared->done_cond);
 }
 
 static THREAD_TYPE worker_proc(THREAD_ARG arg)
 {
 	compress_worker_t *worker = arg;
 	thread_pool_processor_t *shared = worker->shared;
-	sqfs_block_t *blk = NULL;
-	int status = 0;
+	work_slot_t *slot;
+	sqfs_block_t *blk;
+	int status;
 
 	for (;;) {
-		LOCK(&shared->mtx);
-		if (blk != NULL)
-			store_completed_block(shared, blk, status);
-
-		blk = get_next_work_item(shared);
-		UNLOCK(&shared->mtx);
-
+		blk = get_next_work_item(shared, &slot);
 		if (blk == NULL)
 			break;
 
 		status = block_processor_do_block(blk, worker->cmp,
 						  worker->scratch,
 						  shared->base.max_block_size);
+
+		store_completed_block(shared, slot, status);
 	}
 
 	return THREAD_EXIT_SUCCESS;
 }
 
+static int handle_io_queue(thread_pool_processor_t *proc, sqfs_block_t *list)
+{
+	sqfs_block_t *it = list;
+	int status = 0;
+
+	while (status == 0 && it != NULL) {
+		status = process_completed_block(&proc->base, it);
+		it = it->next;
+
+		if (status != 0)
+			set_status(proc, status);
+	}
+
+	return status;
+}
+
+static THREAD_TYPE io_thread_proc(THREAD_ARG arg)
+{
+	thread_pool_processor_t *proc = arg;
+	sqfs_block_t *list, *last;
+	size_t count;
+
+	LOCK(&proc->io_mtx);
+	for (;;) {
+		while (proc->io_queue == NULL && !proc->io_exit)
+			AWAIT(&proc->io_cond, &proc->io_mtx);
+
+		if (proc->io_queue == NULL)
+			break;
+
+		list = proc->io_queue;
+		last = proc->io_queue_last;
+		proc->io_queue = NULL;
+		proc->io_queue_last = NULL;
+		UNLOCK(&proc->io_mtx);
+
+		if (ATOMIC_LOAD(&proc->status) == 0)
+			handle_io_queue(proc, list);
+
+		for (count = 1, last = list; last->next != NULL; ++count)
+			last = last->next;
+
+		LOCK(&proc->io_mtx);
+		last->next = proc->io_written;
+		proc->io_written = list;
+		proc->io_pending -= count;
+		SIGNAL_ALL(&proc->io_done_cond);
+	}
+	UNLOCK(&proc->io_mtx);
+
+	return THREAD_EXIT_SUCCESS;
+}
+
 static void block_processor_destroy(sqfs_object_t *obj)
 {
 	thread_pool_processor_t *proc = (thread_pool_processor_t *)obj;
-	unsigned int i;
+	size_t i;
+
+	ATOMIC_STORE(&proc->status, -1);
 
 	LOCK(&proc->mtx);
-	proc->status = -1;
 	SIGNAL_ALL(&proc->queue_cond);
 	UNLOCK(&proc->mtx);
 
@@ -185,15 +248,41 @@ static void block_processor_destroy(sqfs_object_t *obj)
 		}
 	}
 
+	LOCK(&proc->io_mtx);
+	proc->io_exit = true;
+	SIGNAL_ALL(&proc->io_cond);
+	UNLOCK(&proc->io_mtx);
+
+	THREAD_JOIN(proc->io_thread);
+
+	CONDITION_DESTROY(&proc->io_done_cond);
+	CONDITION_DESTROY(&proc->io_cond);
+	MUTEX_DESTROY(&proc->io_mtx);
 	CONDITION_DESTROY(&proc->done_cond);
 	CONDITION_DESTROY(&proc->queue_cond);
 	MUTEX_DESTROY(&proc->mtx);
+	CONDITION_DESTROY(&proc->prod_cond);
+	MUTEX_DESTROY(&proc->prod_mtx);
+
+	release_block_list(&proc->base, proc->io_queue);
+	release_block_list(&proc->base, proc->io_written);
 
-	free_blk_list(proc->proc_queue);
-	free_blk_list(proc->io_queue);
-	free_blk_list(proc->done);
-	free(proc->base.blk_current);
-	free(proc->base.frag_block);
+	if (proc->proc_ring != NULL) {
+		for (i = 0; i <= proc->ring_mask; ++i)
+			release_block(&proc->base, proc->proc_ring[i].blk);
+	}
+
+	if (proc->io_ring != NULL) {
+		for (i = 0; i <= proc->ring_mask; ++i)
+			release_block(&proc->base, proc->io_ring[i]);
+	}
+
+	block_streams_cleanup(&proc->base);
+	release_block(&proc->base, proc->base.frag_block);
+	block_pool_cleanup(&proc->base);
+
+	free(proc->proc_ring);
+	free(proc->io_ring);
 	free(proc);
 }
 
@@ -201,15 +290,23 @@ static thread_pool_processor_t *block_processor_create(size_t max_block_size,
 						       sqfs_compressor_t *cmp,
 						       unsigned int num_workers,
 						       size_t max_backlog,
+						       sqfs_u32 flags,
 						       sqfs_block_writer_t *wr,
 						       sqfs_frag_table_t *tbl)
 {
 	thread_pool_processor_t *proc;
+	size_t pool_count;
 	unsigned int i;
 
+	if (flags & ~SQFS_BLOCK_PROCESSOR_ALL_FLAGS)
+		return NULL;
+
 	if (num_workers < 1)
 		num_workers = 1;
 
+	if (max_backlog < 1)
+		max_backlog = 1;
+
 	proc = alloc_flex(sizeof(*proc),
 			  sizeof(proc->workers[0]), num_workers);
 	if (proc == NULL)
@@ -217,13 +314,41 @@ static thread_pool_processor_t *block_processor_create(size_t max_block_size,
 
 	proc->num_workers = num_workers;
 	proc->max_backlog = max_backlog;
+	proc->flags = flags;
 	proc->base.max_block_size = max_block_size;
 	proc->base.cmp = cmp;
 	proc->base.frag_tbl = tbl;
 	proc->base.wr = wr;
 	proc->base.stats.size = sizeof(proc->base.stats);
+	proc->base.max_stream_queue = max_backlog;
 	((sqfs_object_t *)proc)->destroy = block_processor_destroy;
 
+	/* sequence numbers wrap around, so the ring size must be a power
+	   of two to keep the slot mapping continuous */
+	proc->ring_mask = 1;
+	while (proc->ring_mask < max_backlog)
+		proc->ring_mask *= 2;
+	proc->ring_mask -= 1;
+
+	proc->proc_ring = alloc_array(sizeof(proc->proc_ring[0]),
+				      proc->ring_mask + 1);
+	if (proc->proc_ring == NULL)
+		goto fail;
+
+	proc->io_ring = alloc_array(sizeof(proc->io_ring[0]),
+				    proc->ring_mask + 1);
+	if (proc->io_ring == NULL)
+		goto fail;
+
+	/* blocks in flight, plus the current block, fragment block and
+	   sentinel, plus the blocks waiting for the I/O thread */
+	pool_count = max_backlog + 3;
+	if (flags & SQFS_BLOCK_PROCESSOR_ASYNC_IO)
+		pool_count += max_backlog;
+
+	if (block_pool_init(&proc->base, pool_count, flags))
+		goto fail;
+
 	for (i = 0; i < num_workers; ++i) {
 		proc->workers[i] = alloc_flex(sizeof(compress_worker_t),
 					      1, max_block_size);
@@ -245,24 +370,28 @@ fail:
 }
 
 #if defined(_WIN32) || defined(__WINDOWS__)
-sqfs_block_processor_t *sqfs_block_processor_create(size_t max_block_size,
-						    sqfs_compressor_t *cmp,
-						    unsigned int num_workers,
-						    size_t max_backlog,
-						    sqfs_block_writer_t *wr,
-						    sqfs_frag_table_t *tbl)
+sqfs_block_processor_t
+*sqfs_block_processor_create_ex(size_t max_block_size, sqfs_compressor_t *cmp,
+				unsigned int num_workers, size_t max_backlog,
+				sqfs_u32 flags, sqfs_block_writer_t *wr,
+				sqfs_frag_table_t *tbl)
 {
 	thread_pool_processor_t *proc;
 	unsigned int i;
 
 	proc = block_processor_create(max_block_size, cmp, num_workers,
-				      max_backlog, wr, tbl);
+				      max_backlog, flags, wr, tbl);
 	if (proc == NULL)
 		return NULL;
 
 	InitializeCriticalSection(&proc->mtx);
+	InitializeCriticalSection(&proc->prod_mtx);
+	InitializeConditionVariable(&proc->prod_cond);
 	InitializeConditionVariable(&proc->queue_cond);
 	InitializeConditionVariable(&proc->done_cond);
+	InitializeCriticalSection(&proc->io_mtx);
+	InitializeConditionVariable(&proc->io_cond);
+	InitializeConditionVariable(&proc->io_done_cond);
 
 	for (i = 0; i < num_workers; ++i) {
 		proc->workers[i]->thread = CreateThread(NULL, 0, worker_proc,
@@ -271,18 +400,24 @@ sqfs_block_processor_t *sqfs_block_processor_create(size_t max_block_size,
 			goto fail;
 	}
 
+	if (flags & SQFS_BLOCK_PROCESSOR_ASYNC_IO) {
+		proc->io_thread = CreateThread(NULL, 0, io_thread_proc,
+					       proc, 0, 0);
+		if (proc->io_thread == NULL)
+			goto fail;
+	}
+
 	return (sqfs_block_processor_t *)proc;
 fail:
 	block_processor_destroy((sqfs_object_t *)proc);
 	return NULL;
 }
 #else
-sqfs_block_processor_t *sqfs_block_processor_create(size_t max_block_size,
-						    sqfs_compressor_t *cmp,
-						    unsigned int num_workers,
-						    size_t max_backlog,
-						    sqfs_block_writer_t *wr,
-						    sqfs_frag_table_t *tbl)
+sqfs_block_processor_t
+*sqfs_block_processor_create_ex(size_t max_block_size, sqfs_compressor_t *cmp,
+				unsigned int num_workers, size_t max_backlog,
+				sqfs_u32 flags, sqfs_block_writer_t *wr,
+				sqfs_frag_table_t *tbl)
 {
 	thread_pool_processor_t *proc;
 	sigset_t set, oldset;
@@ -290,13 +425,18 @@ sqfs_block_processor_t *sqfs_block_processor_create(size_t max_block_size,
 	int ret;
 
 	proc = block_processor_create(max_block_size, cmp, num_workers,
-				      max_backlog, wr, tbl);
+				      max_backlog, flags, wr, tbl);
 	if (proc == NULL)
 		return NULL;
 
 	proc->mtx = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+	proc->prod_mtx = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+	proc->prod_cond = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
 	proc->queue_cond = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
 	proc->done_cond = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
+	proc->io_mtx = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+	proc->io_cond = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
+	proc->io_done_cond = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
 
 	sigfillset(&set);
 	pthread_sigmask(SIG_SETMASK, &set, &oldset);
@@ -309,6 +449,13 @@ sqfs_block_processor_t *sqfs_block_processor_create(size_t max_block_size,
 			goto fail;
 	}
 
+	if (flags & SQFS_BLOCK_PROCESSOR_ASYNC_IO) {
+		ret = pthread_create(&proc->io_thread, NULL,
+				     io_thread_proc, proc);
+		if (ret != 0)
+			goto fail;
+	}
+
 	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
 	return (sqfs_block_processor_t *)proc;
 fail:
@@ -318,95 +465,182 @@ fail:
 }
 #endif
 
-static void store_io_block(thread_pool_processor_t *proc, sqfs_block_t *blk)
+sqfs_block_processor_t *sqfs_block_processor_create(size_t max_block_size,
+						    sqfs_compressor_t *cmp,
+						    unsigned int num_workers,
+						    size_t max_backlog,
+						    sqfs_block_writer_t *wr,
+						    sqfs_frag_table_t *tbl)
 {
-	sqfs_block_t *it = proc->io_queue, *prev = NULL;
+	return sqfs_block_processor_create_ex(max_block_size, cmp, num_workers,
+					      max_backlog, 0, wr, tbl);
+}
 
-	while (it != NULL && it->io_seq_num < blk->io_seq_num) {
-		prev = it;
-		it = it->next;
-	}
+void lock_io_state(sqfs_block_processor_t *proc)
+{
+	thread_pool_processor_t *thproc = (thread_pool_processor_t *)proc;
 
-	if (prev == NULL) {
-		blk->next = proc->io_queue;
-		proc->io_queue = blk;
-	} else {
-		blk->next = prev->next;
-		prev->next = blk;
-	}
+	if (thproc->flags & SQFS_BLOCK_PROCESSOR_ASYNC_IO)
+		LOCK(&thproc->io_mtx);
+}
+
+void unlock_io_state(sqfs_block_processor_t *proc)
+{
+	thread_pool_processor_t *thproc = (thread_pool_processor_t *)proc;
+
+	if (thproc->flags & SQFS_BLOCK_PROCESSOR_ASYNC_IO)
+		UNLOCK(&thproc->io_mtx);
+}
+
+void lock_producer(sqfs_block_processor_t *proc)
+{
+	LOCK(&((thread_pool_processor_t *)proc)->prod_mtx);
+}
+
+void unlock_producer(sqfs_block_processor_t *proc)
+{
+	UNLOCK(&((thread_pool_processor_t *)proc)->prod_mtx);
+}
+
+int wait_producer(sqfs_block_processor_t *proc)
+{
+	thread_pool_processor_t *thproc = (thread_pool_processor_t *)proc;
+	int status = ATOMIC_LOAD(&thproc->status);
+
+	if (status != 0)
+		return status;
+
+	AWAIT(&thproc->prod_cond, &thproc->prod_mtx);
+	return ATOMIC_LOAD(&thproc->status);
+}
+
+void signal_producers(sqfs_block_processor_t *proc)
+{
+	SIGNAL_ALL(&((thread_pool_processor_t *)proc)->prod_cond);
+}
 
+static void store_io_block(thread_pool_processor_t *proc, sqfs_block_t *blk)
+{
+	proc->io_ring[blk->io_seq_num & proc->ring_mask] = blk;
 	proc->backlog += 1;
 }
 
 static sqfs_block_t *try_dequeue_io(thread_pool_processor_t *proc)
 {
-	sqfs_block_t *out;
+	size_t idx = proc->io_deq_id & proc->ring_mask;
+	sqfs_block_t *out = proc->io_ring[idx];
 
-	if (proc->io_queue == NULL)
+	if (out == NULL || out->io_seq_num != proc->io_deq_id)
 		return NULL;
 
-	if (proc->io_queue->io_seq_num != proc->io_deq_id)
-		return NULL;
-
-	out = proc->io_queue;
-	proc->io_queue = out->next;
-	out->next = NULL;
+	proc->io_ring[idx] = NULL;
 	proc->io_deq_id += 1;
 	proc->backlog -= 1;
 	return out;
 }
 
-static sqfs_block_t *try_dequeue_done(thread_pool_processor_t *proc)
+static sqfs_block_t *try_dequeue_done(thread_pool_processor_t *proc,
+				      int *status)
 {
+	work_slot_t *slot;
 	sqfs_block_t *out;
 
-	if (proc->done == NULL)
+	if (proc->proc_deq_id == proc->proc_enq_id)
 		return NULL;
 
-	if (proc->done->proc_seq_num != proc->proc_deq_id)
+	slot = proc->proc_ring + (proc->proc_deq_id & proc->ring_mask);
+	if (!ATOMIC_LOAD(&slot->done))
 		return NULL;
 
-	out = proc->done;
-	proc->done = out->next;
-	out->next = NULL;
+	out = slot->blk;
+	*status = slot->status;
+	slot->blk = NULL;
+	slot->done = 0;
+
 	proc->proc_deq_id += 1;
 	proc->backlog -= 1;
 	return out;
 }
 
+static void wait_for_done(thread_pool_processor_t *proc)
+{
+	work_slot_t *slot;
+
+	slot = proc->proc_ring + (proc->proc_deq_id & proc->ring_mask);
+
+	LOCK(&proc->mtx);
+	ATOMIC_STORE(&proc->main_waiting, 1);
+
+	while (ATOMIC_LOAD(&proc->status) == 0 && !ATOMIC_LOAD(&slot->done))
+		AWAIT(&proc->done_cond, &proc->mtx);
+
+	ATOMIC_STORE(&proc->main_waiting, 0);
+	UNLOCK(&proc->mtx);
+}
+
 static void append_block(thread_pool_processor_t *proc, sqfs_block_t *block)
 {
-	if (proc->proc_queue_last == NULL) {
-		proc->proc_queue = proc->proc_queue_last = block;
-	} else {
-		proc->proc_queue_last->next = block;
-		proc->proc_queue_last = block;
-	}
+	work_slot_t *slot;
 
-	block->proc_seq_num = proc->proc_enq_id++;
+	block->proc_seq_num = proc->proc_enq_id;
 	block->next = NULL;
+
+	slot = proc->proc_ring + (block->proc_seq_num & proc->ring_mask);
+	slot->blk = block;
+	slot->status = 0;
+	slot->done = 0;
+
+	ATOMIC_STORE(&proc->proc_enq_id, block->proc_seq_num + 1);
 	proc->backlog += 1;
+
+	if (ATOMIC_LOAD(&proc->idle_workers) > 0) {
+		LOCK(&proc->mtx);
+		SIGNAL_ONE(&proc->queue_cond);
+		UNLOCK(&proc->mtx);
+	}
 }
 
-static int handle_io_queue(thread_pool_processor_t *proc, sqfs_block_t *list)
+static int submit_io_queue(thread_pool_processor_t *proc, sqfs_block_t *list,
+			   bool wait_idle)
 {
-	sqfs_block_t *it = list;
-	int status = 0;
+	size_t count = 1, limit = wait_idle ? 0 : proc->max_backlog;
+	sqfs_block_t *last = list;
 
-	while (status == 0 && it != NULL) {
-		status = process_completed_block(&proc->base, it);
-		it = it->next;
+	sqfs_block_t *written;
 
-		if (status != 0) {
-			LOCK(&proc->mtx);
-			if (proc->status == 0)
-				proc->status = status;
-			SIGNAL_ALL(&proc->queue_cond);
-			UNLOCK(&proc->mtx);
+	if (!(proc->flags & SQFS_BLOCK_PROCESSOR_ASYNC_IO)) {
+		handle_io_queue(proc, list);
+		release_block_list(&proc->base, list);
+		return ATOMIC_LOAD(&proc->status);
+	}
+
+	LOCK(&proc->io_mtx);
+	if (list != NULL) {
+		while (last->next != NULL) {
+			last = last->next;
+			count += 1;
 		}
+
+		if (proc->io_queue_last == NULL) {
+			proc->io_queue = list;
+		} else {
+			proc->io_queue_last->next = list;
+		}
+
+		proc->io_queue_last = last;
+		proc->io_pending += count;
+		SIGNAL_ALL(&proc->io_cond);
 	}
 
-	return status;
+	while (proc->io_pending > limit && ATOMIC_LOAD(&proc->status) == 0)
+		AWAIT(&proc->io_done_cond, &proc->io_mtx);
+
+	written = proc->io_written;
+	proc->io_written = NULL;
+	UNLOCK(&proc->io_mtx);
+
+	release_block_list(&proc->base, written);
+	return ATOMIC_LOAD(&proc->status);
 }
 
 int append_to_work_queue(sqfs_block_processor_t *proc, sqfs_block_t *block)
@@ -414,11 +648,11 @@ int append_to_work_queue(sqfs_block_processor_t *proc, sqfs_block_t *block)
 	thread_pool_processor_t *thproc = (thread_pool_processor_t *)proc;
 	sqfs_block_t *io_list = NULL, *io_list_last = NULL;
 	sqfs_block_t *blk, *fragblk, *free_list = NULL;
+	bool sync = (block == NULL);
 	int status;
 
-	LOCK(&thproc->mtx);
 	for (;;) {
-		status = thproc->status;
+		status = ATOMIC_LOAD(&thproc->status);
 		if (status != 0)
 			break;
 
@@ -444,23 +678,35 @@ int append_to_work_queue(sqfs_block_processor_t *proc, sqfs_block_t *block)
 			continue;
 		}
 
-		blk = try_dequeue_done(thproc);
+		blk = try_dequeue_done(thproc, &status);
 		if (blk == NULL) {
-			AWAIT(&thproc->done_cond, &thproc->mtx);
+			wait_for_done(thproc);
+			continue;
+		}
+
+		if (status != 0) {
+			release_block(proc, blk);
+			set_status(thproc, status);
 			continue;
 		}
 
 		if (blk->flags & SQFS_BLK_IS_FRAGMENT) {
 			fragblk = NULL;
-			thproc->status = process_completed_fragment(proc, blk,
-								    &fragblk);
+			lock_io_state(proc);
+			status = process_completed_fragment(proc, blk,
+							    &fragblk);
+			unlock_io_state(proc);
 			blk->next = free_list;
 			free_list = blk;
 
+			if (status != 0) {
+				set_status(thproc, status);
+				continue;
+			}
+
 			if (fragblk != NULL) {
 				fragblk->io_seq_num = thproc->io_enq_id++;
 				append_block(thproc, fragblk);
-				SIGNAL_ALL(&thproc->queue_cond);
 			}
 		} else {
 			if (!(blk->flags & SQFS_BLK_FRAGMENT_BLOCK))
@@ -468,15 +714,15 @@ int append_to_work_queue(sqfs_block_processor_t *proc, sqfs_block_t *block)
 			store_io_block(thproc, blk);
 		}
 	}
-	SIGNAL_ALL(&thproc->queue_cond);
-	UNLOCK(&thproc->mtx);
-	free(block);
+	release_block(proc, block);
 
-	if (status == 0)
-		status = handle_io_queue(thproc, io_list);
+	if (status == 0) {
+		status = submit_io_queue(thproc, io_list, sync);
+	} else {
+		release_block_list(proc, io_list);
+	}
 
-	free_blk_list(io_list);
-	free_blk_list(free_list);
+	release_block_list(proc, free_list);
 	return status;
 }
 
@@ -504,15 +750,10 @@ int sqfs_block_processor_finish(sqfs_block_processor_t *proc)
 
 		if (status == 0)
 			status = handle_io_queue(thproc, blk);
-		free(blk);
+		release_block(proc, blk);
 
-		if (status != 0) {
-			LOCK(&thproc->mtx);
-			if (thproc->status == 0)
-				thproc->status = status;
-			SIGNAL_ALL(&thproc->queue_cond);
-			UNLOCK(&thproc->mtx);
-		}
+		if (status != 0)
+			set_status(thproc, status);
 	}
 
 	return status;
@@ -19,10 +19,14 @@
 	(((sqfs_u64)(size) << 32) | (sqfs_u64)(chksum))
 
 #define INIT_BLOCK_COUNT (128)
+#define INIT_INDEX_BUCKETS (128)
 
 typedef struct {
 	sqfs_u64 offset;
 	sqfs_u64 hash;
+
+	/* 1 + index of the next block in the same deduplication bucket */
+	size_t next;
 } blk_info_t;
 
 struct sqfs_block_writer_t {
@@ -34,6 +38,18 @@ struct sqfs_block_writer_t {
 	blk_info_t *blocks;
 	size_t devblksz;
 
+	/*
+	  Hash index over all blocks that preceed the current file, used to
+	  find candidate runs for deduplication. The blocks in a bucket are
+	  chained in ascending order. Each bucket holds 1 + the index of the
+	  first and the last block, or 0 if empty. Both arrays share a single
+	  allocation.
+	 */
+	size_t *index;
+	size_t *index_tail;
+	size_t num_buckets;
+	size_t num_indexed;
+
 	sqfs_block_writer_stats_t stats;
 
 	const sqfs_block_hooks_t *hooks;
@@ -68,25 +84,121 @@ static int store_block_location(sqfs_block_writer_t *wr, sqfs_u64 offset,
 	return 0;
 }
 
+static size_t bucket_of(const sqfs_block_writer_t *wr, sqfs_u64 hash)
+{
+	return ((sqfs_u32)hash ^ (sqfs_u32)(hash >> 32)) &
+		(wr->num_buckets - 1);
+}
+
+static void index_insert(sqfs_block_writer_t *wr, size_t i)
+{
+	size_t bucket = bucket_of(wr, wr->blocks[i].hash);
+
+	wr->blocks[i].next = 0;
+
+	if (wr->index_tail[bucket] == 0) {
+		wr->index[bucket] = i + 1;
+	} else {
+		wr->blocks[wr->index_tail[bucket] - 1].next = i + 1;
+	}
+
+	wr->index_tail[bucket] = i + 1;
+}
+
+static int alloc_index(sqfs_block_writer_t *wr, size_t num_buckets)
+{
+	size_t *new = alloc_array(2 * sizeof(new[0]), num_buckets);
+
+	if (new == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	free(wr->index);
+	wr->index = new;
+	wr->index_tail = new + num_buckets;
+	wr->num_buckets = num_buckets;
+	return 0;
+}
+
+static int grow_index(sqfs_block_writer_t *wr)
+{
+	size_t i;
+	int err;
+
+	err = alloc_index(wr, wr->num_buckets * 2);
+	if (err)
+		return err;
+
+	for (i = 0; i < wr->num_indexed; ++i) {
+		if (wr->blocks[i].hash != 0)
+			index_insert(wr, i);
+	}
+
+	return 0;
+}
+
+static int index_blocks(sqfs_block_writer_t *wr)
+{
+	size_t idx;
+	int err;
+
+	while (wr->num_indexed < wr->num_blocks) {
+		if (wr->num_indexed >= wr->num_buckets) {
+			err = grow_index(wr);
+			if (err)
+				return err;
+		}
+
+		idx = wr->num_indexed++;
+
+		if (wr->blocks[idx].hash != 0)
+			index_insert(wr, idx);
+	}
+
+	return 0;
+}
+
 static size_t deduplicate_blocks(sqfs_block_writer_t *wr, size_t count)
 {
-	size_t i, j;
+	const blk_info_t *file = wr->blocks + wr->file_start;
+	size_t i, j, it, start = wr->file_start;
 
-	for (i = 0; i < wr->file_start; ++i) {
-		for (j = 0; j < count; ++j) {
-			if (wr->blocks[i + j].hash == 0)
-				break;
+	for (j = 0; j < count; ++j) {
+		if (file[j].hash == 0)
+			goto out;
+	}
+
+	/*
+	  The bucket chains are sorted by ascending block index, so the first
+	  match is the earliest one, like with a linear scan.
+	 */
+	it = wr->index[bucket_of(wr, file[0].hash)];
 
-			if (wr->blocks[i + j].hash !=
-			    wr->blocks[wr->file_start + j].hash)
+	for (; it != 0; it = wr->blocks[it - 1].next) {
+		i = it - 1;
+
+		if (wr->blocks[i].hash != file[0].hash)
+			continue;
+
+		if (i + count > wr->file_start)
+			break;
+
+		for (j = 1; j < count; ++j) {
+			if (wr->blocks[i + j].hash != file[j].hash)
 				break;
 		}
 
-		if (j == count)
+		if (j == count) {
+			start = i;
 			break;
+		}
 	}
-
-	return i;
+out:
+	if (start < wr->file_start) {
+		wr->stats.index_hits += 1;
+	} else {
+		wr->stats.index_misses += 1;
+	}
+	return start;
 }
 
 static int align_file(sqfs_block_writer_t *wr)
@@ -118,6 +230,7 @@ static int align_file(sqfs_block_writer_t *wr)
 
 static void block_writer_destroy(sqfs_object_t *wr)
 {
+	free(((sqfs_block_writer_t *)wr)->index);
 	free(((sqfs_block_writer_t *)wr)->blocks);
 	free(wr);
 }
@@ -147,6 +260,12 @@ sqfs_block_writer_t *sqfs_block_writer_create(sqfs_file_t *file,
 		return NULL;
 	}
 
+	if (alloc_index(wr, INIT_INDEX_BUCKETS)) {
+		free(wr->blocks);
+		free(wr);
+		return NULL;
+	}
+
 	return wr;
 }
 
@@ -181,6 +300,10 @@ int sqfs_block_writer_write(sqfs_block_writer_t *wr, sqfs_u32 size,
 	}
 
 	if (flags & SQFS_BLK_FIRST_BLOCK) {
+		err = index_blocks(wr);
+		if (err)
+			return err;
+
 		wr->start = wr->file->get_size(wr->file);
 		wr->file_start = wr->num_blocks;
 
@@ -237,13 +360,7 @@ int sqfs_block_writer_write(sqfs_block_writer_t *wr, sqfs_u32 size,
 			if (start >= wr->file_start)
 				return 0;
 
-			offset = start + count;
-			if (offset >= wr->file_start) {
-				count = wr->num_blocks - offset;
-				wr->num_blocks = offset;
-			} else {
-				wr->num_blocks = wr->file_start;
-			}
+			wr->num_blocks = wr->file_start;
 
 			err = wr->file->truncate(wr->file, wr->start);
 			if (err)
@@ -0,0 +1,739 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * data_reader.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+#define DEFAULT_CACHE_BLOCKS (8)
+
+/* for files with fewer blocks, summing up the sizes is cheap enough */
+#define MIN_INDEXED_BLOCKS (16)
+
+static size_t cache_hash(const sqfs_data_reader_t *data, sqfs_u64 location)
+{
+	location *= 0x9E3779B97F4A7C15ULL;
+
+	return (size_t)(location >> 32) & (data->num_buckets - 1);
+}
+
+static void cache_lru_unlink(sqfs_data_reader_t *data, cache_entry_t *ent)
+{
+	if (ent->lru_prev == NULL) {
+		data->lru_head = ent->lru_next;
+	} else {
+		ent->lru_prev->lru_next = ent->lru_next;
+	}
+
+	if (ent->lru_next == NULL) {
+		data->lru_tail = ent->lru_prev;
+	} else {
+		ent->lru_next->lru_prev = ent->lru_prev;
+	}
+
+	ent->lru_prev = NULL;
+	ent->lru_next = NULL;
+}
+
+static void cache_lru_push_front(sqfs_data_reader_t *data, cache_entry_t *ent)
+{
+	ent->lru_prev = NULL;
+	ent->lru_next = data->lru_head;
+
+	if (data->lru_head == NULL) {
+		data->lru_tail = ent;
+	} else {
+		data->lru_head->lru_prev = ent;
+	}
+
+	data->lru_head = ent;
+}
+
+static void cache_hash_unlink(sqfs_data_reader_t *data, cache_entry_t *ent)
+{
+	cache_entry_t **it = data->buckets + cache_hash(data, ent->location);
+
+	while (*it != ent)
+		it = &((*it)->next);
+
+	*it = ent->next;
+	ent->next = NULL;
+}
+
+static void cache_hash_insert(sqfs_data_reader_t *data, cache_entry_t *ent)
+{
+	size_t idx = cache_hash(data, ent->location);
+
+	ent->next = data->buckets[idx];
+	data->buckets[idx] = ent;
+}
+
+cache_entry_t *cache_lookup(sqfs_data_reader_t *data, sqfs_u64 location)
+{
+	cache_entry_t *ent = data->buckets[cache_hash(data, location)];
+
+	while (ent != NULL && ent->location != location)
+		ent = ent->next;
+
+	return ent;
+}
+
+static void cache_evict_lru(sqfs_data_reader_t *data)
+{
+	cache_entry_t *ent = data->lru_tail;
+
+	cache_lru_unlink(data, ent);
+	cache_hash_unlink(data, ent);
+	data->cache_count -= 1;
+	free(ent);
+}
+
+static void cache_clear(sqfs_data_reader_t *data)
+{
+	while (data->lru_tail != NULL)
+		cache_evict_lru(data);
+}
+
+static int cache_resize(sqfs_data_reader_t *data, size_t max_count)
+{
+	size_t num_buckets = 16;
+	cache_entry_t **buckets;
+	cache_entry_t *ent;
+
+	while (num_buckets < max_count * 2)
+		num_buckets *= 2;
+
+	while (data->cache_count > max_count)
+		cache_evict_lru(data);
+
+	data->cache_max = max_count;
+
+	if (num_buckets == data->num_buckets)
+		return 0;
+
+	buckets = alloc_array(sizeof(buckets[0]), num_buckets);
+	if (buckets == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	free(data->buckets);
+	data->buckets = buckets;
+	data->num_buckets = num_buckets;
+
+	for (ent = data->lru_head; ent != NULL; ent = ent->lru_next)
+		cache_hash_insert(data, ent);
+
+	return 0;
+}
+
+int get_raw_data(sqfs_file_t *file, sqfs_u64 offset, size_t size,
+		 sqfs_u8 *buffer, const sqfs_u8 **out)
+{
+	const void *ptr;
+
+	if (sqfs_file_get_mapping(file, offset, size, &ptr) == 0) {
+		*out = ptr;
+		return 0;
+	}
+
+	*out = buffer;
+	return file->read_at(file, offset, buffer, size);
+}
+
+static int read_block(sqfs_data_reader_t *data, sqfs_u64 off, sqfs_u32 size,
+		      sqfs_u32 max_size, size_t *out_sz, sqfs_u8 *out)
+{
+	const sqfs_u8 *raw = data->scratch;
+	sqfs_u32 on_disk_size;
+	sqfs_s32 ret;
+	int err;
+
+	*out_sz = max_size;
+
+	if (SQFS_IS_SPARSE_BLOCK(size)) {
+		memset(out, 0, max_size);
+		return 0;
+	}
+
+	on_disk_size = SQFS_ON_DISK_BLOCK_SIZE(size);
+
+	if (on_disk_size > max_size)
+		return SQFS_ERROR_OVERFLOW;
+
+	if (SQFS_IS_BLOCK_COMPRESSED(size)) {
+		err = get_raw_data(data->file, off, on_disk_size,
+				   data->scratch, &raw);
+		if (err)
+			return err;
+
+		ret = data->cmp->do_block(data->cmp, raw, on_disk_size,
+					  out, max_size);
+		if (ret <= 0)
+			return ret < 0 ? ret : SQFS_ERROR_OVERFLOW;
+
+		*out_sz = ret;
+	} else {
+		err = data->file->read_at(data->file, off, out, on_disk_size);
+		if (err)
+			return err;
+
+		*out_sz = on_disk_size;
+	}
+
+	return 0;
+}
+
+static int get_cached_block(sqfs_data_reader_t *data, sqfs_u64 location,
+			    sqfs_u32 size, cache_entry_t **out)
+{
+	cache_entry_t *ent = cache_lookup(data, location);
+	int err;
+
+	if (ent != NULL) {
+		data->stats.cache_hits += 1;
+		cache_lru_unlink(data, ent);
+		cache_lru_push_front(data, ent);
+		*out = ent;
+		return 0;
+	}
+
+	data->stats.cache_misses += 1;
+
+	if (data->cache_count >= data->cache_max) {
+		/* recycle the least recently used block */
+		ent = data->lru_tail;
+		cache_lru_unlink(data, ent);
+		cache_hash_unlink(data, ent);
+	} else {
+		ent = alloc_flex(sizeof(*ent), 1, data->block_size);
+		if (ent == NULL)
+			return SQFS_ERROR_ALLOC;
+
+		data->cache_count += 1;
+	}
+
+	err = read_ahead_get(data, location, &ent);
+	if (err == 0) {
+		err = read_block(data, location, size, data->block_size,
+				 &ent->size, ent->data);
+	} else if (err > 0) {
+		err = 0;
+	}
+
+	if (err) {
+		data->cache_count -= 1;
+		free(ent);
+		return err;
+	}
+
+	ent->location = location;
+	cache_hash_insert(data, ent);
+	cache_lru_push_front(data, ent);
+	*out = ent;
+	return 0;
+}
+
+static int get_fragment_block(sqfs_data_reader_t *data, size_t idx,
+			      cache_entry_t **out)
+{
+	sqfs_fragment_t ent;
+	int ret;
+
+	ret = sqfs_frag_table_lookup(data->frag_tbl, idx, &ent);
+	if (ret != 0)
+		return ret;
+
+	return get_cached_block(data, ent.start_offset, ent.size, out);
+}
+
+static int get_block_into(sqfs_data_reader_t *data, sqfs_u64 off,
+			  sqfs_u32 size, sqfs_u32 max_size, size_t *out_sz,
+			  sqfs_u8 *out)
+{
+	cache_entry_t *ent;
+	int err;
+
+	*out_sz = 0;
+
+	if (SQFS_IS_SPARSE_BLOCK(size)) {
+		memset(out, 0, max_size);
+		*out_sz = max_size;
+		return 0;
+	}
+
+	ent = cache_lookup(data, off);
+
+	if (ent != NULL) {
+		data->stats.cache_hits += 1;
+	} else if (data->ra != NULL) {
+		/* pick up the block from the read-ahead workers */
+		err = get_cached_block(data, off, size, &ent);
+		if (err)
+			return err;
+	} else {
+		err = read_block(data, off, size, max_size, out_sz, out);
+		if (err)
+			*out_sz = 0;
+		return err;
+	}
+
+	if (ent->size > max_size)
+		return SQFS_ERROR_OVERFLOW;
+
+	memcpy(out, ent->data, ent->size);
+	*out_sz = ent->size;
+	return 0;
+}
+
+static sqfs_u64 sum_block_sizes(const sqfs_inode_generic_t *inode,
+				sqfs_u64 start, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; ++i)
+		start += SQFS_ON_DISK_BLOCK_SIZE(inode->extra[i]);
+
+	return start;
+}
+
+static int build_block_index(block_index_t *idx,
+			     const sqfs_inode_generic_t *inode,
+			     sqfs_u64 start, size_t count)
+{
+	sqfs_u64 *new;
+	size_t i;
+
+	if (idx->max < count + 1) {
+		new = alloc_array(sizeof(new[0]), count + 1);
+		if (new == NULL)
+			return SQFS_ERROR_ALLOC;
+
+		free(idx->offsets);
+		idx->offsets = new;
+		idx->max = count + 1;
+	}
+
+	idx->offsets[0] = start;
+
+	for (i = 0; i < count; ++i) {
+		idx->offsets[i + 1] = idx->offsets[i] +
+			SQFS_ON_DISK_BLOCK_SIZE(inode->extra[i]);
+	}
+
+	idx->start = start;
+	idx->count = count;
+	idx->inode_number = inode->base.inode_number;
+	return 0;
+}
+
+/*
+  Find the on-disk location of a block. For large files, a table of block
+  locations is built once on first access, so that seeking within the file
+  does not require summing up the sizes of all preceeding blocks.
+
+  Different files can share a start location and block count, e.g. if a file
+  starts with sparse blocks that take up no space, so the tables are also
+  keyed by inode number.
+ */
+static sqfs_u64 get_block_location(sqfs_data_reader_t *data,
+				   const sqfs_inode_generic_t *inode,
+				   size_t index)
+{
+	size_t i, count = sqfs_inode_get_file_block_count(inode);
+	block_index_t *idx;
+	sqfs_u64 start;
+
+	sqfs_inode_get_file_block_start(inode, &start);
+
+	if (index < MIN_INDEXED_BLOCKS || index > count)
+		return sum_block_sizes(inode, start, index);
+
+	for (i = 0; i < NUM_BLOCK_INDEX; ++i) {
+		idx = data->blk_index + i;
+
+		if (idx->offsets != NULL && idx->start == start &&
+		    idx->count == count &&
+		    idx->inode_number == inode->base.inode_number) {
+			goto out;
+		}
+	}
+
+	idx = data->blk_index;
+
+	for (i = 1; i < NUM_BLOCK_INDEX; ++i) {
+		if (data->blk_index[i].last_used < idx->last_used)
+			idx = data->blk_index + i;
+	}
+
+	if (build_block_index(idx, inode, start, count) != 0) {
+		idx->count = 0;
+		idx->last_used = 0;
+		return sum_block_sizes(inode, start, index);
+	}
+out:
+	idx->last_used = ++data->blk_index_clock;
+	return idx->offsets[index];
+}
+
+static int locate_block(sqfs_data_reader_t *data,
+			const sqfs_inode_generic_t *inode, size_t index,
+			sqfs_u64 *location, size_t *unpacked_size)
+{
+	sqfs_u64 filesz, skip;
+
+	sqfs_inode_get_file_size(inode, &filesz);
+
+	if (index >= sqfs_inode_get_file_block_count(inode))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	*location = get_block_location(data, inode, index);
+
+	skip = (sqfs_u64)index * data->block_size;
+	filesz = filesz > skip ? filesz - skip : 0;
+
+	*unpacked_size = filesz < data->block_size ? filesz : data->block_size;
+
+	read_ahead_schedule(data, inode, index, *location);
+	return 0;
+}
+
+static int get_fragment(sqfs_data_reader_t *data,
+			const sqfs_inode_generic_t *inode,
+			cache_entry_t **ent, sqfs_u32 *offset, sqfs_u32 *size)
+{
+	sqfs_u32 frag_idx, frag_off, frag_sz;
+	size_t block_count;
+	sqfs_u64 filesz;
+	int err;
+
+	sqfs_inode_get_file_size(inode, &filesz);
+	sqfs_inode_get_frag_location(inode, &frag_idx, &frag_off);
+	*ent = NULL;
+	*offset = 0;
+	*size = 0;
+
+	block_count = sqfs_inode_get_file_block_count(inode);
+
+	if (block_count * data->block_size >= filesz)
+		return 0;
+
+	frag_sz = filesz % data->block_size;
+
+	err = get_fragment_block(data, frag_idx, ent);
+	if (err)
+		return err;
+
+	if (frag_off + frag_sz > data->block_size)
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	*offset = frag_off;
+	*size = frag_sz;
+	return 0;
+}
+
+static void data_reader_destroy(sqfs_object_t *obj)
+{
+	sqfs_data_reader_t *data = (sqfs_data_reader_t *)obj;
+	size_t i;
+
+	read_ahead_destroy(data->ra);
+	cache_clear(data);
+	sqfs_destroy(data->frag_tbl);
+	for (i = 0; i < NUM_BLOCK_INDEX; ++i)
+		free(data->blk_index[i].offsets);
+
+	free(data->buckets);
+	free(data);
+}
+
+static sqfs_object_t *data_reader_copy(const sqfs_object_t *obj)
+{
+	const sqfs_data_reader_t *data = (const sqfs_data_reader_t *)obj;
+	sqfs_data_reader_t *copy;
+
+	copy = alloc_flex(sizeof(*data), 1, data->block_size);
+	if (copy == NULL)
+		return NULL;
+
+	memcpy(copy, data, sizeof(*data) + data->block_size);
+
+	/* the copy starts out with an empty cache of the same budget */
+	copy->buckets = NULL;
+	copy->num_buckets = 0;
+	copy->lru_head = NULL;
+	copy->lru_tail = NULL;
+	copy->cache_count = 0;
+	copy->ra = NULL;
+
+	/* the block location index is rebuilt on demand */
+	memset(copy->blk_index, 0, sizeof(copy->blk_index));
+	copy->blk_index_clock = 0;
+
+	if (cache_resize(copy, data->cache_max))
+		goto fail_cache;
+
+	copy->frag_tbl = sqfs_copy(data->frag_tbl);
+	if (copy->frag_tbl == NULL)
+		goto fail_ftbl;
+
+	/* with its own set of read-ahead workers */
+	if (read_ahead_create(copy))
+		goto fail_ra;
+
+	/* XXX: file and cmp aren't deep-copied becaues data
+	        doesn't own them either. */
+	return (sqfs_object_t *)copy;
+fail_ra:
+	sqfs_destroy(copy->frag_tbl);
+fail_ftbl:
+	free(copy->buckets);
+fail_cache:
+	free(copy);
+	return NULL;
+}
+
+sqfs_data_reader_t *sqfs_data_reader_create(sqfs_file_t *file,
+					    size_t block_size,
+					    sqfs_compressor_t *cmp)
+{
+	sqfs_data_reader_t *data = alloc_flex(sizeof(*data), 1, block_size);
+
+	if (data == NULL)
+		return NULL;
+
+	if (cache_resize(data, DEFAULT_CACHE_BLOCKS)) {
+		free(data);
+		return NULL;
+	}
+
+	data->frag_tbl = sqfs_frag_table_create(0);
+	if (data->frag_tbl == NULL) {
+		free(data->buckets);
+		free(data);
+		return NULL;
+	}
+
+	((sqfs_object_t *)data)->destroy = data_reader_destroy;
+	((sqfs_object_t *)data)->copy = data_reader_copy;
+	data->stats.size = sizeof(data->stats);
+	data->file = file;
+	data->block_size = block_size;
+	data->cmp = cmp;
+	return data;
+}
+
+int sqfs_data_reader_set_cache_size(sqfs_data_reader_t *data, size_t size)
+{
+	size_t count = size / data->block_size;
+
+	return cache_resize(data, count > 0 ? count : 1);
+}
+
+int sqfs_data_reader_set_read_ahead(sqfs_data_reader_t *data,
+				    unsigned int num_workers,
+				    size_t max_blocks)
+{
+	int ret;
+
+	read_ahead_destroy(data->ra);
+	data->ra = NULL;
+	data->ra_workers = num_workers;
+	data->ra_blocks = max_blocks;
+
+	ret = read_ahead_create(data);
+	if (ret != 0)
+		data->ra_workers = 0;
+
+	return ret;
+}
+
+const sqfs_data_reader_stats_t
+*sqfs_data_reader_get_stats(const sqfs_data_reader_t *data)
+{
+	return &data->stats;
+}
+
+int sqfs_data_reader_load_fragment_table(sqfs_data_reader_t *data,
+					 const sqfs_super_t *super)
+{
+	return sqfs_frag_table_read(data->frag_tbl, data->file,
+				    super, data->cmp);
+}
+
+int sqfs_data_reader_get_block(sqfs_data_reader_t *data,
+			       const sqfs_inode_generic_t *inode,
+			       size_t index, size_t *size, sqfs_u8 **out)
+{
+	size_t unpacked_size;
+	sqfs_u64 off;
+	int err;
+
+	*size = 0;
+	*out = NULL;
+
+	err = locate_block(data, inode, index, &off, &unpacked_size);
+	if (err)
+		return err;
+
+	*out = alloc_array(1, unpacked_size);
+	if (*out == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	err = get_block_into(data, off, inode->extra[index],
+			     unpacked_size, size, *out);
+	if (err) {
+		free(*out);
+		*out = NULL;
+	}
+	return err;
+}
+
+int sqfs_data_reader_get_block_into(sqfs_data_reader_t *data,
+				    const sqfs_inode_generic_t *inode,
+				    size_t index, size_t *size,
+				    sqfs_u8 *buffer)
+{
+	size_t unpacked_size;
+	sqfs_u64 off;
+	int err;
+
+	*size = 0;
+
+	err = locate_block(data, inode, index, &off, &unpacked_size);
+	if (err)
+		return err;
+
+	return get_block_into(data, off, inode->extra[index],
+			      unpacked_size, size, buffer);
+}
+
+int sqfs_data_reader_get_fragment(sqfs_data_reader_t *data,
+				  const sqfs_inode_generic_t *inode,
+				  size_t *size, sqfs_u8 **out)
+{
+	sqfs_u32 frag_off, frag_sz;
+	cache_entry_t *ent;
+	int err;
+
+	*size = 0;
+	*out = NULL;
+
+	err = get_fragment(data, inode, &ent, &frag_off, &frag_sz);
+	if (err || ent == NULL)
+		return err;
+
+	*out = alloc_array(1, frag_sz);
+	if (*out == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	*size = frag_sz;
+	memcpy(*out, ent->data + frag_off, frag_sz);
+	return 0;
+}
+
+int sqfs_data_reader_get_fragment_into(sqfs_data_reader_t *data,
+				       const sqfs_inode_generic_t *inode,
+				       size_t *size, sqfs_u8 *buffer)
+{
+	sqfs_u32 frag_off, frag_sz;
+	cache_entry_t *ent;
+	int err;
+
+	*size = 0;
+
+	err = get_fragment(data, inode, &ent, &frag_off, &frag_sz);
+	if (err || ent == NULL)
+		return err;
+
+	*size = frag_sz;
+	memcpy(buffer, ent->data + frag_off, frag_sz);
+	return 0;
+}
+
+sqfs_s32 sqfs_data_reader_read(sqfs_data_reader_t *data,
+			       const sqfs_inode_generic_t *inode,
+			       sqfs_u64 offset, void *buffer, sqfs_u32 size)
+{
+	sqfs_u32 frag_idx, frag_off, diff, total = 0;
+	size_t i, block_count;
+	sqfs_u64 off, filesz, skip;
+	cache_entry_t *ent;
+	int err;
+
+	if (size >= 0x7FFFFFFF)
+		size = 0x7FFFFFFE;
+
+	/* work out file location and size */
+	sqfs_inode_get_file_size(inode, &filesz);
+	sqfs_inode_get_frag_location(inode, &frag_idx, &frag_off);
+	block_count = sqfs_inode_get_file_block_count(inode);
+
+	/* find location of the first block */
+	i = offset / data->block_size;
+	if (i > block_count)
+		i = block_count;
+
+	skip = (sqfs_u64)i * data->block_size;
+	offset -= skip;
+	filesz = filesz > skip ? filesz - skip : 0;
+
+	off = get_block_location(data, inode, i);
+
+	/* copy data from blocks */
+	while (i < block_count && size > 0 && filesz > 0) {
+		diff = data->block_size - offset;
+		if (size < diff)
+			diff = size;
+
+		read_ahead_schedule(data, inode, i, off);
+
+		if (SQFS_IS_SPARSE_BLOCK(inode->extra[i])) {
+			memset(buffer, 0, diff);
+		} else {
+			err = get_cached_block(data, off, inode->extra[i],
+					       &ent);
+			if (err)
+				return err;
+
+			memcpy(buffer, ent->data + offset, diff);
+			off += SQFS_ON_DISK_BLOCK_SIZE(inode->extra[i]);
+		}
+
+		if (filesz >= data->block_size) {
+			filesz -= data->block_size;
+		} else {
+			filesz = 0;
+		}
+
+		++i;
+		offset = 0;
+		size -= diff;
+		total += diff;
+		buffer = (char *)buffer + diff;
+	}
+
+	/* copy from fragment */
+	if (i == block_count && size > 0 && filesz > 0) {
+		err = get_fragment_block(data, frag_idx, &ent);
+		if (err)
+			return err;
+
+		if (frag_off + filesz > data->block_size)
+			return SQFS_ERROR_OUT_OF_BOUNDS;
+
+		if (offset >= filesz)
+			return total;
+
+		if (offset + size > filesz)
+			size = filesz - offset;
+
+		if (size == 0)
+			return total;
+
+		memcpy(buffer, ent->data + frag_off + offset, size);
+		total += size;
+	}
+
+	return total;
+}
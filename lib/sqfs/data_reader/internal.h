@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * internal.h
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef INTERNAL_H
+#define INTERNAL_H
+
+#include "config.h"
+
+#include "sqfs/data_reader.h"
+#include "sqfs/compressor.h"
+#include "sqfs/frag_table.h"
+#include "sqfs/block.h"
+#include "sqfs/error.h"
+#include "sqfs/table.h"
+#include "sqfs/inode.h"
+#include "sqfs/io.h"
+#include "util.h"
+#include "../io_file.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct cache_entry_t {
+	/* hash chain */
+	struct cache_entry_t *next;
+
+	/* LRU list, most recently used first */
+	struct cache_entry_t *lru_prev;
+	struct cache_entry_t *lru_next;
+
+	sqfs_u64 location;
+	size_t size;
+
+	sqfs_u8 data[];
+} cache_entry_t;
+
+/*
+  Prefix sums of the on-disk block sizes of a large file, i.e. the locations
+  of its blocks, followed by the end location. Identified by the inode
+  number, start location and block count of the file.
+ */
+typedef struct {
+	sqfs_u64 *offsets;
+	size_t max;
+	size_t count;
+	sqfs_u64 start;
+	sqfs_u32 inode_number;
+
+	/* for recycling the least recently used one */
+	sqfs_u64 last_used;
+} block_index_t;
+
+#define NUM_BLOCK_INDEX (4)
+
+typedef struct read_ahead_t read_ahead_t;
+
+struct sqfs_data_reader_t {
+	sqfs_object_t obj;
+
+	sqfs_frag_table_t *frag_tbl;
+	sqfs_compressor_t *cmp;
+	sqfs_file_t *file;
+
+	/* decompressed data and fragment blocks, keyed by on-disk location */
+	cache_entry_t **buckets;
+	size_t num_buckets;
+	cache_entry_t *lru_head;
+	cache_entry_t *lru_tail;
+	size_t cache_count;
+	size_t cache_max;
+
+	/* block locations of the last few large files accessed */
+	block_index_t blk_index[NUM_BLOCK_INDEX];
+	sqfs_u64 blk_index_clock;
+
+	/* NULL if read-ahead is disabled */
+	read_ahead_t *ra;
+	unsigned int ra_workers;
+	size_t ra_blocks;
+
+	sqfs_data_reader_stats_t stats;
+	sqfs_u32 block_size;
+
+	sqfs_u8 scratch[];
+};
+
+SQFS_INTERNAL cache_entry_t *cache_lookup(sqfs_data_reader_t *data,
+					  sqfs_u64 location);
+
+/*
+  Get a pointer to raw data in the file, either directly through the files
+  mapping, or by reading it into the supplied buffer.
+ */
+SQFS_INTERNAL int get_raw_data(sqfs_file_t *file, sqfs_u64 offset, size_t size,
+			       sqfs_u8 *buffer, const sqfs_u8 **out);
+
+SQFS_INTERNAL int read_ahead_create(sqfs_data_reader_t *data);
+
+SQFS_INTERNAL void read_ahead_destroy(read_ahead_t *ra);
+
+/*
+  Called with the block that is about to be accessed. If the access pattern
+  is sequential, queues the following blocks of the inode for decompression.
+ */
+SQFS_INTERNAL void read_ahead_schedule(sqfs_data_reader_t *data,
+				       const sqfs_inode_generic_t *inode,
+				       size_t index, sqfs_u64 location);
+
+/*
+  If the block at the given location has been queued, waits for it and
+  swaps the buffer in *ent with the one holding the decompressed block.
+
+  Returns a positive value if the block was found, zero if not and an
+  SQFS_ERROR code if decompressing it failed.
+ */
+SQFS_INTERNAL int read_ahead_get(sqfs_data_reader_t *data, sqfs_u64 location,
+				 cache_entry_t **ent);
+
+#endif /* INTERNAL_H */
@@ -0,0 +1,384 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * read_ahead.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+#include "../winpthread.h"
+
+enum {
+	JOB_QUEUED = 0,
+	JOB_BUSY,
+	JOB_DONE,
+};
+
+/*
+  A slot in the job ring. The job with sequence number N is stored in
+  slot N % max_jobs. Every slot owns an input buffer for the compressed
+  block and an output buffer that is swapped with a cache entry once the
+  block is picked up.
+ */
+typedef struct {
+	sqfs_u64 location;
+	sqfs_u32 size;
+	size_t index;
+
+	int state;
+	int status;
+
+	cache_entry_t *out;
+	sqfs_u8 *in;
+
+	/* either points to in, or directly into the mapped file */
+	const sqfs_u8 *src;
+} ra_job_t;
+
+typedef struct {
+	read_ahead_t *shared;
+	sqfs_compressor_t *cmp;
+	THREAD_HANDLE thread;
+} ra_worker_t;
+
+struct read_ahead_t {
+	MUTEX_TYPE mtx;
+	CONDITION_TYPE queue_cond;
+	CONDITION_TYPE done_cond;
+	int terminate;
+
+	ra_job_t *jobs;
+	size_t max_jobs;
+	sqfs_u32 block_size;
+
+	/* sequence numbers; head and tail are only written by the main
+	   thread, but always with the mutex held */
+	size_t head;
+	size_t tail;
+	size_t claim;
+
+	/* sequential access detection, only accessed by the main thread */
+	sqfs_u64 file_start;
+	size_t last_index;
+	size_t next_index;
+	sqfs_u64 next_location;
+	int have_last;
+
+	unsigned int num_workers;
+	ra_worker_t workers[];
+};
+
+static THREAD_TYPE worker_proc(THREAD_ARG arg)
+{
+	ra_worker_t *worker = arg;
+	read_ahead_t *ra = worker->shared;
+	ra_job_t *job;
+	sqfs_s32 ret;
+
+	LOCK(&ra->mtx);
+	for (;;) {
+		while (!ra->terminate && ra->claim == ra->tail)
+			AWAIT(&ra->queue_cond, &ra->mtx);
+
+		if (ra->terminate)
+			break;
+
+		job = ra->jobs + (ra->claim++ % ra->max_jobs);
+		job->state = JOB_BUSY;
+		UNLOCK(&ra->mtx);
+
+		ret = worker->cmp->do_block(worker->cmp, job->src,
+					    SQFS_ON_DISK_BLOCK_SIZE(job->size),
+					    job->out->data, ra->block_size);
+
+		LOCK(&ra->mtx);
+		if (ret <= 0) {
+			job->status = ret < 0 ? ret : SQFS_ERROR_OVERFLOW;
+			job->out->size = 0;
+		} else {
+			job->status = 0;
+			job->out->size = ret;
+		}
+
+		job->state = JOB_DONE;
+		SIGNAL_ALL(&ra->done_cond);
+	}
+	UNLOCK(&ra->mtx);
+	return THREAD_EXIT_SUCCESS;
+}
+
+/* must be called with the mutex held */
+static void drop_head(read_ahead_t *ra)
+{
+	ra_job_t *job = ra->jobs + (ra->head % ra->max_jobs);
+
+	if (ra->claim == ra->head) {
+		ra->claim += 1;
+	} else {
+		while (job->state != JOB_DONE)
+			AWAIT(&ra->done_cond, &ra->mtx);
+	}
+
+	ra->head += 1;
+}
+
+static void drop_all(read_ahead_t *ra)
+{
+	LOCK(&ra->mtx);
+	while (ra->head != ra->tail)
+		drop_head(ra);
+	UNLOCK(&ra->mtx);
+}
+
+void read_ahead_schedule(sqfs_data_reader_t *data,
+			 const sqfs_inode_generic_t *inode,
+			 size_t index, sqfs_u64 location)
+{
+	read_ahead_t *ra = data->ra;
+	size_t count, limit;
+	sqfs_u32 size, on_disk;
+	int sequential;
+	sqfs_u64 start;
+	ra_job_t *job;
+
+	if (ra == NULL)
+		return;
+
+	sqfs_inode_get_file_block_start(inode, &start);
+	count = sqfs_inode_get_file_block_count(inode);
+
+	if (ra->have_last && start == ra->file_start) {
+		if (index == ra->last_index)
+			return;
+
+		sequential = (index == ra->last_index + 1);
+	} else {
+		sequential = 0;
+	}
+
+	if (!sequential) {
+		drop_all(ra);
+		ra->next_index = index + 1;
+		ra->next_location = location +
+			SQFS_ON_DISK_BLOCK_SIZE(inode->extra[index]);
+	}
+
+	ra->have_last = 1;
+	ra->file_start = start;
+	ra->last_index = index;
+
+	/* reading from the start of a file is taken as a hint as well */
+	if (!sequential && index != 0)
+		return;
+
+	/* jobs for blocks we have moved past were served from the cache */
+	LOCK(&ra->mtx);
+	while (ra->head != ra->tail &&
+	       ra->jobs[ra->head % ra->max_jobs].index < index) {
+		drop_head(ra);
+	}
+	UNLOCK(&ra->mtx);
+
+	limit = index + 1 + ra->max_jobs;
+	if (limit > count)
+		limit = count;
+
+	while (ra->next_index < limit && ra->tail - ra->head < ra->max_jobs) {
+		size = inode->extra[ra->next_index];
+		on_disk = SQFS_ON_DISK_BLOCK_SIZE(size);
+
+		job = ra->jobs + (ra->tail % ra->max_jobs);
+		job->location = ra->next_location;
+		job->index = ra->next_index;
+		job->size = size;
+
+		ra->next_location += on_disk;
+		ra->next_index += 1;
+
+		/* only compressed blocks are worth handing to a worker */
+		if (SQFS_IS_SPARSE_BLOCK(size) ||
+		    !SQFS_IS_BLOCK_COMPRESSED(size) ||
+		    on_disk > ra->block_size ||
+		    cache_lookup(data, job->location) != NULL) {
+			continue;
+		}
+
+		/* leave reporting of I/O errors to the synchronous path */
+		if (get_raw_data(data->file, job->location, on_disk,
+				 job->in, &job->src)) {
+			break;
+		}
+
+		LOCK(&ra->mtx);
+		job->state = JOB_QUEUED;
+		ra->tail += 1;
+		SIGNAL_ONE(&ra->queue_cond);
+		UNLOCK(&ra->mtx);
+	}
+}
+
+int read_ahead_get(sqfs_data_reader_t *data, sqfs_u64 location,
+		   cache_entry_t **ent)
+{
+	read_ahead_t *ra = data->ra;
+	cache_entry_t *out;
+	ra_job_t *job;
+	size_t seq;
+	int ret;
+
+	if (ra == NULL)
+		return 0;
+
+	for (seq = ra->head; seq != ra->tail; ++seq) {
+		if (ra->jobs[seq % ra->max_jobs].location == location)
+			break;
+	}
+
+	if (seq == ra->tail)
+		return 0;
+
+	LOCK(&ra->mtx);
+	while (ra->head != seq)
+		drop_head(ra);
+
+	job = ra->jobs + (seq % ra->max_jobs);
+
+	while (job->state != JOB_DONE)
+		AWAIT(&ra->done_cond, &ra->mtx);
+
+	ra->head += 1;
+	UNLOCK(&ra->mtx);
+
+	out = job->out;
+	job->out = *ent;
+	*ent = out;
+
+	ret = job->status;
+	if (ret != 0)
+		return ret;
+
+	data->stats.read_ahead_hits += 1;
+	return 1;
+}
+
+void read_ahead_destroy(read_ahead_t *ra)
+{
+	unsigned int i;
+
+	if (ra == NULL)
+		return;
+
+	LOCK(&ra->mtx);
+	ra->terminate = 1;
+	SIGNAL_ALL(&ra->queue_cond);
+	UNLOCK(&ra->mtx);
+
+	for (i = 0; i < ra->num_workers; ++i) {
+		THREAD_JOIN(ra->workers[i].thread);
+
+		if (ra->workers[i].cmp != NULL)
+			sqfs_destroy(ra->workers[i].cmp);
+	}
+
+	for (i = 0; ra->jobs != NULL && i < ra->max_jobs; ++i) {
+		free(ra->jobs[i].out);
+		free(ra->jobs[i].in);
+	}
+
+	MUTEX_DESTROY(&ra->mtx);
+	CONDITION_DESTROY(&ra->queue_cond);
+	CONDITION_DESTROY(&ra->done_cond);
+	free(ra->jobs);
+	free(ra);
+}
+
+int read_ahead_create(sqfs_data_reader_t *data)
+{
+	unsigned int i, num_workers = data->ra_workers;
+	size_t max_jobs = data->ra_blocks;
+	read_ahead_t *ra;
+#if !defined(_WIN32) && !defined(__WINDOWS__)
+	sigset_t set, oldset;
+#endif
+	int ret = 0;
+
+	if (num_workers == 0)
+		return 0;
+
+	if (max_jobs == 0)
+		max_jobs = 2 * num_workers;
+
+	ra = alloc_flex(sizeof(*ra), sizeof(ra->workers[0]), num_workers);
+	if (ra == NULL)
+		return SQFS_ERROR_ALLOC;
+
+#if defined(_WIN32) || defined(__WINDOWS__)
+	InitializeCriticalSection(&ra->mtx);
+	InitializeConditionVariable(&ra->queue_cond);
+	InitializeConditionVariable(&ra->done_cond);
+#else
+	ra->mtx = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+	ra->queue_cond = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
+	ra->done_cond = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
+#endif
+
+	ra->max_jobs = max_jobs;
+	ra->block_size = data->block_size;
+
+	ra->jobs = alloc_array(sizeof(ra->jobs[0]), max_jobs);
+	if (ra->jobs == NULL)
+		goto fail_alloc;
+
+	for (i = 0; i < max_jobs; ++i) {
+		ra->jobs[i].out = alloc_flex(sizeof(cache_entry_t), 1,
+					     data->block_size);
+		ra->jobs[i].in = malloc(data->block_size);
+
+		if (ra->jobs[i].out == NULL || ra->jobs[i].in == NULL)
+			goto fail_alloc;
+	}
+
+	for (i = 0; i < num_workers; ++i) {
+		ra->workers[i].shared = ra;
+		ra->workers[i].cmp = sqfs_copy(data->cmp);
+
+		if (ra->workers[i].cmp == NULL)
+			goto fail_alloc;
+	}
+
+#if defined(_WIN32) || defined(__WINDOWS__)
+	for (i = 0; i < num_workers; ++i) {
+		ra->workers[i].thread = CreateThread(NULL, 0, worker_proc,
+						     ra->workers + i, 0, 0);
+		if (ra->workers[i].thread == NULL)
+			goto fail_thread;
+
+		ra->num_workers += 1;
+	}
+#else
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oldset);
+
+	for (i = 0; i < num_workers; ++i) {
+		if (pthread_create(&ra->workers[i].thread, NULL,
+				   worker_proc, ra->workers + i)) {
+			pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+			goto fail_thread;
+		}
+
+		ra->num_workers += 1;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+#endif
+
+	data->ra = ra;
+	return 0;
+fail_alloc:
+	ret = SQFS_ERROR_ALLOC;
+fail_thread:
+	/* also destroy the compressors of workers that never started */
+	ra->num_workers = num_workers;
+	read_ahead_destroy(ra);
+	return ret == 0 ? SQFS_ERROR_INTERNAL : ret;
+}
@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * serial.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+/* Without thread support, blocks are always read synchronously. */
+
+int read_ahead_create(sqfs_data_reader_t *data)
+{
+	(void)data;
+	return 0;
+}
+
+void read_ahead_destroy(read_ahead_t *ra)
+{
+	(void)ra;
+}
+
+void read_ahead_schedule(sqfs_data_reader_t *data,
+			 const sqfs_inode_generic_t *inode,
+			 size_t index, sqfs_u64 location)
+{
+	(void)data; (void)inode; (void)index; (void)location;
+}
+
+int read_ahead_get(sqfs_data_reader_t *data, sqfs_u64 location,
+		   cache_entry_t **ent)
+{
+	(void)data; (void)location; (void)ent;
+	return 0;
+}
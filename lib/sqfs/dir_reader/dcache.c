@@ -0,0 +1,160 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * dcache.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+static sqfs_u32 dcache_hash(sqfs_u64 parent, const char *name,
+			    size_t name_len)
+{
+	parent *= 0x9E3779B97F4A7C15ULL;
+
+	return xxh32(name, name_len) ^ (sqfs_u32)(parent >> 32);
+}
+
+static void lru_unlink(dcache_t *cache, dcache_ent_t *ent)
+{
+	if (ent->lru_prev == NULL) {
+		cache->lru_head = ent->lru_next;
+	} else {
+		ent->lru_prev->lru_next = ent->lru_next;
+	}
+
+	if (ent->lru_next == NULL) {
+		cache->lru_tail = ent->lru_prev;
+	} else {
+		ent->lru_next->lru_prev = ent->lru_prev;
+	}
+
+	ent->lru_prev = NULL;
+	ent->lru_next = NULL;
+}
+
+static void lru_push_front(dcache_t *cache, dcache_ent_t *ent)
+{
+	ent->lru_prev = NULL;
+	ent->lru_next = cache->lru_head;
+
+	if (cache->lru_head == NULL) {
+		cache->lru_tail = ent;
+	} else {
+		cache->lru_head->lru_prev = ent;
+	}
+
+	cache->lru_head = ent;
+}
+
+static void evict_lru(dcache_t *cache)
+{
+	dcache_ent_t *ent = cache->lru_tail;
+	dcache_ent_t **it;
+
+	it = cache->buckets + (ent->hash & (cache->num_buckets - 1));
+
+	while (*it != ent)
+		it = &((*it)->next);
+
+	*it = ent->next;
+
+	lru_unlink(cache, ent);
+	cache->count -= 1;
+	free(ent);
+}
+
+void dcache_cleanup(dcache_t *cache)
+{
+	while (cache->lru_tail != NULL)
+		evict_lru(cache);
+
+	free(cache->buckets);
+	memset(cache, 0, sizeof(*cache));
+}
+
+int dcache_init(dcache_t *cache, size_t max_count)
+{
+	size_t num_buckets = 16;
+
+	dcache_cleanup(cache);
+
+	if (max_count == 0)
+		return 0;
+
+	while (num_buckets < max_count * 2)
+		num_buckets *= 2;
+
+	cache->buckets = alloc_array(sizeof(cache->buckets[0]), num_buckets);
+	if (cache->buckets == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	memset(cache->buckets, 0, sizeof(cache->buckets[0]) * num_buckets);
+	cache->num_buckets = num_buckets;
+	cache->max_count = max_count;
+	return 0;
+}
+
+const dcache_value_t *dcache_lookup(dcache_t *cache, sqfs_u64 parent,
+				    const char *name, size_t name_len)
+{
+	sqfs_u32 hash;
+	dcache_ent_t *ent;
+
+	if (cache->max_count == 0)
+		return NULL;
+
+	hash = dcache_hash(parent, name, name_len);
+	ent = cache->buckets[hash & (cache->num_buckets - 1)];
+
+	while (ent != NULL) {
+		if (ent->hash == hash && ent->parent == parent &&
+		    ent->name_len == name_len &&
+		    memcmp(ent->name, name, name_len) == 0) {
+			break;
+		}
+
+		ent = ent->next;
+	}
+
+	if (ent == NULL)
+		return NULL;
+
+	if (ent != cache->lru_head) {
+		lru_unlink(cache, ent);
+		lru_push_front(cache, ent);
+	}
+
+	return &ent->value;
+}
+
+void dcache_insert(dcache_t *cache, sqfs_u64 parent,
+		   const char *name, size_t name_len,
+		   const dcache_value_t *value)
+{
+	dcache_ent_t *ent;
+	size_t idx;
+
+	if (cache->max_count == 0)
+		return;
+
+	if (cache->count >= cache->max_count)
+		evict_lru(cache);
+
+	ent = alloc_flex(sizeof(*ent), 1, name_len);
+	if (ent == NULL)
+		return;
+
+	ent->parent = parent;
+	ent->hash = dcache_hash(parent, name, name_len);
+	ent->value = *value;
+	ent->name_len = name_len;
+	memcpy(ent->name, name, name_len);
+
+	idx = ent->hash & (cache->num_buckets - 1);
+	ent->next = cache->buckets[idx];
+	cache->buckets[idx] = ent;
+
+	lru_push_front(cache, ent);
+	cache->count += 1;
+}
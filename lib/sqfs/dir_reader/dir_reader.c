@@ -0,0 +1,569 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * dir_reader.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+static void dir_reader_destroy(sqfs_object_t *obj)
+{
+	sqfs_dir_reader_t *rd = (sqfs_dir_reader_t *)obj;
+
+	sqfs_destroy(rd->meta_inode);
+	sqfs_destroy(rd->meta_dir);
+	dcache_cleanup(&rd->dcache);
+	free(rd->ent);
+	free(rd->idx_offsets);
+	free(rd->idx_data);
+	free(rd);
+}
+
+static sqfs_object_t *dir_reader_copy(const sqfs_object_t *obj)
+{
+	const sqfs_dir_reader_t *rd = (const sqfs_dir_reader_t *)obj;
+	sqfs_dir_reader_t *copy  = malloc(sizeof(*copy));
+
+	if (copy == NULL)
+		return NULL;
+
+	memcpy(copy, rd, sizeof(*copy));
+	copy->idx_data = NULL;
+	copy->idx_offsets = NULL;
+	copy->ent = NULL;
+	copy->ent_max = 0;
+	memset(&copy->dcache, 0, sizeof(copy->dcache));
+
+	copy->meta_inode = sqfs_copy(rd->meta_inode);
+	if (copy->meta_inode == NULL)
+		goto fail_mino;
+
+	copy->meta_dir = sqfs_copy(rd->meta_dir);
+	if (copy->meta_dir == NULL)
+		goto fail_mdir;
+
+	if (rd->idx_data != NULL) {
+		copy->idx_data = malloc(rd->idx_data_max);
+		if (copy->idx_data == NULL)
+			goto fail_idx;
+
+		memcpy(copy->idx_data, rd->idx_data, rd->idx_data_max);
+	}
+
+	if (rd->idx_offsets != NULL) {
+		copy->idx_offsets = alloc_array(sizeof(size_t),
+						rd->idx_count_max);
+		if (copy->idx_offsets == NULL)
+			goto fail_idx;
+
+		memcpy(copy->idx_offsets, rd->idx_offsets,
+		       sizeof(size_t) * rd->idx_count);
+	}
+
+	/* the copy starts out with an empty cache of the same size */
+	if (dcache_init(&copy->dcache, rd->dcache.max_count))
+		goto fail_idx;
+
+	return (sqfs_object_t *)copy;
+fail_idx:
+	free(copy->idx_offsets);
+	free(copy->idx_data);
+	sqfs_destroy(copy->meta_dir);
+fail_mdir:
+	sqfs_destroy(copy->meta_inode);
+fail_mino:
+	free(copy);
+	return NULL;
+}
+
+static int load_dir_index(sqfs_dir_reader_t *rd,
+			  const sqfs_inode_generic_t *inode)
+{
+	size_t i, offset, count, used = inode->payload_bytes_used;
+	sqfs_dir_index_t ent;
+	size_t *offsets;
+	sqfs_u8 *data;
+
+	rd->idx_count = 0;
+
+	if (inode->base.type != SQFS_INODE_EXT_DIR)
+		return 0;
+
+	count = inode->data.dir_ext.inodex_count;
+	if (count == 0 || used == 0)
+		return 0;
+
+	if (used > rd->idx_data_max) {
+		data = realloc(rd->idx_data, used);
+		if (data == NULL)
+			return SQFS_ERROR_ALLOC;
+
+		rd->idx_data = data;
+		rd->idx_data_max = used;
+	}
+
+	if (count > rd->idx_count_max) {
+		offsets = alloc_array(sizeof(offsets[0]), count);
+		if (offsets == NULL)
+			return SQFS_ERROR_ALLOC;
+
+		free(rd->idx_offsets);
+		rd->idx_offsets = offsets;
+		rd->idx_count_max = count;
+	}
+
+	memcpy(rd->idx_data, inode->extra, used);
+
+	for (i = 0, offset = 0; i < count; ++i) {
+		if (sizeof(ent) > used - offset)
+			break;
+
+		memcpy(&ent, rd->idx_data + offset, sizeof(ent));
+
+		if (ent.size >= used - offset - sizeof(ent))
+			break;
+
+		rd->idx_offsets[i] = offset;
+		offset += sizeof(ent) + ent.size + 1;
+	}
+
+	rd->idx_count = i;
+	return 0;
+}
+
+static int name_compare(const char *lhs, size_t lhs_len,
+			const char *rhs, size_t rhs_len)
+{
+	int ret = memcmp(lhs, rhs, lhs_len < rhs_len ? lhs_len : rhs_len);
+
+	if (ret == 0 && lhs_len != rhs_len)
+		ret = lhs_len < rhs_len ? -1 : 1;
+
+	return ret;
+}
+
+/*
+  Position the reader on the directory header that a listing entry with the
+  given name has to follow, using a binary search on the directory index.
+  Every index entry points to a header and holds the name of the first entry
+  after it. Without a usable index, this rewinds to the start of the listing.
+ */
+static int seek_dir_index(sqfs_dir_reader_t *rd, const char *name,
+			  size_t len)
+{
+	size_t lo = 0, hi = rd->idx_count, mid, offset;
+	sqfs_dir_index_t ent;
+	const sqfs_u8 *ptr;
+	sqfs_u64 block;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		ptr = rd->idx_data + rd->idx_offsets[mid];
+		memcpy(&ent, ptr, sizeof(ent));
+
+		if (name_compare((const char *)ptr + sizeof(ent),
+				 ent.size + 1, name, len) <= 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if (lo == 0) {
+		if (rd->size == rd->start_size)
+			return 0;
+
+		return sqfs_dir_reader_rewind(rd);
+	}
+
+	memcpy(&ent, rd->idx_data + rd->idx_offsets[lo - 1], sizeof(ent));
+
+	if (ent.index >= rd->start_size)
+		return SQFS_ERROR_CORRUPTED;
+
+	block = rd->super->directory_table_start + ent.start_block;
+	offset = (rd->dir_offset + ent.index) % SQFS_META_BLOCK_SIZE;
+
+	memset(&rd->hdr, 0, sizeof(rd->hdr));
+	rd->size = rd->start_size - ent.index;
+	rd->entries = 0;
+
+	return sqfs_meta_reader_seek(rd->meta_dir, block, offset);
+}
+
+int dir_reader_read_ent(sqfs_dir_reader_t *rd, const sqfs_dir_entry_t **out)
+{
+	sqfs_dir_entry_t ent;
+	sqfs_u16 *diff_u16;
+	size_t count;
+	void *new;
+	int err;
+
+	if (!rd->entries) {
+		if (rd->size < sizeof(rd->hdr))
+			return 1;
+
+		err = sqfs_meta_reader_read_dir_header(rd->meta_dir, &rd->hdr);
+		if (err)
+			return err;
+
+		rd->size -= sizeof(rd->hdr);
+		rd->entries = rd->hdr.count + 1;
+	}
+
+	err = sqfs_meta_reader_read(rd->meta_dir, &ent, sizeof(ent));
+	if (err)
+		return err;
+
+	diff_u16 = (sqfs_u16 *)&ent.inode_diff;
+	*diff_u16 = le16toh(*diff_u16);
+
+	ent.offset = le16toh(ent.offset);
+	ent.type = le16toh(ent.type);
+	ent.size = le16toh(ent.size);
+
+	count = sizeof(ent) + ent.size + 2;
+
+	if (count > rd->ent_max) {
+		new = realloc(rd->ent, count);
+		if (new == NULL)
+			return SQFS_ERROR_ALLOC;
+
+		rd->ent = new;
+		rd->ent_max = count;
+	}
+
+	*rd->ent = ent;
+	rd->ent->name[ent.size + 1] = '\0';
+
+	err = sqfs_meta_reader_read(rd->meta_dir, rd->ent->name, ent.size + 1);
+	if (err)
+		return err;
+
+	count = sizeof(ent) + strlen((const char *)rd->ent->name);
+
+	if (count > rd->size) {
+		rd->size = 0;
+		rd->entries = 0;
+	} else {
+		rd->size -= count;
+		rd->entries -= 1;
+	}
+
+	rd->inode_offset = ent.offset;
+	*out = rd->ent;
+	return 0;
+}
+
+/* look up a name that is not necessarily null-terminated */
+static int find_entry(sqfs_dir_reader_t *rd, const char *name, size_t len)
+{
+	const sqfs_dir_entry_t *ent;
+	int ret;
+
+	ret = seek_dir_index(rd, name, len);
+	if (ret)
+		return ret;
+
+	do {
+		ret = dir_reader_read_ent(rd, &ent);
+		if (ret < 0)
+			return ret;
+		if (ret > 0)
+			return SQFS_ERROR_NO_ENTRY;
+
+		ret = strncmp((const char *)ent->name, name, len);
+		if (ret == 0)
+			ret = ent->name[len];
+	} while (ret < 0);
+
+	return ret == 0 ? 0 : SQFS_ERROR_NO_ENTRY;
+}
+
+sqfs_dir_reader_t *sqfs_dir_reader_create(const sqfs_super_t *super,
+					  sqfs_compressor_t *cmp,
+					  sqfs_file_t *file)
+{
+	sqfs_dir_reader_t *rd = calloc(1, sizeof(*rd));
+	sqfs_u64 start, limit;
+
+	if (rd == NULL)
+		return NULL;
+
+	start = super->inode_table_start;
+	limit = super->directory_table_start;
+
+	rd->meta_inode = sqfs_meta_reader_create(file, cmp, start, limit);
+
+	if (rd->meta_inode == NULL) {
+		free(rd);
+		return NULL;
+	}
+
+	start = super->directory_table_start;
+	limit = super->id_table_start;
+
+	if (super->fragment_table_start < limit)
+		limit = super->fragment_table_start;
+
+	if (super->export_table_start < limit)
+		limit = super->export_table_start;
+
+	rd->meta_dir = sqfs_meta_reader_create(file, cmp, start, limit);
+
+	if (rd->meta_dir == NULL) {
+		sqfs_destroy(rd->meta_inode);
+		free(rd);
+		return NULL;
+	}
+
+	((sqfs_object_t *)rd)->destroy = dir_reader_destroy;
+	((sqfs_object_t *)rd)->copy = dir_reader_copy;
+	rd->super = super;
+	return rd;
+}
+
+void sqfs_dir_reader_set_cache(sqfs_dir_reader_t *rd, sqfs_meta_cache_t *cache)
+{
+	sqfs_meta_reader_set_cache(rd->meta_inode, cache);
+	sqfs_meta_reader_set_cache(rd->meta_dir, cache);
+}
+
+int sqfs_dir_reader_set_dentry_cache(sqfs_dir_reader_t *rd,
+				     size_t max_entries)
+{
+	return dcache_init(&rd->dcache, max_entries);
+}
+
+int sqfs_dir_reader_open_dir(sqfs_dir_reader_t *rd,
+			     const sqfs_inode_generic_t *inode)
+{
+	sqfs_u64 block_start;
+	size_t size, offset;
+	int ret;
+
+	if (inode->base.type == SQFS_INODE_DIR) {
+		size = inode->data.dir.size;
+		offset = inode->data.dir.offset;
+		block_start = inode->data.dir.start_block;
+	} else if (inode->base.type == SQFS_INODE_EXT_DIR) {
+		size = inode->data.dir_ext.size;
+		offset = inode->data.dir_ext.offset;
+		block_start = inode->data.dir_ext.start_block;
+	} else {
+		return SQFS_ERROR_NOT_DIR;
+	}
+
+	memset(&rd->hdr, 0, sizeof(rd->hdr));
+	rd->size = size;
+	rd->start_size = size;
+	rd->entries = 0;
+	rd->idx_count = 0;
+
+	if (rd->size <= sizeof(rd->hdr))
+		return 0;
+
+	ret = load_dir_index(rd, inode);
+	if (ret)
+		return ret;
+
+	block_start += rd->super->directory_table_start;
+
+	rd->dir_block_start = block_start;
+	rd->dir_offset = offset;
+
+	return sqfs_meta_reader_seek(rd->meta_dir, block_start, offset);
+}
+
+int sqfs_dir_reader_read(sqfs_dir_reader_t *rd, sqfs_dir_entry_t **out)
+{
+	const sqfs_dir_entry_t *ent;
+	size_t size;
+	int err;
+
+	err = dir_reader_read_ent(rd, &ent);
+	if (err)
+		return err;
+
+	size = sizeof(*ent) + ent->size + 2;
+
+	*out = malloc(size);
+	if (*out == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	memcpy(*out, ent, size);
+	return 0;
+}
+
+int sqfs_dir_reader_rewind(sqfs_dir_reader_t *rd)
+{
+	memset(&rd->hdr, 0, sizeof(rd->hdr));
+	rd->size = rd->start_size;
+	rd->entries = 0;
+
+	return sqfs_meta_reader_seek(rd->meta_dir, rd->dir_block_start,
+				     rd->dir_offset);
+}
+
+int sqfs_dir_reader_find(sqfs_dir_reader_t *rd, const char *name)
+{
+	return find_entry(rd, name, strlen(name));
+}
+
+int sqfs_dir_reader_get_inode(sqfs_dir_reader_t *rd,
+			      sqfs_inode_generic_t **inode)
+{
+	sqfs_u64 block_start;
+
+	block_start = rd->hdr.start_block;
+
+	return sqfs_meta_reader_read_inode(rd->meta_inode, rd->super,
+					   block_start, rd->inode_offset,
+					   inode);
+}
+
+int sqfs_dir_reader_get_root_inode(sqfs_dir_reader_t *rd,
+				   sqfs_inode_generic_t **inode)
+{
+	sqfs_u64 block_start = rd->super->root_inode_ref >> 16;
+	sqfs_u16 offset = rd->super->root_inode_ref & 0xFFFF;
+
+	return sqfs_meta_reader_read_inode(rd->meta_inode, rd->super,
+					   block_start, offset, inode);
+}
+
+static int read_inode_ref(sqfs_dir_reader_t *rd, sqfs_u64 ref,
+			  sqfs_inode_generic_t **inode)
+{
+	return sqfs_meta_reader_read_inode(rd->meta_inode, rd->super,
+					   ref >> 16, ref & 0xFFFF, inode);
+}
+
+/* fill in what a path component resolves to from its inode */
+static void get_dcache_value(const sqfs_inode_generic_t *inode,
+			     sqfs_u64 inode_ref, dcache_value_t *value)
+{
+	memset(value, 0, sizeof(*value));
+	value->inode_ref = inode_ref;
+	value->inode_type = inode->base.type;
+
+	if (inode->base.type == SQFS_INODE_DIR) {
+		value->dir_location = inode->data.dir.start_block;
+		value->dir_location <<= 16;
+		value->dir_location |= inode->data.dir.offset;
+		value->dir_size = inode->data.dir.size;
+	} else if (inode->base.type == SQFS_INODE_EXT_DIR) {
+		value->dir_location = inode->data.dir_ext.start_block;
+		value->dir_location <<= 16;
+		value->dir_location |= inode->data.dir_ext.offset;
+		value->dir_size = inode->data.dir_ext.size;
+	}
+}
+
+int sqfs_dir_reader_find_by_path(sqfs_dir_reader_t *rd,
+				 const sqfs_inode_generic_t *start,
+				 const char *path, sqfs_inode_generic_t **out)
+{
+	sqfs_inode_generic_t *inode;
+	const dcache_value_t *hit;
+	dcache_value_t current;
+	sqfs_u64 parent, ref;
+	const char *ptr;
+	int ret = 0;
+
+	if (start == NULL) {
+		ret = sqfs_dir_reader_get_root_inode(rd, &inode);
+	} else {
+		inode = alloc_flex(sizeof(*inode), 1,
+				   start->payload_bytes_used);
+		if (inode == NULL) {
+			ret = SQFS_ERROR_ALLOC;
+		} else {
+			memcpy(inode, start,
+			       sizeof(*start) + start->payload_bytes_used);
+		}
+	}
+
+	if (ret)
+		return ret;
+
+	/*
+	  The inode reference of the start node is not known, but it is
+	  only needed after a cache hit, where inode is NULL.
+	 */
+	get_dcache_value(inode, 0, &current);
+
+	while (*path != '\0') {
+		if (*path == '/' || *path == '\\') {
+			while (*path == '/' || *path == '\\')
+				++path;
+			continue;
+		}
+
+		ptr = strchr(path, '/');
+		if (ptr == NULL) {
+			ptr = strchr(path, '\\');
+
+			if (ptr == NULL) {
+				for (ptr = path; *ptr != '\0'; ++ptr)
+					;
+			}
+		}
+
+		/*
+		  The listing location identifies a directory, except for
+		  empty ones that can share it with the next directory.
+		 */
+		parent = current.dir_location;
+		hit = NULL;
+
+		if (current.dir_size > sizeof(sqfs_dir_header_t)) {
+			hit = dcache_lookup(&rd->dcache, parent,
+					    path, ptr - path);
+		}
+
+		if (hit != NULL) {
+			free(inode);
+			inode = NULL;
+			current = *hit;
+			path = ptr;
+			continue;
+		}
+
+		if (inode == NULL) {
+			ret = read_inode_ref(rd, current.inode_ref, &inode);
+			if (ret)
+				return ret;
+		}
+
+		ret = sqfs_dir_reader_open_dir(rd, inode);
+		free(inode);
+		if (ret)
+			return ret;
+
+		ret = find_entry(rd, path, ptr - path);
+		if (ret)
+			return ret;
+
+		ret = sqfs_dir_reader_get_inode(rd, &inode);
+		if (ret)
+			return ret;
+
+		ref = rd->hdr.start_block;
+		ref = (ref << 16) | rd->inode_offset;
+
+		get_dcache_value(inode, ref, &current);
+		dcache_insert(&rd->dcache, parent, path, ptr - path, &current);
+		path = ptr;
+	}
+
+	if (inode == NULL) {
+		ret = read_inode_ref(rd, current.inode_ref, &inode);
+		if (ret)
+			return ret;
+	}
+
+	*out = inode;
+	return 0;
+}
@@ -0,0 +1,125 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * internal.h
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef INTERNAL_H
+#define INTERNAL_H
+
+#include "config.h"
+
+#include "sqfs/meta_reader.h"
+#include "sqfs/dir_reader.h"
+#include "sqfs/compressor.h"
+#include "sqfs/super.h"
+#include "sqfs/inode.h"
+#include "sqfs/error.h"
+#include "sqfs/block.h"
+#include "sqfs/dir.h"
+#include "util.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+/* what a path component resolves to */
+typedef struct {
+	sqfs_u64 inode_ref;
+	int inode_type;
+
+	/* location and size of the listing, if the inode is a directory */
+	sqfs_u64 dir_location;
+	size_t dir_size;
+} dcache_value_t;
+
+typedef struct dcache_ent_t {
+	/* hash chain */
+	struct dcache_ent_t *next;
+
+	/* LRU list, most recently used first */
+	struct dcache_ent_t *lru_prev;
+	struct dcache_ent_t *lru_next;
+
+	/* the listing of the parent directory identifies it */
+	sqfs_u64 parent;
+	sqfs_u32 hash;
+
+	dcache_value_t value;
+
+	size_t name_len;
+	char name[];
+} dcache_ent_t;
+
+/*
+  Maps names in a directory to what they resolve to. Bounded in size, the
+  least recently used entries are dropped first.
+ */
+typedef struct {
+	dcache_ent_t **buckets;
+	size_t num_buckets;
+	dcache_ent_t *lru_head;
+	dcache_ent_t *lru_tail;
+	size_t count;
+	size_t max_count;
+} dcache_t;
+
+struct sqfs_dir_reader_t {
+	sqfs_object_t base;
+
+	sqfs_meta_reader_t *meta_dir;
+	sqfs_meta_reader_t *meta_inode;
+	const sqfs_super_t *super;
+
+	sqfs_dir_header_t hdr;
+	sqfs_u64 dir_block_start;
+	size_t entries;
+	size_t size;
+
+	size_t start_size;
+	sqfs_u16 dir_offset;
+	sqfs_u16 inode_offset;
+
+	/*
+	  A copy of the directory index of the currently open directory and
+	  the byte offsets of the individual entries in it.
+	 */
+	sqfs_u8 *idx_data;
+	size_t idx_data_max;
+	size_t *idx_offsets;
+	size_t idx_count;
+	size_t idx_count_max;
+
+	/* the last entry read, reused for every entry */
+	sqfs_dir_entry_t *ent;
+	size_t ent_max;
+
+	dcache_t dcache;
+};
+
+/*
+  Works like sqfs_dir_reader_read, but returns a pointer to an internal
+  buffer that is overwritten by the next call instead of allocating a copy.
+ */
+SQFS_INTERNAL int dir_reader_read_ent(sqfs_dir_reader_t *rd,
+				      const sqfs_dir_entry_t **out);
+
+/*
+  Drop all entries and change the maximum number of entries. If the maximum
+  is zero, the cache is disabled and all memory is released.
+ */
+SQFS_INTERNAL int dcache_init(dcache_t *cache, size_t max_count);
+
+SQFS_INTERNAL void dcache_cleanup(dcache_t *cache);
+
+/* Returns NULL if not found. The pointer is valid until the next insert. */
+SQFS_INTERNAL const dcache_value_t *dcache_lookup(dcache_t *cache,
+						  sqfs_u64 parent,
+						  const char *name,
+						  size_t name_len);
+
+/* Failing to allocate an entry is not an error, the entry is dropped. */
+SQFS_INTERNAL void dcache_insert(dcache_t *cache, sqfs_u64 parent,
+				 const char *name, size_t name_len,
+				 const dcache_value_t *value);
+
+#endif /* INTERNAL_H */
@@ -0,0 +1,532 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * read_tree.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+#include "sqfs/id_table.h"
+
+#define ARENA_ALIGN sizeof(sqfs_u64)
+#define ARENA_MIN_CHUNK (16 * 1024)
+#define ARENA_MAX_CHUNK (1024 * 1024)
+
+typedef struct arena_chunk_t {
+	struct arena_chunk_t *next;
+	size_t size;
+	size_t used;
+	sqfs_u8 data[];
+} arena_chunk_t;
+
+/*
+  Book keeping for trees read with SQFS_TREE_ARENA. It is stored in the same
+  allocation as the root node, right in front of it.
+ */
+typedef struct {
+	/* most recently allocated first, only the first one is filled */
+	arena_chunk_t *chunks;
+	size_t next_size;
+
+	/* needed for expanding directories of a lazy tree */
+	sqfs_dir_reader_t *rd;
+	const sqfs_id_table_t *idtbl;
+	unsigned int flags;
+} tree_t;
+
+#define TREE_HDR_SIZE ((sizeof(tree_t) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+static tree_t *get_tree(sqfs_tree_node_t *n)
+{
+	while (n->parent != NULL)
+		n = n->parent;
+
+	return (tree_t *)((char *)n - TREE_HDR_SIZE);
+}
+
+static void *arena_alloc(tree_t *tree, size_t size)
+{
+	arena_chunk_t *chunk = tree->chunks;
+	size_t pad = 0, chunk_size;
+	sqfs_u8 *ptr;
+
+	if (chunk != NULL) {
+		ptr = chunk->data + chunk->used;
+		pad = (ARENA_ALIGN - (uintptr_t)ptr % ARENA_ALIGN) % ARENA_ALIGN;
+	}
+
+	if (chunk == NULL || chunk->size - chunk->used < size ||
+	    chunk->size - chunk->used - size < pad) {
+		chunk_size = tree->next_size;
+
+		/* oversized allocations get a chunk of their own */
+		if (chunk_size - ARENA_ALIGN < size &&
+		    SZ_ADD_OV(size, ARENA_ALIGN, &chunk_size)) {
+			return NULL;
+		}
+
+		chunk = alloc_flex(sizeof(*chunk), 1, chunk_size);
+		if (chunk == NULL)
+			return NULL;
+
+		chunk->size = chunk_size;
+		chunk->next = tree->chunks;
+		tree->chunks = chunk;
+
+		if (tree->next_size < ARENA_MAX_CHUNK)
+			tree->next_size *= 2;
+
+		ptr = chunk->data;
+		pad = (ARENA_ALIGN - (uintptr_t)ptr % ARENA_ALIGN) % ARENA_ALIGN;
+	}
+
+	ptr = chunk->data + chunk->used + pad;
+	chunk->used += pad + size;
+	return ptr;
+}
+
+static void tree_destroy(tree_t *tree)
+{
+	arena_chunk_t *chunk;
+
+	while (tree->chunks != NULL) {
+		chunk = tree->chunks;
+		tree->chunks = chunk->next;
+		free(chunk);
+	}
+
+	free(tree);
+}
+
+static int should_skip(int type, unsigned int flags)
+{
+	switch (type) {
+	case SQFS_INODE_BDEV:
+	case SQFS_INODE_CDEV:
+	case SQFS_INODE_EXT_CDEV:
+	case SQFS_INODE_EXT_BDEV:
+		return (flags & SQFS_TREE_NO_DEVICES);
+	case SQFS_INODE_SLINK:
+	case SQFS_INODE_EXT_SLINK:
+		return (flags & SQFS_TREE_NO_SLINKS);
+	case SQFS_INODE_SOCKET:
+	case SQFS_INODE_EXT_SOCKET:
+		return(flags & SQFS_TREE_NO_SOCKETS);
+	case SQFS_INODE_FIFO:
+	case SQFS_INODE_EXT_FIFO:
+		return (flags & SQFS_TREE_NO_FIFO);
+	}
+
+	return 0;
+}
+
+static bool would_be_own_parent(sqfs_tree_node_t *parent, sqfs_tree_node_t *n)
+{
+	sqfs_u32 inum = n->inode->base.inode_number;
+
+	while (parent != NULL) {
+		if (parent->inode->base.inode_number == inum)
+			return true;
+
+		parent = parent->parent;
+	}
+
+	return false;
+}
+
+/*
+  On success, the node takes over the inode. With a tree, it is copied into
+  the arena and the original is freed.
+ */
+static sqfs_tree_node_t *create_node(tree_t *tree, sqfs_inode_generic_t *inode,
+				     const char *name)
+{
+	size_t len = strlen(name), isize;
+	sqfs_inode_generic_t *copy;
+	sqfs_tree_node_t *n;
+
+	if (tree == NULL) {
+		n = alloc_flex(sizeof(*n), 1, len + 1);
+		if (n == NULL)
+			return NULL;
+
+		n->inode = inode;
+	} else {
+		isize = sizeof(*inode) + inode->payload_bytes_used;
+
+		n = arena_alloc(tree, sizeof(*n) + len + 1);
+		copy = arena_alloc(tree, isize);
+		if (n == NULL || copy == NULL)
+			return NULL;
+
+		memcpy(copy, inode, isize);
+		copy->payload_bytes_available = inode->payload_bytes_used;
+		free(inode);
+
+		memset(n, 0, sizeof(*n));
+		n->inode = copy;
+		n->flags = SQFS_TREE_NODE_ARENA;
+	}
+
+	memcpy(n->name, name, len + 1);
+	return n;
+}
+
+/* Like create_node, but also sets up the tree if one is requested. */
+static sqfs_tree_node_t *create_root(tree_t **tree,
+				     sqfs_inode_generic_t *inode,
+				     const char *name)
+{
+	size_t len = strlen(name), isize;
+	sqfs_inode_generic_t *copy;
+	sqfs_tree_node_t *n;
+	tree_t *new;
+
+	if (*tree == NULL)
+		return create_node(NULL, inode, name);
+
+	new = alloc_flex(TREE_HDR_SIZE + sizeof(*n), 1, len + 1);
+	if (new == NULL)
+		return NULL;
+
+	*new = **tree;
+	n = (sqfs_tree_node_t *)((char *)new + TREE_HDR_SIZE);
+
+	isize = sizeof(*inode) + inode->payload_bytes_used;
+	copy = arena_alloc(new, isize);
+	if (copy == NULL) {
+		tree_destroy(new);
+		return NULL;
+	}
+
+	memcpy(copy, inode, isize);
+	copy->payload_bytes_available = inode->payload_bytes_used;
+	free(inode);
+
+	n->inode = copy;
+	n->flags = SQFS_TREE_NODE_ARENA;
+	memcpy(n->name, name, len + 1);
+
+	*tree = new;
+	return n;
+}
+
+/* nodes from an arena are released together with the tree */
+static void free_node(sqfs_tree_node_t *n)
+{
+	if (n->flags & SQFS_TREE_NODE_ARENA)
+		return;
+
+	free(n->inode);
+	free(n);
+}
+
+static bool is_dir(const sqfs_tree_node_t *n)
+{
+	return n->inode->base.type == SQFS_INODE_DIR ||
+		n->inode->base.type == SQFS_INODE_EXT_DIR;
+}
+
+static int fill_dir(sqfs_dir_reader_t *dr, tree_t *tree,
+		    sqfs_tree_node_t *root, unsigned int flags)
+{
+	sqfs_tree_node_t *n, *prev, **tail;
+	const sqfs_dir_entry_t *ent;
+	sqfs_inode_generic_t *inode;
+	int err;
+
+	tail = &root->children;
+
+	for (;;) {
+		err = dir_reader_read_ent(dr, &ent);
+		if (err > 0)
+			break;
+		if (err < 0)
+			return err;
+
+		if (should_skip(ent->type, flags))
+			continue;
+
+		err = sqfs_dir_reader_get_inode(dr, &inode);
+		if (err)
+			return err;
+
+		n = create_node(tree, inode, (const char *)ent->name);
+		if (n == NULL) {
+			free(inode);
+			return SQFS_ERROR_ALLOC;
+		}
+
+		if (would_be_own_parent(root, n)) {
+			free_node(n);
+			return SQFS_ERROR_LINK_LOOP;
+		}
+
+		*tail = n;
+		tail = &n->next;
+		n->parent = root;
+	}
+
+	n = root->children;
+	prev = NULL;
+
+	while (n != NULL) {
+		if (is_dir(n)) {
+			if (flags & SQFS_TREE_LAZY) {
+				if (!(flags & SQFS_TREE_NO_RECURSE))
+					n->flags |= SQFS_TREE_NODE_UNEXPANDED;
+			} else if (!(flags & SQFS_TREE_NO_RECURSE)) {
+				err = sqfs_dir_reader_open_dir(dr, n->inode);
+				if (err)
+					return err;
+
+				err = fill_dir(dr, tree, n, flags);
+				if (err)
+					return err;
+			}
+
+			if (n->children == NULL &&
+			    (flags & SQFS_TREE_NO_EMPTY)) {
+				if (prev == NULL) {
+					root->children = root->children->next;
+					free_node(n);
+					n = root->children;
+				} else {
+					prev->next = n->next;
+					free_node(n);
+					n = prev->next;
+				}
+				continue;
+			}
+		}
+
+		prev = n;
+		n = n->next;
+	}
+
+	return 0;
+}
+
+static int resolve_ids(sqfs_tree_node_t *root, const sqfs_id_table_t *idtbl)
+{
+	sqfs_tree_node_t *it;
+	int err;
+
+	for (it = root->children; it != NULL; it = it->next)
+		resolve_ids(it, idtbl);
+
+	err = sqfs_id_table_index_to_id(idtbl, root->inode->base.uid_idx,
+					&root->uid);
+	if (err)
+		return err;
+
+	return sqfs_id_table_index_to_id(idtbl, root->inode->base.gid_idx,
+					 &root->gid);
+}
+
+void sqfs_dir_tree_destroy(sqfs_tree_node_t *root)
+{
+	sqfs_tree_node_t *it;
+
+	if (root->flags & SQFS_TREE_NODE_ARENA) {
+		if (root->parent == NULL)
+			tree_destroy(get_tree(root));
+		return;
+	}
+
+	while (root->children != NULL) {
+		it = root->children;
+		root->children = it->next;
+
+		sqfs_dir_tree_destroy(it);
+	}
+
+	free(root->inode);
+	free(root);
+}
+
+int sqfs_dir_tree_get_children(sqfs_tree_node_t *node, sqfs_tree_node_t **out)
+{
+	sqfs_tree_node_t *it;
+	tree_t *tree;
+	int ret;
+
+	if (node->flags & SQFS_TREE_NODE_UNEXPANDED) {
+		tree = get_tree(node);
+
+		ret = sqfs_dir_reader_open_dir(tree->rd, node->inode);
+		if (ret)
+			return ret;
+
+		ret = fill_dir(tree->rd, tree, node, tree->flags);
+
+		for (it = node->children; ret == 0 && it != NULL; it = it->next)
+			ret = resolve_ids(it, tree->idtbl);
+
+		if (ret) {
+			/* the memory stays with the arena, try again next time */
+			node->children = NULL;
+			return ret;
+		}
+
+		node->flags &= ~SQFS_TREE_NODE_UNEXPANDED;
+	}
+
+	*out = node->children;
+	return 0;
+}
+
+int sqfs_dir_reader_get_full_hierarchy(sqfs_dir_reader_t *rd,
+				       const sqfs_id_table_t *idtbl,
+				       const char *path, unsigned int flags,
+				       sqfs_tree_node_t **out)
+{
+	sqfs_tree_node_t *root = NULL, *tail = NULL, *new;
+	sqfs_inode_generic_t *inode, *child;
+	tree_t tmpl, *tree = NULL;
+	char *name = NULL, *cname;
+	const char *ptr;
+	int ret;
+
+	if (flags & ~SQFS_TREE_ALL_FLAGS)
+		return SQFS_ERROR_UNSUPPORTED;
+
+	if (flags & SQFS_TREE_LAZY) {
+		if (flags & SQFS_TREE_NO_EMPTY)
+			return SQFS_ERROR_UNSUPPORTED;
+
+		flags |= SQFS_TREE_ARENA;
+	}
+
+	if (flags & SQFS_TREE_ARENA) {
+		memset(&tmpl, 0, sizeof(tmpl));
+		tmpl.next_size = ARENA_MIN_CHUNK;
+		tmpl.rd = rd;
+		tmpl.idtbl = idtbl;
+		tmpl.flags = flags;
+		tree = &tmpl;
+	}
+
+	ret = sqfs_dir_reader_get_root_inode(rd, &inode);
+	if (ret)
+		return ret;
+
+	/*
+	  Unless the parents are kept, only the inode and name of the
+	  current path component are tracked and the root is created from
+	  the last one.
+	 */
+	if (flags & SQFS_TREE_STORE_PARENTS) {
+		root = tail = create_root(&tree, inode, "");
+		if (root == NULL) {
+			free(inode);
+			return SQFS_ERROR_ALLOC;
+		}
+		inode = NULL;
+	}
+
+	while (path != NULL && *path != '\0') {
+		if (*path == '/' || *path == '\\') {
+			while (*path == '/' || *path == '\\')
+				++path;
+			continue;
+		}
+
+		ret = sqfs_dir_reader_open_dir(rd, tail == NULL ?
+					       inode : tail->inode);
+		if (ret)
+			goto fail;
+
+		ptr = strchr(path, '/');
+		if (ptr == NULL) {
+			ptr = strchr(path, '\\');
+
+			if (ptr == NULL) {
+				for (ptr = path; *ptr != '\0'; ++ptr)
+					;
+			}
+		}
+
+		cname = malloc(ptr - path + 1);
+		if (cname == NULL) {
+			ret = SQFS_ERROR_ALLOC;
+			goto fail;
+		}
+
+		memcpy(cname, path, ptr - path);
+		cname[ptr - path] = '\0';
+
+		ret = sqfs_dir_reader_find(rd, cname);
+		if (ret == 0)
+			ret = sqfs_dir_reader_get_inode(rd, &child);
+
+		if (ret) {
+			free(cname);
+			goto fail;
+		}
+
+		path = ptr;
+
+		if (tail == NULL) {
+			free(inode);
+			free(name);
+			inode = child;
+			name = cname;
+			continue;
+		}
+
+		new = create_node(tree, child, cname);
+		free(cname);
+
+		if (new == NULL) {
+			free(child);
+			ret = SQFS_ERROR_ALLOC;
+			goto fail;
+		}
+
+		tail->children = new;
+		new->parent = tail;
+		tail = new;
+	}
+
+	if (root == NULL) {
+		root = tail = create_root(&tree, inode,
+					  name == NULL ? "" : name);
+		if (root == NULL) {
+			ret = SQFS_ERROR_ALLOC;
+			goto fail;
+		}
+
+		inode = NULL;
+		free(name);
+		name = NULL;
+	}
+
+	if (is_dir(tail)) {
+		if (flags & SQFS_TREE_LAZY) {
+			tail->flags |= SQFS_TREE_NODE_UNEXPANDED;
+		} else {
+			ret = sqfs_dir_reader_open_dir(rd, tail->inode);
+			if (ret)
+				goto fail;
+
+			ret = fill_dir(rd, tree, tail, flags);
+			if (ret)
+				goto fail;
+		}
+	}
+
+	ret = resolve_ids(root, idtbl);
+	if (ret)
+		goto fail;
+
+	*out = root;
+	return 0;
+fail:
+	free(inode);
+	free(name);
+	if (root != NULL)
+		sqfs_dir_tree_destroy(root);
+	return ret;
+}
@@ -182,13 +182,17 @@ int sqfs_dir_writer_begin(sqfs_dir_writer_t *writer, sqfs_u32 flags)
 {
 	sqfs_u32 offset;
 	sqfs_u64 block;
+	int err;
 
 	if (flags != 0)
 		return SQFS_ERROR_UNSUPPORTED;
 
 	writer_reset(writer);
 
-	sqfs_meta_writer_get_position(writer->dm, &block, &offset);
+	err = sqfs_meta_writer_get_position_ex(writer->dm, &block, &offset);
+	if (err)
+		return err;
+
 	writer->dir_ref = (block << 16) | offset;
 	return 0;
 }
@@ -308,7 +312,11 @@ int sqfs_dir_writer_end(sqfs_dir_writer_t *writer)
 	int err;
 
 	for (it = writer->list; it != NULL; ) {
-		sqfs_meta_writer_get_position(writer->dm, &block, &offset);
+		err = sqfs_meta_writer_get_position_ex(writer->dm, &block,
+						       &offset);
+		if (err)
+			return err;
+
 		count = get_conseq_entry_count(offset, it);
 
 		err = add_header(writer, count, it, block);
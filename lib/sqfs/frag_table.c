@@ -13,16 +13,17 @@
 #include "sqfs/error.h"
 #include "sqfs/block.h"
 #include "compat.h"
+#include "util.h"
 
 #include <stdlib.h>
 #include <string.h>
 
 
-#define NUM_BUCKETS (128)
+#define INIT_CHUNK_SLOTS (128)
 
 
-typedef struct chunk_info_t {
-	struct chunk_info_t *next;
+/* A slot in the tail end hash table, unused if size is 0. */
+typedef struct {
 	sqfs_u32 index;
 	sqfs_u32 offset;
 	sqfs_u32 size;
@@ -37,23 +38,17 @@ struct sqfs_frag_table_t {
 	size_t used;
 	sqfs_fragment_t *table;
 
-	chunk_info_t chunks[NUM_BUCKETS];
+	/* open addressing with linear probing, num_slots is a power of 2 */
+	size_t num_slots;
+	size_t num_chunks;
+	chunk_info_t *chunks;
 };
 
 static void frag_table_destroy(sqfs_object_t *obj)
 {
 	sqfs_frag_table_t *tbl = (sqfs_frag_table_t *)obj;
-	chunk_info_t *info;
-	size_t i;
-
-	for (i = 0; i < NUM_BUCKETS; ++i) {
-		while (tbl->chunks[i].next != NULL) {
-			info = tbl->chunks[i].next;
-			tbl->chunks[i].next = info->next;
-			free(info);
-		}
-	}
 
+	free(tbl->chunks);
 	free(tbl->table);
 	free(tbl);
 }
@@ -62,32 +57,31 @@ static sqfs_object_t *frag_table_copy(const sqfs_object_t *obj)
 {
 	const sqfs_frag_table_t *tbl = (const sqfs_frag_table_t *)obj;
 	sqfs_frag_table_t *copy;
-	const chunk_info_t *it;
-	chunk_info_t *last;
-	size_t i;
 
 	copy = malloc(sizeof(*copy));
 	if (copy == NULL)
 		return NULL;
 
 	memcpy(copy, tbl, sizeof(*tbl));
-	for (i = 0; i < NUM_BUCKETS; ++i)
-		copy->chunks[i].next = NULL;
-
-	for (i = 0; i < NUM_BUCKETS; ++i) {
-		last = &(copy->chunks[i]);
-		it = tbl->chunks[i].next;
-
-		while (it != NULL) {
-			last->next = malloc(sizeof(*it));
-			if (last->next == NULL)
-				goto fail;
-
-			memcpy(last->next, it, sizeof(*it));
-			last = last->next;
-			last->next = NULL;
-			it = it->next;
-		}
+	copy->table = NULL;
+	copy->chunks = NULL;
+
+	if (tbl->table != NULL) {
+		copy->table = malloc(sizeof(tbl->table[0]) * tbl->capacity);
+		if (copy->table == NULL)
+			goto fail;
+
+		memcpy(copy->table, tbl->table,
+		       sizeof(tbl->table[0]) * tbl->used);
+	}
+
+	if (tbl->chunks != NULL) {
+		copy->chunks = malloc(sizeof(tbl->chunks[0]) * tbl->num_slots);
+		if (copy->chunks == NULL)
+			goto fail;
+
+		memcpy(copy->chunks, tbl->chunks,
+		       sizeof(tbl->chunks[0]) * tbl->num_slots);
 	}
 
 	return (sqfs_object_t *)copy;
@@ -96,6 +90,45 @@ fail:
 	return NULL;
 }
 
+static chunk_info_t *find_slot(chunk_info_t *chunks, size_t num_slots,
+			       sqfs_u32 hash, sqfs_u32 size)
+{
+	size_t idx = hash & (num_slots - 1);
+
+	while (chunks[idx].size != 0) {
+		if (chunks[idx].hash == hash && chunks[idx].size == size)
+			break;
+
+		idx = (idx + 1) & (num_slots - 1);
+	}
+
+	return chunks + idx;
+}
+
+static int grow_chunk_table(sqfs_frag_table_t *tbl)
+{
+	size_t i, new_sz = tbl->num_slots ? tbl->num_slots * 2 :
+		INIT_CHUNK_SLOTS;
+	chunk_info_t *new;
+
+	new = alloc_array(sizeof(new[0]), new_sz);
+	if (new == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	for (i = 0; i < tbl->num_slots; ++i) {
+		if (tbl->chunks[i].size == 0)
+			continue;
+
+		*find_slot(new, new_sz, tbl->chunks[i].hash,
+			   tbl->chunks[i].size) = tbl->chunks[i];
+	}
+
+	free(tbl->chunks);
+	tbl->chunks = new;
+	tbl->num_slots = new_sz;
+	return 0;
+}
+
 sqfs_frag_table_t *sqfs_frag_table_create(sqfs_u32 flags)
 {
 	sqfs_frag_table_t *tbl;
@@ -267,31 +300,30 @@ int sqfs_frag_table_add_tail_end(sqfs_frag_table_t *tbl,
 				 sqfs_u32 index, sqfs_u32 offset,
 				 sqfs_u32 size, sqfs_u32 hash)
 {
-	size_t idx = hash % NUM_BUCKETS;
-	chunk_info_t *new, *it;
-
-	if (tbl->chunks[idx].size == 0 && tbl->chunks[idx].hash == 0) {
-		tbl->chunks[idx].index = index;
-		tbl->chunks[idx].offset = offset;
-		tbl->chunks[idx].size = size;
-		tbl->chunks[idx].hash = hash;
-	} else {
-		new = calloc(1, sizeof(*new));
-		if (new == NULL)
-			return SQFS_ERROR_ALLOC;
-
-		new->index = index;
-		new->offset = offset;
-		new->size = size;
-		new->hash = hash;
+	chunk_info_t *slot;
+	int err;
 
-		it = &tbl->chunks[idx];
-		while (it->next != NULL)
-			it = it->next;
+	if (size == 0)
+		return 0;
 
-		it->next = new;
+	/* keep the load factor below 3/4 */
+	if (4 * (tbl->num_chunks + 1) > 3 * tbl->num_slots) {
+		err = grow_chunk_table(tbl);
+		if (err)
+			return err;
 	}
 
+	slot = find_slot(tbl->chunks, tbl->num_slots, hash, size);
+
+	/* lookups return the chunk that was added first */
+	if (slot->size != 0)
+		return 0;
+
+	slot->index = index;
+	slot->offset = offset;
+	slot->size = size;
+	slot->hash = hash;
+	tbl->num_chunks += 1;
 	return 0;
 }
 
@@ -299,19 +331,16 @@ int sqfs_frag_table_find_tail_end(sqfs_frag_table_t *tbl,
 				  sqfs_u32 hash, sqfs_u32 size,
 				  sqfs_u32 *index, sqfs_u32 *offset)
 {
-	size_t idx = hash % NUM_BUCKETS;
-	chunk_info_t *it;
+	chunk_info_t *slot;
 
-	if (tbl->chunks[idx].size == 0 && tbl->chunks[idx].hash == 0)
+	if (tbl->num_chunks == 0 || size == 0)
 		return SQFS_ERROR_NO_ENTRY;
 
-	for (it = &tbl->chunks[idx]; it != NULL; it = it->next) {
-		if (it->hash == hash && it->size == size) {
-			*index = it->index;
-			*offset = it->offset;
-			return 0;
-		}
-	}
+	slot = find_slot(tbl->chunks, tbl->num_slots, hash, size);
+	if (slot->size == 0)
+		return SQFS_ERROR_NO_ENTRY;
 
-	return SQFS_ERROR_NO_ENTRY;
+	*index = slot->index;
+	*offset = slot->offset;
+	return 0;
 }
@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * io_file.h
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef IO_FILE_H
+#define IO_FILE_H
+
+#include "config.h"
+
+#include "sqfs/predef.h"
+#include "sqfs/io.h"
+
+/*
+  Get direct read access to a range of a file that was opened through
+  sqfs_open_file with the SQFS_FILE_OPEN_MMAP flag. The returned pointer
+  stays valid until the file object is destroyed.
+
+  For all other file objects, including user supplied implementations of
+  sqfs_file_t, this returns SQFS_ERROR_UNSUPPORTED and the caller has to
+  fall back to read_at.
+ */
+SQFS_INTERNAL int sqfs_file_get_mapping(sqfs_file_t *file, sqfs_u64 offset,
+					size_t size, const void **out);
+
+#endif /* IO_FILE_H */
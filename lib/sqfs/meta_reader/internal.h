@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * internal.h
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef INTERNAL_H
+#define INTERNAL_H
+
+#include "config.h"
+
+#include "sqfs/meta_reader.h"
+#include "sqfs/compressor.h"
+#include "sqfs/error.h"
+#include "sqfs/block.h"
+#include "sqfs/io.h"
+#include "util.h"
+#include "../io_file.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+  Look up the decompressed block at the given on-disk location. On a hit,
+  the data is copied to out and the uncompressed and on-disk size of the
+  block are returned. Returns true on a hit, false on a miss.
+ */
+SQFS_INTERNAL bool meta_cache_fetch(sqfs_meta_cache_t *cache,
+				    sqfs_u64 location, sqfs_u8 *out,
+				    size_t *used, size_t *disk_size);
+
+/*
+  Add a decompressed block to the cache, possibly evicting the least
+  recently used one. Failing to allocate an entry is not an error, the
+  block is simply not cached.
+ */
+SQFS_INTERNAL void meta_cache_insert(sqfs_meta_cache_t *cache,
+				     sqfs_u64 location, const sqfs_u8 *data,
+				     size_t used, size_t disk_size);
+
+#endif /* INTERNAL_H */
@@ -0,0 +1,250 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * meta_cache.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+#if defined(WITH_PTHREAD) || defined(_WIN32) || defined(__WINDOWS__)
+#include "../winpthread.h"
+
+#define CACHE_LOCK(cache) LOCK(&(cache)->mtx)
+#define CACHE_UNLOCK(cache) UNLOCK(&(cache)->mtx)
+#define HAVE_CACHE_LOCK
+#else
+#define CACHE_LOCK(cache)
+#define CACHE_UNLOCK(cache)
+#endif
+
+typedef struct meta_cache_entry_t {
+	/* hash chain */
+	struct meta_cache_entry_t *next;
+
+	/* LRU list, most recently used first */
+	struct meta_cache_entry_t *lru_prev;
+	struct meta_cache_entry_t *lru_next;
+
+	sqfs_u64 location;
+	size_t disk_size;
+	size_t used;
+
+	sqfs_u8 data[SQFS_META_BLOCK_SIZE];
+} meta_cache_entry_t;
+
+struct sqfs_meta_cache_t {
+	sqfs_object_t base;
+
+#ifdef HAVE_CACHE_LOCK
+	/* the cache is shared by readers that may live on other threads */
+	MUTEX_TYPE mtx;
+#endif
+
+	meta_cache_entry_t **buckets;
+	size_t num_buckets;
+	meta_cache_entry_t *lru_head;
+	meta_cache_entry_t *lru_tail;
+	size_t count;
+	size_t max_count;
+
+	sqfs_meta_cache_stats_t stats;
+};
+
+static size_t cache_hash(const sqfs_meta_cache_t *cache, sqfs_u64 location)
+{
+	location *= 0x9E3779B97F4A7C15ULL;
+
+	return (size_t)(location >> 32) & (cache->num_buckets - 1);
+}
+
+static void cache_lru_unlink(sqfs_meta_cache_t *cache,
+			     meta_cache_entry_t *ent)
+{
+	if (ent->lru_prev == NULL) {
+		cache->lru_head = ent->lru_next;
+	} else {
+		ent->lru_prev->lru_next = ent->lru_next;
+	}
+
+	if (ent->lru_next == NULL) {
+		cache->lru_tail = ent->lru_prev;
+	} else {
+		ent->lru_next->lru_prev = ent->lru_prev;
+	}
+
+	ent->lru_prev = NULL;
+	ent->lru_next = NULL;
+}
+
+static void cache_lru_push_front(sqfs_meta_cache_t *cache,
+				 meta_cache_entry_t *ent)
+{
+	ent->lru_prev = NULL;
+	ent->lru_next = cache->lru_head;
+
+	if (cache->lru_head == NULL) {
+		cache->lru_tail = ent;
+	} else {
+		cache->lru_head->lru_prev = ent;
+	}
+
+	cache->lru_head = ent;
+}
+
+static void cache_hash_unlink(sqfs_meta_cache_t *cache,
+			      meta_cache_entry_t *ent)
+{
+	meta_cache_entry_t **it = cache->buckets +
+		cache_hash(cache, ent->location);
+
+	while (*it != ent)
+		it = &((*it)->next);
+
+	*it = ent->next;
+	ent->next = NULL;
+}
+
+static void cache_hash_insert(sqfs_meta_cache_t *cache,
+			      meta_cache_entry_t *ent)
+{
+	size_t idx = cache_hash(cache, ent->location);
+
+	ent->next = cache->buckets[idx];
+	cache->buckets[idx] = ent;
+}
+
+static meta_cache_entry_t *cache_lookup(sqfs_meta_cache_t *cache,
+					sqfs_u64 location)
+{
+	meta_cache_entry_t *ent = cache->buckets[cache_hash(cache, location)];
+
+	while (ent != NULL && ent->location != location)
+		ent = ent->next;
+
+	return ent;
+}
+
+static void meta_cache_destroy(sqfs_object_t *obj)
+{
+	sqfs_meta_cache_t *cache = (sqfs_meta_cache_t *)obj;
+	meta_cache_entry_t *ent;
+
+	while (cache->lru_head != NULL) {
+		ent = cache->lru_head;
+		cache->lru_head = ent->lru_next;
+		free(ent);
+	}
+
+#ifdef HAVE_CACHE_LOCK
+	MUTEX_DESTROY(&cache->mtx);
+#endif
+	free(cache->buckets);
+	free(cache);
+}
+
+sqfs_meta_cache_t *sqfs_meta_cache_create(size_t size)
+{
+	size_t max_count = size / SQFS_META_BLOCK_SIZE;
+	size_t num_buckets = 16;
+	sqfs_meta_cache_t *cache;
+
+	if (max_count == 0)
+		max_count = 1;
+
+	while (num_buckets < max_count * 2)
+		num_buckets *= 2;
+
+	cache = calloc(1, sizeof(*cache));
+	if (cache == NULL)
+		return NULL;
+
+	cache->buckets = alloc_array(sizeof(cache->buckets[0]), num_buckets);
+	if (cache->buckets == NULL) {
+		free(cache);
+		return NULL;
+	}
+
+	memset(cache->buckets, 0, sizeof(cache->buckets[0]) * num_buckets);
+
+#if defined(_WIN32) || defined(__WINDOWS__)
+	InitializeCriticalSection(&cache->mtx);
+#elif defined(HAVE_CACHE_LOCK)
+	cache->mtx = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+	((sqfs_object_t *)cache)->destroy = meta_cache_destroy;
+	cache->num_buckets = num_buckets;
+	cache->max_count = max_count;
+	cache->stats.size = sizeof(cache->stats);
+	return cache;
+}
+
+const sqfs_meta_cache_stats_t
+*sqfs_meta_cache_get_stats(const sqfs_meta_cache_t *cache)
+{
+	return &cache->stats;
+}
+
+bool meta_cache_fetch(sqfs_meta_cache_t *cache, sqfs_u64 location,
+		      sqfs_u8 *out, size_t *used, size_t *disk_size)
+{
+	meta_cache_entry_t *ent;
+
+	CACHE_LOCK(cache);
+	ent = cache_lookup(cache, location);
+
+	if (ent == NULL) {
+		cache->stats.misses += 1;
+		CACHE_UNLOCK(cache);
+		return false;
+	}
+
+	cache->stats.hits += 1;
+
+	if (ent != cache->lru_head) {
+		cache_lru_unlink(cache, ent);
+		cache_lru_push_front(cache, ent);
+	}
+
+	memcpy(out, ent->data, ent->used);
+	*used = ent->used;
+	*disk_size = ent->disk_size;
+	CACHE_UNLOCK(cache);
+	return true;
+}
+
+void meta_cache_insert(sqfs_meta_cache_t *cache, sqfs_u64 location,
+		       const sqfs_u8 *data, size_t used, size_t disk_size)
+{
+	meta_cache_entry_t *ent;
+
+	CACHE_LOCK(cache);
+
+	/* another reader may have beaten us to it */
+	if (cache_lookup(cache, location) != NULL)
+		goto out;
+
+	if (cache->count < cache->max_count) {
+		ent = calloc(1, sizeof(*ent));
+		if (ent == NULL)
+			goto out;
+
+		cache->count += 1;
+	} else {
+		/* recycle the least recently used entry */
+		ent = cache->lru_tail;
+		cache_lru_unlink(cache, ent);
+		cache_hash_unlink(cache, ent);
+	}
+
+	ent->location = location;
+	ent->disk_size = disk_size;
+	ent->used = used;
+	memcpy(ent->data, data, used);
+
+	cache_hash_insert(cache, ent);
+	cache_lru_push_front(cache, ent);
+out:
+	CACHE_UNLOCK(cache);
+}
@@ -5,17 +5,7 @@
  * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
  */
 #define SQFS_BUILDING_DLL
-#include "config.h"
-
-#include "sqfs/meta_reader.h"
-#include "sqfs/compressor.h"
-#include "sqfs/error.h"
-#include "sqfs/block.h"
-#include "sqfs/io.h"
-#include "util.h"
-
-#include <stdlib.h>
-#include <string.h>
+#include "internal.h"
 
 struct sqfs_meta_reader_t {
 	sqfs_object_t base;
@@ -39,6 +29,9 @@ struct sqfs_meta_reader_t {
 	/* A pointer to the compressor to use for extracting data */
 	sqfs_compressor_t *cmp;
 
+	/* An optional cache of decompressed blocks, shared with others */
+	sqfs_meta_cache_t *cache;
+
 	/* The raw data read from the input file */
 	sqfs_u8 data[SQFS_META_BLOCK_SIZE];
 
@@ -60,7 +53,7 @@ static sqfs_object_t *meta_reader_copy(const sqfs_object_t *obj)
 		memcpy(copy, m, sizeof(*m));
 	}
 
-	/* XXX: cmp and file aren't deep-copied because m
+	/* XXX: cmp, file and cache aren't deep-copied because m
 	        doesn't own them either. */
 	return (sqfs_object_t *)copy;
 }
@@ -83,9 +76,17 @@ sqfs_meta_reader_t *sqfs_meta_reader_create(sqfs_file_t *file,
 	return m;
 }
 
+void sqfs_meta_reader_set_cache(sqfs_meta_reader_t *m,
+				sqfs_meta_cache_t *cache)
+{
+	m->cache = cache;
+}
+
 int sqfs_meta_reader_seek(sqfs_meta_reader_t *m, sqfs_u64 block_start,
 			  size_t offset)
 {
+	size_t used, disk_size;
+	const void *raw;
 	bool compressed;
 	sqfs_u16 header;
 	sqfs_u32 size;
@@ -103,6 +104,17 @@ int sqfs_meta_reader_seek(sqfs_meta_reader_t *m, sqfs_u64 block_start,
 		return 0;
 	}
 
+	if (m->cache != NULL &&
+	    meta_cache_fetch(m->cache, block_start, m->data,
+			     &used, &disk_size)) {
+		/* the limit of the reader that cached it may have differed */
+		if ((block_start + disk_size) > m->limit)
+			return SQFS_ERROR_OUT_OF_BOUNDS;
+
+		m->data_used = used;
+		goto out;
+	}
+
 	err = m->file->read_at(m->file, block_start, &header, 2);
 	if (err)
 		return err;
@@ -117,28 +129,49 @@ int sqfs_meta_reader_seek(sqfs_meta_reader_t *m, sqfs_u64 block_start,
 	if ((block_start + 2 + size) > m->limit)
 		return SQFS_ERROR_OUT_OF_BOUNDS;
 
-	err = m->file->read_at(m->file, block_start + 2, m->data, size);
-	if (err)
-		return err;
-
-	if (compressed) {
-		ret = m->cmp->do_block(m->cmp, m->data, size,
-				       m->scratch, sizeof(m->scratch));
+	if (compressed &&
+	    sqfs_file_get_mapping(m->file, block_start + 2, size, &raw) == 0) {
+		/* decompress straight out of the mapped file */
+		ret = m->cmp->do_block(m->cmp, raw, size,
+				       m->data, sizeof(m->data));
 
 		if (ret < 0)
 			return ret;
 
-		memcpy(m->data, m->scratch, ret);
 		m->data_used = ret;
 	} else {
-		m->data_used = size;
+		err = m->file->read_at(m->file, block_start + 2,
+				       m->data, size);
+		if (err)
+			return err;
+
+		if (compressed) {
+			ret = m->cmp->do_block(m->cmp, m->data, size,
+					       m->scratch,
+					       sizeof(m->scratch));
+
+			if (ret < 0)
+				return ret;
+
+			memcpy(m->data, m->scratch, ret);
+			m->data_used = ret;
+		} else {
+			m->data_used = size;
+		}
 	}
 
+	disk_size = size + 2;
+
+	if (m->cache != NULL) {
+		meta_cache_insert(m->cache, block_start, m->data,
+				  m->data_used, disk_size);
+	}
+out:
 	if (offset >= m->data_used)
 		return SQFS_ERROR_OUT_OF_BOUNDS;
 
 	m->block_offset = block_start;
-	m->next_block = block_start + size + 2;
+	m->next_block = block_start + disk_size;
 	m->offset = offset;
 	return 0;
 }
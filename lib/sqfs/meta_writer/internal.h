@@ -0,0 +1,92 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * internal.h
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef INTERNAL_H
+#define INTERNAL_H
+
+#include "config.h"
+
+#include "sqfs/meta_writer.h"
+#include "sqfs/compressor.h"
+#include "sqfs/error.h"
+#include "sqfs/block.h"
+#include "sqfs/io.h"
+#include "util.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+typedef struct meta_block_t {
+	struct meta_block_t *next;
+
+	/* possibly compressed data with 2 byte header */
+	sqfs_u8 data[SQFS_META_BLOCK_SIZE + 2];
+} meta_block_t;
+
+typedef struct meta_workers_t meta_workers_t;
+
+struct sqfs_meta_writer_t {
+	sqfs_object_t base;
+
+	/* A byte offset into the uncompressed data of the current block */
+	size_t offset;
+
+	/*
+	  The location of the next block that is stored in the file. If
+	  blocks are still being compressed by the workers, this is not yet
+	  the location of the current block.
+	 */
+	size_t block_offset;
+
+	/* The underlying file descriptor to write to */
+	sqfs_file_t *file;
+
+	/* A pointer to the compressor to use for compressing the data */
+	sqfs_compressor_t *cmp;
+
+	/* The raw data chunk that data is appended to */
+	sqfs_u8 data[SQFS_META_BLOCK_SIZE];
+
+	sqfs_u32 flags;
+	meta_block_t *list;
+	meta_block_t *list_end;
+
+	/* number of blocks flushed since the last reset, incl. pending ones */
+	sqfs_u64 block_count;
+
+	/* locations of the blocks stored since the last reset */
+	sqfs_u64 *block_starts;
+	size_t num_stored;
+	size_t max_stored;
+
+	meta_workers_t *workers;
+};
+
+/* Compress a chunk of raw data and prepend the meta data block header. */
+SQFS_INTERNAL int meta_block_compress(sqfs_compressor_t *cmp,
+				      const sqfs_u8 *data, size_t size,
+				      meta_block_t *outblk);
+
+/*
+  Append a finished block to the in-memory list or write it to the file.
+  Blocks must be stored in the order they were flushed. Takes ownership
+  of the block.
+ */
+SQFS_INTERNAL int meta_writer_store_block(sqfs_meta_writer_t *m,
+					  meta_block_t *outblk);
+
+SQFS_INTERNAL int meta_workers_create(sqfs_meta_writer_t *m,
+				      unsigned int num_workers);
+
+SQFS_INTERNAL void meta_workers_destroy(meta_workers_t *workers);
+
+/* Hand the current block over to the workers. */
+SQFS_INTERNAL int meta_workers_submit(sqfs_meta_writer_t *m);
+
+/* Wait until at least count blocks are stored. Returns a sticky error. */
+SQFS_INTERNAL int meta_workers_sync(sqfs_meta_writer_t *m, sqfs_u64 count);
+
+#endif /* INTERNAL_H */
@@ -0,0 +1,289 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * meta_writer.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+static int write_block(sqfs_file_t *file, meta_block_t *outblk)
+{
+	size_t count = le16toh(((sqfs_u16 *)outblk->data)[0]) & 0x7FFF;
+	sqfs_u64 off = file->get_size(file);
+
+	return file->write_at(file, off, outblk->data, count + 2);
+}
+
+static void meta_writer_destroy(sqfs_object_t *obj)
+{
+	sqfs_meta_writer_t *m = (sqfs_meta_writer_t *)obj;
+	meta_block_t *blk;
+
+	meta_workers_destroy(m->workers);
+
+	while (m->list != NULL) {
+		blk = m->list;
+		m->list = blk->next;
+		free(blk);
+	}
+
+	free(m->block_starts);
+	free(m);
+}
+
+int meta_block_compress(sqfs_compressor_t *cmp, const sqfs_u8 *data,
+			size_t size, meta_block_t *outblk)
+{
+	sqfs_s32 ret;
+
+	ret = cmp->do_block(cmp, data, size, outblk->data + 2,
+			    sizeof(outblk->data) - 2);
+	if (ret < 0)
+		return ret;
+
+	if (ret > 0) {
+		((sqfs_u16 *)outblk->data)[0] = htole16(ret);
+	} else {
+		((sqfs_u16 *)outblk->data)[0] = htole16(size | 0x8000);
+		memcpy(outblk->data + 2, data, size);
+	}
+
+	return 0;
+}
+
+int meta_writer_store_block(sqfs_meta_writer_t *m, meta_block_t *outblk)
+{
+	size_t count = le16toh(((sqfs_u16 *)outblk->data)[0]) & 0x7FFF;
+	size_t new_max;
+	sqfs_u64 *new;
+	int ret = 0;
+
+	if (m->num_stored == m->max_stored) {
+		new_max = m->max_stored ? m->max_stored * 2 : 16;
+		new = realloc(m->block_starts, sizeof(new[0]) * new_max);
+
+		if (new == NULL) {
+			free(outblk);
+			return SQFS_ERROR_ALLOC;
+		}
+
+		m->block_starts = new;
+		m->max_stored = new_max;
+	}
+
+	m->block_starts[m->num_stored++] = m->block_offset;
+
+	if (m->flags & SQFS_META_WRITER_KEEP_IN_MEMORY) {
+		if (m->list == NULL) {
+			m->list = outblk;
+		} else {
+			m->list_end->next = outblk;
+		}
+		m->list_end = outblk;
+	} else {
+		ret = write_block(m->file, outblk);
+		free(outblk);
+	}
+
+	m->block_offset += count + 2;
+	return ret;
+}
+
+sqfs_meta_writer_t *sqfs_meta_writer_create(sqfs_file_t *file,
+					    sqfs_compressor_t *cmp,
+					    sqfs_u32 flags)
+{
+	sqfs_meta_writer_t *m;
+
+	if (flags & ~SQFS_META_WRITER_ALL_FLAGS)
+		return NULL;
+
+	m = calloc(1, sizeof(*m));
+	if (m == NULL)
+		return NULL;
+
+	((sqfs_object_t *)m)->destroy = meta_writer_destroy;
+	m->cmp = cmp;
+	m->file = file;
+	m->flags = flags;
+	return m;
+}
+
+int sqfs_meta_writer_set_workers(sqfs_meta_writer_t *m,
+				 unsigned int num_workers)
+{
+	int ret = 0;
+
+	if (m->workers != NULL) {
+		ret = meta_workers_sync(m, m->block_count);
+		meta_workers_destroy(m->workers);
+		m->workers = NULL;
+	}
+
+	if (ret == 0 && num_workers > 0)
+		ret = meta_workers_create(m, num_workers);
+
+	return ret;
+}
+
+static int flush_block(sqfs_meta_writer_t *m)
+{
+	meta_block_t *outblk;
+	int ret;
+
+	if (m->workers != NULL) {
+		ret = meta_workers_submit(m);
+	} else {
+		outblk = calloc(1, sizeof(*outblk));
+		if (outblk == NULL)
+			return SQFS_ERROR_ALLOC;
+
+		ret = meta_block_compress(m->cmp, m->data, m->offset, outblk);
+		if (ret) {
+			free(outblk);
+			return ret;
+		}
+
+		ret = meta_writer_store_block(m, outblk);
+	}
+
+	memset(m->data, 0, sizeof(m->data));
+	m->offset = 0;
+	m->block_count += 1;
+	return ret;
+}
+
+int sqfs_meta_writer_flush(sqfs_meta_writer_t *m)
+{
+	int ret = 0;
+
+	if (m->offset != 0)
+		ret = flush_block(m);
+
+	if (ret == 0 && m->workers != NULL)
+		ret = meta_workers_sync(m, m->block_count);
+
+	return ret;
+}
+
+int sqfs_meta_writer_append(sqfs_meta_writer_t *m, const void *data,
+			    size_t size)
+{
+	size_t diff;
+	int ret;
+
+	while (size != 0) {
+		diff = sizeof(m->data) - m->offset;
+
+		if (diff == 0) {
+			ret = flush_block(m);
+			if (ret)
+				return ret;
+			diff = sizeof(m->data);
+		}
+
+		if (diff > size)
+			diff = size;
+
+		memcpy(m->data + m->offset, data, diff);
+		m->offset += diff;
+		size -= diff;
+		data = (const char *)data + diff;
+	}
+
+	if (m->offset == sizeof(m->data))
+		return flush_block(m);
+
+	return 0;
+}
+
+void sqfs_meta_writer_get_position(const sqfs_meta_writer_t *m,
+				   sqfs_u64 *block_start, sqfs_u32 *offset)
+{
+	/* errors are sticky and reported by the next append or flush */
+	sqfs_meta_writer_get_position_ex((sqfs_meta_writer_t *)m,
+					 block_start, offset);
+}
+
+int sqfs_meta_writer_get_position_ex(sqfs_meta_writer_t *m,
+				     sqfs_u64 *block_start, sqfs_u32 *offset)
+{
+	int ret;
+
+	if (m->workers != NULL) {
+		ret = meta_workers_sync(m, m->block_count);
+		if (ret)
+			return ret;
+	}
+
+	*block_start = m->block_offset;
+	*offset = m->offset;
+	return 0;
+}
+
+void sqfs_meta_writer_get_block_index(const sqfs_meta_writer_t *m,
+				      sqfs_u64 *index, sqfs_u32 *offset)
+{
+	*index = m->block_count;
+	*offset = m->offset;
+}
+
+int sqfs_meta_writer_resolve_block(sqfs_meta_writer_t *m, sqfs_u64 index,
+				   sqfs_u64 *block_start)
+{
+	int ret;
+
+	if (index > m->block_count)
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	if (m->workers != NULL && index > m->num_stored) {
+		ret = meta_workers_sync(m, index);
+		if (ret)
+			return ret;
+	}
+
+	if (index < m->num_stored) {
+		*block_start = m->block_starts[index];
+	} else {
+		*block_start = m->block_offset;
+	}
+	return 0;
+}
+
+void sqfs_meta_writer_reset(sqfs_meta_writer_t *m)
+{
+	if (m->workers != NULL)
+		meta_workers_sync(m, m->block_count);
+
+	m->block_offset = 0;
+	m->offset = 0;
+	m->block_count = 0;
+	m->num_stored = 0;
+}
+
+int sqfs_meta_write_write_to_file(sqfs_meta_writer_t *m)
+{
+	meta_block_t *blk;
+	int ret;
+
+	if (m->workers != NULL) {
+		ret = meta_workers_sync(m, m->block_count);
+		if (ret)
+			return ret;
+	}
+
+	while (m->list != NULL) {
+		blk = m->list;
+
+		ret = write_block(m->file, blk);
+		if (ret)
+			return ret;
+
+		m->list = blk->next;
+		free(blk);
+	}
+
+	m->list_end = NULL;
+	return 0;
+}
@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * serial.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+/* Without thread support, blocks are always compressed inline. */
+
+int meta_workers_create(sqfs_meta_writer_t *m, unsigned int num_workers)
+{
+	(void)m; (void)num_workers;
+	return 0;
+}
+
+void meta_workers_destroy(meta_workers_t *workers)
+{
+	(void)workers;
+}
+
+int meta_workers_submit(sqfs_meta_writer_t *m)
+{
+	(void)m;
+	return SQFS_ERROR_INTERNAL;
+}
+
+int meta_workers_sync(sqfs_meta_writer_t *m, sqfs_u64 count)
+{
+	(void)m; (void)count;
+	return 0;
+}
@@ -0,0 +1,279 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * workers.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+#include "../winpthread.h"
+
+enum {
+	JOB_QUEUED = 0,
+	JOB_BUSY,
+	JOB_DONE,
+};
+
+/*
+  A slot in the job ring. The block with sequence number N is compressed
+  in slot N % max_jobs. Finished blocks are stored by the thread that owns
+  the meta writer, strictly in sequence order, so the output is the same
+  as with inline compression.
+ */
+typedef struct {
+	size_t size;
+	int state;
+	int status;
+
+	meta_block_t *out;
+	sqfs_u8 in[SQFS_META_BLOCK_SIZE];
+} meta_job_t;
+
+typedef struct {
+	meta_workers_t *shared;
+	sqfs_compressor_t *cmp;
+	THREAD_HANDLE thread;
+} meta_worker_t;
+
+struct meta_workers_t {
+	MUTEX_TYPE mtx;
+	CONDITION_TYPE queue_cond;
+	CONDITION_TYPE done_cond;
+	int terminate;
+
+	meta_job_t *jobs;
+	size_t max_jobs;
+
+	/* sequence numbers; head and tail are only written by the owner
+	   thread, but always with the mutex held */
+	size_t head;
+	size_t tail;
+	size_t claim;
+
+	/* the first error, reported by every subsequent call */
+	int status;
+
+	unsigned int num_workers;
+	meta_worker_t workers[];
+};
+
+static THREAD_TYPE worker_proc(THREAD_ARG arg)
+{
+	meta_worker_t *worker = arg;
+	meta_workers_t *w = worker->shared;
+	meta_job_t *job;
+	int ret;
+
+	LOCK(&w->mtx);
+	for (;;) {
+		while (!w->terminate && w->claim == w->tail)
+			AWAIT(&w->queue_cond, &w->mtx);
+
+		if (w->terminate)
+			break;
+
+		job = w->jobs + (w->claim++ % w->max_jobs);
+		job->state = JOB_BUSY;
+		UNLOCK(&w->mtx);
+
+		ret = meta_block_compress(worker->cmp, job->in, job->size,
+					  job->out);
+
+		LOCK(&w->mtx);
+		job->status = ret;
+		job->state = JOB_DONE;
+		SIGNAL_ALL(&w->done_cond);
+	}
+	UNLOCK(&w->mtx);
+	return THREAD_EXIT_SUCCESS;
+}
+
+/* store the block at the head of the ring, optionally waiting for it */
+static int store_head(sqfs_meta_writer_t *m, bool wait)
+{
+	meta_workers_t *w = m->workers;
+	meta_block_t *out;
+	meta_job_t *job;
+	int ret;
+
+	job = w->jobs + (w->head % w->max_jobs);
+
+	LOCK(&w->mtx);
+	if (job->state != JOB_DONE) {
+		if (!wait) {
+			UNLOCK(&w->mtx);
+			return 1;
+		}
+
+		while (job->state != JOB_DONE)
+			AWAIT(&w->done_cond, &w->mtx);
+	}
+	w->head += 1;
+	UNLOCK(&w->mtx);
+
+	out = job->out;
+	job->out = NULL;
+
+	if (job->status != 0) {
+		free(out);
+		ret = job->status;
+	} else {
+		ret = meta_writer_store_block(m, out);
+	}
+
+	if (ret != 0 && w->status == 0)
+		w->status = ret;
+
+	return 0;
+}
+
+int meta_workers_submit(sqfs_meta_writer_t *m)
+{
+	meta_workers_t *w = m->workers;
+	meta_job_t *job;
+
+	/* store what is already done, so the output keeps flowing */
+	while (w->head != w->tail) {
+		if (store_head(m, w->tail - w->head >= w->max_jobs))
+			break;
+	}
+
+	if (w->status != 0)
+		return w->status;
+
+	job = w->jobs + (w->tail % w->max_jobs);
+	job->out = calloc(1, sizeof(*job->out));
+	if (job->out == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	memcpy(job->in, m->data, m->offset);
+	job->size = m->offset;
+
+	LOCK(&w->mtx);
+	job->state = JOB_QUEUED;
+	w->tail += 1;
+	SIGNAL_ONE(&w->queue_cond);
+	UNLOCK(&w->mtx);
+	return 0;
+}
+
+int meta_workers_sync(sqfs_meta_writer_t *m, sqfs_u64 count)
+{
+	meta_workers_t *w = m->workers;
+
+	while (m->num_stored < count && w->head != w->tail) {
+		store_head(m, true);
+
+		/* failed blocks are never stored */
+		if (w->status != 0)
+			break;
+	}
+
+	return w->status;
+}
+
+void meta_workers_destroy(meta_workers_t *w)
+{
+	unsigned int i;
+
+	if (w == NULL)
+		return;
+
+	LOCK(&w->mtx);
+	w->terminate = 1;
+	SIGNAL_ALL(&w->queue_cond);
+	UNLOCK(&w->mtx);
+
+	for (i = 0; i < w->num_workers; ++i) {
+		THREAD_JOIN(w->workers[i].thread);
+
+		if (w->workers[i].cmp != NULL)
+			sqfs_destroy(w->workers[i].cmp);
+	}
+
+	for (i = 0; w->jobs != NULL && i < w->max_jobs; ++i)
+		free(w->jobs[i].out);
+
+	MUTEX_DESTROY(&w->mtx);
+	CONDITION_DESTROY(&w->queue_cond);
+	CONDITION_DESTROY(&w->done_cond);
+	free(w->jobs);
+	free(w);
+}
+
+int meta_workers_create(sqfs_meta_writer_t *m, unsigned int num_workers)
+{
+	size_t max_jobs = 4 * num_workers;
+	meta_workers_t *w;
+#if !defined(_WIN32) && !defined(__WINDOWS__)
+	sigset_t set, oldset;
+#endif
+	unsigned int i;
+	int ret = 0;
+
+	w = alloc_flex(sizeof(*w), sizeof(w->workers[0]), num_workers);
+	if (w == NULL)
+		return SQFS_ERROR_ALLOC;
+
+#if defined(_WIN32) || defined(__WINDOWS__)
+	InitializeCriticalSection(&w->mtx);
+	InitializeConditionVariable(&w->queue_cond);
+	InitializeConditionVariable(&w->done_cond);
+#else
+	w->mtx = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+	w->queue_cond = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
+	w->done_cond = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
+#endif
+
+	w->max_jobs = max_jobs;
+
+	w->jobs = alloc_array(sizeof(w->jobs[0]), max_jobs);
+	if (w->jobs == NULL)
+		goto fail_alloc;
+
+	memset(w->jobs, 0, sizeof(w->jobs[0]) * max_jobs);
+
+	for (i = 0; i < num_workers; ++i) {
+		w->workers[i].shared = w;
+		w->workers[i].cmp = sqfs_copy(m->cmp);
+
+		if (w->workers[i].cmp == NULL)
+			goto fail_alloc;
+	}
+
+#if defined(_WIN32) || defined(__WINDOWS__)
+	for (i = 0; i < num_workers; ++i) {
+		w->workers[i].thread = CreateThread(NULL, 0, worker_proc,
+						    w->workers + i, 0, 0);
+		if (w->workers[i].thread == NULL)
+			goto fail_thread;
+
+		w->num_workers += 1;
+	}
+#else
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oldset);
+
+	for (i = 0; i < num_workers; ++i) {
+		if (pthread_create(&w->workers[i].thread, NULL,
+				   worker_proc, w->workers + i)) {
+			pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+			goto fail_thread;
+		}
+
+		w->num_workers += 1;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+#endif
+
+	m->workers = w;
+	return 0;
+fail_alloc:
+	ret = SQFS_ERROR_ALLOC;
+fail_thread:
+	/* also destroy the compressors of workers that never started */
+	w->num_workers = num_workers;
+	meta_workers_destroy(w);
+	return ret == 0 ? SQFS_ERROR_INTERNAL : ret;
+}
@@ -9,6 +9,8 @@
 
 #include "sqfs/io.h"
 #include "sqfs/error.h"
+#include "../io_file.h"
+#include "uring.h"
 
 #include <sys/stat.h>
 #include <stdlib.h>
@@ -17,6 +19,9 @@
 #include <errno.h>
 #include <fcntl.h>
 
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 typedef struct {
 	sqfs_file_t base;
@@ -24,44 +29,27 @@ typedef struct {
 	bool readonly;
 	sqfs_u64 size;
 	int fd;
-} sqfs_file_stdio_t;
 
+	/* set if the file was opened with SQFS_FILE_OPEN_MMAP */
+	sqfs_u8 *map;
 
-static void stdio_destroy(sqfs_object_t *base)
-{
-	sqfs_file_stdio_t *file = (sqfs_file_stdio_t *)base;
-
-	close(file->fd);
-	free(file);
-}
+	/* set if the file was opened with SQFS_FILE_OPEN_ASYNC_WRITE */
+	uring_t *ring;
+} sqfs_file_stdio_t;
 
-static sqfs_object_t *stdio_copy(const sqfs_object_t *base)
+#ifdef HAVE_SYS_MMAN_H
+static int mmap_read_at(sqfs_file_t *base, sqfs_u64 offset,
+			void *buffer, size_t size)
 {
-	const sqfs_file_stdio_t *file = (const sqfs_file_stdio_t *)base;
-	sqfs_file_stdio_t *copy;
-	int err;
-
-	if (!file->readonly) {
-		errno = ENOTSUP;
-		return NULL;
-	}
-
-	copy = calloc(1, sizeof(*copy));
-	if (copy == NULL)
-		return NULL;
+	sqfs_file_stdio_t *file = (sqfs_file_stdio_t *)base;
 
-	memcpy(copy, file, sizeof(*file));
+	if (offset > file->size || size > (file->size - offset))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
 
-	copy->fd = dup(file->fd);
-	if (copy->fd < 0) {
-		err = errno;
-		free(copy);
-		copy = NULL;
-		errno = err;
-	}
-
-	return (sqfs_object_t *)copy;
+	memcpy(buffer, file->map + offset, size);
+	return 0;
 }
+#endif
 
 static int stdio_read_at(sqfs_file_t *base, sqfs_u64 offset,
 			 void *buffer, size_t size)
@@ -69,6 +57,13 @@ static int stdio_read_at(sqfs_file_t *base, sqfs_u64 offset,
 	sqfs_file_stdio_t *file = (sqfs_file_stdio_t *)base;
 	ssize_t ret;
 
+	/* make sure pending writes are visible */
+	if (file->ring != NULL) {
+		ret = uring_flush(file->ring);
+		if (ret != 0)
+			return ret;
+	}
+
 	while (size > 0) {
 		ret = pread(file->fd, buffer, size, offset);
 
@@ -95,6 +90,16 @@ static int stdio_write_at(sqfs_file_t *base, sqfs_u64 offset,
 	sqfs_file_stdio_t *file = (sqfs_file_stdio_t *)base;
 	ssize_t ret;
 
+	if (file->ring != NULL) {
+		ret = uring_write(file->ring, offset, buffer, size);
+		if (ret != 0)
+			return ret;
+
+		if (offset + size > file->size)
+			file->size = offset + size;
+		return 0;
+	}
+
 	while (size > 0) {
 		ret = pwrite(file->fd, buffer, size, offset);
 
@@ -128,6 +133,13 @@ static sqfs_u64 stdio_get_size(const sqfs_file_t *base)
 static int stdio_truncate(sqfs_file_t *base, sqfs_u64 size)
 {
 	sqfs_file_stdio_t *file = (sqfs_file_stdio_t *)base;
+	int ret;
+
+	if (file->ring != NULL) {
+		ret = uring_flush(file->ring);
+		if (ret != 0)
+			return ret;
+	}
 
 	if (ftruncate(file->fd, size))
 		return SQFS_ERROR_IO;
@@ -136,6 +148,104 @@ static int stdio_truncate(sqfs_file_t *base, sqfs_u64 size)
 	return 0;
 }
 
+static void file_map(sqfs_file_stdio_t *file)
+{
+	sqfs_file_t *base = (sqfs_file_t *)file;
+#ifdef HAVE_SYS_MMAN_H
+	void *map;
+
+	/* empty files or files too big for the address space are read */
+	if (file->size > 0 && file->size <= (sqfs_u64)SIZE_MAX) {
+		map = mmap(NULL, file->size, PROT_READ, MAP_SHARED,
+			   file->fd, 0);
+
+		if (map != MAP_FAILED) {
+			file->map = map;
+			base->read_at = mmap_read_at;
+			return;
+		}
+	}
+#endif
+	file->map = NULL;
+	base->read_at = stdio_read_at;
+}
+
+static void stdio_destroy(sqfs_object_t *base)
+{
+	sqfs_file_stdio_t *file = (sqfs_file_stdio_t *)base;
+
+#ifdef HAVE_SYS_MMAN_H
+	if (file->map != NULL)
+		munmap(file->map, file->size);
+#endif
+	if (file->ring != NULL)
+		uring_destroy(file->ring);
+
+	close(file->fd);
+	free(file);
+}
+
+static sqfs_object_t *stdio_copy(const sqfs_object_t *base)
+{
+	const sqfs_file_stdio_t *file = (const sqfs_file_stdio_t *)base;
+	sqfs_file_stdio_t *copy;
+	int err;
+
+	if (!file->readonly) {
+		errno = ENOTSUP;
+		return NULL;
+	}
+
+	copy = calloc(1, sizeof(*copy));
+	if (copy == NULL)
+		return NULL;
+
+	memcpy(copy, file, sizeof(*file));
+
+	copy->fd = dup(file->fd);
+	if (copy->fd < 0) {
+		err = errno;
+		free(copy);
+		errno = err;
+		return NULL;
+	}
+
+	/* the copy must not share a mapping that the original unmaps */
+	if (file->map != NULL)
+		file_map(copy);
+
+	return (sqfs_object_t *)copy;
+}
+
+int sqfs_file_get_mapping(sqfs_file_t *base, sqfs_u64 offset, size_t size,
+			  const void **out)
+{
+	sqfs_file_stdio_t *file = (sqfs_file_stdio_t *)base;
+
+	/* don't look past the interface of a file we did not create */
+	if (((sqfs_object_t *)base)->destroy != stdio_destroy ||
+	    file->map == NULL) {
+		return SQFS_ERROR_UNSUPPORTED;
+	}
+
+	if (offset > file->size || size > (file->size - offset))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	*out = file->map + offset;
+	return 0;
+}
+
+int sqfs_file_flush(sqfs_file_t *base)
+{
+	sqfs_file_stdio_t *file = (sqfs_file_stdio_t *)base;
+
+	if (((sqfs_object_t *)base)->destroy != stdio_destroy ||
+	    file->ring == NULL) {
+		return 0;
+	}
+
+	return uring_flush(file->ring);
+}
 
 sqfs_file_t *sqfs_open_file(const char *filename, sqfs_u32 flags)
 {
@@ -188,6 +298,14 @@ sqfs_file_t *sqfs_open_file(const char *filename, sqfs_u32 flags)
 
 	base->read_at = stdio_read_at;
 	base->write_at = stdio_write_at;
+
+	if (file->readonly && (flags & SQFS_FILE_OPEN_MMAP))
+		file_map(file);
+
+	/* without io_uring support, writes are simply done synchronously */
+	if (!file->readonly && (flags & SQFS_FILE_OPEN_ASYNC_WRITE))
+		file->ring = uring_create(file->fd, 32);
+
 	base->get_size = stdio_get_size;
 	base->truncate = stdio_truncate;
 	((sqfs_object_t *)base)->copy = stdio_copy;
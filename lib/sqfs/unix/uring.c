@@ -0,0 +1,392 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * uring.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "uring.h"
+#include "sqfs/error.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(HAVE_SYS_MMAN_H)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#endif
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(HAVE_SYS_MMAN_H) && \
+	defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+
+typedef struct {
+	struct iovec iov;
+	sqfs_u64 offset;
+	size_t capacity;
+	sqfs_u8 *data;
+} uring_req_t;
+
+struct uring_t {
+	int ring_fd;
+	int fd;
+	int status;
+
+	unsigned int depth;
+	unsigned int batch;
+	unsigned int queued;
+	unsigned int inflight;
+
+	/* range of the file covered by writes that are still in flight */
+	sqfs_u64 pending_start;
+	sqfs_u64 pending_end;
+
+	/* submission queue, shared with the kernel */
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned int sq_local_tail;
+
+	/* completion queue, shared with the kernel */
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ptr;
+	void *cq_ptr;
+	size_t sq_size;
+	size_t cq_size;
+	size_t sqes_size;
+
+	/* indices of unused requests */
+	unsigned int *free_list;
+	unsigned int num_free;
+
+	uring_req_t reqs[];
+};
+
+static int ring_enter(uring_t *ring, unsigned int submit, unsigned int wait)
+{
+	unsigned int flags = wait > 0 ? IORING_ENTER_GETEVENTS : 0;
+	long ret;
+
+	for (;;) {
+		ret = syscall(__NR_io_uring_enter, ring->ring_fd, submit,
+			      wait, flags, NULL, 0);
+		if (ret >= 0)
+			return ret;
+		if (errno != EINTR)
+			return -1;
+	}
+}
+
+static void complete_request(uring_t *ring, unsigned int idx, int res)
+{
+	uring_req_t *req = ring->reqs + idx;
+	const sqfs_u8 *ptr = req->data;
+	size_t size = req->iov.iov_len;
+	sqfs_u64 offset = req->offset;
+	ssize_t ret;
+
+	if (res < 0) {
+		if (ring->status == 0)
+			ring->status = SQFS_ERROR_IO;
+		size = 0;
+	} else {
+		ptr += res;
+		offset += res;
+		size -= res;
+	}
+
+	/* short writes are rare enough to simply finish them here */
+	while (size > 0 && ring->status == 0) {
+		ret = pwrite(ring->fd, ptr, size, offset);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			ring->status = SQFS_ERROR_IO;
+		} else if (ret == 0) {
+			ring->status = SQFS_ERROR_OUT_OF_BOUNDS;
+		} else {
+			ptr += ret;
+			offset += ret;
+			size -= ret;
+		}
+	}
+
+	ring->free_list[ring->num_free++] = idx;
+	ring->inflight -= 1;
+}
+
+static void reap_completions(uring_t *ring)
+{
+	unsigned int head = *ring->cq_head;
+	unsigned int tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	struct io_uring_cqe *cqe;
+
+	while (head != tail) {
+		cqe = ring->cqes + (head & *ring->cq_mask);
+		complete_request(ring, cqe->user_data, cqe->res);
+		++head;
+	}
+
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+	if (ring->inflight == 0)
+		ring->pending_start = ring->pending_end = 0;
+}
+
+static int submit_queued(uring_t *ring, unsigned int wait)
+{
+	int ret;
+
+	do {
+		ret = ring_enter(ring, ring->queued, wait);
+
+		if (ret < 0 || (ret == 0 && ring->queued > 0 && wait == 0)) {
+			if (ring->status == 0)
+				ring->status = SQFS_ERROR_IO;
+			return ring->status;
+		}
+
+		ring->queued -= ret;
+		reap_completions(ring);
+	} while (ring->queued > 0);
+
+	return 0;
+}
+
+int uring_flush(uring_t *ring)
+{
+	if (ring->queued > 0 && submit_queued(ring, 0))
+		return ring->status;
+
+	while (ring->inflight > 0) {
+		if (ring_enter(ring, 0, ring->inflight) < 0) {
+			if (ring->status == 0)
+				ring->status = SQFS_ERROR_IO;
+			return ring->status;
+		}
+
+		reap_completions(ring);
+	}
+
+	return ring->status;
+}
+
+int uring_write(uring_t *ring, sqfs_u64 offset, const void *data, size_t size)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int idx, slot;
+	uring_req_t *req;
+	sqfs_u8 *new;
+
+	if (ring->status != 0 || size == 0)
+		return ring->status;
+
+	/* writes to the same location must not be reordered */
+	if (ring->inflight > 0 && offset < ring->pending_end &&
+	    offset + size > ring->pending_start) {
+		if (uring_flush(ring))
+			return ring->status;
+	}
+
+	while (ring->num_free == 0) {
+		if (submit_queued(ring, 1))
+			return ring->status;
+	}
+
+	idx = ring->free_list[ring->num_free - 1];
+	req = ring->reqs + idx;
+
+	if (req->capacity < size) {
+		new = realloc(req->data, size);
+		if (new == NULL)
+			return SQFS_ERROR_ALLOC;
+
+		req->data = new;
+		req->capacity = size;
+	}
+
+	ring->num_free -= 1;
+
+	memcpy(req->data, data, size);
+	req->offset = offset;
+	req->iov.iov_base = req->data;
+	req->iov.iov_len = size;
+
+	/* IORING_OP_WRITEV is also supported by the earliest kernels */
+	slot = ring->sq_local_tail & *ring->sq_mask;
+	sqe = ring->sqes + slot;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_WRITEV;
+	sqe->fd = ring->fd;
+	sqe->addr = (sqfs_u64)(uintptr_t)&req->iov;
+	sqe->len = 1;
+	sqe->off = offset;
+	sqe->user_data = idx;
+
+	ring->sq_array[slot] = slot;
+	ring->sq_local_tail += 1;
+	__atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+	if (ring->inflight == 0 || offset < ring->pending_start)
+		ring->pending_start = offset;
+	if (ring->inflight == 0 || offset + size > ring->pending_end)
+		ring->pending_end = offset + size;
+
+	ring->queued += 1;
+	ring->inflight += 1;
+
+	if (ring->queued >= ring->batch)
+		submit_queued(ring, 0);
+
+	return ring->status;
+}
+
+void uring_destroy(uring_t *ring)
+{
+	unsigned int i;
+
+	uring_flush(ring);
+
+	for (i = 0; i < ring->depth; ++i)
+		free(ring->reqs[i].data);
+
+	if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+		munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ptr != NULL && ring->cq_ptr != MAP_FAILED &&
+	    ring->cq_ptr != ring->sq_ptr) {
+		munmap(ring->cq_ptr, ring->cq_size);
+	}
+	if (ring->sq_ptr != NULL && ring->sq_ptr != MAP_FAILED)
+		munmap(ring->sq_ptr, ring->sq_size);
+
+	close(ring->ring_fd);
+	free(ring->free_list);
+	free(ring);
+}
+
+uring_t *uring_create(int fd, unsigned int depth)
+{
+	struct io_uring_params params;
+	unsigned int i;
+	uring_t *ring;
+	int ring_fd;
+	sqfs_u8 *sq;
+	sqfs_u8 *cq;
+
+	memset(&params, 0, sizeof(params));
+
+	ring_fd = syscall(__NR_io_uring_setup, depth, &params);
+	if (ring_fd < 0)
+		return NULL;
+
+	ring = alloc_flex(sizeof(*ring), sizeof(ring->reqs[0]),
+			  params.sq_entries);
+	if (ring == NULL) {
+		close(ring_fd);
+		return NULL;
+	}
+
+	ring->ring_fd = ring_fd;
+	ring->fd = fd;
+	ring->depth = params.sq_entries;
+	ring->batch = ring->depth / 4 > 0 ? ring->depth / 4 : 1;
+
+	ring->sq_size = params.sq_off.array +
+		params.sq_entries * sizeof(unsigned int);
+	ring->cq_size = params.cq_off.cqes +
+		params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+#ifdef IORING_FEAT_SINGLE_MMAP
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_size > ring->sq_size)
+			ring->sq_size = ring->cq_size;
+		ring->cq_size = ring->sq_size;
+	}
+#endif
+
+	ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ring_fd,
+			    IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED)
+		goto fail;
+
+#ifdef IORING_FEAT_SINGLE_MMAP
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ptr = ring->sq_ptr;
+	} else
+#endif
+	{
+		ring->cq_ptr = mmap(NULL, ring->cq_size,
+				    PROT_READ | PROT_WRITE,
+				    MAP_SHARED | MAP_POPULATE, ring_fd,
+				    IORING_OFF_CQ_RING);
+		if (ring->cq_ptr == MAP_FAILED)
+			goto fail;
+	}
+
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+		goto fail;
+
+	sq = ring->sq_ptr;
+	ring->sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned int *)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *)(sq + params.sq_off.array);
+	ring->sq_local_tail = *ring->sq_tail;
+
+	cq = ring->cq_ptr;
+	ring->cq_head = (unsigned int *)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned int *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+	ring->free_list = alloc_array(sizeof(ring->free_list[0]), ring->depth);
+	if (ring->free_list == NULL)
+		goto fail;
+
+	for (i = 0; i < ring->depth; ++i)
+		ring->free_list[i] = ring->depth - 1 - i;
+
+	ring->num_free = ring->depth;
+	return ring;
+fail:
+	uring_destroy(ring);
+	return NULL;
+}
+#else
+uring_t *uring_create(int fd, unsigned int depth)
+{
+	(void)fd; (void)depth;
+	return NULL;
+}
+
+void uring_destroy(uring_t *ring)
+{
+	(void)ring;
+}
+
+int uring_write(uring_t *ring, sqfs_u64 offset, const void *data, size_t size)
+{
+	(void)ring; (void)offset; (void)data; (void)size;
+	return SQFS_ERROR_UNSUPPORTED;
+}
+
+int uring_flush(uring_t *ring)
+{
+	(void)ring;
+	return SQFS_ERROR_UNSUPPORTED;
+}
+#endif
@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * uring.h
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef URING_H
+#define URING_H
+
+#include "config.h"
+
+#include "sqfs/predef.h"
+
+/*
+  A queue of asynchronous writes to a file descriptor, backed by an
+  io_uring instance. The data passed to uring_write is copied, so the
+  caller can reuse its buffer right away. Errors of queued writes are
+  remembered and returned by the next uring_write or uring_flush call.
+ */
+typedef struct uring_t uring_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* returns NULL if io_uring is not supported or not available */
+SQFS_INTERNAL uring_t *uring_create(int fd, unsigned int depth);
+
+SQFS_INTERNAL void uring_destroy(uring_t *ring);
+
+SQFS_INTERNAL int uring_write(uring_t *ring, sqfs_u64 offset,
+			      const void *data, size_t size);
+
+/* waits until all queued writes are completed */
+SQFS_INTERNAL int uring_flush(uring_t *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* URING_H */
@@ -9,6 +9,7 @@
 
 #include "sqfs/io.h"
 #include "sqfs/error.h"
+#include "../io_file.h"
 
 #include <stdlib.h>
 
@@ -148,6 +149,18 @@ static int stdio_truncate(sqfs_file_t *base, sqfs_u64 size)
 	return 0;
 }
 
+int sqfs_file_get_mapping(sqfs_file_t *file, sqfs_u64 offset, size_t size,
+			  const void **out)
+{
+	(void)file; (void)offset; (void)size; (void)out;
+	return SQFS_ERROR_UNSUPPORTED;
+}
+
+int sqfs_file_flush(sqfs_file_t *file)
+{
+	(void)file;
+	return 0;
+}
 
 sqfs_file_t *sqfs_open_file(const char *filename, sqfs_u32 flags)
 {
@@ -0,0 +1,58 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * winpthread.h
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef WINPTHREAD_H
+#define WINPTHREAD_H
+
+#if defined(_WIN32) || defined(__WINDOWS__)
+#	define WIN32_LEAN_AND_MEAN
+#	include <windows.h>
+#	define LOCK(mtx) EnterCriticalSection(mtx)
+#	define UNLOCK(mtx) LeaveCriticalSection(mtx)
+#	define AWAIT(cond, mtx) SleepConditionVariableCS(cond, mtx, INFINITE)
+#	define SIGNAL_ALL(cond) WakeAllConditionVariable(cond)
+#	define SIGNAL_ONE(cond) WakeConditionVariable(cond)
+#	define THREAD_JOIN(t) \
+		if (t != NULL) { \
+			WaitForSingleObject(t, INFINITE); \
+			CloseHandle(t); \
+		}
+#	define MUTEX_DESTROY(mtx) DeleteCriticalSection(mtx)
+#	define CONDITION_DESTROY(cond)
+#	define THREAD_EXIT_SUCCESS 0
+#	define THREAD_TYPE DWORD WINAPI
+#	define THREAD_ARG LPVOID
+#	define THREAD_HANDLE HANDLE
+#	define MUTEX_TYPE CRITICAL_SECTION
+#	define CONDITION_TYPE CONDITION_VARIABLE
+#else
+#	include <pthread.h>
+#	include <signal.h>
+#	define LOCK(mtx) pthread_mutex_lock(mtx)
+#	define UNLOCK(mtx) pthread_mutex_unlock(mtx)
+#	define AWAIT(cond, mtx) pthread_cond_wait(cond, mtx)
+#	define SIGNAL_ALL(cond) pthread_cond_broadcast(cond)
+#	define SIGNAL_ONE(cond) pthread_cond_signal(cond)
+#	define THREAD_JOIN(t) if (t != (pthread_t)0) { pthread_join(t, NULL); }
+#	define MUTEX_DESTROY(mtx) pthread_mutex_destroy(mtx)
+#	define CONDITION_DESTROY(cond) pthread_cond_destroy(cond)
+#	define THREAD_EXIT_SUCCESS NULL
+#	define THREAD_TYPE void *
+#	define THREAD_ARG void *
+#	define THREAD_HANDLE pthread_t
+#	define MUTEX_TYPE pthread_mutex_t
+#	define CONDITION_TYPE pthread_cond_t
+#endif
+
+#define ATOMIC_LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_SEQ_CST)
+#define ATOMIC_STORE(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_SEQ_CST)
+#define ATOMIC_ADD(ptr, val) __atomic_add_fetch(ptr, val, __ATOMIC_SEQ_CST)
+#define ATOMIC_SUB(ptr, val) __atomic_sub_fetch(ptr, val, __ATOMIC_SEQ_CST)
+#define ATOMIC_CAS(ptr, expected, val) \
+	__atomic_compare_exchange_n(ptr, expected, val, false, \
+				    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+
+#endif /* WINPTHREAD_H */
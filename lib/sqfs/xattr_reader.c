@@ -33,6 +33,8 @@ struct sqfs_xattr_reader_t {
 
 	sqfs_meta_reader_t *idrd;
 	sqfs_meta_reader_t *kvrd;
+
+	sqfs_meta_cache_t *cache;
 };
 
 static sqfs_object_t *xattr_reader_copy(const sqfs_object_t *obj)
@@ -171,6 +173,9 @@ int sqfs_xattr_reader_load(sqfs_xattr_reader_t *xr, const sqfs_super_t *super,
 	if (xr->kvrd == NULL)
 		goto fail_idrd;
 
+	sqfs_meta_reader_set_cache(xr->idrd, xr->cache);
+	sqfs_meta_reader_set_cache(xr->kvrd, xr->cache);
+
 	xr->xattr_end = super->bytes_used;
 	return 0;
 fail_idrd:
@@ -347,3 +352,15 @@ sqfs_xattr_reader_t *sqfs_xattr_reader_create(sqfs_u32 flags)
 	((sqfs_object_t *)xr)->destroy = xattr_reader_destroy;
 	return xr;
 }
+
+void sqfs_xattr_reader_set_cache(sqfs_xattr_reader_t *xr,
+				 sqfs_meta_cache_t *cache)
+{
+	xr->cache = cache;
+
+	if (xr->idrd != NULL)
+		sqfs_meta_reader_set_cache(xr->idrd, cache);
+
+	if (xr->kvrd != NULL)
+		sqfs_meta_reader_set_cache(xr->kvrd, cache);
+}
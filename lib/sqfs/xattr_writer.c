@@ -404,6 +404,12 @@ static sqfs_s32 write_value(sqfs_meta_writer_t *mw, const char *value_str,
 	void *value;
 	int err;
 
+	err = sqfs_meta_writer_get_position_ex(mw, &block, &offset);
+	if (err)
+		return err;
+
+	*value_ref_out = (block << 16) | (offset & 0xFFFF);
+
 	value = from_base32(value_str, &size);
 	if (value == NULL)
 		return SQFS_ERROR_ALLOC;
@@ -411,9 +417,6 @@ static sqfs_s32 write_value(sqfs_meta_writer_t *mw, const char *value_str,
 	memset(&vent, 0, sizeof(vent));
 	vent.size = htole32(size);
 
-	sqfs_meta_writer_get_position(mw, &block, &offset);
-	*value_ref_out = (block << 16) | (offset & 0xFFFF);
-
 	err = sqfs_meta_writer_append(mw, &vent, sizeof(vent));
 	if (err)
 		goto fail;
@@ -476,7 +479,7 @@ static int write_block_pairs(sqfs_xattr_writer_t *xwr, sqfs_meta_writer_t *mw,
 	const char *key_str, *value_str;
 	sqfs_s32 diff, total = 0;
 	size_t i, refcount;
-	sqfs_u64 ref;
+	sqfs_u64 ref = 0;
 
 	for (i = 0; i < blk->count; ++i) {
 		key_idx = GET_KEY(xwr->kv_pairs[blk->start + i]);
@@ -524,6 +527,7 @@ static int write_kv_pairs(sqfs_xattr_writer_t *xwr, sqfs_meta_writer_t *mw)
 	sqfs_u32 offset;
 	sqfs_s32 size;
 	size_t i;
+	int ret;
 
 	ool_locations = alloc_array(sizeof(ool_locations[0]),
 				    xwr->values.num_strings);
@@ -534,7 +538,12 @@ static int write_kv_pairs(sqfs_xattr_writer_t *xwr, sqfs_meta_writer_t *mw)
 		ool_locations[i] = 0xFFFFFFFFFFFFFFFFUL;
 
 	for (blk = xwr->kv_blocks; blk != NULL; blk = blk->next) {
-		sqfs_meta_writer_get_position(mw, &block, &offset);
+		ret = sqfs_meta_writer_get_position_ex(mw, &block, &offset);
+		if (ret) {
+			free(ool_locations);
+			return ret;
+		}
+
 		blk->start_ref = (block << 16) | (offset & 0xFFFF);
 
 		size = write_block_pairs(xwr, mw, blk, ool_locations);
@@ -572,7 +581,10 @@ static int write_id_table(sqfs_xattr_writer_t *xwr, sqfs_meta_writer_t *mw,
 		if (err)
 			return err;
 
-		sqfs_meta_writer_get_position(mw, &block, &offset);
+		err = sqfs_meta_writer_get_position_ex(mw, &block, &offset);
+		if (err)
+			return err;
+
 		if (block != locations[i - 1])
 			locations[i++] = block;
 	}
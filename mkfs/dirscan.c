@@ -45,11 +45,29 @@ fail:
 	return NULL;
 }
 
-static int xattr_from_path(sqfs_xattr_writer_t *xwr, const char *path)
+typedef struct xattr_pair_t {
+	struct xattr_pair_t *next;
+	const char *key;
+	size_t value_len;
+	sqfs_u8 value[];
+} xattr_pair_t;
+
+static void free_xattr_pairs(xattr_pair_t *list)
+{
+	xattr_pair_t *it;
+
+	while (list != NULL) {
+		it = list;
+		list = list->next;
+		free(it);
+	}
+}
+
+static int read_xattr_pairs(const char *path, xattr_pair_t **out)
 {
-	char *key, *value = NULL, *buffer = NULL;
+	xattr_pair_t *list = NULL, *last = NULL, *pair;
 	ssize_t buflen, vallen, keylen;
-	int ret;
+	char *key, *buffer = NULL;
 
 	buflen = llistxattr(path, NULL, 0);
 	if (buflen < 0) {
@@ -57,8 +75,10 @@ static int xattr_from_path(sqfs_xattr_writer_t *xwr, const char *path)
 		return -1;
 	}
 
-	if (buflen == 0)
+	if (buflen == 0) {
+		*out = NULL;
 		return 0;
+	}
 
 	buffer = malloc(buflen);
 	if (buffer == NULL) {
@@ -74,6 +94,8 @@ static int xattr_from_path(sqfs_xattr_writer_t *xwr, const char *path)
 
 	key = buffer;
 	while (buflen > 0) {
+		keylen = strlen(key) + 1;
+
 		vallen = lgetxattr(path, key, NULL, 0);
 		if (vallen == -1) {
 			fprintf(stderr, "lgetxattr %s: %s",
@@ -82,57 +104,190 @@ static int xattr_from_path(sqfs_xattr_writer_t *xwr, const char *path)
 		}
 
 		if (vallen > 0) {
-			value = calloc(1, vallen);
-			if (value == NULL) {
+			pair = calloc(1, sizeof(*pair) + vallen + keylen);
+			if (pair == NULL) {
 				perror("allocating xattr value buffer");
 				goto fail;
 			}
 
-			vallen = lgetxattr(path, key, value, vallen);
+			vallen = lgetxattr(path, key, pair->value, vallen);
 			if (vallen == -1) {
 				fprintf(stderr, "lgetxattr %s: %s\n",
 					path, strerror(errno));
+				free(pair);
 				goto fail;
 			}
 
-			ret = sqfs_xattr_writer_add(xwr, key, value, vallen);
-			if (ret) {
-				sqfs_perror(path,
-					    "storing xattr key-value pairs",
-					    ret);
-				goto fail;
-			}
+			memcpy(pair->value + vallen, key, keylen);
+			pair->key = (const char *)pair->value + vallen;
+			pair->value_len = vallen;
 
-			free(value);
-			value = NULL;
+			if (last == NULL) {
+				list = pair;
+			} else {
+				last->next = pair;
+			}
+			last = pair;
 		}
 
-		keylen = strlen(key) + 1;
 		buflen -= keylen;
 		key += keylen;
 	}
 
 	free(buffer);
+	*out = list;
 	return 0;
 fail:
-	free(value);
+	free_xattr_pairs(list);
 	free(buffer);
 	return -1;
 }
+
+static int add_xattr_pairs(sqfs_xattr_writer_t *xwr, const char *path,
+			   const xattr_pair_t *list)
+{
+	int ret;
+
+	for (; list != NULL; list = list->next) {
+		ret = sqfs_xattr_writer_add(xwr, list->key, list->value,
+					    list->value_len);
+		if (ret) {
+			sqfs_perror(path, "storing xattr key-value pairs", ret);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int xattr_from_path(sqfs_xattr_writer_t *xwr, const char *path)
+{
+	xattr_pair_t *list;
+	int ret;
+
+	if (read_xattr_pairs(path, &list))
+		return -1;
+
+	ret = add_xattr_pairs(xwr, path, list);
+	free_xattr_pairs(list);
+	return ret;
+}
 #endif
 
 #ifdef _WIN32
 int fstree_from_dir(fstree_t *fs, const char *path, void *selinux_handle,
-		    sqfs_xattr_writer_t *xwr, unsigned int flags)
+		    sqfs_xattr_writer_t *xwr, unsigned int flags,
+		    unsigned int num_threads)
 {
 	(void)fs; (void)path; (void)selinux_handle; (void)xwr; (void)flags;
+	(void)num_threads;
 	fputs("Packing a directory is not supported on Windows.\n", stderr);
 	return -1;
 }
 #else
+#ifdef WITH_PTHREAD
+/*
+  Directories found during the scan are pushed onto a shared stack, from which
+  a pool of threads takes them. Every directory is read by exactly one thread,
+  so the children of each node end up in the same order as with a sequential
+  scan. Extended attributes are read by the scanning threads as well and kept
+  per node until the xattr pass below adds them in the usual order.
+ */
+typedef struct {
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+
+	fstree_t *fs;
+	const char *prefix;
+	int root_fd;
+	dev_t devstart;
+	unsigned int flags;
+
+	tree_node_t **pending;
+	size_t num_pending;
+	size_t max_pending;
+	unsigned int busy;
+	int status;
+
+#ifdef HAVE_SYS_XATTR_H
+	/* indexed by the temporary xattr_idx of a node */
+	xattr_pair_t **xattrs;
+	size_t num_xattrs;
+	size_t max_xattrs;
+#endif
+} dir_scanner_t;
+
+static int grow_array(void **array, size_t *max, size_t used, size_t size)
+{
+	size_t new_max = *max ? (*max * 2) : 64;
+	void *new;
+
+	if (used < *max)
+		return 0;
+
+	new = realloc(*array, new_max * size);
+	if (new == NULL) {
+		perror("growing directory scan queue");
+		return -1;
+	}
+
+	*array = new;
+	*max = new_max;
+	return 0;
+}
+
+static int push_dir(dir_scanner_t *sc, tree_node_t *node)
+{
+	int ret;
+
+	pthread_mutex_lock(&sc->mtx);
+	ret = grow_array((void **)&sc->pending, &sc->max_pending,
+			 sc->num_pending, sizeof(sc->pending[0]));
+	if (ret == 0) {
+		sc->pending[sc->num_pending++] = node;
+		pthread_cond_signal(&sc->cond);
+	}
+	pthread_mutex_unlock(&sc->mtx);
+	return ret;
+}
+
+#ifdef HAVE_SYS_XATTR_H
+static int prefetch_xattrs(dir_scanner_t *sc, tree_node_t *node)
+{
+	xattr_pair_t *list;
+	char *path;
+	int ret;
+
+	path = get_full_path(sc->prefix, node);
+	if (path == NULL)
+		return -1;
+
+	ret = read_xattr_pairs(path, &list);
+	free(path);
+	if (ret)
+		return -1;
+
+	pthread_mutex_lock(&sc->mtx);
+	ret = grow_array((void **)&sc->xattrs, &sc->max_xattrs,
+			 sc->num_xattrs, sizeof(sc->xattrs[0]));
+	if (ret == 0) {
+		node->xattr_idx = sc->num_xattrs;
+		sc->xattrs[sc->num_xattrs++] = list;
+	}
+	pthread_mutex_unlock(&sc->mtx);
+
+	if (ret)
+		free_xattr_pairs(list);
+	return ret;
+}
+#endif
+#else
+typedef struct dir_scanner_t dir_scanner_t;
+#endif
+
 static int xattr_xcan_dfs(const char *path_prefix, void *selinux_handle,
 			  sqfs_xattr_writer_t *xwr, unsigned int flags,
-			  tree_node_t *node)
+			  tree_node_t *node, dir_scanner_t *sc)
 {
 	char *path;
 	int ret;
@@ -150,14 +305,24 @@ static int xattr_xcan_dfs(const char *path_prefix, void *selinux_handle,
 		if (path == NULL)
 			return -1;
 
+#ifdef WITH_PTHREAD
+		if (sc != NULL && node->xattr_idx < sc->num_xattrs) {
+			ret = add_xattr_pairs(xwr, path,
+					      sc->xattrs[node->xattr_idx]);
+		} else {
+			ret = xattr_from_path(xwr, path);
+		}
+#else
+		(void)sc;
 		ret = xattr_from_path(xwr, path);
+#endif
 		free(path);
 
 		if (ret)
 			return -1;
 	}
 #else
-	(void)path_prefix;
+	(void)path_prefix; (void)sc;
 #endif
 
 	if (selinux_handle != NULL) {
@@ -185,7 +350,7 @@ static int xattr_xcan_dfs(const char *path_prefix, void *selinux_handle,
 
 		while (node != NULL) {
 			if (xattr_xcan_dfs(path_prefix, selinux_handle, xwr,
-					   flags, node)) {
+					   flags, node, sc)) {
 				return -1;
 			}
 
@@ -197,7 +362,7 @@ static int xattr_xcan_dfs(const char *path_prefix, void *selinux_handle,
 }
 
 static int populate_dir(int dir_fd, fstree_t *fs, tree_node_t *root,
-			dev_t devstart, unsigned int flags)
+			dev_t devstart, unsigned int flags, dir_scanner_t *sc)
 {
 	char *extra = NULL;
 	struct dirent *ent;
@@ -266,6 +431,20 @@ static int populate_dir(int dir_fd, fstree_t *fs, tree_node_t *root,
 		free(extra);
 		extra = NULL;
 
+#ifdef WITH_PTHREAD
+		if (sc != NULL) {
+#ifdef HAVE_SYS_XATTR_H
+			if ((flags & DIR_SCAN_READ_XATTR) &&
+			    prefetch_xattrs(sc, n)) {
+				goto fail;
+			}
+#endif
+			if (S_ISDIR(n->mode) && push_dir(sc, n))
+				goto fail;
+			continue;
+		}
+#endif
+
 		if (S_ISDIR(n->mode)) {
 			childfd = openat(dir_fd, n->name, O_DIRECTORY |
 					 O_RDONLY | O_CLOEXEC);
@@ -274,7 +453,7 @@ static int populate_dir(int dir_fd, fstree_t *fs, tree_node_t *root,
 				goto fail;
 			}
 
-			if (populate_dir(childfd, fs, n, devstart, flags))
+			if (populate_dir(childfd, fs, n, devstart, flags, sc))
 				goto fail;
 		}
 	}
@@ -289,11 +468,137 @@ fail:
 	return -1;
 }
 
+#ifdef WITH_PTHREAD
+static int scan_pending_dir(dir_scanner_t *sc, tree_node_t *node)
+{
+	char *path;
+	int fd, ret;
+
+	if (node->parent == NULL) {
+		fd = dup(sc->root_fd);
+		path = NULL;
+	} else {
+		path = fstree_get_path(node);
+		if (path == NULL) {
+			perror("reconstructing directory path");
+			return -1;
+		}
+
+		ret = canonicalize_name(path);
+		assert(ret == 0);
+
+		fd = openat(sc->root_fd, path,
+			    O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+	}
+
+	if (fd < 0) {
+		perror(path == NULL ? sc->prefix : path);
+		free(path);
+		return -1;
+	}
+
+	free(path);
+	return populate_dir(fd, sc->fs, node, sc->devstart, sc->flags, sc);
+}
+
+static void *scan_thread_proc(void *arg)
+{
+	dir_scanner_t *sc = arg;
+	tree_node_t *node;
+
+	pthread_mutex_lock(&sc->mtx);
+
+	for (;;) {
+		while (sc->status == 0 && sc->num_pending == 0 && sc->busy > 0)
+			pthread_cond_wait(&sc->cond, &sc->mtx);
+
+		if (sc->status != 0 || sc->num_pending == 0)
+			break;
+
+		node = sc->pending[--sc->num_pending];
+		sc->busy += 1;
+		pthread_mutex_unlock(&sc->mtx);
+
+		if (scan_pending_dir(sc, node)) {
+			pthread_mutex_lock(&sc->mtx);
+			sc->status = -1;
+		} else {
+			pthread_mutex_lock(&sc->mtx);
+		}
+
+		sc->busy -= 1;
+		if (sc->status != 0 || (sc->busy == 0 && sc->num_pending == 0))
+			pthread_cond_broadcast(&sc->cond);
+	}
+
+	pthread_mutex_unlock(&sc->mtx);
+	return NULL;
+}
+
+static int scan_parallel(dir_scanner_t *sc, unsigned int num_threads)
+{
+	pthread_t *threads;
+	unsigned int i;
+	int ret;
+
+	threads = calloc(num_threads, sizeof(threads[0]));
+	if (threads == NULL) {
+		perror("creating directory scanner threads");
+		return -1;
+	}
+
+	if (push_dir(sc, sc->fs->root)) {
+		free(threads);
+		return -1;
+	}
+
+	for (i = 0; i < num_threads; ++i) {
+		ret = pthread_create(threads + i, NULL, scan_thread_proc, sc);
+		if (ret != 0) {
+			fprintf(stderr, "creating directory scanner threads: "
+				"%s\n", strerror(ret));
+			pthread_mutex_lock(&sc->mtx);
+			sc->status = -1;
+			pthread_cond_broadcast(&sc->cond);
+			pthread_mutex_unlock(&sc->mtx);
+			break;
+		}
+	}
+
+	num_threads = i;
+	for (i = 0; i < num_threads; ++i)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+	return sc->status;
+}
+
+static void scanner_cleanup(dir_scanner_t *sc)
+{
+#ifdef HAVE_SYS_XATTR_H
+	size_t i;
+
+	for (i = 0; i < sc->num_xattrs; ++i)
+		free_xattr_pairs(sc->xattrs[i]);
+
+	free(sc->xattrs);
+#endif
+	free(sc->pending);
+	pthread_cond_destroy(&sc->cond);
+	pthread_mutex_destroy(&sc->mtx);
+}
+#endif
+
 int fstree_from_dir(fstree_t *fs, const char *path, void *selinux_handle,
-		    sqfs_xattr_writer_t *xwr, unsigned int flags)
+		    sqfs_xattr_writer_t *xwr, unsigned int flags,
+		    unsigned int num_threads)
 {
+	dir_scanner_t *sc = NULL;
 	struct stat sb;
-	int fd;
+	int fd, ret;
+#ifdef WITH_PTHREAD
+	dir_scanner_t scanner;
+#endif
 
 	fd = open(path, O_DIRECTORY | O_RDONLY | O_CLOEXEC);
 	if (fd < 0) {
@@ -307,15 +612,39 @@ int fstree_from_dir(fstree_t *fs, const char *path, void *selinux_handle,
 		return -1;
 	}
 
-	if (populate_dir(fd, fs, fs->root, sb.st_dev, flags))
-		return -1;
+#ifdef WITH_PTHREAD
+	if (num_threads > 1) {
+		memset(&scanner, 0, sizeof(scanner));
+		pthread_mutex_init(&scanner.mtx, NULL);
+		pthread_cond_init(&scanner.cond, NULL);
+		scanner.fs = fs;
+		scanner.prefix = path;
+		scanner.root_fd = fd;
+		scanner.devstart = sb.st_dev;
+		scanner.flags = xwr != NULL ? flags :
+			(flags & ~DIR_SCAN_READ_XATTR);
+		sc = &scanner;
+
+		ret = scan_parallel(sc, num_threads);
+		close(fd);
+	} else {
+		ret = populate_dir(fd, fs, fs->root, sb.st_dev, flags, NULL);
+	}
+#else
+	(void)num_threads;
+	ret = populate_dir(fd, fs, fs->root, sb.st_dev, flags, NULL);
+#endif
 
-	if (xwr != NULL && (selinux_handle != NULL ||
-			    (flags & DIR_SCAN_READ_XATTR))) {
-		if (xattr_xcan_dfs(path, selinux_handle, xwr, flags, fs->root))
-			return -1;
+	if (ret == 0 && xwr != NULL && (selinux_handle != NULL ||
+					(flags & DIR_SCAN_READ_XATTR))) {
+		ret = xattr_xcan_dfs(path, selinux_handle, xwr, flags,
+				     fs->root, sc);
 	}
 
-	return 0;
+#ifdef WITH_PTHREAD
+	if (sc != NULL)
+		scanner_cleanup(sc);
+#endif
+	return ret;
 }
 #endif
@@ -39,40 +39,54 @@ static int set_working_dir(options_t *opt)
 	return 0;
 }
 
-static int pack_files(sqfs_block_processor_t *data, fstree_t *fs,
-		      options_t *opt)
+static const char *get_file_path(file_info_t *fi, char **node_path)
+{
+	tree_node_t *node;
+	int ret;
+
+	if (fi->input_file != NULL) {
+		*node_path = NULL;
+		return fi->input_file;
+	}
+
+	node = container_of(fi, tree_node_t, data.file);
+
+	*node_path = fstree_get_path(node);
+	if (*node_path == NULL) {
+		perror("reconstructing file path");
+		return NULL;
+	}
+
+	ret = canonicalize_name(*node_path);
+	assert(ret == 0);
+
+	return *node_path;
+}
+
+static int get_file_flags(const options_t *opt, sqfs_file_t *file)
+{
+	int flags = 0;
+
+	if (opt->no_tail_packing && file->get_size(file) > opt->cfg.block_size)
+		flags |= SQFS_BLK_DONT_FRAGMENT;
+
+	return flags;
+}
+
+static int pack_files_serial(sqfs_block_processor_t *data, fstree_t *fs,
+			     options_t *opt)
 {
 	sqfs_inode_generic_t **inode_ptr;
-	sqfs_u64 filesize;
 	sqfs_file_t *file;
-	tree_node_t *node;
 	const char *path;
 	char *node_path;
 	file_info_t *fi;
-	int flags;
 	int ret;
 
-	if (set_working_dir(opt))
-		return -1;
-
 	for (fi = fs->files; fi != NULL; fi = fi->next) {
-		if (fi->input_file == NULL) {
-			node = container_of(fi, tree_node_t, data.file);
-
-			node_path = fstree_get_path(node);
-			if (node_path == NULL) {
-				perror("reconstructing file path");
-				return -1;
-			}
-
-			ret = canonicalize_name(node_path);
-			assert(ret == 0);
-
-			path = node_path;
-		} else {
-			node_path = NULL;
-			path = fi->input_file;
-		}
+		path = get_file_path(fi, &node_path);
+		if (path == NULL)
+			return -1;
 
 		if (!opt->cfg.quiet)
 			printf("packing %s\n", path);
@@ -84,15 +98,10 @@ static int pack_files(sqfs_block_processor_t *data, fstree_t *fs,
 			return -1;
 		}
 
-		flags = 0;
-		filesize = file->get_size(file);
-
-		if (opt->no_tail_packing && filesize > opt->cfg.block_size)
-			flags |= SQFS_BLK_DONT_FRAGMENT;
-
 		inode_ptr = (sqfs_inode_generic_t **)&fi->user_ptr;
 
-		ret = write_data_from_file(path, data, inode_ptr, file, flags);
+		ret = write_data_from_file(path, data, inode_ptr, file,
+					   get_file_flags(opt, file));
 		sqfs_destroy(file);
 		free(node_path);
 
@@ -103,6 +112,262 @@ static int pack_files(sqfs_block_processor_t *data, fstree_t *fs,
 	return 0;
 }
 
+#ifdef WITH_PTHREAD
+/*
+  Reader threads take files from the list in order and feed them to the block
+  processor through streams, which keeps the output identical to reading the
+  files one after another. The data of a file is held back in memory until
+  all files before it are done, so at most READER_WINDOW files per reader may
+  be in flight and files larger than READ_AHEAD_BLOCKS are only read once all
+  files before them are done.
+ */
+#define READER_WINDOW (4)
+#define READ_AHEAD_BLOCKS (8)
+
+typedef struct reader_pool_t reader_pool_t;
+
+typedef struct {
+	reader_pool_t *pool;
+	pthread_t thread;
+	sqfs_u64 index;
+	bool busy;
+} file_reader_t;
+
+struct reader_pool_t {
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+
+	sqfs_block_processor_t *data;
+	const options_t *opt;
+
+	file_info_t *next_file;
+	sqfs_u64 next_index;
+	sqfs_u64 next_stream;
+	sqfs_u64 window;
+	sqfs_u64 max_ahead;
+	int status;
+
+	unsigned int num_readers;
+	file_reader_t readers[];
+};
+
+static sqfs_u64 lowest_active(const reader_pool_t *pool)
+{
+	sqfs_u64 index = pool->next_index;
+	unsigned int i;
+
+	for (i = 0; i < pool->num_readers; ++i) {
+		if (pool->readers[i].busy && pool->readers[i].index < index)
+			index = pool->readers[i].index;
+	}
+
+	return index;
+}
+
+static void set_reader_status(reader_pool_t *pool, int status)
+{
+	if (pool->status == 0)
+		pool->status = status;
+
+	pthread_cond_broadcast(&pool->cond);
+}
+
+/*
+  Ask the kernel to start reading in the beginning of a file that has to wait
+  for the files in front of it, so it is in the page cache once it's due.
+ */
+static void prefetch_file(const char *path, sqfs_u64 size)
+{
+#ifdef HAVE_POSIX_FADVISE
+	int fd = open(path, O_RDONLY);
+
+	if (fd >= 0) {
+		posix_fadvise(fd, 0, size, POSIX_FADV_WILLNEED);
+		close(fd);
+	}
+#else
+	(void)path;
+	(void)size;
+#endif
+}
+
+/* called with the pool locked, returns with the pool locked */
+static int read_file(file_reader_t *rd, file_info_t *fi)
+{
+	reader_pool_t *pool = rd->pool;
+	sqfs_inode_generic_t **inode_ptr;
+	sqfs_block_stream_t *strm;
+	sqfs_file_t *file;
+	const char *path;
+	char *node_path;
+	bool queued;
+	int ret;
+
+	path = get_file_path(fi, &node_path);
+	if (path == NULL)
+		return -1;
+
+	if (!pool->opt->cfg.quiet)
+		printf("packing %s\n", path);
+
+	queued = lowest_active(pool) != rd->index;
+
+	pthread_mutex_unlock(&pool->mtx);
+	if (queued)
+		prefetch_file(path, pool->max_ahead);
+
+	file = sqfs_open_file(path, SQFS_FILE_OPEN_READ_ONLY);
+	if (file == NULL)
+		perror(path);
+	pthread_mutex_lock(&pool->mtx);
+
+	if (file == NULL)
+		goto fail;
+
+	/* streams must be opened in list order */
+	while (pool->status == 0 && pool->next_stream != rd->index)
+		pthread_cond_wait(&pool->cond, &pool->mtx);
+
+	if (pool->status != 0)
+		goto fail;
+
+	inode_ptr = (sqfs_inode_generic_t **)&fi->user_ptr;
+
+	ret = sqfs_block_processor_open_stream(pool->data, inode_ptr,
+					       get_file_flags(pool->opt, file),
+					       &strm);
+	if (ret) {
+		sqfs_perror(path, "beginning file data blocks", ret);
+		goto fail;
+	}
+
+	pool->next_stream += 1;
+	pthread_cond_broadcast(&pool->cond);
+
+	if (file->get_size(file) > pool->max_ahead) {
+		while (pool->status == 0 && lowest_active(pool) != rd->index)
+			pthread_cond_wait(&pool->cond, &pool->mtx);
+
+		if (pool->status != 0) {
+			/* later streams may be waiting for this one */
+			pthread_mutex_unlock(&pool->mtx);
+			sqfs_block_stream_close(strm);
+			pthread_mutex_lock(&pool->mtx);
+			goto fail;
+		}
+	}
+
+	pthread_mutex_unlock(&pool->mtx);
+	ret = write_data_to_stream(path, strm, file);
+	pthread_mutex_lock(&pool->mtx);
+
+	sqfs_destroy(file);
+	free(node_path);
+	return ret;
+fail:
+	if (file != NULL)
+		sqfs_destroy(file);
+	free(node_path);
+	return -1;
+}
+
+static void *reader_proc(void *arg)
+{
+	file_reader_t *rd = arg;
+	reader_pool_t *pool = rd->pool;
+	file_info_t *fi;
+
+	pthread_mutex_lock(&pool->mtx);
+
+	for (;;) {
+		while (pool->status == 0 && pool->next_file != NULL &&
+		       pool->next_index >= lowest_active(pool) + pool->window) {
+			pthread_cond_wait(&pool->cond, &pool->mtx);
+		}
+
+		if (pool->status != 0 || pool->next_file == NULL)
+			break;
+
+		fi = pool->next_file;
+		pool->next_file = fi->next;
+		rd->index = pool->next_index++;
+		rd->busy = true;
+
+		if (read_file(rd, fi))
+			set_reader_status(pool, -1);
+
+		rd->busy = false;
+		pthread_cond_broadcast(&pool->cond);
+	}
+
+	pthread_mutex_unlock(&pool->mtx);
+	return NULL;
+}
+
+static int pack_files_parallel(sqfs_block_processor_t *data, fstree_t *fs,
+			       options_t *opt)
+{
+	unsigned int i, count;
+	reader_pool_t *pool;
+	int ret;
+
+	pool = calloc(1, sizeof(*pool) +
+		      opt->num_readers * sizeof(pool->readers[0]));
+	if (pool == NULL) {
+		perror("creating file reader threads");
+		return -1;
+	}
+
+	pthread_mutex_init(&pool->mtx, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	pool->num_readers = opt->num_readers;
+	pool->data = data;
+	pool->opt = opt;
+	pool->next_file = fs->files;
+	pool->window = (sqfs_u64)READER_WINDOW * opt->num_readers;
+	pool->max_ahead = (sqfs_u64)READ_AHEAD_BLOCKS * opt->cfg.block_size;
+
+	pthread_mutex_lock(&pool->mtx);
+	for (i = 0; i < pool->num_readers; ++i) {
+		pool->readers[i].pool = pool;
+
+		ret = pthread_create(&pool->readers[i].thread, NULL,
+				     reader_proc, pool->readers + i);
+		if (ret != 0) {
+			fprintf(stderr, "creating file reader threads: %s\n",
+				strerror(ret));
+			set_reader_status(pool, -1);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&pool->mtx);
+
+	count = i;
+	for (i = 0; i < count; ++i)
+		pthread_join(pool->readers[i].thread, NULL);
+
+	ret = pool->status;
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mtx);
+	free(pool);
+	return ret;
+}
+#endif
+
+static int pack_files(sqfs_block_processor_t *data, fstree_t *fs,
+		      options_t *opt)
+{
+	if (set_working_dir(opt))
+		return -1;
+
+#ifdef WITH_PTHREAD
+	if (opt->num_readers > 1)
+		return pack_files_parallel(data, fs, opt);
+#endif
+	return pack_files_serial(data, fs, opt);
+}
+
 static int relabel_tree_dfs(const char *filename, sqfs_xattr_writer_t *xwr,
 			    tree_node_t *n, void *selinux_handle)
 {
@@ -152,7 +417,8 @@ static int read_fstree(fstree_t *fs, options_t *opt, sqfs_xattr_writer_t *xwr,
 
 	if (opt->infile == NULL) {
 		return fstree_from_dir(fs, opt->packdir, selinux_handle,
-				       xwr, opt->dirscan_flags);
+				       xwr, opt->dirscan_flags,
+				       opt->num_readers);
 	}
 
 	fp = fopen(opt->infile, "rb");
@@ -29,6 +29,14 @@
 #include <selinux/label.h>
 #endif
 
+#ifdef WITH_PTHREAD
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_POSIX_FADVISE
+#include <fcntl.h>
+#endif
+
 #include <getopt.h>
 #include <assert.h>
 #include <stdlib.h>
@@ -39,12 +47,15 @@
 #include <errno.h>
 #include <ctype.h>
 
+#define DEFAULT_NUM_READERS (4)
+
 typedef struct {
 	sqfs_writer_cfg_t cfg;
 	unsigned int dirscan_flags;
 	const char *infile;
 	const char *packdir;
 	const char *selinux;
+	unsigned int num_readers;
 	bool no_tail_packing;
 } options_t;
 
@@ -59,7 +70,8 @@ enum {
 void process_command_line(options_t *opt, int argc, char **argv);
 
 int fstree_from_dir(fstree_t *fs, const char *path, void *selinux_handle,
-		    sqfs_xattr_writer_t *xwr, unsigned int flags);
+		    sqfs_xattr_writer_t *xwr, unsigned int flags,
+		    unsigned int num_threads);
 
 
 void *selinux_open_context_file(const char *filename);
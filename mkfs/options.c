@@ -16,6 +16,7 @@ static struct option long_opts[] = {
 	{ "pack-dir", required_argument, NULL, 'D' },
 	{ "num-jobs", required_argument, NULL, 'j' },
 	{ "queue-backlog", required_argument, NULL, 'Q' },
+	{ "num-readers", required_argument, NULL, 'R' },
 	{ "keep-time", no_argument, NULL, 'k' },
 #ifdef HAVE_SYS_XATTR_H
 	{ "keep-xattr", no_argument, NULL, 'x' },
@@ -33,7 +34,7 @@ static struct option long_opts[] = {
 	{ NULL, 0, NULL, 0 },
 };
 
-static const char *short_opts = "F:D:X:c:b:B:d:j:Q:kxoefqThV"
+static const char *short_opts = "F:D:X:c:b:B:d:j:Q:R:kxoefqThV"
 #ifdef WITH_SELINUX
 "s:"
 #endif
@@ -70,6 +71,10 @@ static const char *help_string =
 "                              worker queue before the packer starts waiting\n"
 "                              for the block processors to catch up.\n"
 "                              Defaults to 10 times the number of jobs.\n"
+"  --num-readers, -R <count>   Number of threads reading input files and\n"
+"                              scanning directories in parallel. Defaults\n"
+"                              to %u. If set to 1, everything is read one\n"
+"                              after another.\n"
 "  --block-size, -b <size>     Block size to use for Squashfs image.\n"
 "                              Defaults to %u.\n"
 "  --dev-block-size, -B <size> Device block size to padd the image to.\n"
@@ -155,6 +160,7 @@ void process_command_line(options_t *opt, int argc, char **argv)
 
 	memset(opt, 0, sizeof(*opt));
 	sqfs_writer_cfg_init(&opt->cfg);
+	opt->num_readers = DEFAULT_NUM_READERS;
 
 	for (;;) {
 		i = getopt_long(argc, argv, short_opts, long_opts, NULL);
@@ -197,6 +203,9 @@ void process_command_line(options_t *opt, int argc, char **argv)
 		case 'Q':
 			opt->cfg.max_backlog = strtol(optarg, NULL, 0);
 			break;
+		case 'R':
+			opt->num_readers = strtol(optarg, NULL, 0);
+			break;
 		case 'B':
 			if (parse_size("Device block size",
 				       &opt->cfg.devblksize, optarg, 0)) {
@@ -246,7 +255,7 @@ void process_command_line(options_t *opt, int argc, char **argv)
 			break;
 #endif
 		case 'h':
-			printf(help_string,
+			printf(help_string, DEFAULT_NUM_READERS,
 			       SQFS_DEFAULT_BLOCK_SIZE, SQFS_DEVBLK_SIZE);
 			fputs(help_details, stdout);
 			compressor_print_available();
@@ -265,6 +274,9 @@ void process_command_line(options_t *opt, int argc, char **argv)
 	if (opt->cfg.max_backlog < 1)
 		opt->cfg.max_backlog = 10 * opt->cfg.num_jobs;
 
+	if (opt->num_readers < 1)
+		opt->num_readers = 1;
+
 	if (opt->cfg.comp_extra != NULL &&
 	    strcmp(opt->cfg.comp_extra, "help") == 0) {
 		compressor_print_help(opt->cfg.comp_id);
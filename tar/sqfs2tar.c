@@ -16,6 +16,10 @@
 #include <fcntl.h>
 #include <stdio.h>
 
+#ifdef WITH_PTHREAD
+#include <pthread.h>
+#endif
+
 static struct option long_opts[] = {
 	{ "subdir", required_argument, NULL, 'd' },
 	{ "keep-as-dir", no_argument, NULL, 'k' },
@@ -23,12 +27,13 @@ static struct option long_opts[] = {
 	{ "no-skip", no_argument, NULL, 's' },
 	{ "no-xattr", no_argument, NULL, 'X' },
 	{ "no-hard-links", no_argument, NULL, 'L' },
+	{ "num-jobs", required_argument, NULL, 'j' },
 	{ "help", no_argument, NULL, 'h' },
 	{ "version", no_argument, NULL, 'V' },
 	{ NULL, 0, NULL, 0 },
 };
 
-static const char *short_opts = "d:kr:sXLhV";
+static const char *short_opts = "d:kr:sXLj:hV";
 
 static const char *usagestr =
 "Usage: sqfs2tar [OPTIONS...] <sqfsfile>\n"
@@ -60,6 +65,9 @@ static const char *usagestr =
 "  --no-xattr, -X            Do not copy extended attributes.\n"
 "  --no-hard-links, -L       Do not generate hard links. Produce duplicate\n"
 "                            entries instead.\n"
+"  --num-jobs, -j <count>    Number of threads that decompress data blocks\n"
+"                            ahead of the tar writer. Defaults to 1, at\n"
+"                            most 1024.\n"
 "\n"
 "  --no-skip, -s             Abort if a file cannot be stored in a tar\n"
 "                            archive. By default, it is simply skipped\n"
@@ -81,6 +89,7 @@ static bool dont_skip = false;
 static bool keep_as_dir = false;
 static bool no_xattr = false;
 static bool no_links = false;
+static unsigned int num_jobs = 1;
 
 static char *root_becomes = NULL;
 static char **subdirs = NULL;
@@ -89,6 +98,7 @@ static size_t max_subdirs = 0;
 
 static sqfs_xattr_reader_t *xr;
 static sqfs_data_reader_t *data;
+static sqfs_u8 *scratch;
 static sqfs_file_t *file;
 static sqfs_super_t super;
 static sqfs_hard_link_t *links = NULL;
@@ -98,6 +108,8 @@ static FILE *out_file = NULL;
 static void process_args(int argc, char **argv)
 {
 	size_t idx, new_count;
+	char *end;
+	long value;
 	int i, ret;
 	void *new;
 
@@ -162,6 +174,19 @@ static void process_args(int argc, char **argv)
 		case 'L':
 			no_links = true;
 			break;
+		case 'j':
+			value = strtol(optarg, &end, 0);
+			if (end == optarg || *end != '\0' || value < 1) {
+				fprintf(stderr, "Invalid number of jobs: %s\n",
+					optarg);
+				goto fail_arg;
+			}
+
+			if (value > MAX_NUM_JOBS)
+				value = MAX_NUM_JOBS;
+
+			num_jobs = value;
+			break;
 		case 'h':
 			fputs(usagestr, stdout);
 			goto out_success;
@@ -342,6 +367,339 @@ static char *assemble_tar_path(char *name, bool is_dir)
 	return name;
 }
 
+#ifdef WITH_PTHREAD
+/*
+  With more than one job, the data blocks of regular files are decompressed
+  ahead of time by a pool of worker threads, each with its own data reader.
+  The regular files are collected up front in the order in which the tree
+  is written and every data block and fragment becomes one job in a ring.
+  Workers claim jobs in order, the writer picks up the finished ones in the
+  same order. Jobs of files that the writer ends up skipping, or turns into
+  hard links, are simply dropped.
+ */
+enum {
+	JOB_BUSY = 0,
+	JOB_DONE,
+};
+
+typedef struct {
+	size_t file;
+	size_t index;
+	size_t size;
+	int state;
+	int status;
+	sqfs_u8 *data;
+} block_job_t;
+
+typedef struct {
+	pthread_t thread;
+	sqfs_compressor_t *cmp;
+	sqfs_file_t *file;
+	sqfs_data_reader_t *data;
+} worker_t;
+
+static struct {
+	pthread_mutex_t mtx;
+	pthread_cond_t queue_cond;
+	pthread_cond_t done_cond;
+	int terminate;
+
+	const sqfs_tree_node_t **files;
+	size_t num_files;
+	size_t max_files;
+
+	/* the next job to be generated */
+	size_t gen_file;
+	size_t gen_index;
+
+	/* the file the writer is currently at */
+	size_t wr_file;
+
+	block_job_t *jobs;
+	size_t max_jobs;
+	size_t head;
+	size_t tail;
+
+	worker_t *workers;
+	unsigned int num_threads;
+} pipeline;
+
+static size_t get_job_count(const sqfs_inode_generic_t *inode)
+{
+	size_t count = sqfs_inode_get_file_block_count(inode);
+	sqfs_u64 filesz;
+
+	sqfs_inode_get_file_size(inode, &filesz);
+
+	/* the tail end of the file is stored in a fragment */
+	if (filesz > (sqfs_u64)count * super.block_size)
+		count += 1;
+
+	return count;
+}
+
+static int collect_files_dfs(const sqfs_tree_node_t *n)
+{
+	size_t new_sz;
+	void *new;
+
+	if (S_ISREG(n->inode->base.mode) && get_job_count(n->inode) > 0) {
+		if (pipeline.num_files == pipeline.max_files) {
+			new_sz = pipeline.max_files ? pipeline.max_files * 2 : 256;
+			new = realloc(pipeline.files, sizeof(pipeline.files[0]) * new_sz);
+
+			if (new == NULL) {
+				perror("collecting regular files");
+				return -1;
+			}
+
+			pipeline.files = new;
+			pipeline.max_files = new_sz;
+		}
+
+		pipeline.files[pipeline.num_files++] = n;
+	}
+
+	for (n = n->children; n != NULL; n = n->next) {
+		if (collect_files_dfs(n))
+			return -1;
+	}
+
+	return 0;
+}
+
+static void *decompress_thread_proc(void *arg)
+{
+	sqfs_data_reader_t *rd = ((worker_t *)arg)->data;
+	const sqfs_inode_generic_t *inode;
+	block_job_t *job;
+	size_t count;
+	int ret;
+
+	pthread_mutex_lock(&pipeline.mtx);
+
+	for (;;) {
+		while (!pipeline.terminate && (pipeline.gen_file >= pipeline.num_files ||
+					   pipeline.tail - pipeline.head >= pipeline.max_jobs)) {
+			pthread_cond_wait(&pipeline.queue_cond, &pipeline.mtx);
+		}
+
+		if (pipeline.terminate)
+			break;
+
+		job = pipeline.jobs + (pipeline.tail++ % pipeline.max_jobs);
+		job->file = pipeline.gen_file;
+		job->index = pipeline.gen_index;
+		job->state = JOB_BUSY;
+
+		inode = pipeline.files[pipeline.gen_file]->inode;
+		count = get_job_count(inode);
+
+		if (++pipeline.gen_index >= count) {
+			pipeline.gen_file += 1;
+			pipeline.gen_index = 0;
+		}
+
+		pthread_mutex_unlock(&pipeline.mtx);
+
+		if (job->index < sqfs_inode_get_file_block_count(inode)) {
+			ret = sqfs_data_reader_get_block_into(rd, inode,
+							      job->index,
+							      &job->size,
+							      job->data);
+		} else {
+			ret = sqfs_data_reader_get_fragment_into(rd, inode,
+								 &job->size,
+								 job->data);
+		}
+
+		pthread_mutex_lock(&pipeline.mtx);
+		job->status = ret;
+		job->state = JOB_DONE;
+		pthread_cond_broadcast(&pipeline.done_cond);
+	}
+
+	pthread_mutex_unlock(&pipeline.mtx);
+	return NULL;
+}
+
+/* must be called with the mutex held */
+static block_job_t *wait_head(void)
+{
+	block_job_t *job;
+
+	while (pipeline.head == pipeline.tail)
+		pthread_cond_wait(&pipeline.done_cond, &pipeline.mtx);
+
+	job = pipeline.jobs + (pipeline.head % pipeline.max_jobs);
+
+	while (job->state != JOB_DONE)
+		pthread_cond_wait(&pipeline.done_cond, &pipeline.mtx);
+
+	return job;
+}
+
+/* must be called with the mutex held */
+static void drop_head(void)
+{
+	pipeline.head += 1;
+	pthread_cond_signal(&pipeline.queue_cond);
+}
+
+static int write_file_data(const char *name, const sqfs_tree_node_t *n)
+{
+	size_t i, count = get_job_count(n->inode);
+	block_job_t *job;
+	int ret;
+
+	if (count == 0)
+		return 0;
+
+	/* files that the writer skipped come first */
+	while (pipeline.files[pipeline.wr_file] != n)
+		pipeline.wr_file += 1;
+
+	for (i = 0; i < count; ++i) {
+		pthread_mutex_lock(&pipeline.mtx);
+
+		for (;;) {
+			job = wait_head();
+			if (job->file >= pipeline.wr_file)
+				break;
+			drop_head();
+		}
+
+		pthread_mutex_unlock(&pipeline.mtx);
+
+		if (job->status != 0) {
+			sqfs_perror(name, job->index <
+				    sqfs_inode_get_file_block_count(n->inode) ?
+				    "reading data block" :
+				    "reading fragment block", job->status);
+			return -1;
+		}
+
+		ret = write_retry("writing data block", out_file,
+				  job->data, job->size);
+
+		pthread_mutex_lock(&pipeline.mtx);
+		drop_head();
+		pthread_mutex_unlock(&pipeline.mtx);
+
+		if (ret)
+			return -1;
+	}
+
+	pipeline.wr_file += 1;
+	return 0;
+}
+
+static int create_worker(worker_t *w, sqfs_compressor_t *cmp)
+{
+	int ret;
+
+	w->cmp = sqfs_copy(cmp);
+	w->file = sqfs_copy(file);
+
+	if (w->cmp == NULL || w->file == NULL) {
+		perror("creating decompressor thread");
+		return -1;
+	}
+
+	w->data = sqfs_data_reader_create(w->file, super.block_size, w->cmp);
+	if (w->data == NULL) {
+		sqfs_perror(filename, "creating data reader",
+			    SQFS_ERROR_ALLOC);
+		return -1;
+	}
+
+	ret = sqfs_data_reader_load_fragment_table(w->data, &super);
+	if (ret) {
+		sqfs_perror(filename, "loading fragment table", ret);
+		return -1;
+	}
+
+	ret = pthread_create(&w->thread, NULL, decompress_thread_proc, w);
+	if (ret != 0) {
+		fprintf(stderr, "creating decompressor thread: %s\n",
+			strerror(ret));
+		return -1;
+	}
+
+	return 0;
+}
+
+static void pipeline_cleanup(void)
+{
+	unsigned int i;
+	size_t j;
+
+	pthread_mutex_lock(&pipeline.mtx);
+	pipeline.terminate = 1;
+	pthread_cond_broadcast(&pipeline.queue_cond);
+	pthread_mutex_unlock(&pipeline.mtx);
+
+	for (i = 0; i < pipeline.num_threads; ++i)
+		pthread_join(pipeline.workers[i].thread, NULL);
+
+	for (i = 0; pipeline.workers != NULL && i < num_jobs; ++i) {
+		if (pipeline.workers[i].data != NULL)
+			sqfs_destroy(pipeline.workers[i].data);
+		if (pipeline.workers[i].file != NULL)
+			sqfs_destroy(pipeline.workers[i].file);
+		if (pipeline.workers[i].cmp != NULL)
+			sqfs_destroy(pipeline.workers[i].cmp);
+	}
+
+	for (j = 0; pipeline.jobs != NULL && j < pipeline.max_jobs; ++j)
+		free(pipeline.jobs[j].data);
+
+	pthread_cond_destroy(&pipeline.done_cond);
+	pthread_cond_destroy(&pipeline.queue_cond);
+	pthread_mutex_destroy(&pipeline.mtx);
+	free(pipeline.workers);
+	free(pipeline.jobs);
+	free(pipeline.files);
+}
+
+static int pipeline_init(const sqfs_tree_node_t *root, sqfs_compressor_t *cmp)
+{
+	size_t i;
+
+	pthread_mutex_init(&pipeline.mtx, NULL);
+	pthread_cond_init(&pipeline.queue_cond, NULL);
+	pthread_cond_init(&pipeline.done_cond, NULL);
+
+	if (collect_files_dfs(root))
+		return -1;
+
+	pipeline.max_jobs = 4 * (size_t)num_jobs;
+	pipeline.jobs = calloc(pipeline.max_jobs, sizeof(pipeline.jobs[0]));
+	pipeline.workers = calloc(num_jobs, sizeof(pipeline.workers[0]));
+
+	if (pipeline.jobs == NULL || pipeline.workers == NULL)
+		goto fail_alloc;
+
+	for (i = 0; i < pipeline.max_jobs; ++i) {
+		pipeline.jobs[i].data = malloc(super.block_size);
+		if (pipeline.jobs[i].data == NULL)
+			goto fail_alloc;
+	}
+
+	for (i = 0; i < num_jobs; ++i) {
+		if (create_worker(pipeline.workers + i, cmp))
+			return -1;
+
+		pipeline.num_threads += 1;
+	}
+
+	return 0;
+fail_alloc:
+	perror("creating decompressor pipeline");
+	return -1;
+}
+#endif
+
 static int write_tree_dfs(const sqfs_tree_node_t *n)
 {
 	tar_xattr_t *xattr = NULL, *xit;
@@ -434,8 +792,18 @@ static int write_tree_dfs(const sqfs_tree_node_t *n)
 	}
 
 	if (S_ISREG(sb.st_mode)) {
-		if (sqfs_data_reader_dump(name, data, n->inode, out_file,
-					  super.block_size, false)) {
+#ifdef WITH_PTHREAD
+		if (num_jobs > 1) {
+			ret = write_file_data(name, n);
+		} else
+#endif
+		{
+			ret = sqfs_data_reader_dump(name, data, n->inode,
+						    out_file, super.block_size,
+						    false, scratch);
+		}
+
+		if (ret) {
 			free(name);
 			return -1;
 		}
@@ -509,6 +877,7 @@ int main(int argc, char **argv)
 	sqfs_tree_node_t *root = NULL, *subtree;
 	int flags, ret, status = EXIT_FAILURE;
 	sqfs_compressor_config_t cfg;
+	sqfs_meta_cache_t *mcache;
 	sqfs_compressor_t *cmp;
 	sqfs_id_table_t *idtbl;
 	sqfs_dir_reader_t *dr;
@@ -529,7 +898,8 @@ int main(int argc, char **argv)
 		goto out_dirs;
 	}
 
-	file = sqfs_open_file(filename, SQFS_FILE_OPEN_READ_ONLY);
+	file = sqfs_open_file(filename,
+			      SQFS_FILE_OPEN_READ_ONLY | SQFS_FILE_OPEN_MMAP);
 	if (file == NULL) {
 		perror(filename);
 		goto out_dirs;
@@ -557,11 +927,18 @@ int main(int argc, char **argv)
 		goto out_fd;
 	}
 
+	mcache = sqfs_meta_cache_create(META_CACHE_SIZE);
+	if (mcache == NULL) {
+		sqfs_perror(filename, "creating meta data cache",
+			    SQFS_ERROR_ALLOC);
+		goto out_cmp;
+	}
+
 	idtbl = sqfs_id_table_create(0);
 
 	if (idtbl == NULL) {
 		perror("creating ID table");
-		goto out_cmp;
+		goto out_cache;
 	}
 
 	ret = sqfs_id_table_read(idtbl, file, &super, cmp);
@@ -583,6 +960,22 @@ int main(int argc, char **argv)
 		goto out_data;
 	}
 
+	/* with a single job, decompress ahead of the tar writer in the
+	   background, otherwise the pipeline workers take care of that */
+	if (num_jobs == 1) {
+		ret = sqfs_data_reader_set_read_ahead(data, 1, 0);
+		if (ret) {
+			sqfs_perror(filename, "starting read-ahead", ret);
+			goto out_data;
+		}
+	}
+
+	scratch = malloc(super.block_size);
+	if (scratch == NULL) {
+		perror("allocating data block buffer");
+		goto out_data;
+	}
+
 	dr = sqfs_dir_reader_create(&super, cmp, file);
 	if (dr == NULL) {
 		sqfs_perror(filename, "creating dir reader",
@@ -590,6 +983,8 @@ int main(int argc, char **argv)
 		goto out_data;
 	}
 
+	sqfs_dir_reader_set_cache(dr, mcache);
+
 	if (!no_xattr && !(super.flags & SQFS_FLAG_NO_XATTRS)) {
 		xr = sqfs_xattr_reader_create(0);
 		if (xr == NULL) {
@@ -598,6 +993,8 @@ int main(int argc, char **argv)
 			goto out_dr;
 		}
 
+		sqfs_xattr_reader_set_cache(xr, mcache);
+
 		ret = sqfs_xattr_reader_load(xr, &super, file, cmp);
 		if (ret) {
 			sqfs_perror(filename, "loading xattr table", ret);
@@ -607,7 +1004,8 @@ int main(int argc, char **argv)
 
 	if (num_subdirs == 0) {
 		ret = sqfs_dir_reader_get_full_hierarchy(dr, idtbl, NULL,
-							 0, &root);
+							 SQFS_TREE_ARENA,
+							 &root);
 		if (ret) {
 			sqfs_perror(filename, "loading filesystem tree", ret);
 			goto out;
@@ -618,6 +1016,10 @@ int main(int argc, char **argv)
 		if (keep_as_dir || num_subdirs > 1)
 			flags = SQFS_TREE_STORE_PARENTS;
 
+		/* tree_merge moves nodes between trees */
+		if (num_subdirs == 1)
+			flags |= SQFS_TREE_ARENA;
+
 		for (i = 0; i < num_subdirs; ++i) {
 			ret = sqfs_dir_reader_get_full_hierarchy(dr, idtbl,
 								 subdirs[i],
@@ -648,7 +1050,21 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (write_tree_dfs(root))
+#ifdef WITH_PTHREAD
+	if (num_jobs > 1 && pipeline_init(root, cmp)) {
+		pipeline_cleanup();
+		goto out;
+	}
+#endif
+
+	ret = write_tree_dfs(root);
+
+#ifdef WITH_PTHREAD
+	if (num_jobs > 1)
+		pipeline_cleanup();
+#endif
+
+	if (ret)
 		goto out;
 
 	if (terminate_archive())
@@ -672,9 +1088,12 @@ out_xr:
 out_dr:
 	sqfs_destroy(dr);
 out_data:
+	free(scratch);
 	sqfs_destroy(data);
 out_id:
 	sqfs_destroy(idtbl);
+out_cache:
+	sqfs_destroy(mcache);
 out_cmp:
 	sqfs_destroy(cmp);
 out_fd:
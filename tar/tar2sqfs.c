@@ -45,8 +45,9 @@ static const char *short_opts = "r:c:b:B:d:X:j:Q:sxekfqThV";
 static const char *usagestr =
 "Usage: tar2sqfs [OPTIONS...] <sqfsfile>\n"
 "\n"
-"Read an uncompressed tar archive from stdin and turn it into a squashfs\n"
-"filesystem image.\n"
+"Read a tar archive from stdin and turn it into a squashfs filesystem image.\n"
+"The archive can be compressed with gzip, xz, zstd or bzip2, if support for\n"
+"the format was compiled in.\n"
 "\n"
 "Possible options:\n"
 "\n"
@@ -62,7 +63,8 @@ static const char *usagestr =
 "  --comp-extra, -X <options>  A comma separated list of extra options for\n"
 "                              the selected compressor. Specify 'help' to\n"
 "                              get a list of available options.\n"
-"  --num-jobs, -j <count>      Number of compressor jobs to create.\n"
+"  --num-jobs, -j <count>      Number of compressor jobs to create. Also\n"
+"                              used for decompressing xz compressed input.\n"
 "  --queue-backlog, -Q <count> Maximum number of data blocks in the thread\n"
 "                              worker queue before the packer starts waiting\n"
 "                              for the block processors to catch up.\n"
@@ -96,8 +98,8 @@ static const char *usagestr =
 "Examples:\n"
 "\n"
 "\ttar2sqfs rootfs.sqfs < rootfs.tar\n"
-"\tzcat rootfs.tar.gz | tar2sqfs rootfs.sqfs\n"
-"\txzcat rootfs.tar.xz | tar2sqfs rootfs.sqfs\n"
+"\ttar2sqfs rootfs.sqfs < rootfs.tar.gz\n"
+"\ttar2sqfs -j 4 rootfs.sqfs < rootfs.tar.xz\n"
 "\n";
 
 static bool dont_skip = false;
@@ -525,6 +527,11 @@ int main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
+	/* keep the pipe drained while the compressors are busy */
+	input_file = sqfs_get_read_ahead_stream(input_file, cfg.num_jobs);
+	if (input_file == NULL)
+		return EXIT_FAILURE;
+
 	if (sqfs_writer_init(&sqfs, &cfg))
 		return EXIT_FAILURE;
 
@@ -540,5 +547,6 @@ int main(int argc, char **argv)
 	status = EXIT_SUCCESS;
 out:
 	sqfs_writer_cleanup(&sqfs, status);
+	fclose(input_file);
 	return status;
 }
@@ -0,0 +1,329 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * block_processor_streams.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "common.h"
+#include "mem_file.h"
+
+#ifdef WITH_PTHREAD
+#include <pthread.h>
+#endif
+
+#define BLOCK_SIZE (4096)
+#define NUM_FILES (6)
+#define CHUNK_SIZE (1000)
+
+/* enough to hold back all blocks of a file, or few enough to have to wait */
+#define BACKLOG (64)
+#define SMALL_BACKLOG (2)
+
+static const size_t file_size[NUM_FILES] = {
+	10 * BLOCK_SIZE + 123,
+	100,
+	3 * BLOCK_SIZE,
+	7 * BLOCK_SIZE + 4000,
+	0,
+	20 * BLOCK_SIZE + 1,
+};
+
+static sqfs_u8 *file_data[NUM_FILES];
+
+typedef struct {
+	mem_file_t *file;
+	sqfs_block_writer_t *wr;
+	sqfs_frag_table_t *tbl;
+	sqfs_block_processor_t *proc;
+	sqfs_inode_generic_t *inodes[NUM_FILES];
+} image_t;
+
+static void gen_data(void)
+{
+	sqfs_u32 seed = 1;
+	size_t i, j;
+
+	for (i = 0; i < NUM_FILES; ++i) {
+		file_data[i] = malloc(file_size[i] + 1);
+		TEST_NOT_NULL(file_data[i]);
+
+		for (j = 0; j < file_size[i]; ++j) {
+			seed = seed * 1103515245 + 12345;
+			file_data[i][j] = 'a' + ((seed >> 16) % 16);
+		}
+
+		/* a sparse block in the middle of a file */
+		if (file_size[i] > 4 * BLOCK_SIZE)
+			memset(file_data[i] + 2 * BLOCK_SIZE, 0, BLOCK_SIZE);
+	}
+}
+
+static void image_init(image_t *img, sqfs_compressor_t *cmp,
+		       unsigned int num_workers, size_t backlog,
+		       sqfs_u32 flags)
+{
+	memset(img, 0, sizeof(*img));
+
+	img->file = mem_file_create();
+	img->wr = sqfs_block_writer_create((sqfs_file_t *)img->file, 0, 0);
+	TEST_NOT_NULL(img->wr);
+	img->tbl = sqfs_frag_table_create(0);
+	TEST_NOT_NULL(img->tbl);
+
+	img->proc = sqfs_block_processor_create_ex(BLOCK_SIZE, cmp, num_workers,
+						   backlog, flags, img->wr,
+						   img->tbl);
+	TEST_NOT_NULL(img->proc);
+}
+
+static void image_finish(image_t *img)
+{
+	TEST_ASSERT(sqfs_block_processor_finish(img->proc) == 0);
+}
+
+static void image_cleanup(image_t *img)
+{
+	size_t i;
+
+	for (i = 0; i < NUM_FILES; ++i)
+		free(img->inodes[i]);
+
+	sqfs_destroy(img->proc);
+	sqfs_destroy(img->tbl);
+	sqfs_destroy(img->wr);
+	sqfs_destroy(img->file);
+}
+
+/* reference: one file after the other through the classic interface */
+static void write_sequential(image_t *img)
+{
+	size_t i;
+
+	for (i = 0; i < NUM_FILES; ++i) {
+		TEST_ASSERT(sqfs_block_processor_begin_file(img->proc,
+							    img->inodes + i,
+							    0) == 0);
+		TEST_ASSERT(sqfs_block_processor_append(img->proc, file_data[i],
+							file_size[i]) == 0);
+		TEST_ASSERT(sqfs_block_processor_end_file(img->proc) == 0);
+	}
+
+	image_finish(img);
+}
+
+/* all streams open at once, filled interleaved and closed backwards */
+static void write_interleaved(image_t *img)
+{
+	sqfs_block_stream_t *strm[NUM_FILES];
+	size_t i, off[NUM_FILES], diff;
+	bool done;
+
+	for (i = 0; i < NUM_FILES; ++i) {
+		TEST_ASSERT(sqfs_block_processor_open_stream(img->proc,
+							     img->inodes + i, 0,
+							     strm + i) == 0);
+		off[i] = 0;
+	}
+
+	do {
+		done = true;
+
+		for (i = 0; i < NUM_FILES; ++i) {
+			diff = file_size[i] - off[i];
+			if (diff > CHUNK_SIZE)
+				diff = CHUNK_SIZE;
+			if (diff == 0)
+				continue;
+
+			TEST_ASSERT(sqfs_block_stream_append(strm[i],
+							     file_data[i] +
+							     off[i],
+							     diff) == 0);
+			off[i] += diff;
+			done = false;
+		}
+	} while (!done);
+
+	for (i = NUM_FILES; i > 0; --i)
+		TEST_ASSERT(sqfs_block_stream_close(strm[i - 1]) == 0);
+
+	image_finish(img);
+}
+
+#ifdef WITH_PTHREAD
+static void stream_write(sqfs_block_stream_t *strm, size_t idx)
+{
+	size_t off, diff;
+
+	for (off = 0; off < file_size[idx]; off += diff) {
+		diff = file_size[idx] - off;
+		if (diff > CHUNK_SIZE)
+			diff = CHUNK_SIZE;
+
+		TEST_ASSERT(sqfs_block_stream_append(strm, file_data[idx] + off,
+						     diff) == 0);
+	}
+
+	TEST_ASSERT(sqfs_block_stream_close(strm) == 0);
+}
+
+typedef struct {
+	sqfs_block_stream_t *strm;
+	size_t idx;
+} thread_arg_t;
+
+static void *stream_thread(void *arg)
+{
+	thread_arg_t *targ = arg;
+
+	stream_write(targ->strm, targ->idx);
+	return NULL;
+}
+
+/*
+  Every stream is filled and closed by its own thread. The threads are
+  started backwards, so the later streams tend to fill up first.
+ */
+static void write_threaded(image_t *img)
+{
+	pthread_t threads[NUM_FILES];
+	thread_arg_t args[NUM_FILES];
+	size_t i;
+
+	for (i = 0; i < NUM_FILES; ++i) {
+		TEST_ASSERT(sqfs_block_processor_open_stream(img->proc,
+							     img->inodes + i, 0,
+							     &args[i].strm) == 0);
+		args[i].idx = i;
+	}
+
+	for (i = NUM_FILES; i > 0; --i) {
+		TEST_ASSERT(pthread_create(threads + i - 1, NULL,
+					   stream_thread, args + i - 1) == 0);
+	}
+
+	for (i = 0; i < NUM_FILES; ++i)
+		pthread_join(threads[i], NULL);
+
+	image_finish(img);
+}
+#endif
+
+static void compare_inodes(const sqfs_inode_generic_t *a,
+			   const sqfs_inode_generic_t *b)
+{
+	sqfs_u32 a_idx, a_off, b_idx, b_off;
+	sqfs_u64 a_val, b_val;
+	size_t count;
+
+	TEST_NOT_NULL(b);
+
+	count = sqfs_inode_get_file_block_count(a);
+	TEST_EQUAL_UI(sqfs_inode_get_file_block_count(b), count);
+	TEST_ASSERT(memcmp(b->extra, a->extra,
+			   count * sizeof(a->extra[0])) == 0);
+
+	sqfs_inode_get_file_size(a, &a_val);
+	sqfs_inode_get_file_size(b, &b_val);
+	TEST_EQUAL_UI(b_val, a_val);
+
+	sqfs_inode_get_file_block_start(a, &a_val);
+	sqfs_inode_get_file_block_start(b, &b_val);
+	TEST_EQUAL_UI(b_val, a_val);
+
+	sqfs_inode_get_frag_location(a, &a_idx, &a_off);
+	sqfs_inode_get_frag_location(b, &b_idx, &b_off);
+	TEST_EQUAL_UI(b_idx, a_idx);
+	TEST_EQUAL_UI(b_off, a_off);
+}
+
+static void compare_images(image_t *ref, image_t *img)
+{
+	size_t i;
+
+	TEST_EQUAL_UI(img->file->size, ref->file->size);
+	TEST_ASSERT(memcmp(img->file->data, ref->file->data,
+			   ref->file->size) == 0);
+
+	TEST_EQUAL_UI(sqfs_frag_table_get_size(img->tbl),
+		      sqfs_frag_table_get_size(ref->tbl));
+
+	for (i = 0; i < NUM_FILES; ++i)
+		compare_inodes(ref->inodes[i], img->inodes[i]);
+}
+
+static void check_reference(image_t *ref)
+{
+	sqfs_u64 start, last = 0;
+	size_t i, count;
+
+	/* files are stored in the order they were started */
+	for (i = 0; i < NUM_FILES; ++i) {
+		count = sqfs_inode_get_file_block_count(ref->inodes[i]);
+		if (count == 0)
+			continue;
+
+		sqfs_inode_get_file_block_start(ref->inodes[i], &start);
+		TEST_ASSERT(start >= last);
+		last = start;
+	}
+}
+
+static void run(sqfs_compressor_t *cmp, image_t *ref,
+		void (*write_fun)(image_t *), unsigned int num_workers,
+		size_t backlog, sqfs_u32 flags)
+{
+	image_t img;
+
+	image_init(&img, cmp, num_workers, backlog, flags);
+	write_fun(&img);
+	compare_images(ref, &img);
+	image_cleanup(&img);
+}
+
+int main(void)
+{
+	static const sqfs_u32 flags[] = { 0, SQFS_BLOCK_PROCESSOR_ASYNC_IO };
+	static const unsigned int workers[] = { 1, 4 };
+	sqfs_compressor_config_t cfg;
+	sqfs_compressor_t *cmp;
+	image_t ref;
+	size_t i, j;
+
+	gen_data();
+
+	sqfs_compressor_config_init(&cfg, compressor_get_default(),
+				    BLOCK_SIZE, 0);
+	TEST_ASSERT(sqfs_compressor_create(&cfg, &cmp) == 0);
+
+	image_init(&ref, cmp, 1, BACKLOG, 0);
+	write_sequential(&ref);
+	check_reference(&ref);
+
+	for (i = 0; i < sizeof(workers) / sizeof(workers[0]); ++i) {
+		for (j = 0; j < sizeof(flags) / sizeof(flags[0]); ++j) {
+			run(cmp, &ref, write_sequential, workers[i], BACKLOG,
+			    flags[j]);
+			run(cmp, &ref, write_interleaved, workers[i], BACKLOG,
+			    flags[j]);
+#ifdef WITH_PTHREAD
+			run(cmp, &ref, write_threaded, workers[i], BACKLOG,
+			    flags[j]);
+
+			/* later streams have to wait for the earlier ones */
+			run(cmp, &ref, write_threaded, workers[i],
+			    SMALL_BACKLOG, flags[j]);
+#endif
+		}
+	}
+
+	image_cleanup(&ref);
+	sqfs_destroy(cmp);
+
+	for (i = 0; i < NUM_FILES; ++i)
+		free(file_data[i]);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,128 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * block_writer_dedup.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "sqfs/block_writer.h"
+#include "sqfs/block.h"
+#include "mem_file.h"
+
+#define BLK_SIZE (64)
+#define NUM_FILES (200)
+
+static sqfs_u8 blk_data[BLK_SIZE];
+
+static sqfs_u64 write_file(sqfs_block_writer_t *wr, const sqfs_u32 *chksums,
+			   size_t count, sqfs_u32 extra_flags)
+{
+	sqfs_u64 location, first = 0;
+	sqfs_u32 flags;
+	size_t i;
+
+	for (i = 0; i < count; ++i) {
+		flags = SQFS_BLK_IS_COMPRESSED | extra_flags;
+		if (i == 0)
+			flags |= SQFS_BLK_FIRST_BLOCK;
+		if (i == count - 1)
+			flags |= SQFS_BLK_LAST_BLOCK;
+
+		memset(blk_data, chksums[i] & 0xFF, sizeof(blk_data));
+
+		TEST_ASSERT(sqfs_block_writer_write(wr, BLK_SIZE, chksums[i],
+						    flags, blk_data,
+						    &location) == 0);
+		if (i == 0)
+			first = location;
+	}
+
+	/* the last block returns the start of the deduplicated file */
+	return (extra_flags & SQFS_BLK_DONT_DEDUPLICATE) ? first : location;
+}
+
+int main(void)
+{
+	const sqfs_block_writer_stats_t *stats;
+	sqfs_u64 loc[NUM_FILES], location, size;
+	sqfs_block_writer_t *wr;
+	sqfs_u32 chk[3];
+	mem_file_t *file;
+	size_t i;
+
+	file = mem_file_create();
+	wr = sqfs_block_writer_create((sqfs_file_t *)file, 0, 0);
+	TEST_NOT_NULL(wr);
+	stats = sqfs_block_writer_get_stats(wr);
+
+	/* enough unique files to make the index grow a few times */
+	for (i = 0; i < NUM_FILES; ++i) {
+		chk[0] = 2 * i + 1;
+		chk[1] = 2 * i + 2;
+		loc[i] = write_file(wr, chk, 2, 0);
+		TEST_EQUAL_UI(loc[i], i * 2 * BLK_SIZE);
+	}
+
+	TEST_EQUAL_UI(stats->index_hits, 0);
+	TEST_EQUAL_UI(stats->index_misses, NUM_FILES);
+	TEST_EQUAL_UI(stats->blocks_written, 2 * NUM_FILES);
+	size = file->size;
+	TEST_EQUAL_UI(size, 2 * NUM_FILES * BLK_SIZE);
+
+	/* a copy of an earlier file is removed again */
+	chk[0] = 2 * 150 + 1;
+	chk[1] = 2 * 150 + 2;
+	location = write_file(wr, chk, 2, 0);
+	TEST_EQUAL_UI(location, loc[150]);
+	TEST_EQUAL_UI(stats->index_hits, 1);
+	TEST_EQUAL_UI(file->size, size);
+
+	/* a run crossing the boundary of two earlier files */
+	chk[0] = 2 * 10 + 2;
+	chk[1] = 2 * 11 + 1;
+	location = write_file(wr, chk, 2, 0);
+	TEST_EQUAL_UI(location, loc[10] + BLK_SIZE);
+	TEST_EQUAL_UI(stats->index_hits, 2);
+	TEST_EQUAL_UI(file->size, size);
+
+	/* matching prefix only, must be kept */
+	chk[0] = 2 * 20 + 1;
+	chk[1] = 2 * 20 + 2;
+	chk[2] = 100000;
+	location = write_file(wr, chk, 3, 0);
+	TEST_EQUAL_UI(location, size);
+	TEST_EQUAL_UI(stats->index_misses, NUM_FILES + 1);
+	size += 3 * BLK_SIZE;
+	TEST_EQUAL_UI(file->size, size);
+
+	/* with two identical copies on disk, the earliest one is used */
+	chk[0] = 200000;
+	chk[1] = 200001;
+	loc[0] = write_file(wr, chk, 2, SQFS_BLK_DONT_DEDUPLICATE);
+	loc[1] = write_file(wr, chk, 2, SQFS_BLK_DONT_DEDUPLICATE);
+	TEST_EQUAL_UI(loc[0], size);
+	TEST_EQUAL_UI(loc[1], size + 2 * BLK_SIZE);
+	size += 4 * BLK_SIZE;
+
+	location = write_file(wr, chk, 2, 0);
+	TEST_EQUAL_UI(location, loc[0]);
+	TEST_EQUAL_UI(file->size, size);
+
+	/* a file must not be deduplicated against its own blocks */
+	chk[0] = chk[1] = chk[2] = 300000;
+	loc[2] = write_file(wr, chk, 3, 0);
+	TEST_EQUAL_UI(loc[2], size);
+	size += 3 * BLK_SIZE;
+	TEST_EQUAL_UI(file->size, size);
+
+	location = write_file(wr, chk, 2, 0);
+	TEST_EQUAL_UI(location, loc[2]);
+	TEST_EQUAL_UI(file->size, size);
+
+	TEST_EQUAL_UI(stats->blocks_written, size / BLK_SIZE);
+
+	sqfs_destroy(wr);
+	sqfs_destroy(file);
+	return EXIT_SUCCESS;
+}
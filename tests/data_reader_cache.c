@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * data_reader_cache.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "image.h"
+
+#define BLOCK_SIZE (4096)
+#define NUM_FILES (4)
+#define FILE_SIZE (2 * BLOCK_SIZE)
+#define TAIL_SIZE (100)
+
+static sqfs_u8 ref[NUM_FILES][FILE_SIZE];
+static sqfs_u8 tail[2][TAIL_SIZE];
+
+static const char *names[NUM_FILES] = { "a", "b", "c", "d" };
+
+static sqfs_u64 hits, misses;
+
+static void read_block(test_image_t *img, sqfs_inode_generic_t *inode,
+		       const sqfs_u8 *data, size_t idx, int expect_hit)
+{
+	const sqfs_data_reader_stats_t *stats;
+	sqfs_u8 buffer[BLOCK_SIZE];
+
+	TEST_EQUAL_I(sqfs_data_reader_read(img->data, inode, idx * BLOCK_SIZE,
+					   buffer, BLOCK_SIZE), BLOCK_SIZE);
+	TEST_ASSERT(memcmp(buffer, data + idx * BLOCK_SIZE, BLOCK_SIZE) == 0);
+
+	if (expect_hit) {
+		hits += 1;
+	} else {
+		misses += 1;
+	}
+
+	stats = sqfs_data_reader_get_stats(img->data);
+	TEST_EQUAL_UI(stats->cache_hits, hits);
+	TEST_EQUAL_UI(stats->cache_misses, misses);
+}
+
+static void read_tail(test_image_t *img, sqfs_inode_generic_t *inode,
+		      const sqfs_u8 *data, int expect_hit)
+{
+	const sqfs_data_reader_stats_t *stats;
+	sqfs_u8 buffer[TAIL_SIZE];
+
+	TEST_EQUAL_I(sqfs_data_reader_read(img->data, inode, 0, buffer,
+					   TAIL_SIZE), TAIL_SIZE);
+	TEST_ASSERT(memcmp(buffer, data, TAIL_SIZE) == 0);
+
+	if (expect_hit) {
+		hits += 1;
+	} else {
+		misses += 1;
+	}
+
+	stats = sqfs_data_reader_get_stats(img->data);
+	TEST_EQUAL_UI(stats->cache_hits, hits);
+	TEST_EQUAL_UI(stats->cache_misses, misses);
+}
+
+int main(void)
+{
+	sqfs_inode_generic_t *inode[NUM_FILES], *tinode[2];
+	const sqfs_data_reader_stats_t *stats;
+	sqfs_data_reader_t *copy, *orig;
+	sqfs_u64 old_hits, old_misses;
+	sqfs_u32 seed = 1;
+	test_writer_t wr;
+	test_image_t img;
+	size_t i, j;
+
+	for (i = 0; i < NUM_FILES; ++i) {
+		for (j = 0; j < FILE_SIZE; ++j) {
+			seed = seed * 1103515245 + 12345;
+			ref[i][j] = (seed >> 16) & 0xFF;
+		}
+	}
+
+	memset(tail[0], 'x', TAIL_SIZE);
+	memset(tail[1], 'y', TAIL_SIZE);
+
+	test_writer_init(&wr, BLOCK_SIZE, 1);
+	for (i = 0; i < NUM_FILES; ++i)
+		test_writer_add_file(&wr, names[i], ref[i], FILE_SIZE);
+	test_writer_add_file(&wr, "x", tail[0], TAIL_SIZE);
+	test_writer_add_file(&wr, "y", tail[1], TAIL_SIZE);
+
+	test_image_open(&img, test_writer_finish(&wr));
+
+	for (i = 0; i < NUM_FILES; ++i)
+		inode[i] = test_image_lookup(&img, names[i]);
+	tinode[0] = test_image_lookup(&img, "x");
+	tinode[1] = test_image_lookup(&img, "y");
+
+	/* room for two blocks */
+	TEST_ASSERT(sqfs_data_reader_set_cache_size(img.data,
+						    2 * BLOCK_SIZE + 10) == 0);
+
+	read_block(&img, inode[0], ref[0], 0, 0);
+	read_block(&img, inode[1], ref[1], 0, 0);
+	read_block(&img, inode[0], ref[0], 0, 1);
+
+	/* "b" is the least recently used block and gets evicted */
+	read_block(&img, inode[2], ref[2], 0, 0);
+	read_block(&img, inode[0], ref[0], 0, 1);
+	read_block(&img, inode[1], ref[1], 0, 0);
+	read_block(&img, inode[2], ref[2], 0, 0);
+
+	/* interleaving two files whose blocks all fit never misses */
+	TEST_ASSERT(sqfs_data_reader_set_cache_size(img.data,
+						    4 * BLOCK_SIZE) == 0);
+
+	read_block(&img, inode[3], ref[3], 0, 0);
+	read_block(&img, inode[3], ref[3], 1, 0);
+
+	for (i = 0; i < 4; ++i) {
+		read_block(&img, inode[2], ref[2], 0, 1);
+		read_block(&img, inode[3], ref[3], 0, 1);
+		read_block(&img, inode[3], ref[3], 1, 1);
+	}
+
+	/* both tail ends share a fragment block that is only read once */
+	read_tail(&img, tinode[0], tail[0], 0);
+	read_tail(&img, tinode[1], tail[1], 1);
+	read_tail(&img, tinode[0], tail[0], 1);
+
+	/* shrinking the cache drops all but the most recently used block */
+	TEST_ASSERT(sqfs_data_reader_set_cache_size(img.data, 0) == 0);
+	read_tail(&img, tinode[1], tail[1], 1);
+	read_block(&img, inode[3], ref[3], 1, 0);
+	read_tail(&img, tinode[0], tail[0], 0);
+
+	/* a copy starts out with an empty cache */
+	TEST_ASSERT(sqfs_data_reader_set_cache_size(img.data,
+						    4 * BLOCK_SIZE) == 0);
+	read_block(&img, inode[0], ref[0], 1, 0);
+	read_block(&img, inode[0], ref[0], 1, 1);
+
+	copy = sqfs_copy(img.data);
+	TEST_NOT_NULL(copy);
+
+	orig = img.data;
+	img.data = copy;
+	old_hits = hits;
+	old_misses = misses;
+
+	read_block(&img, inode[0], ref[0], 1, 0);
+	read_block(&img, inode[0], ref[0], 1, 1);
+
+	sqfs_destroy(copy);
+	img.data = orig;
+
+	/* without touching the counters of the original */
+	stats = sqfs_data_reader_get_stats(img.data);
+	TEST_EQUAL_UI(stats->cache_hits, old_hits);
+	TEST_EQUAL_UI(stats->cache_misses, old_misses);
+
+	for (i = 0; i < NUM_FILES; ++i)
+		free(inode[i]);
+	free(tinode[0]);
+	free(tinode[1]);
+
+	test_image_close(&img);
+	return EXIT_SUCCESS;
+}
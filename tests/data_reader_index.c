@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * data_reader_index.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "image.h"
+
+#define BLOCK_SIZE (4096)
+#define NUM_R (20)
+
+static void fill_random(sqfs_u8 *data, size_t size, sqfs_u32 seed)
+{
+	size_t i;
+
+	for (i = 0; i < size; ++i) {
+		seed = seed * 1103515245 + 12345;
+		data[i] = seed >> 16;
+	}
+}
+
+static void check_read(test_image_t *img, const sqfs_inode_generic_t *inode,
+		       sqfs_u64 offset, const sqfs_u8 *ref, size_t size)
+{
+	sqfs_u8 buffer[BLOCK_SIZE];
+	sqfs_s32 ret;
+
+	ret = sqfs_data_reader_read(img->data, inode, offset, buffer, size);
+	TEST_EQUAL_I(ret, (sqfs_s32)size);
+	TEST_ASSERT(memcmp(buffer, ref, size) == 0);
+}
+
+int main(void)
+{
+	sqfs_u8 r[NUM_R * BLOCK_SIZE], q[BLOCK_SIZE];
+	sqfs_u8 a[(NUM_R + 1) * BLOCK_SIZE], c[(NUM_R + 1) * BLOCK_SIZE];
+	sqfs_inode_generic_t *ia, *ic;
+	sqfs_u64 start_a, start_c;
+	test_writer_t wr;
+	test_image_t img;
+	size_t i;
+
+	fill_random(r, sizeof(r), 1);
+	fill_random(q, sizeof(q), 2);
+
+	/* a sparse block followed by R, Q and then R followed by Q */
+	memset(a, 0, BLOCK_SIZE);
+	memcpy(a + BLOCK_SIZE, r, sizeof(r));
+	memcpy(c, r, sizeof(r));
+	memcpy(c + sizeof(r), q, sizeof(q));
+
+	test_writer_init(&wr, BLOCK_SIZE, 1);
+	test_writer_add_file(&wr, "a", a, sizeof(a));
+	test_writer_add_file(&wr, "b", q, sizeof(q));
+	test_writer_add_file(&wr, "c", c, sizeof(c));
+
+	test_image_open(&img, test_writer_finish(&wr));
+	ia = test_image_lookup(&img, "a");
+	ic = test_image_lookup(&img, "c");
+
+	/* the sparse block takes no space, c is a duplicate of R and Q */
+	sqfs_inode_get_file_block_start(ia, &start_a);
+	sqfs_inode_get_file_block_start(ic, &start_c);
+	TEST_EQUAL_UI(start_a, start_c);
+	TEST_EQUAL_UI(sqfs_inode_get_file_block_count(ia),
+		      sqfs_inode_get_file_block_count(ic));
+
+	/* build the block index for a, then seek to the end of c */
+	check_read(&img, ia, (NUM_R - 2) * BLOCK_SIZE, a + (NUM_R - 2) *
+		   BLOCK_SIZE, BLOCK_SIZE);
+	check_read(&img, ic, NUM_R * BLOCK_SIZE, q, BLOCK_SIZE);
+	check_read(&img, ia, NUM_R * BLOCK_SIZE, a + NUM_R * BLOCK_SIZE,
+		   BLOCK_SIZE);
+
+	/* random access back and forth between the two */
+	for (i = NUM_R; i > 0; --i) {
+		check_read(&img, ia, i * BLOCK_SIZE, a + i * BLOCK_SIZE,
+			   BLOCK_SIZE);
+		check_read(&img, ic, i * BLOCK_SIZE, c + i * BLOCK_SIZE,
+			   BLOCK_SIZE);
+	}
+
+	free(ia);
+	free(ic);
+	test_image_close(&img);
+	return EXIT_SUCCESS;
+}
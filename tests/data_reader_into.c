@@ -0,0 +1,124 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * data_reader_into.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "image.h"
+
+#define BLOCK_SIZE (4096)
+#define NUM_BLOCKS (5)
+#define TAIL_SIZE (321)
+#define FILE_SIZE (NUM_BLOCKS * BLOCK_SIZE + TAIL_SIZE)
+#define SPARSE_BLOCK (2)
+
+static sqfs_u8 ref[FILE_SIZE];
+
+static void check_blocks(sqfs_data_reader_t *data,
+			 const sqfs_inode_generic_t *inode)
+{
+	sqfs_u8 buffer[BLOCK_SIZE], *out;
+	size_t i, size, out_size;
+
+	for (i = 0; i < NUM_BLOCKS; ++i) {
+		memset(buffer, 0xFF, sizeof(buffer));
+
+		TEST_ASSERT(sqfs_data_reader_get_block_into(data, inode, i,
+							    &size,
+							    buffer) == 0);
+		TEST_EQUAL_UI(size, BLOCK_SIZE);
+		TEST_ASSERT(memcmp(buffer, ref + i * BLOCK_SIZE,
+				   BLOCK_SIZE) == 0);
+
+		/* same result as the allocating version */
+		TEST_ASSERT(sqfs_data_reader_get_block(data, inode, i,
+						       &out_size, &out) == 0);
+		TEST_EQUAL_UI(out_size, size);
+		TEST_ASSERT(memcmp(out, buffer, size) == 0);
+		free(out);
+	}
+
+	size = 1234;
+	TEST_EQUAL_I(sqfs_data_reader_get_block_into(data, inode, NUM_BLOCKS,
+						     &size, buffer),
+		     SQFS_ERROR_OUT_OF_BOUNDS);
+	TEST_EQUAL_UI(size, 0);
+}
+
+static void check_fragment(sqfs_data_reader_t *data,
+			   const sqfs_inode_generic_t *inode)
+{
+	sqfs_u8 buffer[BLOCK_SIZE], *out;
+	size_t size, out_size;
+
+	memset(buffer, 0xFF, sizeof(buffer));
+
+	TEST_ASSERT(sqfs_data_reader_get_fragment_into(data, inode, &size,
+						       buffer) == 0);
+	TEST_EQUAL_UI(size, TAIL_SIZE);
+	TEST_ASSERT(memcmp(buffer, ref + NUM_BLOCKS * BLOCK_SIZE,
+			   TAIL_SIZE) == 0);
+
+	/* nothing beyond the tail end is touched */
+	TEST_EQUAL_UI(buffer[TAIL_SIZE], 0xFF);
+
+	TEST_ASSERT(sqfs_data_reader_get_fragment(data, inode,
+						  &out_size, &out) == 0);
+	TEST_EQUAL_UI(out_size, size);
+	TEST_ASSERT(memcmp(out, buffer, size) == 0);
+	free(out);
+}
+
+int main(void)
+{
+	sqfs_inode_generic_t *inode, *blocks_only;
+	sqfs_u8 buffer[BLOCK_SIZE];
+	sqfs_u32 seed = 1;
+	test_writer_t wr;
+	test_image_t img;
+	size_t i, size;
+
+	for (i = 0; i < FILE_SIZE; ++i) {
+		seed = seed * 1103515245 + 12345;
+		ref[i] = (seed >> 16) & 0x0F;
+	}
+
+	memset(ref + SPARSE_BLOCK * BLOCK_SIZE, 0, BLOCK_SIZE);
+
+	test_writer_init(&wr, BLOCK_SIZE, 1);
+	test_writer_add_file(&wr, "file", ref, FILE_SIZE);
+	test_writer_add_file(&wr, "blocks", ref, NUM_BLOCKS * BLOCK_SIZE);
+
+	test_image_open(&img, test_writer_finish(&wr));
+
+	inode = test_image_lookup(&img, "file");
+	TEST_EQUAL_UI(sqfs_inode_get_file_block_count(inode), NUM_BLOCKS);
+	TEST_ASSERT(SQFS_IS_SPARSE_BLOCK(inode->extra[SPARSE_BLOCK]));
+
+	blocks_only = test_image_lookup(&img, "blocks");
+
+	/* straight from disk, then with the blocks going through the cache */
+	check_blocks(img.data, inode);
+	check_fragment(img.data, inode);
+
+	for (i = 0; i < FILE_SIZE; i += BLOCK_SIZE) {
+		TEST_ASSERT(sqfs_data_reader_read(img.data, inode, i, buffer,
+						  BLOCK_SIZE) > 0);
+	}
+
+	check_blocks(img.data, inode);
+	check_fragment(img.data, inode);
+
+	/* a file without a tail end yields an empty fragment */
+	size = 1234;
+	TEST_ASSERT(sqfs_data_reader_get_fragment_into(img.data, blocks_only,
+						       &size, buffer) == 0);
+	TEST_EQUAL_UI(size, 0);
+
+	free(blocks_only);
+	free(inode);
+	test_image_close(&img);
+	return EXIT_SUCCESS;
+}
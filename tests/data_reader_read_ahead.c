@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * data_reader_read_ahead.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "image.h"
+
+#define BLOCK_SIZE (4096)
+#define NUM_BLOCKS (32)
+#define FILE_SIZE (NUM_BLOCKS * BLOCK_SIZE + 100)
+
+static sqfs_u8 ref[FILE_SIZE];
+
+int main(void)
+{
+	const sqfs_data_reader_stats_t *stats;
+	sqfs_inode_generic_t *inode;
+	sqfs_u8 buffer[BLOCK_SIZE];
+	sqfs_u32 seed = 1;
+	test_writer_t wr;
+	test_image_t img;
+	sqfs_s32 ret;
+	size_t i;
+
+	/* low entropy, so every block is compressed, but no two are equal */
+	for (i = 0; i < FILE_SIZE; ++i) {
+		seed = seed * 1103515245 + 12345;
+		ref[i] = (seed >> 16) & 0x0F;
+	}
+
+	test_writer_init(&wr, BLOCK_SIZE, 1);
+	test_writer_add_file(&wr, "file", ref, FILE_SIZE);
+
+	test_image_open(&img, test_writer_finish(&wr));
+	TEST_ASSERT(sqfs_data_reader_set_read_ahead(img.data, 2, 0) == 0);
+
+	inode = test_image_lookup(&img, "file");
+	TEST_EQUAL_UI(sqfs_inode_get_file_block_count(inode), NUM_BLOCKS);
+
+	for (i = 0; i < NUM_BLOCKS; ++i)
+		TEST_ASSERT(SQFS_IS_BLOCK_COMPRESSED(inode->extra[i]));
+
+	/* read the file front to back */
+	for (i = 0; i < FILE_SIZE; i += ret) {
+		ret = sqfs_data_reader_read(img.data, inode, i,
+					    buffer, sizeof(buffer));
+		TEST_ASSERT(ret > 0);
+		TEST_ASSERT(memcmp(buffer, ref + i, ret) == 0);
+	}
+
+	stats = sqfs_data_reader_get_stats(img.data);
+#ifdef WITH_PTHREAD
+	/* all but the first block are decompressed by the workers */
+	TEST_EQUAL_UI(stats->read_ahead_hits, NUM_BLOCKS - 1);
+#else
+	TEST_EQUAL_UI(stats->read_ahead_hits, 0);
+#endif
+
+	free(inode);
+	test_image_close(&img);
+	return EXIT_SUCCESS;
+}
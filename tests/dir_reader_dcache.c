@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * dir_reader_dcache.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "../lib/sqfs/dir_reader/dcache.c"
+#include "test.h"
+
+#define MAX_ENTRIES (3)
+
+static void insert(dcache_t *cache, sqfs_u64 parent, const char *name,
+		   sqfs_u64 ref)
+{
+	dcache_value_t value;
+
+	memset(&value, 0, sizeof(value));
+	value.inode_ref = ref;
+	value.inode_type = SQFS_INODE_DIR;
+	value.dir_location = ref << 16;
+	value.dir_size = ref + 3;
+
+	dcache_insert(cache, parent, name, strlen(name), &value);
+}
+
+static void check_hit(dcache_t *cache, sqfs_u64 parent, const char *name,
+		      sqfs_u64 ref)
+{
+	const dcache_value_t *value;
+
+	value = dcache_lookup(cache, parent, name, strlen(name));
+	TEST_NOT_NULL(value);
+	TEST_EQUAL_UI(value->inode_ref, ref);
+	TEST_EQUAL_I(value->inode_type, SQFS_INODE_DIR);
+	TEST_EQUAL_UI(value->dir_location, ref << 16);
+	TEST_EQUAL_UI(value->dir_size, ref + 3);
+}
+
+static void check_miss(dcache_t *cache, sqfs_u64 parent, const char *name)
+{
+	TEST_NULL(dcache_lookup(cache, parent, name, strlen(name)));
+}
+
+int main(void)
+{
+	dcache_t cache;
+	size_t i;
+
+	memset(&cache, 0, sizeof(cache));
+
+	/* a disabled cache remembers nothing */
+	TEST_ASSERT(dcache_init(&cache, 0) == 0);
+	insert(&cache, 1, "foo", 10);
+	check_miss(&cache, 1, "foo");
+	TEST_EQUAL_UI(cache.count, 0);
+
+	TEST_ASSERT(dcache_init(&cache, MAX_ENTRIES) == 0);
+
+	insert(&cache, 1, "foo", 10);
+	insert(&cache, 1, "bar", 11);
+	insert(&cache, 2, "foo", 12);
+	TEST_EQUAL_UI(cache.count, 3);
+
+	/* the parent is part of the key, the name length as well */
+	check_hit(&cache, 1, "foo", 10);
+	check_hit(&cache, 2, "foo", 12);
+	check_miss(&cache, 3, "foo");
+	TEST_NULL(dcache_lookup(&cache, 1, "foobar", 2));
+	TEST_NOT_NULL(dcache_lookup(&cache, 1, "foobar", 3));
+
+	/* "bar" is now the least recently used one */
+	insert(&cache, 1, "baz", 13);
+	TEST_EQUAL_UI(cache.count, MAX_ENTRIES);
+	check_miss(&cache, 1, "bar");
+	check_hit(&cache, 1, "foo", 10);
+	check_hit(&cache, 2, "foo", 12);
+	check_hit(&cache, 1, "baz", 13);
+
+	/* a hit on the oldest entry protects it from eviction */
+	check_hit(&cache, 1, "foo", 10);
+	insert(&cache, 1, "qux", 14);
+	check_miss(&cache, 2, "foo");
+	check_hit(&cache, 1, "foo", 10);
+	check_hit(&cache, 1, "baz", 13);
+	check_hit(&cache, 1, "qux", 14);
+
+	/* never grows beyond its limit */
+	for (i = 0; i < 100; ++i)
+		insert(&cache, 100 + i, "x", 100 + i);
+
+	TEST_EQUAL_UI(cache.count, MAX_ENTRIES);
+
+	for (i = 0; i < 100 - MAX_ENTRIES; ++i)
+		check_miss(&cache, 100 + i, "x");
+
+	for (; i < 100; ++i)
+		check_hit(&cache, 100 + i, "x", 100 + i);
+
+	check_miss(&cache, 1, "foo");
+
+	/* resizing drops everything */
+	TEST_ASSERT(dcache_init(&cache, 2 * MAX_ENTRIES) == 0);
+	TEST_EQUAL_UI(cache.count, 0);
+	check_miss(&cache, 199, "x");
+
+	dcache_cleanup(&cache);
+	return EXIT_SUCCESS;
+}
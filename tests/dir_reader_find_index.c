@@ -0,0 +1,116 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * dir_reader_find_index.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "image.h"
+
+#define NUM_ENTRIES (2000)
+
+/* long names, so that the listing spans a lot of meta data blocks */
+#define NAME_FMT "entry_%05u_with_a_rather_long_file_name"
+
+static sqfs_u8 data[NUM_ENTRIES];
+
+static void get_name(char *buffer, unsigned int i)
+{
+	/* only even numbers exist, odd ones fall between two entries */
+	sprintf(buffer, NAME_FMT, 2 * i);
+}
+
+static void check_found(test_image_t *img, const char *name, sqfs_u64 size)
+{
+	sqfs_inode_generic_t *inode;
+	sqfs_u64 actual;
+
+	TEST_ASSERT(sqfs_dir_reader_find(img->dr, name) == 0);
+	TEST_ASSERT(sqfs_dir_reader_get_inode(img->dr, &inode) == 0);
+	TEST_EQUAL_UI(inode->base.type, SQFS_INODE_FILE);
+
+	sqfs_inode_get_file_size(inode, &actual);
+	TEST_EQUAL_UI(actual, size);
+	free(inode);
+}
+
+static void check_missing(test_image_t *img, const char *name)
+{
+	TEST_EQUAL_I(sqfs_dir_reader_find(img->dr, name), SQFS_ERROR_NO_ENTRY);
+}
+
+int main(void)
+{
+	sqfs_inode_generic_t *dir, *inode;
+	char name[64], path[80];
+	test_writer_t wr;
+	test_image_t img;
+	unsigned int i;
+	sqfs_u64 size;
+
+	memset(data, 'A', sizeof(data));
+
+	test_writer_init(&wr, SQFS_DEFAULT_BLOCK_SIZE, 1);
+	test_writer_add_dir(&wr, "big");
+
+	for (i = 0; i < NUM_ENTRIES; ++i) {
+		get_name(name, i);
+		sprintf(path, "big/%s", name);
+		test_writer_add_file(&wr, path, data, i + 1);
+	}
+
+	test_image_open(&img, test_writer_finish(&wr));
+
+	dir = test_image_lookup(&img, "big");
+	TEST_EQUAL_UI(dir->base.type, SQFS_INODE_EXT_DIR);
+	TEST_ASSERT(dir->data.dir_ext.inodex_count > 4);
+
+	TEST_ASSERT(sqfs_dir_reader_open_dir(img.dr, dir) == 0);
+
+	/* first and last entry */
+	get_name(name, 0);
+	check_found(&img, name, 1);
+	get_name(name, NUM_ENTRIES - 1);
+	check_found(&img, name, NUM_ENTRIES);
+
+	/* every entry, backwards, so each search starts at the wrong place */
+	for (i = NUM_ENTRIES; i > 0; --i) {
+		get_name(name, i - 1);
+		check_found(&img, name, i);
+	}
+
+	/* names sorting before, after and between the existing ones */
+	check_missing(&img, "a");
+	check_missing(&img, "entry_");
+	check_missing(&img, "zzz");
+
+	for (i = 0; i < NUM_ENTRIES; ++i) {
+		sprintf(name, NAME_FMT, 2 * i + 1);
+		check_missing(&img, name);
+
+		/* prefix of an existing name */
+		get_name(name, i);
+		name[strlen(name) - 1] = '\0';
+		check_missing(&img, name);
+	}
+
+	/* still works after a failed search */
+	get_name(name, NUM_ENTRIES / 2);
+	check_found(&img, name, NUM_ENTRIES / 2 + 1);
+
+	/* path lookups go through the same search */
+	for (i = 0; i < NUM_ENTRIES; i += 97) {
+		get_name(name, i);
+		sprintf(path, "big/%s", name);
+
+		inode = test_image_lookup(&img, path);
+		sqfs_inode_get_file_size(inode, &size);
+		TEST_EQUAL_UI(size, i + 1);
+		free(inode);
+	}
+
+	free(dir);
+	test_image_close(&img);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,187 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * dir_tree_lazy.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "image.h"
+
+#define NUM_MANY (500)
+
+static const char data[] = "Hello, World!\n";
+
+static size_t count_nodes(sqfs_tree_node_t *n)
+{
+	sqfs_tree_node_t *it;
+	size_t count = 1;
+
+	TEST_ASSERT(sqfs_dir_tree_get_children(n, &it) == 0);
+
+	for (; it != NULL; it = it->next)
+		count += count_nodes(it);
+
+	return count;
+}
+
+/* walk both trees, expanding lazy directories on the way */
+static void compare_trees(sqfs_tree_node_t *ref, sqfs_tree_node_t *n,
+			  sqfs_u32 node_flags)
+{
+	sqfs_tree_node_t *rit, *it;
+
+	TEST_STR_EQUAL((const char *)n->name, (const char *)ref->name);
+	TEST_EQUAL_UI(n->inode->base.type, ref->inode->base.type);
+	TEST_EQUAL_UI(n->inode->base.inode_number,
+		      ref->inode->base.inode_number);
+	TEST_EQUAL_UI(n->uid, ref->uid);
+	TEST_EQUAL_UI(n->gid, ref->gid);
+
+	TEST_ASSERT(sqfs_dir_tree_get_children(ref, &rit) == 0);
+	TEST_ASSERT(sqfs_dir_tree_get_children(n, &it) == 0);
+	TEST_EQUAL_UI(n->flags, node_flags);
+
+	while (rit != NULL && it != NULL) {
+		TEST_ASSERT(it->parent == n);
+		compare_trees(rit, it, node_flags);
+
+		rit = rit->next;
+		it = it->next;
+	}
+
+	TEST_NULL(rit);
+	TEST_NULL(it);
+}
+
+static sqfs_tree_node_t *find_child(sqfs_tree_node_t *n, const char *name)
+{
+	for (n = n->children; n != NULL; n = n->next) {
+		if (strcmp((const char *)n->name, name) == 0)
+			break;
+	}
+
+	return n;
+}
+
+int main(void)
+{
+	sqfs_tree_node_t *ref, *tree, *n, *it;
+	char path[64];
+	test_writer_t wr;
+	test_image_t img;
+	size_t i;
+
+	test_writer_init(&wr, SQFS_DEFAULT_BLOCK_SIZE, 1);
+	test_writer_add_dir(&wr, "a");
+	test_writer_add_dir(&wr, "a/sub");
+	test_writer_add_dir(&wr, "empty");
+	test_writer_add_dir(&wr, "many");
+	test_writer_add_file(&wr, "a/x", data, sizeof(data));
+	test_writer_add_file(&wr, "a/y", data, sizeof(data) - 1);
+	test_writer_add_file(&wr, "a/sub/z", data, 3);
+	test_writer_add_file(&wr, "file", data, 5);
+
+	/* enough nodes to fill a few arena chunks */
+	for (i = 0; i < NUM_MANY; ++i) {
+		sprintf(path, "many/file_with_a_long_name_%04u", (unsigned)i);
+		test_writer_add_file(&wr, path, data, i % sizeof(data));
+	}
+
+	test_image_open(&img, test_writer_finish(&wr));
+
+	/* reference, one allocation per node */
+	TEST_ASSERT(sqfs_dir_reader_get_full_hierarchy(img.dr, img.idtbl,
+						       NULL, 0, &ref) == 0);
+	TEST_EQUAL_UI(ref->flags, 0);
+	TEST_EQUAL_UI(count_nodes(ref), NUM_MANY + 9);
+
+	/* the same tree from an arena */
+	TEST_ASSERT(sqfs_dir_reader_get_full_hierarchy(img.dr, img.idtbl,
+						       NULL, SQFS_TREE_ARENA,
+						       &tree) == 0);
+	compare_trees(ref, tree, SQFS_TREE_NODE_ARENA);
+
+	/* destroying anything but the root does nothing */
+	sqfs_dir_tree_destroy(find_child(tree, "a"));
+	compare_trees(ref, tree, SQFS_TREE_NODE_ARENA);
+	sqfs_dir_tree_destroy(tree);
+
+	/* a lazy tree only has the root at first */
+	TEST_ASSERT(sqfs_dir_reader_get_full_hierarchy(img.dr, img.idtbl,
+						       NULL, SQFS_TREE_LAZY,
+						       &tree) == 0);
+	TEST_EQUAL_UI(tree->flags,
+		      SQFS_TREE_NODE_ARENA | SQFS_TREE_NODE_UNEXPANDED);
+	TEST_NULL(tree->children);
+
+	TEST_ASSERT(sqfs_dir_tree_get_children(tree, &it) == 0);
+	TEST_ASSERT(it == tree->children);
+	TEST_EQUAL_UI(tree->flags, SQFS_TREE_NODE_ARENA);
+
+	n = find_child(tree, "a");
+	TEST_NOT_NULL(n);
+	TEST_EQUAL_UI(n->flags,
+		      SQFS_TREE_NODE_ARENA | SQFS_TREE_NODE_UNEXPANDED);
+	TEST_NULL(n->children);
+
+	n = find_child(tree, "file");
+	TEST_NOT_NULL(n);
+	TEST_EQUAL_UI(n->flags, SQFS_TREE_NODE_ARENA);
+
+	/* expanding again returns the same nodes */
+	TEST_ASSERT(sqfs_dir_tree_get_children(tree, &n) == 0);
+	TEST_ASSERT(n == it);
+
+	compare_trees(ref, tree, SQFS_TREE_NODE_ARENA);
+	sqfs_dir_tree_destroy(tree);
+
+	/* a lazy sub tree, with and without the parents */
+	TEST_ASSERT(sqfs_dir_reader_get_full_hierarchy(img.dr, img.idtbl,
+						       "a", SQFS_TREE_LAZY,
+						       &tree) == 0);
+	TEST_NULL(tree->parent);
+	compare_trees(find_child(ref, "a"), tree, SQFS_TREE_NODE_ARENA);
+	sqfs_dir_tree_destroy(tree);
+
+	TEST_ASSERT(sqfs_dir_reader_get_full_hierarchy(img.dr, img.idtbl,
+						       "a/sub",
+						       SQFS_TREE_LAZY |
+						       SQFS_TREE_STORE_PARENTS,
+						       &tree) == 0);
+	TEST_NOT_NULL(tree->children);
+	TEST_NULL(tree->children->next);
+	n = tree->children->children;
+	TEST_NOT_NULL(n);
+	TEST_STR_EQUAL((const char *)n->name, "sub");
+	TEST_EQUAL_UI(n->flags,
+		      SQFS_TREE_NODE_ARENA | SQFS_TREE_NODE_UNEXPANDED);
+	compare_trees(find_child(find_child(ref, "a"), "sub"), n,
+		      SQFS_TREE_NODE_ARENA);
+	sqfs_dir_tree_destroy(tree);
+
+	/* lazy trees cannot know in advance which directories end up empty */
+	tree = NULL;
+	TEST_EQUAL_I(sqfs_dir_reader_get_full_hierarchy(img.dr, img.idtbl,
+							NULL,
+							SQFS_TREE_LAZY |
+							SQFS_TREE_NO_EMPTY,
+							&tree),
+		     SQFS_ERROR_UNSUPPORTED);
+	TEST_NULL(tree);
+
+	/* but the arena alone can */
+	TEST_ASSERT(sqfs_dir_reader_get_full_hierarchy(img.dr, img.idtbl,
+						       NULL,
+						       SQFS_TREE_ARENA |
+						       SQFS_TREE_NO_EMPTY,
+						       &tree) == 0);
+	TEST_NULL(find_child(tree, "empty"));
+	TEST_NOT_NULL(find_child(tree, "a"));
+	TEST_EQUAL_UI(count_nodes(tree), NUM_MANY + 8);
+	sqfs_dir_tree_destroy(tree);
+
+	sqfs_dir_tree_destroy(ref);
+	test_image_close(&img);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,106 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * file_mmap.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "image.h"
+
+#define IMAGE_NAME "file_mmap.sqfs"
+#define BLOCK_SIZE (4096)
+#define FILE_SIZE (5 * BLOCK_SIZE + 100)
+
+static sqfs_u8 ref[3][FILE_SIZE];
+
+static const char *names[3] = { "a", "dir/b", "dir/c" };
+
+static void fill_data(void)
+{
+	sqfs_u32 seed = 1;
+	size_t i, j;
+
+	for (i = 0; i < 3; ++i) {
+		for (j = 0; j < FILE_SIZE; ++j) {
+			seed = seed * 1103515245 + 12345;
+
+			/* make "a" compressible, the others not */
+			ref[i][j] = i == 0 ? (j / 100) & 0xFF : (seed >> 16);
+		}
+	}
+}
+
+static void check_files(test_image_t *img)
+{
+	sqfs_inode_generic_t *inode;
+	sqfs_u8 buffer[FILE_SIZE];
+	sqfs_s32 ret;
+	size_t i;
+
+	for (i = 0; i < 3; ++i) {
+		inode = test_image_lookup(img, names[i]);
+
+		ret = sqfs_data_reader_read(img->data, inode, 0,
+					    buffer, sizeof(buffer));
+		TEST_EQUAL_I(ret, FILE_SIZE);
+		TEST_ASSERT(memcmp(buffer, ref[i], FILE_SIZE) == 0);
+
+		free(inode);
+	}
+}
+
+int main(void)
+{
+	sqfs_file_t *file, *mapped, *copy;
+	sqfs_u8 a[64], b[64];
+	test_writer_t wr;
+	test_image_t img;
+	size_t i;
+
+	fill_data();
+
+	test_writer_init(&wr, BLOCK_SIZE, 1);
+	test_writer_add_dir(&wr, "dir");
+	for (i = 0; i < 3; ++i)
+		test_writer_add_file(&wr, names[i], ref[i], FILE_SIZE);
+
+	/*
+	  Only a file on disk can be mapped. Open it both ways and remove it
+	  right away, so it does not stay behind if a check fails.
+	 */
+	file = test_writer_finish(&wr);
+	test_image_save(file, IMAGE_NAME);
+	sqfs_destroy(file);
+
+	file = sqfs_open_file(IMAGE_NAME, SQFS_FILE_OPEN_READ_ONLY);
+	mapped = sqfs_open_file(IMAGE_NAME, SQFS_FILE_OPEN_READ_ONLY |
+				SQFS_FILE_OPEN_MMAP);
+	remove(IMAGE_NAME);
+
+	TEST_NOT_NULL(file);
+	TEST_NOT_NULL(mapped);
+
+	/* the same content through pread and through the mapping */
+	test_image_open(&img, file);
+	check_files(&img);
+	test_image_close(&img);
+
+	test_image_open(&img, mapped);
+	check_files(&img);
+
+	TEST_EQUAL_I(img.file->read_at(img.file,
+				       img.file->get_size(img.file) - 10,
+				       a, 20), SQFS_ERROR_OUT_OF_BOUNDS);
+
+	/* a copy maps the file again and outlives the original */
+	copy = sqfs_copy(img.file);
+	TEST_NOT_NULL(copy);
+	TEST_ASSERT(img.file->read_at(img.file, 0, a, sizeof(a)) == 0);
+	test_image_close(&img);
+
+	TEST_ASSERT(copy->read_at(copy, 0, b, sizeof(b)) == 0);
+	TEST_ASSERT(memcmp(a, b, sizeof(a)) == 0);
+	sqfs_destroy(copy);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * fill_files_order.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "../unpack/fill_files.c"
+#include "test.h"
+
+#define BLOCK_SIZE (4096)
+#define NUM_FILES (200)
+#define NUM_FRAGS (7)
+
+static sqfs_inode_generic_t inodes[NUM_FILES];
+
+static sqfs_u32 rng(sqfs_u32 *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 16;
+}
+
+static void gen_files(void)
+{
+	sqfs_inode_generic_t *inode;
+	sqfs_u32 seed = 42, blocks;
+	size_t i;
+
+	files = calloc(NUM_FILES, sizeof(files[0]));
+	TEST_NOT_NULL(files);
+	num_files = NUM_FILES;
+	max_files = NUM_FILES;
+
+	for (i = 0; i < NUM_FILES; ++i) {
+		inode = inodes + i;
+		inode->base.type = SQFS_INODE_FILE;
+		inode->data.file.blocks_start = rng(&seed) % 1000;
+
+		blocks = rng(&seed) % 3;
+		inode->data.file.fragment_index = rng(&seed) % (NUM_FRAGS + 1);
+		inode->data.file.fragment_offset = rng(&seed) % BLOCK_SIZE;
+		inode->data.file.file_size = blocks * BLOCK_SIZE;
+
+		if (inode->data.file.fragment_index == NUM_FRAGS) {
+			inode->data.file.fragment_index = 0xFFFFFFFF;
+			inode->data.file.fragment_offset = 0xFFFFFFFF;
+		} else {
+			inode->data.file.file_size += 1 + rng(&seed) %
+				(BLOCK_SIZE - 1);
+		}
+
+		files[i].inode = inode;
+	}
+}
+
+static int sign(int x)
+{
+	return x < 0 ? -1 : (x > 0 ? 1 : 0);
+}
+
+static void check_sorted(void)
+{
+	const sqfs_inode_generic_t *prev, *cur;
+	sqfs_u32 prev_idx, cur_idx;
+	size_t i, j;
+
+	for (i = 0; i < num_files; ++i) {
+		for (j = 0; j < num_files; ++j) {
+			TEST_EQUAL_I(sign(compare_files(files + i, files + j)),
+				     -sign(compare_files(files + j, files + i)));
+		}
+	}
+
+	for (i = 1; i < num_files; ++i) {
+		prev = files[i - 1].inode;
+		cur = files[i].inode;
+		prev_idx = get_frag_index(prev);
+		cur_idx = get_frag_index(cur);
+
+		/* fragment users come first and are grouped by index */
+		TEST_ASSERT(prev_idx <= cur_idx);
+
+		if (prev_idx != cur_idx)
+			continue;
+
+		/* tail-end only files first, then by start block */
+		if (cur_idx != 0xFFFFFFFF &&
+		    prev->data.file.file_size >= BLOCK_SIZE) {
+			TEST_ASSERT(cur->data.file.file_size >= BLOCK_SIZE);
+		}
+
+		if (cur_idx == 0xFFFFFFFF ||
+		    (prev->data.file.file_size >= BLOCK_SIZE) ==
+		    (cur->data.file.file_size >= BLOCK_SIZE)) {
+			TEST_ASSERT(prev->data.file.blocks_start <=
+				    cur->data.file.blocks_start);
+		}
+	}
+}
+
+#ifdef WITH_PTHREAD
+static void check_claims(void)
+{
+	bool seen[NUM_FRAGS];
+	unpack_state_t state;
+	size_t start, end, i;
+	sqfs_u32 idx;
+
+	memset(seen, 0, sizeof(seen));
+	memset(&state, 0, sizeof(state));
+	pthread_mutex_init(&state.mtx, NULL);
+
+	/* every fragment block is handed out as part of exactly one run */
+	while ((end = claim_files(&state, &start)) > start) {
+		idx = get_frag_index(files[start].inode);
+
+		if (idx != 0xFFFFFFFF) {
+			TEST_ASSERT(!seen[idx]);
+			seen[idx] = true;
+		} else {
+			TEST_EQUAL_UI(end - start, 1);
+		}
+
+		for (i = start; i < end; ++i)
+			TEST_EQUAL_UI(get_frag_index(files[i].inode), idx);
+	}
+
+	TEST_EQUAL_UI(state.next, num_files);
+	pthread_mutex_destroy(&state.mtx);
+}
+#endif
+
+int main(void)
+{
+	block_size = BLOCK_SIZE;
+
+	gen_files();
+	qsort(files, num_files, sizeof(files[0]), compare_files);
+	check_sorted();
+#ifdef WITH_PTHREAD
+	check_claims();
+#endif
+	clear_file_list();
+	return EXIT_SUCCESS;
+}
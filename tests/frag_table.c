@@ -0,0 +1,104 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * frag_table.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "sqfs/frag_table.h"
+#include "sqfs/error.h"
+#include "sqfs/block.h"
+#include "test.h"
+
+#define NUM_CHUNKS (5000)
+#define NUM_FRAGS (1000)
+
+/* few distinct hashes, so that the probe sequences get long */
+#define HASH(i) ((sqfs_u32)(i) & 0x1F)
+#define SIZE(i) ((sqfs_u32)(i) + 1)
+
+static void check_chunks(sqfs_frag_table_t *tbl)
+{
+	sqfs_u32 index, offset;
+	size_t i;
+
+	for (i = 0; i < NUM_CHUNKS; ++i) {
+		TEST_ASSERT(sqfs_frag_table_find_tail_end(tbl, HASH(i), SIZE(i),
+							  &index,
+							  &offset) == 0);
+		TEST_EQUAL_UI(index, i / 10);
+		TEST_EQUAL_UI(offset, i);
+	}
+
+	TEST_EQUAL_I(sqfs_frag_table_find_tail_end(tbl, HASH(0), SIZE(1) + 1,
+						   &index, &offset),
+		     SQFS_ERROR_NO_ENTRY);
+	TEST_EQUAL_I(sqfs_frag_table_find_tail_end(tbl, 0xDEADBEEF, SIZE(0),
+						   &index, &offset),
+		     SQFS_ERROR_NO_ENTRY);
+}
+
+static void check_frags(sqfs_frag_table_t *tbl)
+{
+	sqfs_fragment_t frag;
+	size_t i;
+
+	TEST_EQUAL_UI(sqfs_frag_table_get_size(tbl), NUM_FRAGS);
+
+	for (i = 0; i < NUM_FRAGS; ++i) {
+		TEST_ASSERT(sqfs_frag_table_lookup(tbl, i, &frag) == 0);
+		TEST_EQUAL_UI(frag.start_offset, i * 1000);
+		TEST_EQUAL_UI(frag.size, i + 10);
+	}
+
+	TEST_EQUAL_I(sqfs_frag_table_lookup(tbl, NUM_FRAGS, &frag),
+		     SQFS_ERROR_OUT_OF_BOUNDS);
+}
+
+int main(void)
+{
+	sqfs_frag_table_t *tbl, *copy;
+	sqfs_u32 index, offset;
+	size_t i;
+
+	tbl = sqfs_frag_table_create(0);
+	TEST_NOT_NULL(tbl);
+
+	TEST_EQUAL_I(sqfs_frag_table_find_tail_end(tbl, 0, 1, &index, &offset),
+		     SQFS_ERROR_NO_ENTRY);
+
+	/* the fragment array grows while appending */
+	for (i = 0; i < NUM_FRAGS; ++i) {
+		TEST_ASSERT(sqfs_frag_table_append(tbl, i * 1000, i + 10,
+						   &index) == 0);
+		TEST_EQUAL_UI(index, i);
+	}
+
+	/* the tail end table is rehashed several times */
+	for (i = 0; i < NUM_CHUNKS; ++i) {
+		TEST_ASSERT(sqfs_frag_table_add_tail_end(tbl, i / 10, i,
+							 SIZE(i),
+							 HASH(i)) == 0);
+	}
+
+	/* re-adding a known chunk keeps the first one */
+	TEST_ASSERT(sqfs_frag_table_add_tail_end(tbl, 12345, 54321,
+						 SIZE(42), HASH(42)) == 0);
+
+	/* empty chunks are never remembered */
+	TEST_ASSERT(sqfs_frag_table_add_tail_end(tbl, 1, 2, 0, HASH(7)) == 0);
+
+	check_chunks(tbl);
+	check_frags(tbl);
+
+	/* a copy is independent of the original */
+	copy = sqfs_copy(tbl);
+	TEST_NOT_NULL(copy);
+	sqfs_destroy(tbl);
+
+	check_chunks(copy);
+	check_frags(copy);
+	sqfs_destroy(copy);
+	return EXIT_SUCCESS;
+}
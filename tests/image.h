@@ -0,0 +1,167 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * image.h
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "common.h"
+#include "mem_file.h"
+
+/*
+  Helpers for tests that pack a few files into an in-memory SquashFS image
+  through the same writer that the packing tools use and then read it back.
+ */
+typedef struct {
+	sqfs_writer_cfg_t cfg;
+	sqfs_writer_t wr;
+} test_writer_t;
+
+typedef struct {
+	sqfs_file_t *file;
+	sqfs_compressor_t *cmp;
+	sqfs_id_table_t *idtbl;
+	sqfs_dir_reader_t *dr;
+	sqfs_data_reader_t *data;
+	sqfs_super_t super;
+} test_image_t;
+
+static ATTRIB_UNUSED void test_writer_init(test_writer_t *img,
+					   size_t block_size,
+					   size_t num_jobs)
+{
+	/* sqfs_writer_init does not touch the xattr writer with no_xattr */
+	memset(img, 0, sizeof(*img));
+
+	sqfs_writer_cfg_init(&img->cfg);
+	img->cfg.filename = "test image";
+	img->cfg.outfile = (sqfs_file_t *)mem_file_create();
+	img->cfg.block_size = block_size;
+	img->cfg.num_jobs = num_jobs;
+	img->cfg.no_xattr = true;
+	img->cfg.quiet = true;
+
+	TEST_ASSERT(sqfs_writer_init(&img->wr, &img->cfg) == 0);
+}
+
+static ATTRIB_UNUSED tree_node_t *test_writer_add_dir(test_writer_t *img,
+						      const char *path)
+{
+	struct stat sb;
+	tree_node_t *n;
+
+	memset(&sb, 0, sizeof(sb));
+	sb.st_mode = S_IFDIR | 0755;
+
+	n = fstree_add_generic(&img->wr.fs, path, &sb, NULL);
+	TEST_NOT_NULL(n);
+	return n;
+}
+
+static ATTRIB_UNUSED tree_node_t *test_writer_add_file(test_writer_t *img,
+						       const char *path,
+						       const void *data,
+						       size_t size)
+{
+	struct stat sb;
+	tree_node_t *n;
+
+	memset(&sb, 0, sizeof(sb));
+	sb.st_mode = S_IFREG | 0644;
+	sb.st_size = size;
+
+	n = fstree_add_generic(&img->wr.fs, path, &sb, NULL);
+	TEST_NOT_NULL(n);
+
+	TEST_ASSERT(sqfs_block_processor_begin_file(img->wr.data,
+			(sqfs_inode_generic_t **)&n->data.file.user_ptr,
+			0) == 0);
+	TEST_ASSERT(sqfs_block_processor_append(img->wr.data,
+						data, size) == 0);
+	TEST_ASSERT(sqfs_block_processor_end_file(img->wr.data) == 0);
+	return n;
+}
+
+/* Returns the finished image, which the writer no longer references. */
+static ATTRIB_UNUSED sqfs_file_t *test_writer_finish(test_writer_t *img)
+{
+	sqfs_file_t *file;
+
+	TEST_ASSERT(fstree_post_process(&img->wr.fs) == 0);
+	TEST_ASSERT(sqfs_writer_finish(&img->wr, &img->cfg) == 0);
+
+	file = sqfs_copy(img->wr.outfile);
+	TEST_NOT_NULL(file);
+
+	sqfs_writer_cleanup(&img->wr, EXIT_SUCCESS);
+	return file;
+}
+
+/* For tests that need the image on disk, e.g. to run a tool on it. */
+static ATTRIB_UNUSED void test_image_save(sqfs_file_t *file,
+					  const char *filename)
+{
+	const mem_file_t *mem = (const mem_file_t *)file;
+	FILE *fp;
+
+	fp = fopen(filename, "wb");
+	TEST_NOT_NULL(fp);
+	TEST_EQUAL_UI(fwrite(mem->data, 1, mem->size, fp), mem->size);
+	TEST_ASSERT(fclose(fp) == 0);
+}
+
+/* Takes ownership of the file. */
+static ATTRIB_UNUSED void test_image_open(test_image_t *img,
+					  sqfs_file_t *file)
+{
+	sqfs_compressor_config_t cfg;
+
+	memset(img, 0, sizeof(*img));
+
+	img->file = file;
+	TEST_NOT_NULL(img->file);
+	TEST_ASSERT(sqfs_super_read(&img->super, img->file) == 0);
+
+	sqfs_compressor_config_init(&cfg, img->super.compression_id,
+				    img->super.block_size,
+				    SQFS_COMP_FLAG_UNCOMPRESS);
+	TEST_ASSERT(sqfs_compressor_create(&cfg, &img->cmp) == 0);
+
+	img->idtbl = sqfs_id_table_create(0);
+	TEST_NOT_NULL(img->idtbl);
+	TEST_ASSERT(sqfs_id_table_read(img->idtbl, img->file, &img->super,
+				       img->cmp) == 0);
+
+	img->dr = sqfs_dir_reader_create(&img->super, img->cmp, img->file);
+	TEST_NOT_NULL(img->dr);
+
+	img->data = sqfs_data_reader_create(img->file, img->super.block_size,
+					    img->cmp);
+	TEST_NOT_NULL(img->data);
+	TEST_ASSERT(sqfs_data_reader_load_fragment_table(img->data,
+							 &img->super) == 0);
+}
+
+static ATTRIB_UNUSED sqfs_inode_generic_t *test_image_lookup(test_image_t *img,
+							     const char *path)
+{
+	sqfs_inode_generic_t *inode = NULL;
+
+	TEST_ASSERT(sqfs_dir_reader_find_by_path(img->dr, NULL, path,
+						 &inode) == 0);
+	TEST_NOT_NULL(inode);
+	return inode;
+}
+
+static ATTRIB_UNUSED void test_image_close(test_image_t *img)
+{
+	sqfs_destroy(img->data);
+	sqfs_destroy(img->dr);
+	sqfs_destroy(img->idtbl);
+	sqfs_destroy(img->cmp);
+	sqfs_destroy(img->file);
+}
+
+#endif /* IMAGE_H */
@@ -0,0 +1,210 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * input_stream.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "common.h"
+#include "test.h"
+
+/*
+  Built a second time with the fopencookie wrappers disabled, to exercise
+  the temporary file that is used on systems that lack it.
+ */
+#ifdef TEST_TMPFILE
+#undef HAVE_FOPENCOOKIE
+#include "../lib/common/io_stdin.c"
+#endif
+
+#if defined(WITH_GZIP)
+#include <zlib.h>
+#endif
+
+#if defined(WITH_XZ)
+#include <lzma.h>
+#endif
+
+#if defined(WITH_ZSTD)
+#include <zstd.h>
+#endif
+
+#if defined(WITH_BZIP2)
+#include <bzlib.h>
+#endif
+
+#define STR(x) #x
+#define STRVALUE(x) STR(x)
+
+#define TEST_PATH STRVALUE(TESTPATH)
+
+#define MAX_INPUT_SIZE (64 * 1024)
+#define MAX_OUTPUT_SIZE (4 * MAX_INPUT_SIZE)
+
+static sqfs_u8 input[MAX_INPUT_SIZE];
+static size_t input_size;
+
+static sqfs_u8 packed[MAX_OUTPUT_SIZE];
+static size_t packed_size;
+
+static sqfs_u8 output[MAX_OUTPUT_SIZE];
+
+static void load_input(const char *path)
+{
+	FILE *fp;
+
+	fp = fopen(path, "rb");
+	TEST_NOT_NULL(fp);
+
+	input_size = fread(input, 1, sizeof(input), fp);
+	TEST_ASSERT(input_size > 0);
+	TEST_ASSERT(feof(fp));
+	fclose(fp);
+}
+
+/* feeds the packed data through the stream and compares the result */
+static void check_stream(const char *name, const sqfs_u8 *ref,
+			 size_t ref_size, unsigned int num_jobs)
+{
+	size_t total = 0, ret;
+	FILE *fp, *out;
+
+	fp = tmpfile();
+	TEST_NOT_NULL(fp);
+	TEST_EQUAL_UI(fwrite(packed, 1, packed_size, fp), packed_size);
+	TEST_ASSERT(fflush(fp) == 0);
+	TEST_ASSERT(fseek(fp, 0, SEEK_SET) == 0);
+
+	out = sqfs_get_read_ahead_stream(fp, num_jobs);
+	TEST_NOT_NULL(out);
+
+	while ((ret = fread(output + total, 1, 1000, out)) > 0) {
+		total += ret;
+		TEST_ASSERT(total <= ref_size);
+	}
+
+	TEST_ASSERT(!ferror(out));
+
+	if (total != ref_size || memcmp(output, ref, ref_size) != 0) {
+		fprintf(stderr, "%s: %u jobs: mismatch after decoding\n",
+			name, num_jobs);
+		exit(EXIT_FAILURE);
+	}
+
+	if (out != fp)
+		fclose(out);
+	fclose(fp);
+}
+
+/* the input as is, plus the same again as a second stream */
+static void check_packed(const char *name, size_t size)
+{
+	static sqfs_u8 twice[2 * MAX_INPUT_SIZE];
+
+	TEST_ASSERT(size > 0);
+	TEST_ASSERT(2 * size <= sizeof(packed));
+	TEST_ASSERT(stream_decompressor_detect(packed, size) !=
+		    STREAM_COMPRESSOR_NONE);
+
+	packed_size = size;
+	check_stream(name, input, input_size, 1);
+	check_stream(name, input, input_size, 4);
+
+	memcpy(packed + size, packed, size);
+	memcpy(twice, input, input_size);
+	memcpy(twice + input_size, input, input_size);
+
+	packed_size = 2 * size;
+	check_stream(name, twice, 2 * input_size, 1);
+	check_stream(name, twice, 2 * input_size, 4);
+}
+
+#if defined(WITH_GZIP)
+static void check_gzip(void)
+{
+	z_stream strm;
+
+	memset(&strm, 0, sizeof(strm));
+	TEST_ASSERT(deflateInit2(&strm, Z_BEST_COMPRESSION, Z_DEFLATED,
+				 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+
+	strm.next_in = input;
+	strm.avail_in = input_size;
+	strm.next_out = packed;
+	strm.avail_out = sizeof(packed) / 2;
+
+	TEST_ASSERT(deflate(&strm, Z_FINISH) == Z_STREAM_END);
+	check_packed("gzip", strm.total_out);
+	deflateEnd(&strm);
+}
+#endif
+
+#if defined(WITH_XZ)
+static void check_xz(void)
+{
+	size_t size = 0;
+
+	TEST_ASSERT(lzma_easy_buffer_encode(LZMA_PRESET_DEFAULT,
+					    LZMA_CHECK_CRC64, NULL,
+					    input, input_size, packed, &size,
+					    sizeof(packed) / 2) == LZMA_OK);
+	check_packed("xz", size);
+}
+#endif
+
+#if defined(WITH_ZSTD)
+static void check_zstd(void)
+{
+	size_t size;
+
+	size = ZSTD_compress(packed, sizeof(packed) / 2, input, input_size,
+			     ZSTD_CLEVEL_DEFAULT);
+	TEST_ASSERT(!ZSTD_isError(size));
+	check_packed("zstd", size);
+}
+#endif
+
+#if defined(WITH_BZIP2)
+static void check_bzip2(void)
+{
+	unsigned int size = sizeof(packed) / 2;
+
+	TEST_ASSERT(BZ2_bzBuffToBuffCompress((char *)packed, &size,
+					     (char *)input, input_size,
+					     9, 0, 0) == BZ_OK);
+	check_packed("bzip2", size);
+}
+#endif
+
+int main(void)
+{
+	load_input(TEST_PATH "/format-acceptance/gnu.tar");
+
+	/* uncompressed input is passed through */
+	memcpy(packed, input, input_size);
+	packed_size = input_size;
+	check_stream("tar", input, input_size, 1);
+
+	/* also if it only starts like a compressed stream */
+	memcpy(packed, "BZ", 2);
+	check_stream("tar", packed, packed_size, 1);
+
+	/* and if it is shorter than the magic */
+	packed_size = 2;
+	check_stream("tar", packed, packed_size, 1);
+
+#if defined(WITH_GZIP)
+	check_gzip();
+#endif
+#if defined(WITH_XZ)
+	check_xz();
+#endif
+#if defined(WITH_ZSTD)
+	check_zstd();
+#endif
+#if defined(WITH_BZIP2)
+	check_bzip2();
+#endif
+	return EXIT_SUCCESS;
+}
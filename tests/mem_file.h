@@ -0,0 +1,128 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * mem_file.h
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef MEM_FILE_H
+#define MEM_FILE_H
+
+#include "sqfs/error.h"
+#include "sqfs/io.h"
+#include "test.h"
+
+/*
+  A minimal, growable in-memory implementation of sqfs_file_t for tests
+  that want to inspect exactly what a writer produced.
+ */
+typedef struct {
+	sqfs_file_t base;
+
+	sqfs_u8 *data;
+	sqfs_u64 size;
+	sqfs_u64 max_size;
+} mem_file_t;
+
+static int mem_file_truncate(sqfs_file_t *base, sqfs_u64 size)
+{
+	mem_file_t *file = (mem_file_t *)base;
+	size_t new_sz;
+	void *new;
+
+	if (size > file->max_size) {
+		new_sz = file->max_size ? file->max_size : 4096;
+		while (new_sz < size)
+			new_sz *= 2;
+
+		new = realloc(file->data, new_sz);
+		if (new == NULL)
+			return SQFS_ERROR_ALLOC;
+
+		file->data = new;
+		file->max_size = new_sz;
+	}
+
+	if (size > file->size)
+		memset(file->data + file->size, 0, size - file->size);
+
+	file->size = size;
+	return 0;
+}
+
+static int mem_file_read_at(sqfs_file_t *base, sqfs_u64 offset,
+			    void *buffer, size_t size)
+{
+	mem_file_t *file = (mem_file_t *)base;
+
+	if (offset > file->size || size > (file->size - offset))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	memcpy(buffer, file->data + offset, size);
+	return 0;
+}
+
+static int mem_file_write_at(sqfs_file_t *base, sqfs_u64 offset,
+			     const void *buffer, size_t size)
+{
+	mem_file_t *file = (mem_file_t *)base;
+	int ret;
+
+	if (offset + size > file->size) {
+		ret = mem_file_truncate(base, offset + size);
+		if (ret)
+			return ret;
+	}
+
+	memcpy(file->data + offset, buffer, size);
+	return 0;
+}
+
+static sqfs_u64 mem_file_get_size(const sqfs_file_t *base)
+{
+	return ((const mem_file_t *)base)->size;
+}
+
+static void mem_file_destroy(sqfs_object_t *base)
+{
+	free(((mem_file_t *)base)->data);
+	free(base);
+}
+
+static sqfs_object_t *mem_file_copy(const sqfs_object_t *base)
+{
+	const mem_file_t *file = (const mem_file_t *)base;
+	mem_file_t *copy = malloc(sizeof(*copy));
+
+	if (copy == NULL)
+		return NULL;
+
+	memcpy(copy, file, sizeof(*copy));
+
+	if (file->max_size > 0) {
+		copy->data = malloc(file->max_size);
+		if (copy->data == NULL) {
+			free(copy);
+			return NULL;
+		}
+
+		memcpy(copy->data, file->data, file->size);
+	}
+
+	return (sqfs_object_t *)copy;
+}
+
+static ATTRIB_UNUSED mem_file_t *mem_file_create(void)
+{
+	mem_file_t *file = calloc(1, sizeof(*file));
+	TEST_NOT_NULL(file);
+
+	((sqfs_object_t *)file)->destroy = mem_file_destroy;
+	((sqfs_object_t *)file)->copy = mem_file_copy;
+	file->base.read_at = mem_file_read_at;
+	file->base.write_at = mem_file_write_at;
+	file->base.get_size = mem_file_get_size;
+	file->base.truncate = mem_file_truncate;
+	return file;
+}
+
+#endif /* MEM_FILE_H */
@@ -0,0 +1,153 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * meta_cache.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "common.h"
+#include "mem_file.h"
+
+#define NUM_BLOCKS (8)
+
+static sqfs_u64 location[NUM_BLOCKS];
+static sqfs_u64 hits, misses;
+
+static void write_blocks(mem_file_t *file, sqfs_compressor_t *cmp)
+{
+	sqfs_u8 buffer[SQFS_META_BLOCK_SIZE];
+	sqfs_u64 start = file->size;
+	sqfs_meta_writer_t *m;
+	sqfs_u32 offset;
+	size_t i;
+
+	m = sqfs_meta_writer_create((sqfs_file_t *)file, cmp, 0);
+	TEST_NOT_NULL(m);
+
+	for (i = 0; i < NUM_BLOCKS; ++i) {
+		sqfs_meta_writer_get_position(m, location + i, &offset);
+		TEST_EQUAL_UI(offset, 0);
+		location[i] += start;
+
+		memset(buffer, 'A' + i, sizeof(buffer));
+		TEST_ASSERT(sqfs_meta_writer_append(m, buffer,
+						    sizeof(buffer)) == 0);
+	}
+
+	TEST_ASSERT(sqfs_meta_writer_flush(m) == 0);
+	sqfs_destroy(m);
+}
+
+static void seek(sqfs_meta_reader_t *rd, sqfs_meta_cache_t *cache,
+		 size_t idx, int expect_hit)
+{
+	const sqfs_meta_cache_stats_t *stats;
+	sqfs_u8 buffer[16];
+
+	TEST_ASSERT(sqfs_meta_reader_seek(rd, location[idx], 100) == 0);
+	TEST_ASSERT(sqfs_meta_reader_read(rd, buffer, sizeof(buffer)) == 0);
+
+	TEST_EQUAL_UI(buffer[0], 'A' + idx);
+	TEST_EQUAL_UI(buffer[sizeof(buffer) - 1], 'A' + idx);
+
+	if (expect_hit > 0) {
+		hits += 1;
+	} else if (expect_hit == 0) {
+		misses += 1;
+	}
+
+	stats = sqfs_meta_cache_get_stats(cache);
+	TEST_EQUAL_UI(stats->hits, hits);
+	TEST_EQUAL_UI(stats->misses, misses);
+}
+
+int main(void)
+{
+	sqfs_meta_reader_t *rd[2], *copy, *small;
+	sqfs_compressor_config_t cfg;
+	sqfs_compressor_t *cmp, *ucmp;
+	sqfs_meta_cache_t *cache;
+	mem_file_t *file;
+
+	sqfs_compressor_config_init(&cfg, compressor_get_default(),
+				    SQFS_DEFAULT_BLOCK_SIZE, 0);
+	TEST_ASSERT(sqfs_compressor_create(&cfg, &cmp) == 0);
+
+	sqfs_compressor_config_init(&cfg, compressor_get_default(),
+				    SQFS_DEFAULT_BLOCK_SIZE,
+				    SQFS_COMP_FLAG_UNCOMPRESS);
+	TEST_ASSERT(sqfs_compressor_create(&cfg, &ucmp) == 0);
+
+	/* leave room for a super block, like in a real image */
+	file = mem_file_create();
+	TEST_ASSERT(file->base.truncate((sqfs_file_t *)file,
+					sizeof(sqfs_super_t)) == 0);
+	write_blocks(file, cmp);
+	TEST_EQUAL_UI(location[0], sizeof(sqfs_super_t));
+
+	cache = sqfs_meta_cache_create(4 * SQFS_META_BLOCK_SIZE + 100);
+	TEST_NOT_NULL(cache);
+	TEST_EQUAL_UI(sqfs_meta_cache_get_stats(cache)->size,
+		      sizeof(sqfs_meta_cache_stats_t));
+
+	rd[0] = sqfs_meta_reader_create((sqfs_file_t *)file, ucmp,
+					location[0], file->size);
+	rd[1] = sqfs_meta_reader_create((sqfs_file_t *)file, ucmp,
+					location[0], file->size);
+	TEST_NOT_NULL(rd[0]);
+	TEST_NOT_NULL(rd[1]);
+
+	sqfs_meta_reader_set_cache(rd[0], cache);
+	sqfs_meta_reader_set_cache(rd[1], cache);
+
+	/* a block read by one reader is picked up by the other */
+	seek(rd[0], cache, 0, 0);
+	seek(rd[1], cache, 0, 1);
+
+	/* staying on the current block does not touch the cache */
+	seek(rd[0], cache, 0, -1);
+
+	/* fill the cache and hit the oldest block, evicting the second */
+	seek(rd[0], cache, 1, 0);
+	seek(rd[0], cache, 2, 0);
+	seek(rd[0], cache, 3, 0);
+	seek(rd[1], cache, 0, -1);
+	seek(rd[1], cache, 3, 1);
+	seek(rd[1], cache, 0, 1);
+	seek(rd[1], cache, 4, 0);
+	seek(rd[0], cache, 2, 1);
+	seek(rd[0], cache, 1, 0);
+
+	/* a copy shares the cache of the original */
+	copy = sqfs_copy(rd[0]);
+	TEST_NOT_NULL(copy);
+	seek(copy, cache, 1, -1);
+	seek(copy, cache, 4, 1);
+	sqfs_destroy(copy);
+
+	/* cached blocks still have to fit the limit of the reader */
+	small = sqfs_meta_reader_create((sqfs_file_t *)file, ucmp,
+					location[0], location[4] + 1);
+	TEST_NOT_NULL(small);
+	sqfs_meta_reader_set_cache(small, cache);
+
+	TEST_EQUAL_I(sqfs_meta_reader_seek(small, location[4], 0),
+		     SQFS_ERROR_OUT_OF_BOUNDS);
+	hits += 1;
+	seek(small, cache, 2, 1);
+	sqfs_destroy(small);
+
+	/* without a cache, nothing is counted */
+	sqfs_meta_reader_set_cache(rd[0], NULL);
+	seek(rd[0], cache, 5, -1);
+	seek(rd[0], cache, 4, -1);
+
+	sqfs_destroy(rd[0]);
+	sqfs_destroy(rd[1]);
+	sqfs_destroy(cache);
+	sqfs_destroy(file);
+	sqfs_destroy(ucmp);
+	sqfs_destroy(cmp);
+	return EXIT_SUCCESS;
+}
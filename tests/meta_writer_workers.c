@@ -0,0 +1,141 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * meta_writer_workers.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "common.h"
+#include "mem_file.h"
+
+#define DATA_SIZE (300 * 1024)
+#define NUM_MARKS (64)
+
+static sqfs_u8 data[DATA_SIZE];
+
+typedef struct {
+	mem_file_t *file;
+	sqfs_u64 index[NUM_MARKS];
+	sqfs_u64 start[NUM_MARKS];
+	sqfs_u32 offset[NUM_MARKS];
+} result_t;
+
+static void gen_data(void)
+{
+	sqfs_u32 seed = 1;
+	size_t i;
+
+	for (i = 0; i < DATA_SIZE; ++i) {
+		seed = seed * 1103515245 + 12345;
+
+		/* alternate between compressible and incompressible runs */
+		if ((i / 20000) % 2) {
+			data[i] = (seed >> 16) & 0xFF;
+		} else {
+			data[i] = (seed >> 16) & 0x03;
+		}
+	}
+}
+
+static void write_data(sqfs_compressor_t *cmp, unsigned int num_workers,
+		       sqfs_u32 flags, result_t *out)
+{
+	size_t i, off, diff;
+	sqfs_meta_writer_t *m;
+	sqfs_u64 start;
+	sqfs_u32 offset;
+
+	memset(out, 0, sizeof(*out));
+	out->file = mem_file_create();
+
+	m = sqfs_meta_writer_create((sqfs_file_t *)out->file, cmp, flags);
+	TEST_NOT_NULL(m);
+	TEST_ASSERT(sqfs_meta_writer_set_workers(m, num_workers) == 0);
+
+	/* odd sized chunks, so that entries straddle block boundaries */
+	for (i = 0, off = 0; off < DATA_SIZE; ++i, off += diff) {
+		diff = 37 + (i * 1013) % 3001;
+		if (diff > DATA_SIZE - off)
+			diff = DATA_SIZE - off;
+
+		if (i < NUM_MARKS) {
+			sqfs_meta_writer_get_block_index(m, out->index + i,
+							 out->offset + i);
+		}
+
+		TEST_ASSERT(sqfs_meta_writer_append(m, data + off, diff) == 0);
+
+		/* now and then, ask for the position directly */
+		if (i % 16 == 15) {
+			TEST_ASSERT(sqfs_meta_writer_get_position_ex(m, &start,
+								     &offset) == 0);
+		}
+	}
+
+	for (i = 0; i < NUM_MARKS; ++i) {
+		TEST_ASSERT(sqfs_meta_writer_resolve_block(m, out->index[i],
+							   out->start + i) == 0);
+	}
+
+	TEST_ASSERT(sqfs_meta_writer_flush(m) == 0);
+
+	if (flags & SQFS_META_WRITER_KEEP_IN_MEMORY) {
+		TEST_EQUAL_UI(out->file->size, 0);
+		TEST_ASSERT(sqfs_meta_write_write_to_file(m) == 0);
+	}
+
+	sqfs_destroy(m);
+}
+
+static void compare(const result_t *ref, const result_t *res)
+{
+	size_t i;
+
+	TEST_EQUAL_UI(res->file->size, ref->file->size);
+	TEST_ASSERT(memcmp(res->file->data, ref->file->data,
+			   ref->file->size) == 0);
+
+	for (i = 0; i < NUM_MARKS; ++i) {
+		TEST_EQUAL_UI(res->index[i], ref->index[i]);
+		TEST_EQUAL_UI(res->start[i], ref->start[i]);
+		TEST_EQUAL_UI(res->offset[i], ref->offset[i]);
+	}
+}
+
+int main(void)
+{
+	static const sqfs_u32 flags[] = { 0, SQFS_META_WRITER_KEEP_IN_MEMORY };
+	static const unsigned int workers[] = { 1, 2, 4 };
+	sqfs_compressor_config_t cfg;
+	sqfs_compressor_t *cmp;
+	result_t ref, res;
+	size_t i, j;
+
+	gen_data();
+
+	sqfs_compressor_config_init(&cfg, compressor_get_default(),
+				    SQFS_DEFAULT_BLOCK_SIZE, 0);
+	TEST_ASSERT(sqfs_compressor_create(&cfg, &cmp) == 0);
+
+	/* reference: inline compression, straight to the file */
+	write_data(cmp, 0, 0, &ref);
+	TEST_ASSERT(ref.file->size > 0);
+	TEST_ASSERT(ref.start[NUM_MARKS - 1] > 0);
+
+	for (i = 0; i < sizeof(flags) / sizeof(flags[0]); ++i) {
+		write_data(cmp, 0, flags[i], &res);
+		compare(&ref, &res);
+		sqfs_destroy(res.file);
+
+		for (j = 0; j < sizeof(workers) / sizeof(workers[0]); ++j) {
+			write_data(cmp, workers[j], flags[i], &res);
+			compare(&ref, &res);
+			sqfs_destroy(res.file);
+		}
+	}
+
+	sqfs_destroy(ref.file);
+	sqfs_destroy(cmp);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * sqfs2tar_jobs_img.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "image.h"
+
+#define BLOCK_SIZE (4096)
+#define DATA_SIZE (10 * BLOCK_SIZE + 123)
+
+static sqfs_u8 data[DATA_SIZE];
+
+static void gen_data(void)
+{
+	sqfs_u32 seed = 1;
+	size_t i;
+
+	for (i = 0; i < DATA_SIZE; ++i) {
+		seed = seed * 1103515245 + 12345;
+		data[i] = (seed >> 16) & 0x0F;
+	}
+}
+
+/*
+  None of the packing tools can produce a name that sqfs2tar refuses to
+  unpack, so patch the name in the tree after adding the node.
+ */
+static void make_insane(tree_node_t *n)
+{
+	char *ptr = strchr(n->name, '_');
+
+	TEST_NOT_NULL(ptr);
+	*ptr = '\\';
+}
+
+/*
+  Writes an image for tests/sqfs2tar_jobs.sh that contains multi block
+  files which sqfs2tar has to skip, or turns into hard links, in between
+  files that it actually unpacks.
+ */
+int main(int argc, char **argv)
+{
+	test_writer_t wr;
+	sqfs_file_t *file;
+	tree_node_t *n;
+
+	if (argc != 2) {
+		fputs("Usage: sqfs2tar_jobs_img <image>\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	gen_data();
+
+	test_writer_init(&wr, BLOCK_SIZE, 1);
+
+	/* a skipped directory, with everything below it */
+	n = test_writer_add_dir(&wr, "bad_dir");
+	test_writer_add_file(&wr, "bad_dir/inner", data + 7, DATA_SIZE - 7);
+	test_writer_add_file(&wr, "bad_dir/small", data, 100);
+	make_insane(n);
+
+	test_writer_add_dir(&wr, "dir");
+	test_writer_add_file(&wr, "dir/a_first", data, 3 * BLOCK_SIZE + 5);
+
+	n = test_writer_add_file(&wr, "dir/b_skipped", data + 1,
+				 5 * BLOCK_SIZE + 17);
+	make_insane(n);
+
+	test_writer_add_file(&wr, "dir/c_big", data + 2, DATA_SIZE - 2);
+	test_writer_add_file(&wr, "dir/d_small", data + 3, 200);
+	test_writer_add_file(&wr, "dir/e_last", data + 4, 2 * BLOCK_SIZE);
+
+	/* the duplicate is the second one in tree order */
+	TEST_NOT_NULL(fstree_add_hard_link(&wr.wr.fs, "dir/z_link",
+					   "dir/c_big"));
+
+	file = test_writer_finish(&wr);
+	test_image_save(file, argv[1]);
+	sqfs_destroy(file);
+	return EXIT_SUCCESS;
+}
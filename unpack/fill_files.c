@@ -14,51 +14,49 @@ static struct file_ent {
 
 static size_t num_files = 0, max_files = 0;
 static size_t block_size = 0;
+static int image_fd = -1;
+
+/* returns 0xFFFFFFFF if the file has no fragment */
+static sqfs_u32 get_frag_index(const sqfs_inode_generic_t *inode)
+{
+	sqfs_u32 frag_idx, frag_off;
+	sqfs_u64 size;
+
+	sqfs_inode_get_frag_location(inode, &frag_idx, &frag_off);
+	sqfs_inode_get_file_size(inode, &size);
+
+	if ((size % block_size) == 0 || frag_off >= block_size)
+		return 0xFFFFFFFF;
+
+	return frag_idx;
+}
 
 static int compare_files(const void *l, const void *r)
 {
-	sqfs_u32 lhs_frag_idx, lhs_frag_off, rhs_frag_idx, rhs_frag_off;
-	sqfs_u64 lhs_size, rhs_size, lhs_start, rhs_start;
 	const struct file_ent *lhs = l, *rhs = r;
+	sqfs_u64 lhs_size, rhs_size, lhs_start, rhs_start;
+	sqfs_u32 lhs_frag_idx, rhs_frag_idx;
 
-	sqfs_inode_get_frag_location(lhs->inode, &lhs_frag_idx, &lhs_frag_off);
+	lhs_frag_idx = get_frag_index(lhs->inode);
 	sqfs_inode_get_file_block_start(lhs->inode, &lhs_start);
 	sqfs_inode_get_file_size(lhs->inode, &lhs_size);
 
-	sqfs_inode_get_frag_location(rhs->inode, &rhs_frag_idx, &rhs_frag_off);
+	rhs_frag_idx = get_frag_index(rhs->inode);
 	sqfs_inode_get_file_block_start(rhs->inode, &rhs_start);
 	sqfs_inode_get_file_size(rhs->inode, &rhs_size);
 
-	/* Files with fragments come first, ordered by ID.
-	   In case of tie, files without data blocks come first,
-	   and the others are ordered by start block. */
-	if ((lhs_size % block_size) && (lhs_frag_off < block_size) &&
-	    (lhs_frag_idx != 0xFFFFFFFF)) {
-		if ((rhs_size % block_size) && (rhs_frag_off < block_size) &&
-		    (rhs_frag_idx != 0xFFFFFFFF))
-			return -1;
+	/* Files with fragments come first, ordered by ID, so files that
+	   share a fragment block end up next to each other. In case of
+	   tie, files without data blocks come first, and the others are
+	   ordered by start block. */
+	if (lhs_frag_idx != rhs_frag_idx)
+		return lhs_frag_idx < rhs_frag_idx ? -1 : 1;
 
-		if (lhs_frag_idx < rhs_frag_idx)
-			return -1;
-
-		if (lhs_frag_idx > rhs_frag_idx)
-			return 1;
-
-		if (lhs_size < block_size)
-			return (rhs_size < block_size) ? 0 : -1;
-
-		if (rhs_size < block_size)
-			return 1;
-
-		goto order_by_start;
+	if (lhs_frag_idx != 0xFFFFFFFF &&
+	    (lhs_size < block_size) != (rhs_size < block_size)) {
+		return lhs_size < block_size ? -1 : 1;
 	}
 
-	if ((rhs_size % block_size) && (rhs_frag_off < block_size) &&
-	    (rhs_frag_idx != 0xFFFFFFFF))
-		return 1;
-
-	/* order the rest by start block */
-order_by_start:
 	return lhs_start < rhs_start ? -1 : lhs_start > rhs_start ? 1 : 0;
 }
 
@@ -133,42 +131,399 @@ static int gen_file_list_dfs(const sqfs_tree_node_t *n)
 	return 0;
 }
 
-static int fill_files(sqfs_data_reader_t *data, int flags)
+#ifndef _WIN32
+static int write_data(int fd, const sqfs_u8 *data, size_t size)
 {
-	size_t i;
-	FILE *fp;
+	ssize_t ret;
 
-	for (i = 0; i < num_files; ++i) {
-		fp = fopen(files[i].path, "wb");
-		if (fp == NULL) {
-			fprintf(stderr, "unpacking %s: %s\n",
-				files[i].path, strerror(errno));
+	while (size > 0) {
+		ret = write(fd, data, size);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
 			return -1;
 		}
 
-		if (!(flags & UNPACK_QUIET))
-			printf("unpacking %s\n", files[i].path);
+		data += ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+static ssize_t copy_range(int fd, sqfs_u64 offset, size_t size)
+{
+	off_t off = offset;
+	ssize_t ret;
+
+#ifdef HAVE_COPY_FILE_RANGE
+	ret = copy_file_range(image_fd, &off, fd, NULL, size, 0);
+	if (ret >= 0 || (errno != EXDEV && errno != ENOSYS &&
+			 errno != EINVAL && errno != EOPNOTSUPP)) {
+		return ret;
+	}
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+	ret = sendfile(fd, image_fd, &off, size);
+#else
+	(void)fd; (void)off; (void)size;
+	errno = ENOSYS;
+	ret = -1;
+#endif
+	return ret;
+}
+
+/*
+  Copy a run of uncompressed blocks from the image to the current position
+  of the output file, without passing the data through user space if the
+  kernel allows it.
+ */
+static int copy_blocks(int fd, sqfs_u64 offset, sqfs_u64 size,
+		       sqfs_u8 *scratch)
+{
+	bool fallback = false;
+	ssize_t ret;
+	size_t diff;
+
+	while (size > 0) {
+		if (!fallback) {
+			diff = size > 0x40000000 ? 0x40000000 : size;
+			ret = copy_range(fd, offset, diff);
+
+			if (ret < 0 && errno == EINTR)
+				continue;
+
+			if (ret < 0 && (errno == ENOSYS || errno == EINVAL)) {
+				fallback = true;
+				continue;
+			}
+		} else {
+			diff = size > block_size ? block_size : size;
+			ret = pread(image_fd, scratch, diff, offset);
+
+			if (ret < 0 && errno == EINTR)
+				continue;
+
+			if (ret > 0 && write_data(fd, scratch, ret))
+				return -1;
+		}
+
+		if (ret < 0)
+			return -1;
 
-		if (sqfs_data_reader_dump(files[i].path, data, files[i].inode,
-					  fp, block_size,
-					  (flags & UNPACK_NO_SPARSE) == 0)) {
-			fclose(fp);
+		if (ret == 0) {
+			errno = EIO;
 			return -1;
 		}
 
-		fflush(fp);
+		offset += ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+static bool has_uncompressed_blocks(const sqfs_inode_generic_t *inode)
+{
+	size_t i, count = sqfs_inode_get_file_block_count(inode);
+
+	for (i = 0; i < count; ++i) {
+		if (!SQFS_IS_SPARSE_BLOCK(inode->extra[i]) &&
+		    !SQFS_IS_BLOCK_COMPRESSED(inode->extra[i])) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static int dump_file_fd(sqfs_data_reader_t *data, const struct file_ent *ent,
+			int fd, bool allow_sparse, sqfs_u8 *scratch)
+{
+	const sqfs_inode_generic_t *inode = ent->inode;
+	size_t i, j, diff, count, chunk_size;
+	sqfs_u64 filesz, location, run_size;
+	int err;
+
+	sqfs_inode_get_file_size(inode, &filesz);
+	sqfs_inode_get_file_block_start(inode, &location);
+	count = sqfs_inode_get_file_block_count(inode);
+
+	if (allow_sparse && ftruncate(fd, filesz))
+		goto fail_errno;
+
+	for (i = 0; i < count; i = j) {
+		/* gather a run of uncompressed blocks at full size */
+		run_size = 0;
+
+		for (j = i; j < count; ++j) {
+			diff = (filesz < block_size) ? filesz : block_size;
+
+			if (SQFS_IS_SPARSE_BLOCK(inode->extra[j]) ||
+			    SQFS_IS_BLOCK_COMPRESSED(inode->extra[j]) ||
+			    SQFS_ON_DISK_BLOCK_SIZE(inode->extra[j]) != diff) {
+				break;
+			}
+
+			run_size += diff;
+			filesz -= diff;
+		}
+
+		if (j > i) {
+			if (copy_blocks(fd, location, run_size, scratch))
+				goto fail_errno;
+
+			location += run_size;
+			continue;
+		}
+
+		diff = (filesz < block_size) ? filesz : block_size;
+
+		if (SQFS_IS_SPARSE_BLOCK(inode->extra[i]) && allow_sparse) {
+			if (lseek(fd, diff, SEEK_CUR) == (off_t)-1)
+				goto fail_errno;
+		} else {
+			err = sqfs_data_reader_get_block_into(data, inode, i,
+							      &chunk_size,
+							      scratch);
+			if (err) {
+				sqfs_perror(ent->path, "reading data block",
+					    err);
+				return -1;
+			}
+
+			if (write_data(fd, scratch, chunk_size))
+				goto fail_errno;
+		}
+
+		location += SQFS_ON_DISK_BLOCK_SIZE(inode->extra[i]);
+		filesz -= diff;
+		j = i + 1;
+	}
+
+	if (filesz > 0) {
+		err = sqfs_data_reader_get_fragment_into(data, inode,
+							 &chunk_size, scratch);
+		if (err) {
+			sqfs_perror(ent->path, "reading fragment block", err);
+			return -1;
+		}
+
+		if (write_data(fd, scratch, chunk_size))
+			goto fail_errno;
+	}
+
+	return 0;
+fail_errno:
+	fprintf(stderr, "unpacking %s: %s\n", ent->path, strerror(errno));
+	return -1;
+}
+#endif
+
+static int unpack_file(sqfs_data_reader_t *data, const struct file_ent *ent,
+		       int flags, sqfs_u8 *scratch)
+{
+	bool allow_sparse = (flags & UNPACK_NO_SPARSE) == 0;
+	FILE *fp;
+	int ret;
+
+	fp = fopen(ent->path, "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "unpacking %s: %s\n",
+			ent->path, strerror(errno));
+		return -1;
+	}
+
+	if (!(flags & UNPACK_QUIET))
+		printf("unpacking %s\n", ent->path);
+
+#ifndef _WIN32
+	/* the FILE is not written to, so the descriptor can be used */
+	if (image_fd >= 0 && has_uncompressed_blocks(ent->inode)) {
+		ret = dump_file_fd(data, ent, fileno(fp), allow_sparse,
+				   scratch);
+	} else
+#endif
+	{
+		ret = sqfs_data_reader_dump(ent->path, data, ent->inode, fp,
+					    block_size, allow_sparse, scratch);
+	}
+
+	if (ret) {
 		fclose(fp);
+		return -1;
 	}
 
+	fflush(fp);
+	fclose(fp);
 	return 0;
 }
 
-int fill_unpacked_files(size_t blk_sz, const sqfs_tree_node_t *root,
-			sqfs_data_reader_t *data, int flags)
+static int fill_files(sqfs_data_reader_t *data, int flags)
 {
+	sqfs_u8 *scratch;
+	size_t i;
+
+	scratch = malloc(block_size);
+	if (scratch == NULL) {
+		perror("allocating data block buffer");
+		return -1;
+	}
+
+	for (i = 0; i < num_files; ++i) {
+		if (unpack_file(data, files + i, flags, scratch)) {
+			free(scratch);
+			return -1;
+		}
+	}
+
+	free(scratch);
+	return 0;
+}
+
+#ifdef WITH_PTHREAD
+/*
+  Each worker thread has its own data reader and compressor, and claims runs
+  of the sorted file list. Files that share a fragment block are sorted next
+  to each other and always claimed as one run. Every fragment block is thus
+  decompressed only once, by the worker that owns it.
+ */
+typedef struct {
+	pthread_mutex_t mtx;
+	size_t next;
 	int status;
+	int flags;
+
+	const sqfs_super_t *super;
+	sqfs_compressor_t *cmp;
+	sqfs_file_t *file;
+} unpack_state_t;
+
+static size_t claim_files(unpack_state_t *state, size_t *start)
+{
+	size_t end;
+	sqfs_u32 idx;
 
-	block_size = blk_sz;
+	pthread_mutex_lock(&state->mtx);
+	*start = state->next;
+	end = *start;
+
+	if (state->status == 0 && end < num_files) {
+		idx = get_frag_index(files[end++].inode);
+
+		while (idx != 0xFFFFFFFF && end < num_files &&
+		       get_frag_index(files[end].inode) == idx) {
+			++end;
+		}
+	}
+
+	state->next = end;
+	pthread_mutex_unlock(&state->mtx);
+	return end;
+}
+
+static void *unpack_thread_proc(void *arg)
+{
+	unpack_state_t *state = arg;
+	sqfs_data_reader_t *data = NULL;
+	sqfs_compressor_t *cmp = NULL;
+	sqfs_file_t *file = NULL;
+	sqfs_u8 *scratch = NULL;
+	size_t start, end;
+	int ret;
+
+	cmp = sqfs_copy(state->cmp);
+	file = sqfs_copy(state->file);
+	scratch = malloc(block_size);
+
+	if (cmp == NULL || file == NULL || scratch == NULL) {
+		perror("creating unpack worker");
+		goto fail;
+	}
+
+	data = sqfs_data_reader_create(file, block_size, cmp);
+	if (data == NULL) {
+		sqfs_perror(NULL, "creating data reader", SQFS_ERROR_ALLOC);
+		goto fail;
+	}
+
+	ret = sqfs_data_reader_load_fragment_table(data, state->super);
+	if (ret) {
+		sqfs_perror(NULL, "loading fragment table", ret);
+		goto fail;
+	}
+
+	while ((end = claim_files(state, &start)) > start) {
+		for (; start < end; ++start) {
+			if (unpack_file(data, files + start, state->flags,
+					scratch)) {
+				goto fail;
+			}
+		}
+	}
+out:
+	if (data != NULL)
+		sqfs_destroy(data);
+	if (file != NULL)
+		sqfs_destroy(file);
+	if (cmp != NULL)
+		sqfs_destroy(cmp);
+	free(scratch);
+	return NULL;
+fail:
+	pthread_mutex_lock(&state->mtx);
+	state->status = -1;
+	pthread_mutex_unlock(&state->mtx);
+	goto out;
+}
+
+static int fill_files_parallel(unpack_state_t *state, unsigned int num_jobs)
+{
+	pthread_t *threads;
+	unsigned int i;
+	int ret;
+
+	threads = calloc(num_jobs, sizeof(threads[0]));
+	if (threads == NULL) {
+		perror("creating unpack worker threads");
+		return -1;
+	}
+
+	for (i = 0; i < num_jobs; ++i) {
+		ret = pthread_create(threads + i, NULL,
+				     unpack_thread_proc, state);
+		if (ret != 0) {
+			fprintf(stderr, "creating unpack worker threads: "
+				"%s\n", strerror(ret));
+			pthread_mutex_lock(&state->mtx);
+			state->status = -1;
+			pthread_mutex_unlock(&state->mtx);
+			break;
+		}
+	}
+
+	num_jobs = i;
+	for (i = 0; i < num_jobs; ++i)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+	return state->status;
+}
+#endif
+
+int fill_unpacked_files(const sqfs_super_t *super, const sqfs_tree_node_t *root,
+			sqfs_file_t *file, sqfs_compressor_t *cmp,
+			sqfs_data_reader_t *data, int flags,
+			unsigned int num_jobs, int image)
+{
+#ifdef WITH_PTHREAD
+	unpack_state_t state;
+#endif
+	int status;
+
+	block_size = super->block_size;
+	image_fd = image;
 
 	if (gen_file_list_dfs(root)) {
 		clear_file_list();
@@ -177,7 +532,27 @@ int fill_unpacked_files(size_t blk_sz, const sqfs_tree_node_t *root,
 
 	qsort(files, num_files, sizeof(files[0]), compare_files);
 
+#ifdef WITH_PTHREAD
+	if (num_jobs > 1 && num_files > 1) {
+		memset(&state, 0, sizeof(state));
+		pthread_mutex_init(&state.mtx, NULL);
+		state.flags = flags;
+		state.super = super;
+		state.cmp = cmp;
+		state.file = file;
+
+		if (num_jobs > num_files)
+			num_jobs = num_files;
+
+		status = fill_files_parallel(&state, num_jobs);
+		pthread_mutex_destroy(&state.mtx);
+	} else {
+		status = fill_files(data, flags);
+	}
+#else
+	(void)file; (void)cmp; (void)num_jobs;
 	status = fill_files(data, flags);
+#endif
 	clear_file_list();
 	return status;
 }
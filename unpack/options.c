@@ -25,6 +25,7 @@ static struct option long_opts[] = {
 	{ "describe", no_argument, NULL, 'd' },
 	{ "chmod", no_argument, NULL, 'C' },
 	{ "chown", no_argument, NULL, 'O' },
+	{ "num-jobs", required_argument, NULL, 'j' },
 	{ "quiet", no_argument, NULL, 'q' },
 	{ "help", no_argument, NULL, 'h' },
 	{ "version", no_argument, NULL, 'V' },
@@ -78,6 +79,9 @@ static const char *help_string =
 "                            those store in the squashfs image.\n"
 "  --chown, -O               Change ownership of unpacked files to the\n"
 "                            UID/GID set in the squashfs image.\n"
+"  --num-jobs, -j <count>    Number of threads used for unpacking regular\n"
+"                            files in parallel. Defaults to 1, at most\n"
+"                            1024.\n"
 "  --quiet, -q               Do not print out progress while unpacking.\n"
 "\n"
 "  --help, -h                Print help text and exit.\n"
@@ -107,11 +111,14 @@ static char *get_path(char *old, const char *arg)
 
 void process_command_line(options_t *opt, int argc, char **argv)
 {
+	char *end;
+	long value;
 	int i;
 
 	opt->op = OP_NONE;
 	opt->rdtree_flags = 0;
 	opt->flags = 0;
+	opt->num_jobs = 1;
 	opt->cmdpath = NULL;
 	opt->unpack_root = NULL;
 	opt->image_name = NULL;
@@ -178,6 +185,19 @@ void process_command_line(options_t *opt, int argc, char **argv)
 			opt->op = OP_UNPACK;
 			opt->cmdpath = get_path(opt->cmdpath, optarg);
 			break;
+		case 'j':
+			value = strtol(optarg, &end, 0);
+			if (end == optarg || *end != '\0' || value < 1) {
+				fprintf(stderr, "Invalid number of jobs: %s\n",
+					optarg);
+				goto fail_arg;
+			}
+
+			if (value > MAX_NUM_JOBS)
+				value = MAX_NUM_JOBS;
+
+			opt->num_jobs = value;
+			break;
 		case 'q':
 			opt->flags |= UNPACK_QUIET;
 			break;
@@ -203,6 +223,15 @@ void process_command_line(options_t *opt, int argc, char **argv)
 		opt->rdtree_flags |= SQFS_TREE_NO_RECURSE;
 	}
 
+	/* the tree is never modified, so release it in one go */
+	opt->rdtree_flags |= SQFS_TREE_ARENA;
+
+	/* only the inode of the path is needed, don't read the children */
+	if ((opt->op == OP_CAT || opt->op == OP_RDATTR) &&
+	    !(opt->rdtree_flags & SQFS_TREE_NO_EMPTY)) {
+		opt->rdtree_flags |= SQFS_TREE_LAZY;
+	}
+
 	if (optind >= argc) {
 		fputs("Missing image argument\n", stderr);
 		goto fail_arg;
@@ -10,6 +10,7 @@ int main(int argc, char **argv)
 {
 	sqfs_xattr_reader_t *xattr = NULL;
 	sqfs_compressor_config_t cfg;
+	sqfs_meta_cache_t *mcache;
 	int status = EXIT_FAILURE;
 	sqfs_data_reader_t *data;
 	sqfs_dir_reader_t *dirrd;
@@ -18,12 +19,14 @@ int main(int argc, char **argv)
 	sqfs_tree_node_t *n;
 	sqfs_super_t super;
 	sqfs_file_t *file;
+	int image_fd = -1;
 	options_t opt;
 	int ret;
 
 	process_command_line(&opt, argc, argv);
 
-	file = sqfs_open_file(opt.image_name, SQFS_FILE_OPEN_READ_ONLY);
+	file = sqfs_open_file(opt.image_name,
+			      SQFS_FILE_OPEN_READ_ONLY | SQFS_FILE_OPEN_MMAP);
 	if (file == NULL) {
 		perror(opt.image_name);
 		goto out_cmd;
@@ -51,14 +54,23 @@ int main(int argc, char **argv)
 		goto out_file;
 	}
 
+	mcache = sqfs_meta_cache_create(META_CACHE_SIZE);
+	if (mcache == NULL) {
+		sqfs_perror(opt.image_name, "creating meta data cache",
+			    SQFS_ERROR_ALLOC);
+		goto out_cmp;
+	}
+
 	if (!(super.flags & SQFS_FLAG_NO_XATTRS)) {
 		xattr = sqfs_xattr_reader_create(0);
 		if (xattr == NULL) {
 			sqfs_perror(opt.image_name, "creating xattr reader",
 				    SQFS_ERROR_ALLOC);
-			goto out_cmp;
+			goto out_cache;
 		}
 
+		sqfs_xattr_reader_set_cache(xattr, mcache);
+
 		ret = sqfs_xattr_reader_load(xattr, &super, file, cmp);
 		if (ret) {
 			sqfs_perror(opt.image_name, "loading xattr table",
@@ -87,6 +99,8 @@ int main(int argc, char **argv)
 		goto out_id;
 	}
 
+	sqfs_dir_reader_set_cache(dirrd, mcache);
+
 	data = sqfs_data_reader_create(file, super.block_size, cmp);
 	if (data == NULL) {
 		sqfs_perror(opt.image_name, "creating data reader",
@@ -100,6 +114,15 @@ int main(int argc, char **argv)
 		goto out_data;
 	}
 
+	/* files are read front to back, unless every job has its own reader */
+	if (opt.op == OP_CAT || (opt.op == OP_UNPACK && opt.num_jobs == 1)) {
+		ret = sqfs_data_reader_set_read_ahead(data, opt.num_jobs, 0);
+		if (ret) {
+			sqfs_perror(opt.image_name, "starting read-ahead", ret);
+			goto out_data;
+		}
+	}
+
 	ret = sqfs_dir_reader_get_full_hierarchy(dirrd, idtbl, opt.cmdpath,
 						 opt.rdtree_flags, &n);
 	if (ret) {
@@ -119,11 +142,16 @@ int main(int argc, char **argv)
 		}
 
 		if (sqfs_data_reader_dump(opt.cmdpath, data, n->inode,
-					  stdout, super.block_size, false)) {
+					  stdout, super.block_size, false,
+					  NULL)) {
 			goto out;
 		}
 		break;
 	case OP_UNPACK:
+#ifndef _WIN32
+		/* uncompressed blocks are copied from the image directly */
+		image_fd = open(opt.image_name, O_RDONLY);
+#endif
 		if (opt.unpack_root != NULL) {
 			if (mkdir_p(opt.unpack_root))
 				goto out;
@@ -137,8 +165,10 @@ int main(int argc, char **argv)
 		if (restore_fstree(n, opt.flags))
 			goto out;
 
-		if (fill_unpacked_files(super.block_size, n, data, opt.flags))
+		if (fill_unpacked_files(&super, n, file, cmp, data,
+					opt.flags, opt.num_jobs, image_fd)) {
 			goto out;
+		}
 
 		if (update_tree_attribs(xattr, n, opt.flags))
 			goto out;
@@ -155,6 +185,10 @@ int main(int argc, char **argv)
 
 	status = EXIT_SUCCESS;
 out:
+#ifndef _WIN32
+	if (image_fd >= 0)
+		close(image_fd);
+#endif
 	sqfs_dir_tree_destroy(n);
 out_data:
 	sqfs_destroy(data);
@@ -165,6 +199,8 @@ out_id:
 out_xr:
 	if (xattr != NULL)
 		sqfs_destroy(xattr);
+out_cache:
+	sqfs_destroy(mcache);
 out_cmp:
 	sqfs_destroy(cmp);
 out_file:
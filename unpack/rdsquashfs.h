@@ -23,6 +23,12 @@
 	setxattr(path, name, value, size, 0, flags | XATTR_NOFOLLOW)
 #endif
 #endif
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+#ifdef WITH_PTHREAD
+#include <pthread.h>
+#endif
 #include <string.h>
 #include <stdlib.h>
 #include <getopt.h>
@@ -53,6 +59,7 @@ typedef struct {
 	int op;
 	int rdtree_flags;
 	int flags;
+	unsigned int num_jobs;
 	char *cmdpath;
 	const char *unpack_root;
 	const char *image_name;
@@ -65,8 +72,10 @@ int restore_fstree(sqfs_tree_node_t *root, int flags);
 int update_tree_attribs(sqfs_xattr_reader_t *xattr,
 			const sqfs_tree_node_t *root, int flags);
 
-int fill_unpacked_files(size_t blk_sz, const sqfs_tree_node_t *root,
-			sqfs_data_reader_t *data, int flags);
+int fill_unpacked_files(const sqfs_super_t *super, const sqfs_tree_node_t *root,
+			sqfs_file_t *file, sqfs_compressor_t *cmp,
+			sqfs_data_reader_t *data, int flags,
+			unsigned int num_jobs, int image_fd);
 
 int describe_tree(const sqfs_tree_node_t *root, const char *unpack_root);
 